@@ -33,6 +33,9 @@ i32 sys_closefrom(i32);
 i32 sys_dup(i32);
 i32 sys_dup2(i32, i32, i32);
 i32 sys_dup3(i32, i32, i32);
+i32 sys_epoll_create1(i32);
+i32 sys_epoll_ctl(i32, i32, i32, void *);
+i32 sys_epoll_pwait(i32, void *, i32, i32, const void *, u64);
 i32 sys_execve(const char *, char *const[], char *const[]);
 i32 sys_execveat(i32, const char *, char *const[], char *const[], i32);
 i32 sys_faccessat(i32, const char *, i32, u32);
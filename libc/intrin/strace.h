@@ -58,8 +58,14 @@ COSMOPOLITAN_C_START_
   ((void)(SYSDEBUG && _TIMETRACE && strace_enabled(0) > 0 && \
           (__stracef(STRACE_PROLOGUE FMT "\n", ##__VA_ARGS__), 0)))
 
+struct StackFrame;
+
+extern bool __strace_summary;
+
 int strace_enabled(int);
 void __stracef(const char *, ...);
+bool __strace_tally(const char *, va_list, const struct StackFrame *);
+void __strace_fork_child(void);
 
 COSMOPOLITAN_C_END_
 #endif /* !(__ASSEMBLER__ + __LINKER__ + 0) */
@@ -20,14 +20,19 @@
 #include "libc/intrin/describebacktrace.h"
 #include "libc/intrin/kprintf.h"
 #include "libc/intrin/strace.h"
+#include "libc/intrin/weaken.h"
+#include "libc/nexgen32e/stackframe.h"
 #include "libc/runtime/runtime.h"
 
 dontinstrument void __stracef(const char *fmt, ...) {
   va_list v;
+  struct StackFrame *fr;
   if (strace_enabled(0) <= 0)
     return;
   va_start(v, fmt);
-  kvprintf(fmt, v);
+  fr = __builtin_frame_address(0);
+  if (!_weaken(__strace_tally) || !_weaken(__strace_tally)(fmt, v, fr->next))
+    kvprintf(fmt, v);
   va_end(v);
 }
 
@@ -40,6 +40,7 @@
 #include "libc/nt/thread.h"
 #include "libc/nt/thunk/msabi.h"
 #include "libc/proc/proc.h"
+#include "libc/runtime/ftrace.internal.h"
 #include "libc/runtime/internal.h"
 #include "libc/runtime/runtime.h"
 #include "libc/runtime/syslib.internal.h"
@@ -299,6 +300,14 @@ int _fork(uint32_t dwCreationFlags) {
       }
     }
 
+    // discard binary function trace the parent will write itself
+    if (_weaken(__ftrace_fork_child))
+      _weaken(__ftrace_fork_child)();
+
+    // discard system call summary the parent will print itself
+    if (_weaken(__strace_fork_child))
+      _weaken(__strace_fork_child)();
+
     // reactivate ftrace
     /* if (ftrace_stackdigs) */
     /*   if (_weaken(ftrace_install)) */
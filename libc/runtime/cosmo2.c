@@ -176,14 +176,21 @@ wontreturn textstartup void cosmo(long *sp, struct Syslib *m1, char *exename,
 
   __enable_tls();
 
+#if SYSDEBUG
+  __init_audit_init(argc, argv, envp, (long *)auxv);
+#endif
   _init();
   // initialize program
 #if SYSDEBUG
   argc = __strace_init(argc, argv, envp, auxv);
+  argc = __profile_init(argc, argv, envp, auxv);
+  if (__init_audit) {
+    __init_audit_run(argc, argv, envp, (long *)auxv);
+  } else
 #endif
-  for (init_f **fp = __init_array_start; fp < __init_array_end; ++fp) {
-    (*fp)(argc, argv, envp, auxv);
-  }
+    for (init_f **fp = __init_array_start; fp < __init_array_end; ++fp) {
+      (*fp)(argc, argv, envp, auxv);
+    }
 #ifdef FTRACE
   argc = ftrace_init();
 #endif
@@ -0,0 +1,34 @@
+#ifndef COSMOPOLITAN_LIBC_RUNTIME_FTRACE_INTERNAL_H_
+#define COSMOPOLITAN_LIBC_RUNTIME_FTRACE_INTERNAL_H_
+#include "libc/thread/tls.h"
+COSMOPOLITAN_C_START_
+
+#define FTRACE_MAGIC   "\177FTRACE\1"
+#define FTRACE_RETIRED 0xffff
+
+struct FtraceChunk {   /* 32 */
+  char magic[8];       /*  0 FTRACE_MAGIC */
+  uint32_t count;      /*  8 records that follow */
+  uint32_t size;       /* 12 sizeof(struct FtraceRecord) */
+  uint64_t ticks;      /* 16 rdtsc() ticks elapsed since setup, or 0 */
+  uint64_t nanos;      /* 24 monotonic nanoseconds elapsed since setup */
+};
+
+struct FtraceRecord {  /* 32 */
+  uint64_t tsc;        /*  0 rdtsc() - kStartTsc */
+  uint64_t addr;       /*  8 function being called */
+  int32_t pid;         /* 16 */
+  int32_t tid;         /* 20 */
+  uint32_t stackuse;   /* 24 bytes */
+  uint32_t depth;      /* 28 nesting level */
+};
+
+extern bool __ftrace_binary;
+
+int __ftrace_binary_init(void);
+void __ftrace_record(struct CosmoFtrace *, uintptr_t, long, int);
+void __ftrace_release(void);
+void __ftrace_fork_child(void);
+
+COSMOPOLITAN_C_END_
+#endif /* COSMOPOLITAN_LIBC_RUNTIME_FTRACE_INTERNAL_H_ */
@@ -0,0 +1,216 @@
+/*-*- mode:c;indent-tabs-mode:nil;c-basic-offset:2;tab-width:8;coding:utf-8 -*-│
+│ vi: set et ft=c ts=2 sts=2 sw=2 fenc=utf-8                               :vi │
+╞══════════════════════════════════════════════════════════════════════════════╡
+│ Copyright 2024 Justine Alexandra Roberts Tunney                              │
+│                                                                              │
+│ Permission to use, copy, modify, and/or distribute this software for         │
+│ any purpose with or without fee is hereby granted, provided that the         │
+│ above copyright notice and this permission notice appear in all copies.      │
+│                                                                              │
+│ THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL                │
+│ WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED                │
+│ WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE             │
+│ AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL         │
+│ DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR        │
+│ PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER               │
+│ TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR             │
+│ PERFORMANCE OF THIS SOFTWARE.                                                │
+╚─────────────────────────────────────────────────────────────────────────────*/
+#include "libc/atomic.h"
+#include "libc/calls/calls.h"
+#include "libc/calls/struct/timespec.h"
+#include "libc/intrin/atomic.h"
+#include "libc/intrin/kprintf.h"
+#include "libc/nexgen32e/rdtsc.h"
+#include "libc/runtime/ftrace.internal.h"
+#include "libc/runtime/internal.h"
+#include "libc/runtime/runtime.h"
+#include "libc/str/str.h"
+#include "libc/sysv/consts/map.h"
+#include "libc/sysv/consts/prot.h"
+#include "libc/thread/tls.h"
+
+/**
+ * @fileoverview binary function call logging
+ *
+ * When `--ftrace-binary` is passed, ftracer() appends fixed-size
+ * records to a ring owned by the calling thread, rather than printing
+ * a line of text for every call. A ring is written with a single klog()
+ * call when it fills up, when its thread exits, and when the process
+ * exits. Each write is a struct FtraceChunk followed by its records, so
+ * it's safe to interleave with kprintf() output. Use tool/decode/ftrace
+ * to turn the log back into text, Chrome traces, or folded stacks.
+ *
+ * The last chunk written at exit has no records. It says how many
+ * nanoseconds of monotonic time passed for the ticks counted since the
+ * rings were set up, so the decoder can convert timestamps without
+ * having to guess the frequency of the timestamp counter.
+ */
+
+#define FTRACE_RINGS   256
+#define FTRACE_RECORDS 2048
+
+struct FtraceRing {
+  _Atomic(int) owner;
+  unsigned n;
+  struct FtraceChunk hdr;
+  struct FtraceRecord rec[FTRACE_RECORDS];
+};
+
+bool __ftrace_binary;
+static uint64_t g_ftrace_tsc;
+static struct timespec g_ftrace_ts;
+static struct FtraceRing *g_ftrace_rings;
+
+privileged static struct CosmoFtrace *ftrace_self(void) {
+  if (__tls_enabled) {
+    return &__get_tls_privileged()->tib_ftracer;
+  } else {
+    return 0;
+  }
+}
+
+privileged static int ftrace_tid(void) {
+  if (__tls_enabled) {
+    return atomic_load_explicit(&__get_tls_privileged()->tib_ptid,
+                                memory_order_relaxed);
+  } else {
+    return __pid;
+  }
+}
+
+privileged static struct FtraceRing *ftrace_ring(struct CosmoFtrace *ft) {
+  int i, owner;
+  if (!g_ftrace_rings || ft->ft_ring == FTRACE_RETIRED)
+    return 0;
+  if (ft->ft_ring)
+    return g_ftrace_rings + ft->ft_ring - 1;
+  for (i = 0; i < FTRACE_RINGS; ++i) {
+    owner = 0;
+    if (atomic_compare_exchange_strong_explicit(
+            &g_ftrace_rings[i].owner, &owner, ftrace_tid(),
+            memory_order_acquire, memory_order_relaxed)) {
+      g_ftrace_rings[i].n = 0;
+      ft->ft_ring = i + 1;
+      return g_ftrace_rings + i;
+    }
+  }
+  ft->ft_ring = FTRACE_RETIRED;
+  return 0;
+}
+
+privileged static void ftrace_write(struct FtraceRing *r) {
+  unsigned n;
+  if ((n = r->n) > FTRACE_RECORDS)
+    n = FTRACE_RECORDS;
+  if (n) {
+    __builtin_memcpy(r->hdr.magic, FTRACE_MAGIC, 8);
+    r->hdr.count = n;
+    r->hdr.size = sizeof(struct FtraceRecord);
+    r->hdr.ticks = 0;
+    r->hdr.nanos = 0;
+    klog((const char *)&r->hdr,
+         sizeof(struct FtraceChunk) + n * sizeof(struct FtraceRecord));
+  }
+  r->n = 0;
+}
+
+/**
+ * Appends function call to ring of calling thread.
+ *
+ * This is called by ftracer() when `--ftrace-binary` is in effect. If
+ * a signal handler interrupts us, then records may be lost, but they
+ * won't be torn.
+ */
+privileged void __ftrace_record(struct CosmoFtrace *ft, uintptr_t fn,
+                                long stackuse, int depth) {
+  unsigned i;
+  struct FtraceRing *r;
+  if (!(r = ftrace_ring(ft)))
+    return;
+  if (r->n >= FTRACE_RECORDS)
+    ftrace_write(r);
+  if ((i = r->n++) >= FTRACE_RECORDS)
+    return;
+  r->rec[i].tsc = rdtsc() - kStartTsc;
+  r->rec[i].addr = fn;
+  r->rec[i].pid = __pid;
+  r->rec[i].tid = ftrace_tid();
+  r->rec[i].stackuse = stackuse;
+  r->rec[i].depth = depth;
+}
+
+/**
+ * Writes out records of calling thread and gives its ring back.
+ *
+ * This is called by pthread_exit(). Any functions the thread calls
+ * afterwards won't be logged, since they'd claim a ring that's never
+ * released.
+ */
+privileged void __ftrace_release(void) {
+  struct FtraceRing *r;
+  struct CosmoFtrace *ft;
+  if (!(ft = ftrace_self()) || !ft->ft_ring || ft->ft_ring == FTRACE_RETIRED)
+    return;
+  r = g_ftrace_rings + ft->ft_ring - 1;
+  ft->ft_ring = FTRACE_RETIRED;
+  ftrace_write(r);
+  atomic_store_explicit(&r->owner, 0, memory_order_release);
+}
+
+/**
+ * Resets rings in child process after fork().
+ *
+ * Records the parent hasn't written yet are its own business, and the
+ * rings of threads that didn't survive the fork are given back.
+ */
+privileged void __ftrace_fork_child(void) {
+  int i;
+  struct CosmoFtrace *ft;
+  if (!g_ftrace_rings)
+    return;
+  ft = ftrace_self();
+  for (i = 0; i < FTRACE_RINGS; ++i) {
+    g_ftrace_rings[i].n = 0;
+    if (ft && ft->ft_ring == i + 1) {
+      atomic_store_explicit(&g_ftrace_rings[i].owner, ftrace_tid(),
+                            memory_order_relaxed);
+    } else {
+      atomic_store_explicit(&g_ftrace_rings[i].owner, 0,
+                            memory_order_relaxed);
+    }
+  }
+}
+
+static void ftrace_flush_all(void) {
+  int i;
+  struct FtraceChunk c;
+  __builtin_memcpy(c.magic, FTRACE_MAGIC, 8);
+  c.count = 0;
+  c.size = sizeof(struct FtraceRecord);
+  c.ticks = rdtsc() - g_ftrace_tsc;
+  c.nanos = timespec_tonanos(timespec_sub(timespec_mono(), g_ftrace_ts));
+  for (i = 0; i < FTRACE_RINGS; ++i)
+    if (atomic_load_explicit(&g_ftrace_rings[i].owner, memory_order_acquire))
+      ftrace_write(g_ftrace_rings + i);
+  klog((const char *)&c, sizeof(c));
+}
+
+/**
+ * Allocates rings for `--ftrace-binary` mode.
+ */
+textstartup int __ftrace_binary_init(void) {
+  void *p;
+  p = mmap(0, FTRACE_RINGS * sizeof(struct FtraceRing), PROT_READ | PROT_WRITE,
+           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (p == MAP_FAILED) {
+    tinyprint(2, "error: --ftrace-binary failed to allocate rings\n", NULL);
+    return -1;
+  }
+  g_ftrace_rings = p;
+  g_ftrace_ts = timespec_mono();
+  g_ftrace_tsc = rdtsc();
+  atexit(ftrace_flush_all);
+  __ftrace_binary = true;
+  return 0;
+}
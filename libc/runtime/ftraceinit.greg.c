@@ -17,6 +17,7 @@
 │ PERFORMANCE OF THIS SOFTWARE.                                                │
 ╚─────────────────────────────────────────────────────────────────────────────*/
 #include "libc/dce.h"
+#include "libc/runtime/ftrace.internal.h"
 #include "libc/runtime/internal.h"
 #include "libc/runtime/runtime.h"
 #include "libc/runtime/symbols.internal.h"
@@ -35,13 +36,26 @@ __static_yoink("zipos");
  * `sed | sort | uniq -c | sort`. A compressed trace can be made by
  * appending `--ftrace 2>&1 | gzip -4 >trace.gz` to the CLI arguments.
  *
+ * Passing `--ftrace-binary` instead logs fixed-size binary records,
+ * which are buffered per thread and written in bulk, so the overhead is
+ * orders of magnitude lower. Since the records go wherever kprintf()
+ * goes, you'll usually want to say something like:
+ *
+ *     KPRINTF_LOG=/tmp/trace.bin ./prog --ftrace-binary
+ *     o//tool/decode/ftrace -j /tmp/trace.bin ./prog.dbg >trace.json
+ *
  * @see libc/runtime/_init.S for documentation
  */
 textstartup int ftrace_init(void) {
   if (IsModeDbg() || strace_enabled(0) > 0) {
     GetSymbolTable();
   }
-  if (__intercept_flag(&__argc, __argv, "--ftrace")) {
+  if (__intercept_flag(&__argc, __argv, "--ftrace-binary")) {
+    if (__ftrace_binary_init() != -1) {
+      ftrace_install();
+      ftrace_enabled(+1);
+    }
+  } else if (__intercept_flag(&__argc, __argv, "--ftrace")) {
     ftrace_install();
     ftrace_enabled(+1);
   }
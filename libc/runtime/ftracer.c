@@ -23,6 +23,7 @@
 #include "libc/intrin/kprintf.h"
 #include "libc/macros.h"
 #include "libc/nexgen32e/stackframe.h"
+#include "libc/runtime/ftrace.internal.h"
 #include "libc/runtime/internal.h"
 #include "libc/runtime/runtime.h"
 #include "libc/runtime/stack.h"
@@ -32,6 +33,7 @@
 
 /**
  * @fileoverview plain-text function call logging
+ * @see libc/runtime/ftracebin.c for binary mode
  */
 
 #define MAX_NESTING 512
@@ -133,8 +135,12 @@ privileged void ftracer(void) {
   sf = sf->next;
   fn = sf->addr + DETOUR_SKEW;
   if (fn != ft->ft_lastaddr) {
-    kprintf("%rFUN %6P %6H %'18T %'*ld %*s%t\n", ftrace_stackdigs, stackuse,
-            GetNestingLevel(ft, sf) * 2, "", fn);
+    if (__ftrace_binary) {
+      __ftrace_record(ft, fn, stackuse, GetNestingLevel(ft, sf));
+    } else {
+      kprintf("%rFUN %6P %6H %'18T %'*ld %*s%t\n", ftrace_stackdigs,
+              stackuse, GetNestingLevel(ft, sf) * 2, "", fn);
+    }
     ft->ft_lastaddr = fn;
   }
 }
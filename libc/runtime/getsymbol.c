@@ -32,13 +32,23 @@ privileged int __get_symbol(struct SymbolTable *t, intptr_t a) {
   //   kprintf is privileged and it depends on this
   // we don't want function tracing because:
   //   function tracing depends on this function via kprintf
-  unsigned l, m, r, n, k;
+  unsigned b, l, m, r, n, k;
   if (!t && __symtab)
     t = __symtab;
   if (t) {
     l = 0;
     r = n = t->count;
     k = a - t->addr_base;
+    if (t->index) {
+      // narrow search to symbols that overlap address bucket, which
+      // is usually only one or two, since there's a bucket per symbol
+      if ((b = k >> t->index_shift) >= t->index_count)
+        return -1;
+      l = t->index[b];
+      r = t->index[b + 1] + 1;
+      if (r > n)
+        r = n;
+    }
     while (l < r) {
       m = (l & r) + ((l ^ r) >> 1);  // floor((a+b)/2)
       if (k < t->symbols[m].x) {
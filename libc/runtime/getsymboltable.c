@@ -37,50 +37,109 @@ __static_yoink("__get_symbol");
 
 struct SymbolTable *__symtab;  // for kprintf
 
+static struct SymbolTable __symtab_zip;
+
+// binary searches zipos index, which is sorted by name
 static ssize_t GetZipFile(struct Zipos *zipos, const char *name) {
-  size_t i, n, c, z;
+  int c;
+  ssize_t cf;
+  size_t l, r, m, n, z;
+  if (!zipos->index)
+    return -1;
   z = strlen(name);
-  c = GetZipCdirOffset(zipos->cdir);
-  n = GetZipCdirRecords(zipos->cdir);
-  for (i = 0; i < n; ++i, c += ZIP_CFILE_HDRSIZE(zipos->map + c)) {
-    if (ZIP_CFILE_NAMESIZE(zipos->map + c) == z &&
-        !memcmp(ZIP_CFILE_NAME(zipos->map + c), name, z)) {
-      return c;
+  l = 0;
+  r = zipos->records;
+  while (l < r) {
+    m = (l + r) >> 1;
+    cf = zipos->index[m];
+    n = ZIP_CFILE_NAMESIZE(zipos->map + cf);
+    if (!(c = memcmp(ZIP_CFILE_NAME(zipos->map + cf), name, MIN(n, z))))
+      c = (int)n - (int)z;
+    if (c < 0) {
+      l = m + 1;
+    } else if (c > 0) {
+      r = m;
+    } else {
+      return cf;
     }
   }
   return -1;
 }
 
+// points symbol table header at arrays in serialized table `p`
+static struct SymbolTable *LoadSymbolTable(const char *p, size_t size) {
+  struct SymbolTable *t = &__symtab_zip;
+  size_t abi1 = offsetof(struct SymbolTable, symbols_offset);
+  if (size < abi1)
+    return 0;
+  memcpy(t, p, MIN(size, sizeof(*t)));
+  if (t->magic != SYMBOLS_MAGIC)
+    return 0;
+  if (t->abi == 1) {
+    // symbols come straight after header in tables made by old linkers
+    t->symbols_offset = abi1;
+    t->index_offset = 0;
+  } else if (t->abi != SYMBOLS_ABI || size < sizeof(*t)) {
+    return 0;
+  }
+  if (t->size > size ||  //
+      t->name_base_offset >= size ||
+      t->symbols_offset + t->count * sizeof(struct Symbol) > size ||
+      t->names_offset + t->count * sizeof(uint32_t) > size ||
+      (t->index_offset &&
+       t->index_offset + (t->index_count + 1ull) * sizeof(uint32_t) > size))
+    return 0;
+  t->mapsize = 0;
+  t->symbols = (struct Symbol *)(p + t->symbols_offset);
+  t->names = (uint32_t *)(p + t->names_offset);
+  t->name_base = (char *)(p + t->name_base_offset);
+  t->index = t->index_offset ? (uint32_t *)(p + t->index_offset) : 0;
+  return t;
+}
+
 /**
  * Reads symbol table from zip directory.
+ *
+ * Linkers store the table uncompressed at a page aligned offset, in
+ * which case it's used in place from the executable's mapping. That
+ * way nothing needs to be copied, and its pages are shared by every
+ * process running the program.
+ *
  * @note This code can't depend on dlmalloc()
  */
 static struct SymbolTable *GetSymbolTableFromZip(struct Zipos *zipos) {
+  char *buf;
   size_t size;
   ssize_t cf, lf;
+  const char *data;
   struct SymbolTable *res = 0;
   if ((cf = GetZipFile(zipos, ".symtab." _ARCH_NAME)) != -1 ||
       (cf = GetZipFile(zipos, ".symtab")) != -1) {
     lf = GetZipCfileOffset(zipos->map + cf);
     size = GetZipLfileUncompressedSize(zipos->map + lf);
-    if ((res = _mapanon(size))) {
-      switch (ZIP_LFILE_COMPRESSIONMETHOD(zipos->map + lf)) {
-        case kZipCompressionNone:
-          memcpy(res, (void *)ZIP_LFILE_CONTENT(zipos->map + lf), size);
+    data = (const char *)ZIP_LFILE_CONTENT(zipos->map + lf);
+    switch (ZIP_LFILE_COMPRESSIONMETHOD(zipos->map + lf)) {
+      case kZipCompressionNone:
+        if (!((uintptr_t)data & 3)) {
+          res = LoadSymbolTable(data, size);
           break;
-        case kZipCompressionDeflate:
-          if (__inflate((void *)res, size,
-                        (void *)ZIP_LFILE_CONTENT(zipos->map + lf),
-                        GetZipLfileCompressedSize(zipos->map + lf))) {
-            munmap(res, size);
-            res = 0;
-          }
-          break;
-        default:
-          munmap(res, size);
-          res = 0;
-          break;
-      }
+        }
+        if ((buf = _mapanon(size))) {
+          memcpy(buf, data, size);
+          if (!(res = LoadSymbolTable(buf, size)))
+            munmap(buf, size);
+        }
+        break;
+      case kZipCompressionDeflate:
+        if ((buf = _mapanon(size))) {
+          if (__inflate(buf, size, data,
+                        GetZipLfileCompressedSize(zipos->map + lf)) ||
+              !(res = LoadSymbolTable(buf, size)))
+            munmap(buf, size);
+        }
+        break;
+      default:
+        break;
     }
   }
   STRACE("GetSymbolTableFromZip() → %p", res);
@@ -104,14 +163,8 @@ static void GetSymbolTableInit(void) {
   struct Zipos *z;
   int e = errno;
   if (!__symtab && !__isworker) {
-    if (_weaken(__zipos_get) && (z = _weaken(__zipos_get)())) {
-      if ((__symtab = GetSymbolTableFromZip(z))) {
-        __symtab->names =
-            (uint32_t *)((char *)__symtab + __symtab->names_offset);
-        __symtab->name_base =
-            (char *)((char *)__symtab + __symtab->name_base_offset);
-      }
-    }
+    if (_weaken(__zipos_get) && (z = _weaken(__zipos_get)()))
+      __symtab = GetSymbolTableFromZip(z);
     if (!__symtab) {
       __symtab = GetSymbolTableFromElf();
     }
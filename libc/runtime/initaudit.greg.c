@@ -0,0 +1,142 @@
+/*-*- mode:c;indent-tabs-mode:nil;c-basic-offset:2;tab-width:8;coding:utf-8 -*-│
+│ vi: set et ft=c ts=2 sts=2 sw=2 fenc=utf-8                               :vi │
+╞══════════════════════════════════════════════════════════════════════════════╡
+│ Copyright 2024 Justine Alexandra Roberts Tunney                              │
+│                                                                              │
+│ Permission to use, copy, modify, and/or distribute this software for         │
+│ any purpose with or without fee is hereby granted, provided that the         │
+│ above copyright notice and this permission notice appear in all copies.      │
+│                                                                              │
+│ THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL                │
+│ WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED                │
+│ WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE             │
+│ AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL         │
+│ DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR        │
+│ PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER               │
+│ TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR             │
+│ PERFORMANCE OF THIS SOFTWARE.                                                │
+╚─────────────────────────────────────────────────────────────────────────────*/
+#include "libc/calls/calls.h"
+#include "libc/calls/struct/timespec.h"
+#include "libc/errno.h"
+#include "libc/intrin/getenv.h"
+#include "libc/intrin/kprintf.h"
+#include "libc/intrin/safemacros.h"
+#include "libc/intrin/weaken.h"
+#include "libc/log/libfatal.internal.h"
+#include "libc/nexgen32e/rdtsc.h"
+#include "libc/runtime/internal.h"
+#include "libc/runtime/runtime.h"
+#include "libc/runtime/symbols.internal.h"
+
+/**
+ * @fileoverview startup cost audit
+ *
+ * When a program is run with `COSMOPOLITAN_INIT_AUDIT=1` then the time
+ * spent in each step of getting to main() is measured and printed to
+ * stderr at exit, which looks like this:
+ *
+ *     hello.com[1234] init audit
+ *           18,401 ns  _start
+ *           41,220 ns  _init
+ *              310 ns  program_invocation_short_name_init
+ *           61,902 ns  total before main()
+ *           12,014 ns  main()
+ *
+ * The `_start` step covers everything from process entry until the
+ * runtime begins, e.g. stack and syscall setup. The `_init` step runs
+ * the .init.start runlevels, which includes tls, memory, and file
+ * descriptor setup. Each constructor is then timed individually. The
+ * symbol names are only shown if the symbol table was linked, otherwise
+ * addresses are printed, which can be looked up in the .dbg file. Time the
+ * ape loader or kernel spent before `_start` isn't counted.
+ *
+ * This is only available in builds that have SYSDEBUG.
+ */
+
+#define AUDIT_CTORS 128  // constructors that are timed individually
+
+typedef void init_f(int, char **, char **, long *);
+
+extern init_f *__init_array_start[] __attribute__((__weak__));
+extern init_f *__init_array_end[] __attribute__((__weak__));
+
+bool __init_audit;
+
+static struct {
+  uint64_t start;     // rdtsc() when __init_audit_init() was called
+  uint64_t ctors;     // rdtsc() when __init_audit_run() was called
+  uint64_t main;      // rdtsc() when constructors finished
+  uint64_t ctor[AUDIT_CTORS];
+  struct timespec ts;  // when __init_audit_run() was called
+} g_audit;
+
+// converts rdtsc ticks to nanoseconds, based on how long we've run
+static unsigned long ToNanos(unsigned long ticks, unsigned long tsc,
+                             unsigned long ns) {
+  if (!tsc)
+    return 0;
+  return (unsigned __int128)ticks * ns / tsc;
+}
+
+static void __init_audit_report(void) {
+  long i, n;
+  uint64_t end;
+  unsigned long ns, tsc;
+  end = rdtsc();
+  tsc = end - g_audit.ctors;
+  ns = timespec_tonanos(timespec_sub(timespec_mono(), g_audit.ts));
+  if (_weaken(GetSymbolTable))
+    _weaken(GetSymbolTable)();
+  n = __init_array_end - __init_array_start;
+  kprintf("\n%s[%d] init audit\n", program_invocation_short_name, getpid());
+  kprintf("  %'12lu ns  _start\n",
+          ToNanos(g_audit.start - kStartTsc, tsc, ns));
+  kprintf("  %'12lu ns  _init\n",
+          ToNanos(g_audit.ctors - g_audit.start, tsc, ns));
+  for (i = 0; i < n && i < AUDIT_CTORS; ++i)
+    kprintf("  %'12lu ns  %t\n",
+            ToNanos(g_audit.ctor[i] - (i ? g_audit.ctor[i - 1] : g_audit.ctors),
+                    tsc, ns),
+            __init_array_start[i]);
+  if (i < n)
+    kprintf("  %'12lu ns  %ld more constructors\n",
+            ToNanos(g_audit.main - g_audit.ctor[i - 1], tsc, ns), n - i);
+  kprintf("  %'12lu ns  total before main()\n",
+          ToNanos(g_audit.main - kStartTsc, tsc, ns));
+  kprintf("  %'12lu ns  main()\n", ToNanos(end - g_audit.main, tsc, ns));
+}
+
+/**
+ * Enables startup audit if `COSMOPOLITAN_INIT_AUDIT` is set.
+ *
+ * This is called right before _init() so it can be timed.
+ */
+textstartup void __init_audit_init(int argc, char **argv, char **envp,
+                                   long *auxv) {
+  /* asan isn't initialized yet at runlevel 300 */
+  if (__atoul(nulltoempty(__getenv(envp, "COSMOPOLITAN_INIT_AUDIT").s))) {
+    __init_audit = true;
+    g_audit.start = rdtsc();
+  }
+}
+
+/**
+ * Calls constructors while timing each one.
+ *
+ * This is used instead of the usual loop if __init_audit is set.
+ */
+textstartup void __init_audit_run(int argc, char **argv, char **envp,
+                                  long *auxv) {
+  long i, n;
+  g_audit.ctors = rdtsc();
+  g_audit.ts = timespec_mono();
+  n = __init_array_end - __init_array_start;
+  for (i = 0; i < n; ++i) {
+    __init_array_start[i](argc, argv, envp, auxv);
+    if (i < AUDIT_CTORS)
+      g_audit.ctor[i] = rdtsc();
+  }
+  g_audit.main = rdtsc();
+  atexit(__init_audit_report);
+}
@@ -15,6 +15,8 @@ COSMOPOLITAN_C_START_
 extern int __pid;
 extern char __runlevel;
 extern int ftrace_stackdigs;
+extern int __profile_hz;
+extern bool __init_audit;
 extern const signed char kNtStdio[3];
 extern const char v_ntsubsystem[] __attribute__((__weak__));
 extern const uintptr_t __fini_array_end[] __attribute__((__weak__));
@@ -32,6 +34,9 @@ extern unsigned char _tls_content[] __attribute__((__weak__));
 
 void _init(void);
 int ftrace_init(void);
+int __profile_init(int, char **, char **, long *);
+void __init_audit_init(int, char **, char **, long *);
+void __init_audit_run(int, char **, char **, long *);
 void ftrace_hook(void);
 void __morph_tls(void);
 void __enable_tls(void);
@@ -37,6 +37,24 @@
 #include "libc/sysv/consts/prot.h"
 #include "libc/sysv/errfuns.h"
 
+// buckets address space so __get_symbol() needn't search whole table
+static void IndexSymbolTable(struct SymbolTable *t) {
+  unsigned j, range;
+  uint64_t b, bucket;
+  range = t->addr_end - t->addr_base;
+  for (t->index_shift = 0;
+       t->index_shift < 31 && (range >> t->index_shift) >= MAX(t->count, 1);
+       ++t->index_shift) {
+  }
+  t->index_count = (range >> t->index_shift) + 1;
+  for (j = b = 0; b <= t->index_count; ++b) {
+    bucket = b << t->index_shift;
+    while (j < t->count && t->symbols[j].y < bucket)
+      ++j;
+    t->index[b] = j;
+  }
+}
+
 static struct SymbolTable *OpenSymbolTableImpl(const char *filename) {
   int fd;
   void *map;
@@ -48,7 +66,8 @@ static struct SymbolTable *OpenSymbolTableImpl(const char *filename) {
   struct SymbolTable *t;
   size_t n, m, tsz, size;
   const Elf64_Sym *symtab, *sym;
-  ptrdiff_t names_offset, name_base_offset, stp_offset;
+  ptrdiff_t symbols_offset, names_offset, index_offset, name_base_offset;
+  ptrdiff_t stp_offset;
   long pagesz = __pagesize;
   map = MAP_FAILED;
   if ((fd = open(filename, O_RDONLY | O_CLOEXEC)) == -1)
@@ -70,9 +89,12 @@ static struct SymbolTable *OpenSymbolTableImpl(const char *filename) {
     goto RaiseEnobufs;
   tsz = 0;
   tsz += sizeof(struct SymbolTable);
+  symbols_offset = tsz;
   tsz += sizeof(struct Symbol) * n;
   names_offset = tsz;
   tsz += sizeof(unsigned) * n;
+  index_offset = tsz;
+  tsz += sizeof(unsigned) * (n + 3);
   name_base_offset = tsz;
   tsz += m;
   tsz = ROUNDUP(tsz, pagesz);
@@ -87,9 +109,13 @@ static struct SymbolTable *OpenSymbolTableImpl(const char *filename) {
   t->abi = SYMBOLS_ABI;
   t->size = size;
   t->mapsize = size;
+  t->symbols_offset = symbols_offset;
   t->names_offset = names_offset;
+  t->index_offset = index_offset;
   t->name_base_offset = name_base_offset;
+  t->symbols = (struct Symbol *)((char *)t + t->symbols_offset);
   t->names = (uint32_t *)((char *)t + t->names_offset);
+  t->index = (uint32_t *)((char *)t + t->index_offset);
   t->name_base = (char *)((char *)t + t->name_base_offset);
   GetImageRange(elf, &t->addr_base, &t->addr_end);
   memcpy(t->name_base, name_base, m);
@@ -130,6 +156,7 @@ static struct SymbolTable *OpenSymbolTableImpl(const char *filename) {
     ++j;
   }
   t->count = j;
+  IndexSymbolTable(t);
   if (!IsWindows())
     munmap(stp, sizeof(const Elf64_Sym *) * n);
   munmap(map, filesize);
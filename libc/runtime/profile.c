@@ -0,0 +1,240 @@
+/*-*- mode:c;indent-tabs-mode:nil;c-basic-offset:2;tab-width:8;coding:utf-8 -*-│
+│ vi: set et ft=c ts=2 sts=2 sw=2 fenc=utf-8                               :vi │
+╞══════════════════════════════════════════════════════════════════════════════╡
+│ Copyright 2024 Justine Alexandra Roberts Tunney                              │
+│                                                                              │
+│ Permission to use, copy, modify, and/or distribute this software for         │
+│ any purpose with or without fee is hereby granted, provided that the         │
+│ above copyright notice and this permission notice appear in all copies.      │
+│                                                                              │
+│ THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL                │
+│ WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED                │
+│ WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE             │
+│ AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL         │
+│ DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR        │
+│ PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER               │
+│ TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR             │
+│ PERFORMANCE OF THIS SOFTWARE.                                                │
+╚─────────────────────────────────────────────────────────────────────────────*/
+#include "libc/atomic.h"
+#include "libc/calls/calls.h"
+#include "libc/calls/struct/itimerval.h"
+#include "libc/calls/struct/itimerval.internal.h"
+#include "libc/calls/struct/sigaction.h"
+#include "libc/calls/struct/siginfo.h"
+#include "libc/calls/struct/sigset.h"
+#include "libc/calls/ucontext.h"
+#include "libc/dce.h"
+#include "libc/errno.h"
+#include "libc/intrin/atomic.h"
+#include "libc/intrin/kprintf.h"
+#include "libc/limits.h"
+#include "libc/macros.h"
+#include "libc/mem/alg.h"
+#include "libc/nexgen32e/stackframe.h"
+#include "libc/runtime/internal.h"
+#include "libc/runtime/runtime.h"
+#include "libc/runtime/symbols.internal.h"
+#include "libc/str/str.h"
+#include "libc/sysv/consts/itimer.h"
+#include "libc/sysv/consts/o.h"
+#include "libc/sysv/consts/sa.h"
+#include "libc/sysv/consts/sig.h"
+
+/**
+ * @fileoverview statistical sampling profiler
+ *
+ * When a program is run with `--profile` or `--profile=HZ` then
+ * ITIMER_PROF is armed to deliver SIGPROF at HZ (default 100) times per
+ * second of cpu time consumed by the process. The signal handler walks
+ * the frame pointers of whichever thread was interrupted, and appends
+ * the backtrace to a preallocated buffer without taking any locks. At
+ * exit, samples are symbolized with GetSymbolTable() and written as
+ * folded stacks to `PROG.PID.folded` in the current directory, which
+ * can be fed straight into flamegraph.pl.
+ *
+ * Child processes created by fork() aren't profiled, because POSIX
+ * doesn't let them inherit interval timers.
+ */
+
+#define PROFILE_DEPTH 64
+#define PROFILE_WORDS (1024 * 1024)
+#define PROFILE_SYM   0x8000000000000000
+
+int __profile_hz;
+
+static struct {
+  int pid;
+  atomic_ulong used;
+  atomic_ulong dropped;
+  uintptr_t *words;
+} g_profile;
+
+static struct {
+  int fd;
+  size_t n;
+  char b[4096];
+} g_out;
+
+static void OnSigProf(int sig, siginfo_t *si, void *arg) {
+  int n;
+  size_t i;
+  uintptr_t page;
+  struct StackFrame *fp, *next;
+  uintptr_t pcs[PROFILE_DEPTH];
+  ucontext_t *ctx = arg;
+#ifdef __x86_64__
+  pcs[0] = ctx->uc_mcontext.rip;
+  fp = (struct StackFrame *)ctx->uc_mcontext.rbp;
+#elif defined(__aarch64__)
+  pcs[0] = ctx->uc_mcontext.pc;
+  fp = (struct StackFrame *)ctx->uc_mcontext.regs[29];
+#endif
+  // validating every frame would be too slow, so we only ask the
+  // memory manager about frames that land on a page we haven't seen
+  for (page = 0, n = 1; n < PROFILE_DEPTH; fp = next) {
+    if (!fp || ((uintptr_t)fp & 7))
+      break;
+    if ((uintptr_t)fp >> 12 != page) {
+      if (kisdangerous(fp))
+        break;
+      page = (uintptr_t)fp >> 12;
+    }
+    if (!fp->addr)
+      break;
+    pcs[n++] = fp->addr;
+    if ((next = fp->next) <= fp)
+      break;
+  }
+  i = atomic_fetch_add_explicit(&g_profile.used, n + 1, memory_order_relaxed);
+  if (i + n + 1 > PROFILE_WORDS) {
+    atomic_fetch_add_explicit(&g_profile.dropped, 1, memory_order_relaxed);
+    return;
+  }
+  memcpy(g_profile.words + i + 1, pcs, n * sizeof(*pcs));
+  atomic_store_explicit((atomic_ulong *)(g_profile.words + i), n,
+                        memory_order_release);
+}
+
+static int CompareSamples(const void *a, const void *b) {
+  size_t i;
+  const uintptr_t *x = *(const uintptr_t *const *)a;
+  const uintptr_t *y = *(const uintptr_t *const *)b;
+  if (x[0] != y[0])
+    return x[0] < y[0] ? -1 : 1;
+  for (i = x[0]; i; --i)
+    if (x[i] != y[i])
+      return x[i] < y[i] ? -1 : 1;
+  return 0;
+}
+
+static void Flush(void) {
+  if (g_out.n)
+    write(g_out.fd, g_out.b, g_out.n);
+  g_out.n = 0;
+}
+
+static void Print(const char *s, size_t n) {
+  if (g_out.n + n > sizeof(g_out.b))
+    Flush();
+  if (n > sizeof(g_out.b)) {
+    write(g_out.fd, s, n);
+  } else {
+    memcpy(g_out.b + g_out.n, s, n);
+    g_out.n += n;
+  }
+}
+
+static void PrintFrame(struct SymbolTable *st, uintptr_t x) {
+  char buf[24];
+  const char *s;
+  if ((x & PROFILE_SYM) && (s = __get_symbol_name(st, x & ~PROFILE_SYM))) {
+    Print(s, strlen(s));
+  } else {
+    Print(buf, ksnprintf(buf, sizeof(buf), "%#lx", x));
+  }
+}
+
+static void PrintSample(struct SymbolTable *st, const uintptr_t *w,
+                        size_t count) {
+  size_t i;
+  char buf[24];
+  for (i = w[0]; i; --i) {
+    PrintFrame(st, w[i]);
+    if (i > 1)
+      Print(";", 1);
+  }
+  Print(buf, ksnprintf(buf, sizeof(buf), " %zu\n", count));
+}
+
+static void WriteProfile(void) {
+  int sym;
+  char path[PATH_MAX];
+  uintptr_t *w, **v;
+  size_t i, j, n, m, used;
+  struct SymbolTable *st;
+  if (getpid() != g_profile.pid)
+    return;
+  sys_setitimer(ITIMER_PROF, &(struct itimerval){0}, 0);
+  used = atomic_load_explicit(&g_profile.used, memory_order_acquire);
+  used = MIN(used, PROFILE_WORDS);
+
+  // symbolize in place, so identical stacks sort next to each other
+  // even if the leaf was interrupted at different instructions
+  st = GetSymbolTable();
+  for (m = i = 0; i < used && (n = g_profile.words[i]); i += n + 1, ++m) {
+    w = g_profile.words + i;
+    for (j = 1; j <= n; ++j)
+      if ((sym = __get_symbol(st, w[j] - (j > 1))) != -1)
+        w[j] = PROFILE_SYM | sym;
+  }
+  if (!m || !(v = _mapanon(m * sizeof(*v))))
+    return;
+  for (m = i = 0; i < used && (n = g_profile.words[i]); i += n + 1)
+    v[m++] = g_profile.words + i;
+  qsort(v, m, sizeof(*v), CompareSamples);
+
+  ksnprintf(path, sizeof(path), "%s.%d.folded", program_invocation_short_name,
+            g_profile.pid);
+  if ((g_out.fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                       0644)) != -1) {
+    for (i = 0; i < m; i = j) {
+      for (j = i + 1; j < m && !CompareSamples(v + i, v + j); ++j) {
+      }
+      PrintSample(st, v[i], j - i);
+    }
+    Flush();
+    close(g_out.fd);
+    kprintf("wrote %'zu samples to %s (%'lu dropped)\n", m, path,
+            atomic_load_explicit(&g_profile.dropped, memory_order_relaxed));
+  } else {
+    kprintf("error: --profile failed to open %s: %s\n", path, strerror(errno));
+  }
+  munmap(v, m * sizeof(*v));
+}
+
+__attribute__((__constructor__(99))) static textstartup void
+StartProfile(void) {
+  struct sigaction sa;
+  struct itimerval it;
+  if (__profile_hz <= 0)
+    return;
+  if (IsWindows() || IsMetal()) {
+    kprintf("error: --profile isn't supported on this platform\n");
+    return;
+  }
+  if (!(g_profile.words = _mapanon(PROFILE_WORDS * sizeof(uintptr_t)))) {
+    kprintf("error: --profile failed to allocate buffer\n");
+    return;
+  }
+  g_profile.pid = getpid();
+  atexit(WriteProfile);
+  sa.sa_flags = SA_RESTART | SA_SIGINFO;
+  sa.sa_sigaction = OnSigProf;
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGPROF, &sa, 0);
+  it.it_interval.tv_sec = 1 / __profile_hz;
+  it.it_interval.tv_usec = 1000000 / __profile_hz % 1000000;
+  it.it_value = it.it_interval;
+  sys_setitimer(ITIMER_PROF, &it, 0);
+}
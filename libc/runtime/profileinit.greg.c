@@ -0,0 +1,50 @@
+/*-*- mode:c;indent-tabs-mode:nil;c-basic-offset:2;tab-width:8;coding:utf-8 -*-│
+│ vi: set et ft=c ts=2 sts=2 sw=2 fenc=utf-8                               :vi │
+╞══════════════════════════════════════════════════════════════════════════════╡
+│ Copyright 2024 Justine Alexandra Roberts Tunney                              │
+│                                                                              │
+│ Permission to use, copy, modify, and/or distribute this software for         │
+│ any purpose with or without fee is hereby granted, provided that the         │
+│ above copyright notice and this permission notice appear in all copies.      │
+│                                                                              │
+│ THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL                │
+│ WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED                │
+│ WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE             │
+│ AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL         │
+│ DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR        │
+│ PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER               │
+│ TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR             │
+│ PERFORMANCE OF THIS SOFTWARE.                                                │
+╚─────────────────────────────────────────────────────────────────────────────*/
+#include "libc/runtime/internal.h"
+
+/**
+ * Enables sampling profiler if `--profile` or `--profile=HZ` is passed.
+ *
+ * The flag is removed before main() is called.
+ *
+ * @see libc/runtime/profile.c
+ */
+textstartup int __profile_init(int argc, char **argv, char **envp,
+                               long *auxv) {
+  /* asan isn't initialized yet at runlevel 300 */
+  int i, j, hz;
+  const char *a, *s;
+  for (j = i = 1; i < argc; ++i) {
+    a = argv[i];
+    s = "--profile";
+    while (*s && *a == *s)
+      ++a, ++s;
+    if (*s || (*a && *a != '=')) {
+      argv[j++] = argv[i];
+      continue;
+    }
+    for (hz = 0, a += !!*a; '0' <= *a && *a <= '9'; ++a)
+      if ((hz = hz * 10 + *a - '0') > 1000000)
+        hz = 1000000;
+    __profile_hz = hz ? hz : 100;
+  }
+  if (j < argc)
+    argv[j] = 0;
+  return (__argc = j);
+}
@@ -19,16 +19,26 @@
 #include "libc/calls/calls.h"
 #include "libc/intrin/getenv.h"
 #include "libc/intrin/safemacros.h"
+#include "libc/intrin/strace.h"
 #include "libc/log/libfatal.internal.h"
 #include "libc/runtime/internal.h"
 #include "libc/runtime/runtime.h"
 
 /**
  * Enables plaintext system call logging  if `--strace` flag is passed.
+ *
+ * If `--strace=summary` is passed, or `STRACE=summary` is set, then
+ * system calls are counted and timed instead, and printed at exit.
+ *
+ * @see libc/runtime/stracesummary.c
  */
 textstartup int __strace_init(int argc, char **argv, char **envp, long *auxv) {
   /* asan isn't initialized yet at runlevel 300 */
-  if (__intercept_flag(&argc, argv, "--strace") ||
+  if (__intercept_flag(&argc, argv, "--strace=summary") ||
+      !__strcmp(nulltoempty(__getenv(envp, "STRACE").s), "summary")) {
+    __strace_summary = true;
+    strace_enabled(+1);
+  } else if (__intercept_flag(&argc, argv, "--strace") ||
       __atoul(nulltoempty(__getenv(envp, "STRACE").s))) {
     strace_enabled(+1);
   }
@@ -0,0 +1,473 @@
+/*-*- mode:c;indent-tabs-mode:nil;c-basic-offset:2;tab-width:8;coding:utf-8 -*-│
+│ vi: set et ft=c ts=2 sts=2 sw=2 fenc=utf-8                               :vi │
+╞══════════════════════════════════════════════════════════════════════════════╡
+│ Copyright 2024 Justine Alexandra Roberts Tunney                              │
+│                                                                              │
+│ Permission to use, copy, modify, and/or distribute this software for         │
+│ any purpose with or without fee is hereby granted, provided that the         │
+│ above copyright notice and this permission notice appear in all copies.      │
+│                                                                              │
+│ THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL                │
+│ WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED                │
+│ WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE             │
+│ AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL         │
+│ DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR        │
+│ PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER               │
+│ TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR             │
+│ PERFORMANCE OF THIS SOFTWARE.                                                │
+╚─────────────────────────────────────────────────────────────────────────────*/
+#include "libc/atomic.h"
+#include "libc/calls/calls.h"
+#include "libc/calls/struct/timespec.h"
+#include "libc/ctype.h"
+#include "libc/dce.h"
+#include "libc/errno.h"
+#include "libc/intrin/atomic.h"
+#include "libc/intrin/kprintf.h"
+#include "libc/intrin/strace.h"
+#include "libc/macros.h"
+#include "libc/mem/alg.h"
+#include "libc/nexgen32e/rdtsc.h"
+#include "libc/nexgen32e/stackframe.h"
+#include "libc/runtime/runtime.h"
+#include "libc/str/str.h"
+#include "libc/thread/tls.h"
+
+/**
+ * @fileoverview system call summary
+ *
+ * When a program is run with `--strace=summary` or `STRACE=summary`,
+ * STRACE() events aren't printed. Instead, each one is tallied in a
+ * table owned by the calling thread, keyed by the system call name at
+ * the start of its format string. At exit, the tables of every thread
+ * are merged and printed like `strace -c`, followed by a histogram of
+ * latencies in power of two buckets for each system call.
+ *
+ * An event counts as an error if the wrapper that logged it returned
+ * -1, or NULL when its result is printed as a pointer.
+ *
+ * On x86-64 Linux, a hook chained to __systemfive remembers when each
+ * raw system call started, along with the frames it was called from.
+ * When a wrapper logs its STRACE() event, it's timed from the first of
+ * those raw system calls that was made beneath the wrapper's frame, up
+ * until the event. Raw system calls issued outside any wrapper, e.g.
+ * by locks, are therefore not charged to the next one. Elsewhere, only
+ * calls and errors are counted.
+ */
+
+#define STRACE_TABLES  128  // threads that get their own table
+#define STRACE_ENTRIES 128  // distinct call sites per table
+#define STRACE_BUCKETS 40   // log2 rdtsc ticks
+#define STRACE_NAMES   512  // distinct names printed at exit
+#define STRACE_CALLS   16   // raw system calls remembered per thread
+#define STRACE_DEPTH   4    // frames remembered per raw system call
+#define STRACE_REACH   65536
+
+struct StraceStat {
+  _Atomic(const char *) key;  // format string or %s name argument
+  bool isarg;
+  bool ignore;
+  atomic_ulong calls;
+  atomic_ulong errors;
+  atomic_ulong timed;
+  atomic_ulong ticks;
+  atomic_uint hist[STRACE_BUCKETS];
+};
+
+struct StraceFrame {
+  uintptr_t bp;  // frame address
+  uintptr_t ip;  // its return address
+};
+
+struct StraceCall {
+  uint64_t start;
+  struct StraceFrame frame[STRACE_DEPTH];
+};
+
+struct StraceTable {
+  struct StraceStat stat[STRACE_ENTRIES];
+};
+
+struct StraceRow {
+  char name[32];
+  unsigned long calls;
+  unsigned long errors;
+  unsigned long timed;
+  unsigned long ticks;
+  unsigned long hist[STRACE_BUCKETS];
+};
+
+bool __strace_summary;
+void *__strace_next;
+void __strace_hook(void);
+extern void *__systemfive;
+
+static struct {
+  int pid;
+  bool hooked;
+  uint64_t tsc;
+  struct timespec ts;
+  atomic_uint claimed;
+  atomic_ulong dropped;
+  struct StraceTable *tables;
+} g_strace;
+
+static _Thread_local struct {
+  unsigned calls;  // raw system calls since last event
+  struct StraceCall call[STRACE_CALLS];
+  struct StraceTable *table;
+} g_strace_thread;
+
+static dontinstrument bool IsTallying(void) {
+  return __tls_enabled && !(__get_tls()->tib_flags & TIB_FLAG_VFORKED);
+}
+
+/**
+ * Remembers when a raw system call started, and who called it.
+ *
+ * This is called by __strace_hook() after each system call returns,
+ * with the hook's own frame. Frames are only followed while they look
+ * like they're further up the same stack.
+ */
+dontinstrument void __strace_syscall(uint64_t start,
+                                     const struct StackFrame *fr) {
+  int i;
+  uintptr_t sp, bp;
+  struct StraceCall *c;
+  if (!IsTallying())
+    return;
+  c = g_strace_thread.call + g_strace_thread.calls++ % STRACE_CALLS;
+  c->start = start;
+  sp = (uintptr_t)fr;
+  for (i = 0; i < STRACE_DEPTH; ++i) {
+    bp = (uintptr_t)fr->next;
+    if (bp <= (uintptr_t)fr || bp - sp > STRACE_REACH || (bp & 7))
+      break;
+    fr = fr->next;
+    c->frame[i].bp = bp;
+    c->frame[i].ip = fr->addr;
+  }
+  for (; i < STRACE_DEPTH; ++i)
+    c->frame[i].bp = 0;
+}
+
+// returns true if raw system call was made beneath wrapper frame
+static dontinstrument bool IsBeneath(const struct StraceCall *c,
+                                     const struct StackFrame *fr) {
+  int i;
+  for (i = 0; i < STRACE_DEPTH && c->frame[i].bp; ++i)
+    if (c->frame[i].bp == (uintptr_t)fr && c->frame[i].ip == fr->addr)
+      return true;
+  return false;
+}
+
+// finds when the first raw system call made by wrapper started, and
+// forgets every raw system call the thread has made until this event
+static dontinstrument bool GetStart(const struct StackFrame *fr,
+                                    uint64_t *start) {
+  unsigned i, n;
+  n = g_strace_thread.calls;
+  g_strace_thread.calls = 0;
+  for (i = n > STRACE_CALLS ? n - STRACE_CALLS : 0; i < n; ++i) {
+    if (IsBeneath(g_strace_thread.call + i % STRACE_CALLS, fr)) {
+      *start = g_strace_thread.call[i % STRACE_CALLS].start;
+      return true;
+    }
+  }
+  return false;
+}
+
+static dontinstrument const char *GetArrow(const char *s) {
+  const char *p, *q;
+  for (p = 0; (q = strstr(s, "→ ")); s = q + strlen("→ "))
+    p = q + strlen("→ ");
+  return p;
+}
+
+// returns true if wrapper returned -1, or a null pointer, by walking
+// the arguments of the directives in an event like "close(%d) → %d% m"
+// up to the first one after the last arrow, which holds what it returned
+static dontinstrument bool IsFailure(const char *fmt, va_list va) {
+  int type;
+  long rc;
+  va_list vc;
+  bool isptr;
+  const char *f, *arrow;
+  if (!(arrow = GetArrow(fmt)))
+    return false;
+  va_copy(vc, va);
+  for (rc = 0, isptr = false, f = fmt; (f = strchr(f, '%'));) {
+    for (type = 0; *++f;) {
+      if (*f == 'h') {
+        --type;
+      } else if (*f == 'l' || *f == 'j' || *f == 'z') {
+        ++type;
+      } else if (*f == '*') {
+        (void)va_arg(vc, int);
+      } else if (!strchr(".-#`_,' +^!0123456789", *f)) {
+        break;
+      }
+    }
+    if (!*f)
+      break;
+    if (f >= arrow) {
+      if ((isptr = *f == 'p')) {
+        rc = va_arg(vc, intptr_t);
+      } else if (strchr("dux", *f) && type >= -1) {
+        rc = type > 0 ? va_arg(vc, long) : va_arg(vc, int);
+      }
+      break;
+    }
+    if (*f == 'p' || *f == 't' || *f == 's') {
+      (void)va_arg(vc, void *);
+    } else if (strchr("udbxXocCG", *f)) {
+      if (type > 0) {
+        (void)va_arg(vc, long);
+      } else {
+        (void)va_arg(vc, int);
+      }
+    }
+    ++f;
+  }
+  va_end(vc);
+  return rc == -1 || (isptr && !rc);
+}
+
+// extracts name from format string like "read(%d, ...) → %ld"
+static dontinstrument bool GetName(const char *s, char name[32]) {
+  int i;
+  for (i = 0; i < 31 && (isalnum(s[i]) || s[i] == '_'); ++i)
+    name[i] = s[i];
+  name[i] = 0;
+  return i && s[i] == '(';
+}
+
+static dontinstrument const char *SkipPrologue(const char *fmt) {
+  if (!strncmp(fmt, STRACE_PROLOGUE, sizeof(STRACE_PROLOGUE) - 1))
+    fmt += sizeof(STRACE_PROLOGUE) - 1;
+  if (!strncmp(fmt, "\e[2m", 4))
+    fmt += 4;
+  return fmt;
+}
+
+static dontinstrument struct StraceTable *GetTable(void) {
+  unsigned i;
+  if (!g_strace_thread.table) {
+    i = atomic_fetch_add_explicit(&g_strace.claimed, 1, memory_order_relaxed);
+    g_strace_thread.table = g_strace.tables + MIN(i, STRACE_TABLES - 1);
+  }
+  return g_strace_thread.table;
+}
+
+static dontinstrument struct StraceStat *GetStat(struct StraceTable *t,
+                                                 const char *key, bool isarg,
+                                                 const char *fmt) {
+  char name[32];
+  unsigned i, h;
+  const char *k;
+  struct StraceStat *s;
+  h = (uintptr_t)key * 0x9e3779b97f4a7c15 >> 57;
+  for (i = 0; i < STRACE_ENTRIES; ++i) {
+    s = t->stat + (h + i) % STRACE_ENTRIES;
+    k = atomic_load_explicit(&s->key, memory_order_acquire);
+    if (k == key)
+      return s;
+    if (k)
+      continue;
+    if (!atomic_compare_exchange_strong_explicit(&s->key, &k, key,
+                                                 memory_order_acq_rel,
+                                                 memory_order_acquire)) {
+      if (k == key)
+        return s;
+      continue;
+    }
+    s->isarg = isarg;
+    s->ignore = !isarg && !GetName(fmt, name);
+    return s;
+  }
+  return 0;
+}
+
+/**
+ * Tallies STRACE() event, if `--strace=summary` is in effect.
+ *
+ * @param fr is frame of the wrapper that logged the event
+ * @return true if event was consumed and shouldn't be printed
+ */
+dontinstrument bool __strace_tally(const char *fmt, va_list va,
+                                   const struct StackFrame *fr) {
+  bool isarg;
+  va_list vc;
+  uint64_t end, start, ticks;
+  const char *key;
+  struct StraceStat *s;
+  struct StraceTable *t;
+  if (!__strace_summary)
+    return false;
+  if (!g_strace.tables || !IsTallying())
+    return true;
+  end = rdtsc();
+  key = fmt = SkipPrologue(fmt);
+  if ((isarg = !strncmp(fmt, "%s(", 3))) {
+    va_copy(vc, va);
+    key = va_arg(vc, const char *);
+    va_end(vc);
+  }
+  t = GetTable();
+  if (!(s = GetStat(t, key, isarg, fmt))) {
+    atomic_fetch_add_explicit(&g_strace.dropped, 1, memory_order_relaxed);
+    return true;
+  }
+  if (s->ignore)
+    return true;
+  atomic_fetch_add_explicit(&s->calls, 1, memory_order_relaxed);
+  if (IsFailure(fmt, va))
+    atomic_fetch_add_explicit(&s->errors, 1, memory_order_relaxed);
+  if (GetStart(fr, &start)) {
+    ticks = end - start;
+    atomic_fetch_add_explicit(&s->timed, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&s->ticks, ticks, memory_order_relaxed);
+    atomic_fetch_add_explicit(
+        &s->hist[MIN(ticks ? 63 - __builtin_clzll(ticks) : 0,
+                     STRACE_BUCKETS - 1)],
+        1, memory_order_relaxed);
+  }
+  return true;
+}
+
+/**
+ * Forgets system calls the parent made, in a forked child.
+ */
+void __strace_fork_child(void) {
+  if (!g_strace.tables)
+    return;
+  bzero(g_strace.tables, sizeof(struct StraceTable) *
+                             MIN(atomic_load(&g_strace.claimed),
+                                 STRACE_TABLES));
+  g_strace_thread.calls = 0;
+  g_strace.pid = getpid();
+}
+
+static int CompareRows(const void *a, const void *b) {
+  const struct StraceRow *x = a, *y = b;
+  if (x->ticks != y->ticks)
+    return x->ticks < y->ticks ? 1 : -1;
+  if (x->calls != y->calls)
+    return x->calls < y->calls ? 1 : -1;
+  return strcmp(x->name, y->name);
+}
+
+static size_t MergeStat(struct StraceRow *r, size_t n, struct StraceStat *s) {
+  size_t i, j;
+  char name[32];
+  const char *key;
+  if (!(key = atomic_load_explicit(&s->key, memory_order_acquire)) ||
+      s->ignore || !atomic_load_explicit(&s->calls, memory_order_relaxed))
+    return n;
+  if (s->isarg) {
+    strlcpy(name, key, sizeof(name));
+  } else {
+    GetName(key, name);
+  }
+  for (i = 0; i < n; ++i)
+    if (!strcmp(r[i].name, name))
+      break;
+  if (i == n) {
+    if (n == STRACE_NAMES)
+      return n;
+    strcpy(r[n++].name, name);
+  }
+  r[i].calls += s->calls;
+  r[i].errors += s->errors;
+  r[i].timed += s->timed;
+  r[i].ticks += s->ticks;
+  for (j = 0; j < STRACE_BUCKETS; ++j)
+    r[i].hist[j] += s->hist[j];
+  return n;
+}
+
+// converts rdtsc ticks to nanoseconds, based on how long we've run
+static unsigned long ToNanos(unsigned long ticks, unsigned long tsc,
+                             unsigned long ns) {
+  if (!tsc)
+    return 0;
+  return (unsigned __int128)ticks * ns / tsc;
+}
+
+static void PrintSummary(void) {
+  struct StraceRow *r, sum;
+  size_t i, j, k, n, tables;
+  unsigned long ns, tsc, pct;
+  if (getpid() != g_strace.pid)
+    return;
+  tsc = rdtsc() - g_strace.tsc;
+  ns = timespec_tonanos(timespec_sub(timespec_mono(), g_strace.ts));
+  if (!(r = _mapanon(STRACE_NAMES * sizeof(*r))))
+    return;
+  tables = MIN(atomic_load(&g_strace.claimed), STRACE_TABLES);
+  for (n = i = 0; i < tables; ++i)
+    for (j = 0; j < STRACE_ENTRIES; ++j)
+      n = MergeStat(r, n, g_strace.tables[i].stat + j);
+  qsort(r, n, sizeof(*r), CompareRows);
+  bzero(&sum, sizeof(sum));
+  for (i = 0; i < n; ++i) {
+    sum.calls += r[i].calls;
+    sum.errors += r[i].errors;
+    sum.ticks += r[i].ticks;
+  }
+
+  kprintf("\n%s[%d] system call summary (%'lu tables, %'lu dropped)\n",
+          program_invocation_short_name, g_strace.pid, tables,
+          atomic_load(&g_strace.dropped));
+  kprintf("%% time     seconds  usecs/call     calls    errors syscall\n"
+          "------ ----------- ----------- --------- --------- "
+          "----------------\n");
+  for (i = 0; i < n; ++i) {
+    pct = sum.ticks ? r[i].ticks * 10000 / sum.ticks : 0;
+    k = ToNanos(r[i].ticks, tsc, ns);
+    kprintf("%3lu.%02lu %4lu.%06lu %11lu %9lu %9lu %s\n", pct / 100,
+            pct % 100, k / 1000000000, k / 1000 % 1000000,
+            r[i].timed ? k / 1000 / r[i].timed : 0, r[i].calls, r[i].errors,
+            r[i].name);
+  }
+  k = ToNanos(sum.ticks, tsc, ns);
+  kprintf("------ ----------- ----------- --------- --------- "
+          "----------------\n"
+          "100.00 %4lu.%06lu %11s %9lu %9lu total\n",
+          k / 1000000000, k / 1000 % 1000000, "", sum.calls, sum.errors);
+  if (!g_strace.hooked)
+    kprintf("latency is only measured on x86-64 linux\n");
+
+  for (i = 0; i < n; ++i) {
+    if (!r[i].timed)
+      continue;
+    kprintf("\n%s latency\n", r[i].name);
+    for (j = 0; j < STRACE_BUCKETS; ++j)
+      if (r[i].hist[j])
+        kprintf("  %'12lu ns ≤ t < %'12lu ns %'12lu\n",
+                j ? ToNanos(1ul << j, tsc, ns) : 0,
+                ToNanos(2ul << j, tsc, ns), r[i].hist[j]);
+  }
+  munmap(r, STRACE_NAMES * sizeof(*r));
+}
+
+__attribute__((__constructor__)) static textstartup void StartSummary(void) {
+  if (!__strace_summary)
+    return;
+  g_strace.tables = _mapanon(STRACE_TABLES * sizeof(struct StraceTable));
+  if (!g_strace.tables) {
+    kprintf("error: --strace=summary failed to allocate tables\n");
+    return;
+  }
+  g_strace.pid = getpid();
+  g_strace.tsc = rdtsc();
+  g_strace.ts = timespec_mono();
+  atexit(PrintSummary);
+#ifdef __x86_64__
+  if (IsLinux()) {
+    __strace_next = __systemfive;
+    __systemfive = __strace_hook;
+    g_strace.hooked = true;
+  }
+#endif
+}
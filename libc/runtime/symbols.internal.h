@@ -3,7 +3,7 @@
 COSMOPOLITAN_C_START_
 
 #define SYMBOLS_MAGIC 0x544d5953 /* SYMT */
-#define SYMBOLS_ABI   1
+#define SYMBOLS_ABI   2
 
 struct Symbol {
   unsigned x; /* start (relative to addr_base) */
@@ -12,17 +12,22 @@ struct Symbol {
 
 struct SymbolTable {
   uint32_t magic;            /* 0xFEEDABEE little endian */
-  uint32_t abi;              /* 1 */
+  uint32_t abi;              /* 2 */
   uint64_t count;            /* of `symbols` */
   uint64_t size;             /* file size */
-  uint64_t mapsize;          /* of this object */
+  uint64_t mapsize;          /* of this object, or 0 if not owned */
   int64_t addr_base;         /* IMAGE_BASE_VIRTUAL */
   int64_t addr_end;          /* _end - 1 */
   uint32_t *names;           /* relative to `name_base` */
   char *name_base;           /* double-nul terminated w/ empty first */
   uint32_t names_offset;     /* for file loading */
   uint32_t name_base_offset; /* for file loading */
-  struct Symbol symbols[];   /* sorted and non-overlapping intervals */
+  uint32_t symbols_offset;   /* for file loading (abi 1 ends here) */
+  uint32_t index_offset;     /* for file loading */
+  uint32_t index_shift;      /* log2 of address bytes per bucket */
+  uint32_t index_count;      /* of buckets, not counting sentinel */
+  struct Symbol *symbols;    /* sorted and non-overlapping intervals */
+  uint32_t *index;           /* lowest symbol that may be in bucket */
 };
 
 struct SymbolTable *GetSymbolTable(void);
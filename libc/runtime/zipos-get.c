@@ -92,6 +92,14 @@ static void __zipos_generate_index(struct Zipos *zipos) {
   for (i = 0, c = GetZipCdirOffset(zipos->cdir); i < zipos->records;
        ++i, c += ZIP_CFILE_HDRSIZE(zipos->map + c))
     zipos->index[i] = c;
+  // our linkers emit the central directory already sorted by name, so
+  // we only need to sort if something like `zip -r` has since changed
+  for (i = 1; i < zipos->records; ++i)
+    if (__zipos_compare_names(zipos->index + i - 1, zipos->index + i,
+                              zipos) > 0)
+      break;
+  if (i >= zipos->records)
+    return;
   // smoothsort() isn't the fastest algorithm, but it guarantees
   // o(nlogn) won't smash the stack and doesn't depend on malloc
   smoothsort_r(zipos->index, zipos->records, sizeof(size_t),
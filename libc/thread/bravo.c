@@ -0,0 +1,163 @@
+/*-*- mode:c;indent-tabs-mode:nil;c-basic-offset:2;tab-width:8;coding:utf-8 -*-│
+│ vi: set et ft=c ts=2 sts=2 sw=2 fenc=utf-8                               :vi │
+╞══════════════════════════════════════════════════════════════════════════════╡
+│ Copyright 2024 Justine Alexandra Roberts Tunney                              │
+│                                                                              │
+│ Permission to use, copy, modify, and/or distribute this software for         │
+│ any purpose with or without fee is hereby granted, provided that the         │
+│ above copyright notice and this permission notice appear in all copies.      │
+│                                                                              │
+│ THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL                │
+│ WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED                │
+│ WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE             │
+│ AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL         │
+│ DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR        │
+│ PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER               │
+│ TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR             │
+│ PERFORMANCE OF THIS SOFTWARE.                                                │
+╚─────────────────────────────────────────────────────────────────────────────*/
+#include "libc/calls/struct/timespec.h"
+#include "libc/intrin/atomic.h"
+#include "libc/stdalign.h"
+#include "libc/thread/posixthread.internal.h"
+#include "libc/thread/thread.h"
+
+/**
+ * @fileoverview reader bias for read-write locks
+ *
+ * This implements BRAVO (Dice and Kogan, "BRAVO: Biased Locking for
+ * Reader-Writer Locks", USENIX ATC 2019) on top of the *NSYNC mutex,
+ * for locks created with pthread_rwlockattr_setreaderbias_np(). While
+ * a lock is biased, a reader publishes itself by claiming a slot in a
+ * big table of visible readers, chosen by hashing the lock and thread
+ * together. Readers then only touch their own cache line rather than
+ * all bouncing the lock word between cores. Writers take the *NSYNC
+ * lock, turn the bias off, and wait for the table to drain of readers
+ * of their lock. Since that scan is costly, the bias is held off for a
+ * while afterwards, in proportion to how long the scan took, so locks
+ * that are written often end up behaving like ordinary *NSYNC locks.
+ */
+
+#define BRAVO_SLOTS    4096  // visible readers table size
+#define BRAVO_HELD     4     // fast path read locks a thread can hold
+#define BRAVO_INHIBITS 64    // inhibit deadlines, hashed by lock
+#define BRAVO_PENALTY  9     // multiple of revocation time to inhibit
+
+alignas(64) static _Atomic(pthread_rwlock_t *) g_bravo_readers[BRAVO_SLOTS];
+static _Atomic(int64_t) g_bravo_inhibit[BRAVO_INHIBITS];
+
+// slots in readers table which the calling thread has claimed
+static _Thread_local _Atomic(pthread_rwlock_t *) *g_bravo_held[BRAVO_HELD];
+
+static int64_t _pthread_rwlock_bravo_now(void) {
+  return timespec_tonanos(timespec_mono());
+}
+
+/**
+ * Returns slot in readers table used when calling thread reads lock.
+ */
+_Atomic(pthread_rwlock_t *) *_pthread_rwlock_bravo_slot(
+    pthread_rwlock_t *rwlock) {
+  uint64_t h;
+  h = (uintptr_t)rwlock * 0x9e3779b97f4a7c15;
+  h ^= (uintptr_t)g_bravo_held * 0xc2b2ae3d27d4eb4f;
+  return g_bravo_readers + (h >> 52) % BRAVO_SLOTS;
+}
+
+static _Atomic(int64_t) *_pthread_rwlock_bravo_inhibit(
+    pthread_rwlock_t *rwlock) {
+  return g_bravo_inhibit + ((uintptr_t)rwlock >> 4) % BRAVO_INHIBITS;
+}
+
+/**
+ * Tries to acquire read lock by publishing calling thread as a reader.
+ *
+ * @return true if lock was acquired without touching *NSYNC lock
+ */
+bool _pthread_rwlock_bravo_rdlock(pthread_rwlock_t *rwlock) {
+  int i;
+  _Atomic(pthread_rwlock_t *) *slot;
+  pthread_rwlock_t *expect = 0;
+  if (!atomic_load_explicit(&rwlock->_rbias, memory_order_relaxed))
+    return false;
+  for (i = 0; i < BRAVO_HELD; ++i)
+    if (!g_bravo_held[i])
+      break;
+  if (i == BRAVO_HELD)
+    return false;
+  slot = _pthread_rwlock_bravo_slot(rwlock);
+  if (!atomic_compare_exchange_strong(slot, &expect, rwlock))
+    return false;
+  // this seq_cst load pairs with the seq_cst store in revoke()
+  if (atomic_load(&rwlock->_rbias)) {
+    g_bravo_held[i] = slot;
+    return true;
+  }
+  atomic_store_explicit(slot, 0, memory_order_relaxed);
+  return false;
+}
+
+/**
+ * Releases read lock if it was acquired by _pthread_rwlock_bravo_rdlock().
+ *
+ * @return true if read lock was released
+ */
+bool _pthread_rwlock_bravo_runlock(pthread_rwlock_t *rwlock) {
+  int i;
+  _Atomic(pthread_rwlock_t *) *slot;
+  slot = _pthread_rwlock_bravo_slot(rwlock);
+  // another lock we hold may have claimed the same slot, in which case
+  // the read lock being released was taken the slow way through *NSYNC
+  if (atomic_load_explicit(slot, memory_order_relaxed) != rwlock)
+    return false;
+  for (i = 0; i < BRAVO_HELD; ++i) {
+    if (g_bravo_held[i] == slot) {
+      g_bravo_held[i] = 0;
+      atomic_store_explicit(slot, 0, memory_order_release);
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * Turns reader bias back on, once it's no longer being held off.
+ *
+ * This should be called with the *NSYNC lock held in read mode.
+ */
+void _pthread_rwlock_bravo_enable(pthread_rwlock_t *rwlock) {
+  if (!atomic_load_explicit(&rwlock->_rbias, memory_order_relaxed) &&
+      _pthread_rwlock_bravo_now() >=
+          atomic_load_explicit(_pthread_rwlock_bravo_inhibit(rwlock),
+                               memory_order_relaxed))
+    atomic_store_explicit(&rwlock->_rbias, 1, memory_order_relaxed);
+}
+
+/**
+ * Turns off reader bias and waits for published readers to leave.
+ *
+ * This should be called with the *NSYNC lock held in write mode.
+ *
+ * @param block may be false to return false rather than wait
+ * @return true if there are no readers left
+ */
+bool _pthread_rwlock_bravo_revoke(pthread_rwlock_t *rwlock, bool block) {
+  int i, backoff;
+  int64_t start, now;
+  if (!atomic_load_explicit(&rwlock->_rbias, memory_order_relaxed))
+    return true;
+  atomic_store(&rwlock->_rbias, 0);
+  start = _pthread_rwlock_bravo_now();
+  for (i = 0; i < BRAVO_SLOTS; ++i) {
+    for (backoff = 0; atomic_load(g_bravo_readers + i) == rwlock;) {
+      if (!block)
+        return false;
+      backoff = pthread_delay_np(rwlock, backoff);
+    }
+  }
+  now = _pthread_rwlock_bravo_now();
+  atomic_store_explicit(_pthread_rwlock_bravo_inhibit(rwlock),
+                        now + (now - start) * BRAVO_PENALTY,
+                        memory_order_relaxed);
+  return true;
+}
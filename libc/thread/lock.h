@@ -42,5 +42,27 @@ COSMOPOLITAN_C_START_
 #define MUTEX_DEC_DEPTH(word)            ((word) - MUTEX_DEPTH_MIN)
 #define MUTEX_SET_OWNER(word, tid)       ((uint64_t)(tid) << 32 | (uint32_t)(word))
 
+//
+//         COSMOPOLITAN PROCESS SHARED RWLOCKS
+//
+//                                 ┌waited
+//                                 │┌writer
+//                readers          ││
+//   ┌─────────────┴──────────────┐││
+// 0b00000000000000000000000000000000
+//
+// writers that are waiting get counted in _waiters, which stops new
+// readers from taking the lock, so that writers can't get starved out
+//
+
+#define RWLOCK_WRITER      1u
+#define RWLOCK_WAITED      2u
+#define RWLOCK_READER      4u
+#define RWLOCK_READERS(w)  ((w) >> 2)
+#define RWLOCK_SPIN_BUDGET 7  // backoff rounds before futex wait
+
+// pthread_rwlockattr_t holds PTHREAD_PROCESS_SHARED and this bit
+#define RWLOCKATTR_READERBIAS 1
+
 COSMOPOLITAN_C_END_
 #endif /* COSMOPOLITAN_LIBC_THREAD_LOCK_H_ */
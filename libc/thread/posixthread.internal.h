@@ -97,6 +97,12 @@ extern atomic_uint _pthread_count;
 extern struct PosixThread _pthread_static;
 extern _Atomic(pthread_key_dtor) _pthread_key_dtor[PTHREAD_KEYS_MAX];
 
+bool _pthread_rwlock_bravo_rdlock(pthread_rwlock_t *) dontthrow;
+bool _pthread_rwlock_bravo_revoke(pthread_rwlock_t *, bool) dontthrow;
+bool _pthread_rwlock_bravo_runlock(pthread_rwlock_t *) dontthrow;
+_Atomic(pthread_rwlock_t *) *_pthread_rwlock_bravo_slot(
+    pthread_rwlock_t *) dontthrow;
+
 int _pthread_cond_signal(pthread_cond_t *) dontthrow paramsnonnull();
 int _pthread_mutex_lock(pthread_mutex_t *) dontthrow paramsnonnull();
 int _pthread_mutex_trylock(pthread_mutex_t *) dontthrow paramsnonnull();
@@ -113,6 +119,7 @@ void _pthread_lock(void) dontthrow;
 void _pthread_onfork_child(void) dontthrow;
 void _pthread_onfork_parent(void) dontthrow;
 void _pthread_onfork_prepare(void) dontthrow;
+void _pthread_rwlock_bravo_enable(pthread_rwlock_t *) dontthrow;
 void _pthread_unlock(void) dontthrow;
 void _pthread_zombify(struct PosixThread *) dontthrow;
 
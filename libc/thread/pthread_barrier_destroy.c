@@ -28,7 +28,8 @@
  * @raise EINVAL if threads are still inside the barrier
  */
 errno_t pthread_barrier_destroy(pthread_barrier_t *barrier) {
-  if (atomic_load_explicit(&barrier->_waiters, memory_order_relaxed))
+  if (atomic_load_explicit(&barrier->_counter, memory_order_relaxed) !=
+      barrier->_count)
     return EINVAL;
   memset(barrier, -1, sizeof(*barrier));
   return 0;
@@ -40,6 +40,6 @@ errno_t pthread_barrier_init(pthread_barrier_t *barrier,
   barrier->_count = count;
   barrier->_pshared = attr ? *attr : PTHREAD_PROCESS_PRIVATE;
   atomic_store_explicit(&barrier->_counter, count, memory_order_relaxed);
-  atomic_store_explicit(&barrier->_waiters, 0, memory_order_relaxed);
+  atomic_store_explicit(&barrier->_generation, 0, memory_order_relaxed);
   return 0;
 }
@@ -38,10 +38,11 @@
  * @raise EINVAL if barrier is used incorrectly
  */
 errno_t pthread_barrier_wait(pthread_barrier_t *barrier) {
-  int n;
+  int n, gen;
 
   // enter barrier
-  atomic_fetch_add_explicit(&barrier->_waiters, 1, memory_order_acq_rel);
+  // the generation can't advance until we've counted ourself
+  gen = atomic_load_explicit(&barrier->_generation, memory_order_acquire);
   n = atomic_fetch_sub_explicit(&barrier->_counter, 1, memory_order_acq_rel);
   n = n - 1;
 
@@ -52,16 +53,20 @@ errno_t pthread_barrier_wait(pthread_barrier_t *barrier) {
   // reset count and wake waiters if we're last at barrier
   if (!n) {
     atomic_store_explicit(&barrier->_counter, barrier->_count,
-                          memory_order_release);
-    atomic_store_explicit(&barrier->_waiters, 0, memory_order_release);
-    cosmo_futex_wake(&barrier->_waiters, INT_MAX, barrier->_pshared);
+                          memory_order_relaxed);
+    atomic_fetch_add_explicit(&barrier->_generation, 1, memory_order_release);
+    cosmo_futex_wake(&barrier->_generation, INT_MAX, barrier->_pshared);
     return PTHREAD_BARRIER_SERIAL_THREAD;
   }
 
   // wait for everyone else to arrive at barrier
+  // waiting on a generation number rather than a count of waiters is
+  // what lets a thread that's woken late not be confused by the round
+  // of the barrier that's already begun after it
   BLOCK_CANCELATION;
-  while ((n = atomic_load_explicit(&barrier->_waiters, memory_order_acquire)))
-    cosmo_futex_wait(&barrier->_waiters, n, barrier->_pshared, 0, 0);
+  while (atomic_load_explicit(&barrier->_generation, memory_order_acquire) ==
+         gen)
+    cosmo_futex_wait(&barrier->_generation, gen, barrier->_pshared, 0, 0);
   ALLOW_CANCELATION;
 
   return 0;
@@ -30,6 +30,7 @@
 #include "libc/limits.h"
 #include "libc/mem/gc.h"
 #include "libc/mem/mem.h"
+#include "libc/runtime/ftrace.internal.h"
 #include "libc/runtime/internal.h"
 #include "libc/runtime/runtime.h"
 #include "libc/str/str.h"
@@ -95,6 +96,10 @@ wontreturn void pthread_exit(void *rc) {
   // free resources
   __cxa_thread_finalize();
 
+  // write out binary function trace
+  if (_weaken(__ftrace_release))
+    _weaken(__ftrace_release)();
+
   // run atexit handlers if orphaned thread
   // notice how we avoid acquiring the pthread gil
   if (!(population = atomic_fetch_sub(&_pthread_count, 1) - 1)) {
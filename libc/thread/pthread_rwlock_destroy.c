@@ -19,6 +19,7 @@
 #include "libc/errno.h"
 #include "libc/intrin/atomic.h"
 #include "libc/str/str.h"
+#include "libc/thread/lock.h"
 #include "libc/thread/thread.h"
 #include "third_party/nsync/mu.h"
 
@@ -36,7 +37,8 @@ errno_t pthread_rwlock_destroy(pthread_rwlock_t *rwlock) {
     if (atomic_load_explicit(&mu->word, memory_order_relaxed))
       return EBUSY;
   } else {
-    if (atomic_load_explicit(&rwlock->_word, memory_order_relaxed))
+    if (atomic_load_explicit(&rwlock->_word, memory_order_relaxed) &
+        ~RWLOCK_WAITED)
       return EBUSY;
   }
 
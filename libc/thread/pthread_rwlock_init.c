@@ -16,6 +16,7 @@
 │ TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR             │
 │ PERFORMANCE OF THIS SOFTWARE.                                                │
 ╚─────────────────────────────────────────────────────────────────────────────*/
+#include "libc/thread/lock.h"
 #include "libc/thread/thread.h"
 
 /**
@@ -26,8 +27,10 @@
  */
 errno_t pthread_rwlock_init(pthread_rwlock_t *rwlock,
                             const pthread_rwlockattr_t *attr) {
+  pthread_rwlockattr_t a = attr ? *attr : 0;
   *rwlock = (pthread_rwlock_t){
-      ._pshared = attr ? *attr : PTHREAD_PROCESS_PRIVATE,
+      ._pshared = a & ~RWLOCKATTR_READERBIAS,
+      ._readerbias = a & RWLOCKATTR_READERBIAS,
   };
   return 0;
 }
@@ -16,37 +16,74 @@
 │ TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR             │
 │ PERFORMANCE OF THIS SOFTWARE.                                                │
 ╚─────────────────────────────────────────────────────────────────────────────*/
+#include "libc/calls/blockcancel.internal.h"
+#include "libc/cosmo.h"
+#include "libc/errno.h"
 #include "libc/intrin/atomic.h"
+#include "libc/thread/lock.h"
+#include "libc/thread/posixthread.internal.h"
 #include "libc/thread/thread.h"
 #include "third_party/nsync/mu.h"
 
 /**
  * Acquires read lock on read-write lock.
  *
+ * Process shared locks favor writers. Once a writer begins waiting, new
+ * readers queue up behind it. Waiting threads spin briefly and then go
+ * to sleep on a futex.
+ *
  * @return 0 on success, or errno on error
+ * @raise EAGAIN if maximum number of read locks are held
  */
 errno_t pthread_rwlock_rdlock(pthread_rwlock_t *lk) {
 
 #if PTHREAD_USE_NSYNC
   // use nsync if possible
   if (!lk->_pshared) {
+    if (lk->_readerbias && _pthread_rwlock_bravo_rdlock(lk))
+      return 0;
     nsync_mu_rlock((nsync_mu *)lk->_nsync);
+    if (lk->_readerbias)
+      _pthread_rwlock_bravo_enable(lk);
     return 0;
   }
 #endif
 
-  // naive implementation
-  uint32_t w = 0;
+  // futex implementation
+  int backoff = 0;
+  uint32_t w = atomic_load_explicit(&lk->_word, memory_order_relaxed);
   for (;;) {
-    if (w & 1)
-      for (;;)
-        if (~(w = atomic_load_explicit(&lk->_word, memory_order_relaxed)) & 1)
-          break;
-    // xxx: avoid writer starvation in pthread_rwlock_rdlock_test
-    while (atomic_load(&lk->_waiters))
-      pthread_yield_np();
-    if (atomic_compare_exchange_weak_explicit(
-            &lk->_word, &w, w + 2, memory_order_acquire, memory_order_relaxed))
-      return 0;
+    if (!(w & RWLOCK_WRITER) &&
+        !atomic_load_explicit(&lk->_waiters, memory_order_acquire)) {
+      if (RWLOCK_READERS(w + RWLOCK_READER) < RWLOCK_READERS(w))
+        return EAGAIN;
+      if (atomic_compare_exchange_weak_explicit(&lk->_word, &w,
+                                                w + RWLOCK_READER,
+                                                memory_order_acquire,
+                                                memory_order_relaxed))
+        return 0;
+      continue;
+    }
+    if (backoff < RWLOCK_SPIN_BUDGET) {
+      backoff = pthread_delay_np(lk, backoff);
+      w = atomic_load_explicit(&lk->_word, memory_order_relaxed);
+      continue;
+    }
+    if (!(w & RWLOCK_WAITED)) {
+      if (!atomic_compare_exchange_weak_explicit(&lk->_word, &w,
+                                                 w | RWLOCK_WAITED,
+                                                 memory_order_relaxed,
+                                                 memory_order_relaxed))
+        continue;
+      w |= RWLOCK_WAITED;
+      // the writer we're deferring to might have come and gone
+      if (!(w & RWLOCK_WRITER) &&
+          !atomic_load_explicit(&lk->_waiters, memory_order_acquire))
+        continue;
+    }
+    BLOCK_CANCELATION;
+    cosmo_futex_wait((atomic_int *)&lk->_word, w, lk->_pshared, 0, 0);
+    ALLOW_CANCELATION;
+    w = atomic_load_explicit(&lk->_word, memory_order_relaxed);
   }
 }
@@ -18,6 +18,8 @@
 ╚─────────────────────────────────────────────────────────────────────────────*/
 #include "libc/errno.h"
 #include "libc/intrin/atomic.h"
+#include "libc/thread/lock.h"
+#include "libc/thread/posixthread.internal.h"
 #include "libc/thread/thread.h"
 #include "third_party/nsync/mu.h"
 
@@ -34,7 +36,11 @@ errno_t pthread_rwlock_tryrdlock(pthread_rwlock_t *rwlock) {
 #if PTHREAD_USE_NSYNC
   // use nsync if possible
   if (!rwlock->_pshared) {
+    if (rwlock->_readerbias && _pthread_rwlock_bravo_rdlock(rwlock))
+      return 0;
     if (nsync_mu_rtrylock((nsync_mu *)rwlock->_nsync)) {
+      if (rwlock->_readerbias)
+        _pthread_rwlock_bravo_enable(rwlock);
       return 0;
     } else {
       return EBUSY;
@@ -42,12 +48,17 @@ errno_t pthread_rwlock_tryrdlock(pthread_rwlock_t *rwlock) {
   }
 #endif
 
-  // naive implementation
-  uint32_t word = 0;
+  // futex implementation
+  // fail if pthread_rwlock_rdlock() would have had to wait
+  uint32_t word = atomic_load_explicit(&rwlock->_word, memory_order_relaxed);
   for (;;) {
-    if (word & 1)
+    if ((word & RWLOCK_WRITER) ||
+        atomic_load_explicit(&rwlock->_waiters, memory_order_acquire))
       return EBUSY;
-    if (atomic_compare_exchange_weak_explicit(&rwlock->_word, &word, word + 2,
+    if (RWLOCK_READERS(word + RWLOCK_READER) < RWLOCK_READERS(word))
+      return EAGAIN;
+    if (atomic_compare_exchange_weak_explicit(&rwlock->_word, &word,
+                                              word + RWLOCK_READER,
                                               memory_order_acquire,
                                               memory_order_relaxed))
       return 0;
@@ -18,6 +18,8 @@
 ╚─────────────────────────────────────────────────────────────────────────────*/
 #include "libc/errno.h"
 #include "libc/intrin/atomic.h"
+#include "libc/thread/lock.h"
+#include "libc/thread/posixthread.internal.h"
 #include "libc/thread/thread.h"
 #include "third_party/nsync/mu.h"
 
@@ -34,6 +36,12 @@ errno_t pthread_rwlock_trywrlock(pthread_rwlock_t *rwlock) {
   // use nsync if possible
   if (!rwlock->_pshared) {
     if (nsync_mu_trylock((nsync_mu *)rwlock->_nsync)) {
+      // fail rather than wait on readers who bypassed the nsync lock
+      if (rwlock->_readerbias &&
+          !_pthread_rwlock_bravo_revoke(rwlock, false)) {
+        nsync_mu_unlock((nsync_mu *)rwlock->_nsync);
+        return EBUSY;
+      }
       rwlock->_iswrite = 1;
       return 0;
     } else {
@@ -42,10 +50,15 @@ errno_t pthread_rwlock_trywrlock(pthread_rwlock_t *rwlock) {
   }
 #endif
 
-  // naive implementation
-  uint32_t word = 0;
-  if (atomic_compare_exchange_strong_explicit(
-          &rwlock->_word, &word, 1, memory_order_acquire, memory_order_relaxed))
-    return 0;
-  return EBUSY;
+  // futex implementation
+  uint32_t word = atomic_load_explicit(&rwlock->_word, memory_order_relaxed);
+  for (;;) {
+    if (word & ~RWLOCK_WAITED)
+      return EBUSY;
+    if (atomic_compare_exchange_weak_explicit(&rwlock->_word, &word,
+                                              word | RWLOCK_WRITER,
+                                              memory_order_acquire,
+                                              memory_order_relaxed))
+      return 0;
+  }
 }
@@ -16,8 +16,12 @@
 │ TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR             │
 │ PERFORMANCE OF THIS SOFTWARE.                                                │
 ╚─────────────────────────────────────────────────────────────────────────────*/
+#include "libc/cosmo.h"
 #include "libc/errno.h"
 #include "libc/intrin/atomic.h"
+#include "libc/limits.h"
+#include "libc/thread/lock.h"
+#include "libc/thread/posixthread.internal.h"
 #include "libc/thread/thread.h"
 #include "third_party/nsync/mu.h"
 
@@ -35,26 +39,37 @@ errno_t pthread_rwlock_unlock(pthread_rwlock_t *rwlock) {
     if (rwlock->_iswrite) {
       rwlock->_iswrite = 0;
       nsync_mu_unlock((nsync_mu *)rwlock->_nsync);
-    } else {
+    } else if (!rwlock->_readerbias ||
+               !_pthread_rwlock_bravo_runlock(rwlock)) {
       nsync_mu_runlock((nsync_mu *)rwlock->_nsync);
     }
     return 0;
   }
 #endif
 
-  // naive implementation
+  // futex implementation
+  // sleepers are only woken once the lock becomes entirely free
   uint32_t word = atomic_load_explicit(&rwlock->_word, memory_order_relaxed);
   for (;;) {
-    if (word & 1) {
-      atomic_store_explicit(&rwlock->_word, 0, memory_order_release);
-      return 0;
-    } else if (word) {
-      if (atomic_compare_exchange_weak_explicit(&rwlock->_word, &word, word - 2,
+    if (word & RWLOCK_WRITER) {
+      word = atomic_exchange_explicit(&rwlock->_word, 0, memory_order_release);
+      break;
+    } else if (RWLOCK_READERS(word)) {
+      uint32_t next = word - RWLOCK_READER;
+      if (!RWLOCK_READERS(next))
+        next = 0;
+      if (atomic_compare_exchange_weak_explicit(&rwlock->_word, &word, next,
                                                 memory_order_release,
-                                                memory_order_relaxed))
-        return 0;
+                                                memory_order_relaxed)) {
+        if (next)
+          return 0;
+        break;
+      }
     } else {
       return EPERM;
     }
   }
+  if (word & RWLOCK_WAITED)
+    cosmo_futex_wake((atomic_int *)&rwlock->_word, INT_MAX, rwlock->_pshared);
+  return 0;
 }
@@ -16,7 +16,11 @@
 │ TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR             │
 │ PERFORMANCE OF THIS SOFTWARE.                                                │
 ╚─────────────────────────────────────────────────────────────────────────────*/
+#include "libc/calls/blockcancel.internal.h"
+#include "libc/cosmo.h"
 #include "libc/intrin/atomic.h"
+#include "libc/thread/lock.h"
+#include "libc/thread/posixthread.internal.h"
 #include "libc/thread/thread.h"
 #include "third_party/nsync/mu.h"
 
@@ -31,21 +35,49 @@ errno_t pthread_rwlock_wrlock(pthread_rwlock_t *rwlock) {
   // use nsync if possible
   if (!rwlock->_pshared) {
     nsync_mu_lock((nsync_mu *)rwlock->_nsync);
+    if (rwlock->_readerbias)
+      _pthread_rwlock_bravo_revoke(rwlock, true);
     rwlock->_iswrite = 1;
     return 0;
   }
 #endif
 
-  // naive implementation
-  uint32_t w = 0;
+  // futex implementation
+  int backoff = 0;
+  bool waiting = false;
+  uint32_t w = atomic_load_explicit(&rwlock->_word, memory_order_relaxed);
   for (;;) {
-    if (atomic_compare_exchange_weak_explicit(
-            &rwlock->_word, &w, 1, memory_order_acquire, memory_order_relaxed))
-      return 0;
-    atomic_fetch_add(&rwlock->_waiters, 1);
-    for (;;)
-      if (!(w = atomic_load_explicit(&rwlock->_word, memory_order_relaxed)))
-        break;
-    atomic_fetch_sub(&rwlock->_waiters, 1);
+    if (!(w & ~RWLOCK_WAITED)) {
+      if (atomic_compare_exchange_weak_explicit(
+              &rwlock->_word, &w, w | RWLOCK_WRITER, memory_order_acquire,
+              memory_order_relaxed)) {
+        if (waiting)
+          atomic_fetch_sub_explicit(&rwlock->_waiters, 1,
+                                    memory_order_release);
+        return 0;
+      }
+      continue;
+    }
+    if (!waiting) {
+      // hold off any new readers until we're done
+      atomic_fetch_add_explicit(&rwlock->_waiters, 1, memory_order_acq_rel);
+      waiting = true;
+    }
+    if (backoff < RWLOCK_SPIN_BUDGET) {
+      backoff = pthread_delay_np(rwlock, backoff);
+      w = atomic_load_explicit(&rwlock->_word, memory_order_relaxed);
+      continue;
+    }
+    if (!(w & RWLOCK_WAITED)) {
+      if (!atomic_compare_exchange_weak_explicit(
+              &rwlock->_word, &w, w | RWLOCK_WAITED, memory_order_relaxed,
+              memory_order_relaxed))
+        continue;
+      w |= RWLOCK_WAITED;
+    }
+    BLOCK_CANCELATION;
+    cosmo_futex_wait((atomic_int *)&rwlock->_word, w, rwlock->_pshared, 0, 0);
+    ALLOW_CANCELATION;
+    w = atomic_load_explicit(&rwlock->_word, memory_order_relaxed);
   }
 }
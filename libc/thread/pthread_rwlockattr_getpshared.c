@@ -16,6 +16,7 @@
 │ TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR             │
 │ PERFORMANCE OF THIS SOFTWARE.                                                │
 ╚─────────────────────────────────────────────────────────────────────────────*/
+#include "libc/thread/lock.h"
 #include "libc/thread/thread.h"
 
 /**
@@ -28,6 +29,6 @@
  */
 errno_t pthread_rwlockattr_getpshared(const pthread_rwlockattr_t *attr,
                                       int *pshared) {
-  *pshared = *attr;
+  *pshared = *attr & ~RWLOCKATTR_READERBIAS;
   return 0;
 }
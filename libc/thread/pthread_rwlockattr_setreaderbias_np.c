@@ -0,0 +1,43 @@
+/*-*- mode:c;indent-tabs-mode:nil;c-basic-offset:2;tab-width:8;coding:utf-8 -*-│
+│ vi: set et ft=c ts=2 sts=2 sw=2 fenc=utf-8                               :vi │
+╞══════════════════════════════════════════════════════════════════════════════╡
+│ Copyright 2024 Justine Alexandra Roberts Tunney                              │
+│                                                                              │
+│ Permission to use, copy, modify, and/or distribute this software for         │
+│ any purpose with or without fee is hereby granted, provided that the         │
+│ above copyright notice and this permission notice appear in all copies.      │
+│                                                                              │
+│ THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL                │
+│ WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED                │
+│ WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE             │
+│ AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL         │
+│ DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR        │
+│ PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER               │
+│ TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR             │
+│ PERFORMANCE OF THIS SOFTWARE.                                                │
+╚─────────────────────────────────────────────────────────────────────────────*/
+#include "libc/thread/lock.h"
+#include "libc/thread/thread.h"
+
+/**
+ * Sets read-write lock reader bias.
+ *
+ * Locks that have reader bias let readers skip the shared lock word so
+ * read-mostly locks, e.g. for configuration or routing tables, scale
+ * across many cores. The tradeoff is that writers need to scan a table
+ * of visible readers to acquire the lock, and that a thread may only
+ * hold a handful of biased read locks at once before the rest get the
+ * normal treatment. This is ignored for process shared locks.
+ *
+ * @param readerbias may be nonzero to enable reader bias
+ * @return 0 on success, or error on failure
+ */
+errno_t pthread_rwlockattr_setreaderbias_np(pthread_rwlockattr_t *attr,
+                                            int readerbias) {
+  if (readerbias) {
+    *attr |= RWLOCKATTR_READERBIAS;
+  } else {
+    *attr &= ~RWLOCKATTR_READERBIAS;
+  }
+  return 0;
+}
@@ -107,6 +107,8 @@ typedef struct pthread_rwlock_s {
       uint32_t _nsync_word;
       char _pshared;
       char _iswrite;
+      char _readerbias;
+      _PTHREAD_ATOMIC(char) _rbias;
       _PTHREAD_ATOMIC(uint32_t) _word;
       _PTHREAD_ATOMIC(uint32_t) _waiters;
     };
@@ -117,7 +119,7 @@ typedef struct pthread_barrier_s {
   int _count;
   char _pshared;
   _PTHREAD_ATOMIC(int) _counter;
-  _PTHREAD_ATOMIC(int) _waiters;
+  _PTHREAD_ATOMIC(int) _generation;
 } pthread_barrier_t;
 
 typedef struct pthread_attr_s {
@@ -220,8 +222,10 @@ int pthread_rwlock_unlock(pthread_rwlock_t *) dontthrow paramsnonnull();
 int pthread_rwlock_wrlock(pthread_rwlock_t *) dontthrow paramsnonnull();
 int pthread_rwlockattr_destroy(pthread_rwlockattr_t *) libcesque paramsnonnull();
 int pthread_rwlockattr_getpshared(const pthread_rwlockattr_t *, int *) libcesque paramsnonnull();
+int pthread_rwlockattr_getreaderbias_np(const pthread_rwlockattr_t *, int *) libcesque paramsnonnull();
 int pthread_rwlockattr_init(pthread_rwlockattr_t *) libcesque paramsnonnull();
 int pthread_rwlockattr_setpshared(pthread_rwlockattr_t *, int) libcesque paramsnonnull();
+int pthread_rwlockattr_setreaderbias_np(pthread_rwlockattr_t *, int) libcesque paramsnonnull();
 int pthread_setcancelstate(int, int *) libcesque;
 int pthread_setcanceltype(int, int *) libcesque;
 int pthread_setname_np(pthread_t, const char *) libcesque paramsnonnull();
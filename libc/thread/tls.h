@@ -10,6 +10,7 @@ COSMOPOLITAN_C_START_
 
 struct CosmoFtrace {   /* 16 */
   char ft_once;        /*  0 */
+  uint16_t ft_ring;    /*  2 binary mode ring index plus one */
   int ft_skew;         /*  4 */
   int64_t ft_lastaddr; /*  8 */
 };
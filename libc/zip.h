@@ -109,8 +109,12 @@
 #define kZipLfileOffsetNamesize          26
 #define kZipLfileOffsetCompressedsize    18
 #define kZipLfileOffsetUncompressedsize  22
+#define kZipLfileOffsetExtrasize         28
 
-#define kZipGflagUtf8 0x800
+#define kZipGflagDataDescriptor 0x008
+#define kZipGflagUtf8           0x800
+
+#define kZipDataDescriptorMagic ZM_(0x08074b50) /* PK•◘ "PK\7\10" */
 
 #define kZipExtraHdrSize             4
 #define kZipExtraZip64               0x0001
@@ -118,6 +122,7 @@
 #define kZipExtraUnix                0x000d
 #define kZipExtraExtendedTimestamp   0x5455
 #define kZipExtraInfoZipNewUnixExtra 0x7875
+#define kZipExtraAlignment           0xd935 /* zipalign padding */
 
 #define kZipCfileMagic "PK\001\002"
 
@@ -112,6 +112,16 @@ o/$(MODE)/test/libc/proc/fexecve_test.dbg:				\
 		$(APE_NO_MODIFY_SELF)
 	@$(APELINK)
 
+o/$(MODE)/test/libc/proc/startup_test.dbg:				\
+		$(TEST_LIBC_PROC_DEPS)					\
+		o/$(MODE)/test/libc/proc/startup_test.o			\
+		o/$(MODE)/test/libc/proc/startup_test_prog.zip.o	\
+		o/$(MODE)/test/libc/proc/proc.pkg			\
+		$(LIBC_TESTMAIN)					\
+		$(CRT)							\
+		$(APE_NO_MODIFY_SELF)
+	@$(APELINK)
+
 o/$(MODE)/test/libc/proc/life.dbg:					\
 		$(TEST_LIBC_PROC_DEPS)					\
 		o/$(MODE)/test/libc/proc/life.o				\
@@ -122,6 +132,7 @@ o/$(MODE)/test/libc/proc/life.dbg:					\
 o/$(MODE)/test/libc/proc/life.zip.o					\
 o/$(MODE)/test/libc/proc/execve_test_prog1.zip.o			\
 o/$(MODE)/test/libc/proc/execve_test_prog2.zip.o			\
+o/$(MODE)/test/libc/proc/startup_test_prog.zip.o			\
 o/$(MODE)/test/libc/proc/life-pe.zip.o: private				\
 		ZIPOBJ_FLAGS +=						\
 			-B
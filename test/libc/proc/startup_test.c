@@ -0,0 +1,226 @@
+/*-*- mode:c;indent-tabs-mode:nil;c-basic-offset:2;tab-width:8;coding:utf-8 -*-│
+│ vi: set et ft=c ts=2 sts=2 sw=2 fenc=utf-8                               :vi │
+╞══════════════════════════════════════════════════════════════════════════════╡
+│ Copyright 2024 Justine Alexandra Roberts Tunney                              │
+│                                                                              │
+│ Permission to use, copy, modify, and/or distribute this software for         │
+│ any purpose with or without fee is hereby granted, provided that the         │
+│ above copyright notice and this permission notice appear in all copies.      │
+│                                                                              │
+│ THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL                │
+│ WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED                │
+│ WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE             │
+│ AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL         │
+│ DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR        │
+│ PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER               │
+│ TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR             │
+│ PERFORMANCE OF THIS SOFTWARE.                                                │
+╚─────────────────────────────────────────────────────────────────────────────*/
+#include "libc/calls/calls.h"
+#include "libc/calls/struct/timespec.h"
+#include "libc/mem/mem.h"
+#include "libc/runtime/runtime.h"
+#include "libc/serialize.h"
+#include "libc/str/str.h"
+#include "libc/sysv/consts/o.h"
+#include "libc/testlib/benchmark.h"
+#include "libc/testlib/testlib.h"
+#include "libc/zip.h"
+
+// measures how long it takes for programs to start up
+//
+// `hello` is a minimal program and `assets` is the same program with a
+// zip of 100,000 files appended, which stresses how zipos indexes the
+// central directory the first time /zip is accessed. `sorted` has its
+// central directory in name order, the way our linkers emit it, which
+// lets zipos skip sorting it at runtime. the helper writes
+// the time at which main() was reached to its stdout, so we're able to
+// report both exec→main and exec→exit latencies.
+//
+// see also test/tool/net/redbean_test.c for redbean startup.
+
+__static_yoink("zipos");
+
+#define ASSETS 100000
+#define RUNS   32
+
+long g_tomain;
+long g_toexit;
+bool g_sorted;
+bool g_wassorted;
+
+void SetUpOnce(void) {
+  testlib_enable_tmp_setup_teardown_once();
+}
+
+// tests that change g_sorted may bail out early if an assertion fails
+void SetUp(void) {
+  g_wassorted = g_sorted;
+}
+
+void TearDown(void) {
+  g_sorted = g_wassorted;
+}
+
+// returns unique 12 byte name for i'th asset
+static void GetAssetName(char name[13], long i) {
+  uint32_t x = g_sorted ? i : i * 0x9e3779b1;
+  for (int j = 8; j--; x >>= 4)
+    name[j] = "0123456789abcdef"[x & 15];
+  strcpy(name + 8, ".txt");
+}
+
+// appends zip64 of `n` empty files to executable at `path`
+static void AppendAssets(const char *path, long n) {
+  int fd;
+  char *p, *b, name[16];
+  long i, base, cdir, eocd, size;
+  size = n * (kZipLfileHdrMinSize + 12 + kZipCfileHdrMinSize + 12) +
+         kZipCdir64HdrMinSize + kZipCdir64LocatorSize + kZipCdirHdrMinSize;
+  ASSERT_NE(-1, (fd = open(path, O_WRONLY | O_APPEND)));
+  ASSERT_NE(-1, (base = lseek(fd, 0, SEEK_END)));
+  ASSERT_NE(NULL, (b = p = calloc(1, size)));
+  for (i = 0; i < n; ++i, p += kZipLfileHdrMinSize + 12) {
+    GetAssetName(name, i);
+    WRITE32LE(p, kZipLfileHdrMagic);
+    p[4] = kZipEra1993;
+    WRITE16LE(p + 26, 12);
+    memcpy(p + kZipLfileHdrMinSize, name, 12);
+  }
+  cdir = p - b;
+  for (i = 0; i < n; ++i, p += kZipCfileHdrMinSize + 12) {
+    GetAssetName(name, i);
+    WRITE32LE(p, kZipCfileHdrMagic);
+    p[4] = kZipEra1993;
+    p[5] = kZipOsUnix;
+    p[6] = kZipEra1993;
+    WRITE16LE(p + 28, 12);
+    WRITE32LE(p + 38, 0100644u << 16);
+    WRITE32LE(p + 42, base + i * (kZipLfileHdrMinSize + 12));
+    memcpy(p + kZipCfileHdrMinSize, name, 12);
+  }
+  eocd = p - b;
+  WRITE32LE(p, kZipCdir64HdrMagic);
+  WRITE64LE(p + 4, kZipCdir64HdrMinSize - 12);
+  p[12] = kZipEra2001;
+  p[13] = kZipOsUnix;
+  p[14] = kZipEra2001;
+  WRITE64LE(p + 24, n);
+  WRITE64LE(p + 32, n);
+  WRITE64LE(p + 40, eocd - cdir);
+  WRITE64LE(p + 48, base + cdir);
+  p += kZipCdir64HdrMinSize;
+  WRITE32LE(p, kZipCdir64LocatorMagic);
+  WRITE64LE(p + 8, base + eocd);
+  WRITE32LE(p + 16, 1);
+  p += kZipCdir64LocatorSize;
+  WRITE32LE(p, kZipCdirHdrMagic);
+  WRITE16LE(p + 8, 0xffff);
+  WRITE16LE(p + 10, 0xffff);
+  WRITE32LE(p + 12, 0xffffffff);
+  WRITE32LE(p + 16, 0xffffffff);
+  ASSERT_EQ(size, write(fd, b, size));
+  ASSERT_SYS(0, 0, close(fd));
+  free(b);
+}
+
+// runs program and adds its exec→main and exec→exit latency to globals
+static void Launch(const char *prog, const char *arg, char **envp, int rc) {
+  int ws, fds[2];
+  int64_t mainns;
+  struct timespec start;
+  ASSERT_SYS(0, 0, pipe(fds));
+  start = timespec_mono();
+  if (!vfork()) {
+    dup2(fds[1], 1);
+    execve(prog, (char *[]){(char *)prog, (char *)arg, 0}, envp);
+    _Exit(127);
+  }
+  ASSERT_SYS(0, 0, close(fds[1]));
+  ASSERT_SYS(0, sizeof(mainns), read(fds[0], &mainns, sizeof(mainns)));
+  ASSERT_NE(-1, wait(&ws));
+  g_toexit += timespec_tonanos(timespec_sub(timespec_mono(), start));
+  g_tomain += mainns - timespec_tonanos(start);
+  ASSERT_SYS(0, 0, close(fds[0]));
+  ASSERT_TRUE(WIFEXITED(ws));
+  ASSERT_EQ(rc, WEXITSTATUS(ws));
+}
+
+static void Bench(const char *name, const char *prog, const char *arg,
+                  int rc) {
+  char code[64];
+  g_tomain = g_toexit = 0;
+  for (int i = 0; i < RUNS; ++i)
+    Launch(prog, arg, environ, rc);
+  _print_benchmark_result(g_tomain, 1, RUNS,
+                          (stpcpy(stpcpy(code, name), " exec→main"), code));
+  _print_benchmark_result(g_toexit, 1, RUNS,
+                          (stpcpy(stpcpy(code, name), " exec→exit"), code));
+}
+
+TEST(startup, hello) {
+  testlib_extract("/zip/startup_test_prog", "hello", 0755);
+  Launch("./hello", 0, environ, 0);
+  Launch("./hello", "/zip/nope.txt", environ, 1);
+}
+
+TEST(startup, assets) {
+  char path[32];
+  testlib_extract("/zip/startup_test_prog", "assets", 0755);
+  AppendAssets("assets", ASSETS);
+  strcpy(path, "/zip/");
+  GetAssetName(path + 5, 0);
+  Launch("./assets", path, environ, 0);
+  GetAssetName(path + 5, ASSETS - 1);
+  Launch("./assets", path, environ, 0);
+  Launch("./assets", "/zip/nope.txt", environ, 1);
+}
+
+TEST(startup, sortedAssets) {
+  char path[32];
+  g_sorted = true;
+  testlib_extract("/zip/startup_test_prog", "sorted", 0755);
+  AppendAssets("sorted", ASSETS);
+  strcpy(path, "/zip/");
+  GetAssetName(path + 5, 0);
+  Launch("./sorted", path, environ, 0);
+  GetAssetName(path + 5, ASSETS / 2);
+  Launch("./sorted", path, environ, 0);
+  Launch("./sorted", "/zip/nope.txt", environ, 1);
+}
+
+#if SYSDEBUG
+TEST(startup, initAudit_reportsEachStep) {
+  int ws, fds[2];
+  ssize_t rc, got = 0;
+  char buf[8192];
+  testlib_extract("/zip/startup_test_prog", "hello", 0755);
+  ASSERT_SYS(0, 0, pipe(fds));
+  if (!vfork()) {
+    dup2(fds[1], 2);
+    dup2(open("/dev/null", O_WRONLY), 1);
+    execve("./hello", (char *[]){"./hello", 0},
+           (char *[]){"COSMOPOLITAN_INIT_AUDIT=1", 0});
+    _Exit(127);
+  }
+  ASSERT_SYS(0, 0, close(fds[1]));
+  while ((rc = read(fds[0], buf + got, sizeof(buf) - 1 - got)) > 0)
+    got += rc;
+  buf[got] = 0;
+  ASSERT_SYS(0, 0, close(fds[0]));
+  ASSERT_NE(-1, wait(&ws));
+  ASSERT_EQ(0, ws);
+  ASSERT_NE(NULL, strstr(buf, "init audit"));
+  ASSERT_NE(NULL, strstr(buf, "ns  _start\n"));
+  ASSERT_NE(NULL, strstr(buf, "ns  _init\n"));
+  ASSERT_NE(NULL, strstr(buf, "ns  total before main()\n"));
+  ASSERT_NE(NULL, strstr(buf, "ns  main()\n"));
+}
+#endif
+
+BENCH(startup, bench) {
+  Bench("hello", "./hello", 0, 0);
+  Bench("assets", "./assets", 0, 0);
+  Bench("assets /zip", "./assets", "/zip/nope.txt", 1);
+  Bench("sorted /zip", "./sorted", "/zip/nope.txt", 1);
+}
@@ -0,0 +1,77 @@
+/*-*- mode:c;indent-tabs-mode:nil;c-basic-offset:2;tab-width:8;coding:utf-8 -*-│
+│ vi: set et ft=c ts=2 sts=2 sw=2 fenc=utf-8                               :vi │
+╞══════════════════════════════════════════════════════════════════════════════╡
+│ Copyright 2024 Justine Alexandra Roberts Tunney                              │
+│                                                                              │
+│ Permission to use, copy, modify, and/or distribute this software for         │
+│ any purpose with or without fee is hereby granted, provided that the         │
+│ above copyright notice and this permission notice appear in all copies.      │
+│                                                                              │
+│ THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL                │
+│ WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED                │
+│ WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE             │
+│ AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL         │
+│ DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR        │
+│ PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER               │
+│ TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR             │
+│ PERFORMANCE OF THIS SOFTWARE.                                                │
+╚─────────────────────────────────────────────────────────────────────────────*/
+#include "libc/calls/calls.h"
+#include "libc/calls/struct/timespec.h"
+#include "libc/dce.h"
+#include "libc/errno.h"
+#include "libc/fmt/conv.h"
+#include "libc/mem/gc.h"
+#include "libc/runtime/runtime.h"
+#include "libc/stdio/stdio.h"
+#include "libc/str/str.h"
+#include "libc/testlib/testlib.h"
+#include "libc/x/x.h"
+#include "libc/x/xasprintf.h"
+
+// when re-run with --profile by the test below, burns some cpu time
+// so SIGPROF gets delivered, and exits so the profile gets written
+
+dontinline void Spin(void) {
+  struct timespec start = timespec_mono();
+  while (timespec_tomillis(timespec_sub(timespec_mono(), start)) < 300)
+    __asm__ volatile("" ::: "memory");
+}
+
+void SetUpOnce(void) {
+  if (__argc == 2 && !strcmp(__argv[1], "child")) {
+    Spin();
+    exit(0);
+  }
+  testlib_enable_tmp_setup_teardown();
+}
+
+// --profile is only intercepted by builds that support --strace
+#if SYSDEBUG
+TEST(profile, test) {
+  int ws, pid;
+  size_t samples;
+  char *p, *q, *e, *path, *folded;
+  if (IsWindows() || IsMetal())
+    return;
+  ASSERT_NE(-1, (pid = fork()));
+  if (!pid) {
+    execv(GetProgramExecutableName(),
+          (char *const[]){program_invocation_short_name, "--profile=1000",
+                          "child", 0});
+    _Exit(127);
+  }
+  ASSERT_NE(-1, wait(&ws));
+  ASSERT_EQ(0, ws);
+  path = gc(xasprintf("%s.%d.folded", program_invocation_short_name, pid));
+  ASSERT_NE(NULL, (folded = gc(xslurp(path, 0))));
+  // every line is a stack of frames followed by how often it was seen
+  for (samples = 0, p = folded; (e = strchr(p, '\n')); p = e + 1) {
+    ASSERT_NE(NULL, (q = memrchr(p, ' ', e - p)));
+    ASSERT_GT(e - q, 1);
+    samples += strtoul(q + 1, 0, 10);
+  }
+  ASSERT_EQ('\0', *p);
+  ASSERT_GT(samples, 0);
+}
+#endif
@@ -0,0 +1,65 @@
+/*-*- mode:c;indent-tabs-mode:nil;c-basic-offset:2;tab-width:8;coding:utf-8 -*-│
+│ vi: set et ft=c ts=2 sts=2 sw=2 fenc=utf-8                               :vi │
+╞══════════════════════════════════════════════════════════════════════════════╡
+│ Copyright 2024 Justine Alexandra Roberts Tunney                              │
+│                                                                              │
+│ Permission to use, copy, modify, and/or distribute this software for         │
+│ any purpose with or without fee is hereby granted, provided that the         │
+│ above copyright notice and this permission notice appear in all copies.      │
+│                                                                              │
+│ THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL                │
+│ WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED                │
+│ WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE             │
+│ AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL         │
+│ DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR        │
+│ PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER               │
+│ TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR             │
+│ PERFORMANCE OF THIS SOFTWARE.                                                │
+╚─────────────────────────────────────────────────────────────────────────────*/
+#include "libc/calls/calls.h"
+#include "libc/dce.h"
+#include "libc/mem/gc.h"
+#include "libc/runtime/runtime.h"
+#include "libc/stdio/stdio.h"
+#include "libc/str/str.h"
+#include "libc/sysv/consts/o.h"
+#include "libc/testlib/testlib.h"
+#include "libc/x/x.h"
+
+// when re-run by the test below, makes a few system calls and exits
+// so that the summary gets printed
+void SetUpOnce(void) {
+  if (__argc == 2 && !strcmp(__argv[1], "child")) {
+    fsync(-1);
+    fsync(-1);
+    fsync(-1);
+    fsync(2);
+    exit(0);
+  }
+  testlib_enable_tmp_setup_teardown();
+}
+
+#if SYSDEBUG
+TEST(stracesummary, test) {
+  int ws;
+  char *log;
+  if (!fork()) {
+    close(2);
+    open("log", O_CREAT | O_TRUNC | O_WRONLY | O_APPEND, 0644);
+    setenv("STRACE", "summary", true);
+    execv(GetProgramExecutableName(),
+          (char *const[]){GetProgramExecutableName(), "child", 0});
+    _Exit(127);
+  }
+  ASSERT_NE(-1, wait(&ws));
+  ASSERT_EQ(0, ws);
+  ASSERT_NE(NULL, (log = gc(xslurp("log", 0))));
+  ASSERT_NE(NULL, strstr(log, "system call summary"));
+  // calls and errors come from what the fsync() wrapper returned
+  ASSERT_NE(NULL, strstr(log, "        4         3 fsync\n"));
+#ifdef __x86_64__
+  if (IsLinux())
+    ASSERT_NE(NULL, strstr(log, "\nfsync latency\n"));
+#endif
+}
+#endif
@@ -39,6 +39,7 @@ TEST_LIBC_SOCK_DIRECTDEPS =				\
 	LIBC_SYSV_CALLS					\
 	LIBC_TESTLIB					\
 	LIBC_X						\
+	THIRD_PARTY_MUSL				\
 	TOOL_DECODE_LIB
 
 TEST_LIBC_SOCK_DEPS :=					\
@@ -61,6 +62,7 @@ o/$(MODE)/test/libc/sock/unix_test.runs:		\
 		private .PLEDGE = stdio rpath wpath cpath fattr proc unix
 
 o/$(MODE)/test/libc/sock/connect_test.runs		\
+o/$(MODE)/test/libc/sock/dnscache_test.runs		\
 o/$(MODE)/test/libc/sock/recvfrom_test.runs		\
 o/$(MODE)/test/libc/sock/nonblock_test.runs		\
 o/$(MODE)/test/libc/sock/socket_test.runs		\
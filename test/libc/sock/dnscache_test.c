@@ -0,0 +1,238 @@
+/*-*- mode:c;indent-tabs-mode:nil;c-basic-offset:2;tab-width:8;coding:utf-8 -*-│
+│ vi: set et ft=c ts=2 sts=2 sw=2 fenc=utf-8                               :vi │
+╞══════════════════════════════════════════════════════════════════════════════╡
+│ Copyright 2024 Justine Alexandra Roberts Tunney                              │
+│                                                                              │
+│ Permission to use, copy, modify, and/or distribute this software for         │
+│ any purpose with or without fee is hereby granted, provided that the         │
+│ above copyright notice and this permission notice appear in all copies.      │
+│                                                                              │
+│ THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL                │
+│ WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED                │
+│ WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE             │
+│ AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL         │
+│ DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR        │
+│ PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER               │
+│ TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR             │
+│ PERFORMANCE OF THIS SOFTWARE.                                                │
+╚─────────────────────────────────────────────────────────────────────────────*/
+#include "libc/atomic.h"
+#include "libc/calls/calls.h"
+#include "libc/calls/struct/timespec.h"
+#include "libc/intrin/atomic.h"
+#include "libc/sock/sock.h"
+#include "libc/sock/struct/sockaddr.h"
+#include "libc/stdio/stdio.h"
+#include "libc/str/str.h"
+#include "libc/sysv/consts/af.h"
+#include "libc/sysv/consts/ipproto.h"
+#include "libc/sysv/consts/sock.h"
+#include "libc/testlib/testlib.h"
+#include "libc/thread/thread.h"
+#include "third_party/musl/dnscache.h"
+#include "third_party/musl/lookup.internal.h"
+#include "third_party/musl/netdb.h"
+
+// stub nameserver on 127.0.0.1 that answers A queries for any name
+// with 10.0.0.1 and ttl 1, except names starting with "missing" which
+// get nxdomain with an soa whose minimum is 1 second
+
+int g_stub;
+uint16_t g_port;
+pthread_t g_thread;
+atomic_int g_queries;
+atomic_int g_delay_ms;
+
+// points the resolver at our stub rather than /etc/resolv.conf
+int __get_resolv_conf(struct resolvconf *conf, char *search, size_t size) {
+  bzero(conf, sizeof(*conf));
+  conf->ndots = 1;
+  conf->timeout = 5;
+  conf->attempts = 1;
+  conf->port = g_port;
+  conf->nns = 1;
+  conf->ns[0].family = AF_INET;
+  memcpy(conf->ns[0].addr, "\177\0\0\1", 4);
+  if (search)
+    *search = 0;
+  return 0;
+}
+
+static void *StubResolver(void *arg) {
+  int n, q;
+  uint32_t addrsize;
+  struct sockaddr_in addr;
+  unsigned char p[512];
+  for (;;) {
+    addrsize = sizeof(addr);
+    if ((n = recvfrom(g_stub, p, 512 - 64, 0, (struct sockaddr *)&addr,
+                      &addrsize)) < 12)
+      break;
+    ++g_queries;
+    if (g_delay_ms)
+      usleep(g_delay_ms * 1000);
+    for (q = 12; q < n && p[q]; q += p[q] + 1) {
+    }
+    q += 5;
+    p[2] = 0x81;  // qr rd
+    p[3] = 0x80;  // ra
+    p[6] = p[7] = p[8] = p[9] = p[10] = p[11] = 0;
+    if (!memcmp(p + 13, "missing", 7)) {
+      p[3] |= 3;
+      p[9] = 1;
+      memcpy(p + q,
+             "\xc0\x0c\0\6\0\1\0\0\0\x3c\0\x16"  // soa, ttl 60
+             "\0\0"                              // mname, rname
+             "\0\0\0\1\0\0\0\1\0\0\0\1\0\0\0\1"  // serial, etc.
+             "\0\0\0\1",                         // minimum
+             12 + 22);
+      q += 12 + 22;
+    } else {
+      p[7] = 1;
+      memcpy(p + q,
+             "\xc0\x0c\0\1\0\1\0\0\0\1\0\4"  // a, ttl 1
+             "\12\0\0\1",
+             12 + 4);
+      q += 12 + 4;
+    }
+    sendto(g_stub, p, q, 0, (struct sockaddr *)&addr, addrsize);
+  }
+  return 0;
+}
+
+static int Lookup(const char *name) {
+  int rc;
+  struct addrinfo *ai, hints = {.ai_family = AF_INET};
+  if ((rc = getaddrinfo(name, "80", &hints, &ai)))
+    return rc;
+  if (((struct sockaddr_in *)ai->ai_addr)->sin_addr.s_addr !=
+      htonl(0x0a000001))
+    rc = -1;
+  freeaddrinfo(ai);
+  return rc;
+}
+
+void SetUpOnce(void) {
+  uint32_t addrsize = sizeof(struct sockaddr_in);
+  struct sockaddr_in addr = {
+      .sin_family = AF_INET,
+      .sin_addr.s_addr = htonl(0x7f000001),
+  };
+  ASSERT_NE(-1, (g_stub = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP)));
+  ASSERT_SYS(0, 0, bind(g_stub, (struct sockaddr *)&addr, sizeof(addr)));
+  ASSERT_SYS(0, 0, getsockname(g_stub, (struct sockaddr *)&addr, &addrsize));
+  g_port = ntohs(addr.sin_port);
+  ASSERT_EQ(0, pthread_create(&g_thread, 0, StubResolver, 0));
+}
+
+void SetUp(void) {
+  g_queries = 0;
+  g_delay_ms = 0;
+  ASSERT_EQ(0, dns_cache_enable(16));
+}
+
+void TearDown(void) {
+  ASSERT_EQ(0, dns_cache_enable(0));
+}
+
+TEST(dns_cache, disabled_queriesEveryTime) {
+  ASSERT_EQ(0, dns_cache_enable(0));
+  ASSERT_EQ(0, Lookup("uncached.test"));
+  ASSERT_EQ(0, Lookup("uncached.test"));
+  ASSERT_EQ(2, g_queries);
+}
+
+TEST(dns_cache, positiveAnswer_isServedFromCache) {
+  struct dns_cache_stats before, after;
+  dns_cache_stats(&before);
+  ASSERT_EQ(0, Lookup("cached.test"));
+  ASSERT_EQ(0, Lookup("cached.test"));
+  ASSERT_EQ(0, Lookup("CACHED.test"));
+  ASSERT_EQ(1, g_queries);
+  dns_cache_stats(&after);
+  ASSERT_EQ(2, after.hits - before.hits);
+  ASSERT_EQ(1, after.misses - before.misses);
+  ASSERT_EQ(1, after.entries);
+}
+
+TEST(dns_cache, nxdomain_isCachedNegatively) {
+  struct dns_cache_stats before, after;
+  dns_cache_stats(&before);
+  ASSERT_EQ(EAI_NONAME, Lookup("missing.test"));
+  ASSERT_EQ(EAI_NONAME, Lookup("missing.test"));
+  ASSERT_EQ(1, g_queries);
+  dns_cache_stats(&after);
+  ASSERT_EQ(1, after.negative_hits - before.negative_hits);
+}
+
+TEST(dns_cache, recordTtl_isHonored) {
+  struct dns_cache_stats before, after;
+  dns_cache_stats(&before);
+  ASSERT_EQ(0, Lookup("ttl.test"));
+  ASSERT_EQ(EAI_NONAME, Lookup("missing.ttl.test"));
+  ASSERT_EQ(2, g_queries);
+  usleep(1100 * 1000);
+  ASSERT_EQ(0, Lookup("ttl.test"));
+  ASSERT_EQ(EAI_NONAME, Lookup("missing.ttl.test"));
+  ASSERT_EQ(4, g_queries);
+  dns_cache_stats(&after);
+  ASSERT_EQ(2, after.expired - before.expired);
+}
+
+TEST(dns_cache, fullTable_evictsLeastRecentlyUsed) {
+  int i;
+  char name[32];
+  struct dns_cache_stats before, after;
+  ASSERT_EQ(0, dns_cache_enable(2));
+  dns_cache_stats(&before);
+  for (i = 0; i < 3; ++i) {
+    snprintf(name, sizeof(name), "host%d.test", i);
+    ASSERT_EQ(0, Lookup(name));
+  }
+  dns_cache_stats(&after);
+  ASSERT_EQ(1, after.evicted - before.evicted);
+  ASSERT_EQ(2, after.entries);
+  ASSERT_EQ(0, Lookup("host0.test"));
+  ASSERT_EQ(4, g_queries);
+}
+
+static void *LookupWorker(void *arg) {
+  Lookup(arg);
+  return 0;
+}
+
+TEST(dns_cache, concurrentLookups_areCoalesced) {
+  int i;
+  pthread_t th[8];
+  struct dns_cache_stats before, after;
+  g_delay_ms = 200;
+  dns_cache_stats(&before);
+  for (i = 0; i < 8; ++i)
+    ASSERT_EQ(0, pthread_create(th + i, 0, LookupWorker, "slow.test"));
+  for (i = 0; i < 8; ++i)
+    ASSERT_EQ(0, pthread_join(th[i], 0));
+  dns_cache_stats(&after);
+  ASSERT_EQ(1, g_queries);
+  ASSERT_EQ(8, (after.hits - before.hits) + (after.misses - before.misses) +
+                   (after.coalesced - before.coalesced));
+}
+
+TEST(dns_cache, fork_forgetsLookupsInFlight) {
+  int ws, pid;
+  pthread_t th;
+  g_delay_ms = 200;
+  ASSERT_EQ(0, pthread_create(&th, 0, LookupWorker, "forked.test"));
+  while (!g_queries)
+    usleep(1000);
+  ASSERT_NE(-1, (pid = fork()));
+  if (!pid) {
+    // the thread that was resolving forked.test is gone, so waiting on
+    // it would hang; the child should query the name all by itself
+    alarm(5);
+    _Exit(Lookup("forked.test") ? 1 : 0);
+  }
+  ASSERT_NE(-1, waitpid(pid, &ws, 0));
+  ASSERT_TRUE(WIFEXITED(ws));
+  ASSERT_EQ(0, WEXITSTATUS(ws));
+  ASSERT_EQ(0, pthread_join(th, 0));
+}
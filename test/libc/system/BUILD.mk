@@ -89,6 +89,7 @@ o/$(MODE)/test/libc/system/trace_test.dbg:			\
 		o/$(MODE)/test/libc/system/popen_test.zip.o	\
 		o/$(MODE)/test/libc/system/popen_test.dbg.zip.o	\
 		o/$(MODE)/tool/build/echo.zip.o			\
+		o/$(MODE)/tool/decode/ftrace.zip.o		\
 		$(LIBC_TESTMAIN)				\
 		$(CRT)						\
 		$(APE_NO_MODIFY_SELF)
@@ -107,6 +108,7 @@ o/$(MODE)/test/libc/system/systemvpe_test.dbg:			\
 
 o/$(MODE)/test/libc/system/popen_test.zip.o: private ZIPOBJ_FLAGS += -B
 o/$(MODE)/test/libc/system/popen_test.dbg.zip.o: private ZIPOBJ_FLAGS += -B
+o/$(MODE)/tool/decode/ftrace.zip.o: private ZIPOBJ_FLAGS += -B
 
 $(TEST_LIBC_SYSTEM_OBJS): test/libc/system/BUILD.mk
 
@@ -18,7 +18,9 @@
 ╚─────────────────────────────────────────────────────────────────────────────*/
 #include "libc/assert.h"
 #include "libc/calls/calls.h"
+#include "libc/mem/gc.h"
 #include "libc/mem/mem.h"
+#include "libc/runtime/ftrace.internal.h"
 #include "libc/runtime/runtime.h"
 #include "libc/stdio/stdio.h"
 #include "libc/str/str.h"
@@ -72,3 +74,98 @@ TEST(trace, test) {
     _Exit(1);
   }
 }
+
+// runs program with its output redirected to path, returning exit code
+static int Run(const char *path, const char *log, char *const argv[]) {
+  int ws;
+  if (!fork()) {
+    if (log)
+      setenv("KPRINTF_LOG", log, true);
+    close(1);
+    close(2);
+    open(path, O_CREAT | O_TRUNC | O_WRONLY | O_APPEND, 0644);
+    dup(1);
+    execv(argv[0], argv);
+    _Exit(128);
+  }
+  unassert(wait(&ws) != -1);
+  ASSERT_TRUE(WIFEXITED(ws));
+  return WEXITSTATUS(ws);
+}
+
+TEST(trace, binary) {
+  size_t n;
+  char *p, *e, *q, *out;
+  struct FtraceChunk hdr;
+  int records = 0, calibrations = 0;
+  unsetenv("MAKEFLAGS");
+  testlib_extract("/zip/popen_test", "popen_test", 0755);
+  testlib_extract("/zip/popen_test.dbg", "popen_test.dbg", 0755);
+  testlib_extract("/zip/ftrace", "ftrace", 0755);
+  ASSERT_EQ(0, Run("log", "binlog",
+                   (char *[]){"./popen_test", "--ftrace-binary", 0}));
+  ASSERT_NE(NULL, (p = xslurp("binlog", &n)));
+  for (e = p + n; (q = memmem(p, e - p, FTRACE_MAGIC, 8)); p = q + 8) {
+    ASSERT_GE(e - q, sizeof(hdr));
+    memcpy(&hdr, q, sizeof(hdr));
+    ASSERT_EQ(sizeof(struct FtraceRecord), hdr.size);
+    if (hdr.count) {
+      ++records;
+    } else {
+      ASSERT_NE(0, hdr.ticks);
+      ASSERT_NE(0, hdr.nanos);
+      ++calibrations;
+    }
+  }
+  ASSERT_GT(records, 0);
+  ASSERT_GT(calibrations, 0);
+  ASSERT_EQ(0, Run("out", 0,
+                   (char *[]){"./ftrace", "binlog", "popen_test.dbg", 0}));
+  ASSERT_NE(NULL, (out = xslurp("out", 0)));
+  ASSERT_NE(NULL, strstr(out, "testlib_runalltests"));
+}
+
+static void WriteSyntheticLog(const char *path, bool calibrated) {
+  int fd;
+  struct FtraceChunk hdr = {FTRACE_MAGIC, 3, sizeof(struct FtraceRecord)};
+  struct FtraceChunk cal = {FTRACE_MAGIC, 0, sizeof(struct FtraceRecord),
+                            2000, 1000};
+  struct FtraceRecord recs[3] = {
+      {200, 0x1000, 1, 2, 64, 0},
+      {400, 0x2000, 1, 2, 128, 1},
+      {1000, 0x3000, 1, 2, 64, 0},
+  };
+  ASSERT_NE(-1, (fd = creat(path, 0644)));
+  ASSERT_EQ(6, write(fd, "hello\n", 6));
+  ASSERT_EQ(sizeof(hdr), write(fd, &hdr, sizeof(hdr)));
+  ASSERT_EQ(sizeof(recs), write(fd, recs, sizeof(recs)));
+  ASSERT_EQ(6, write(fd, "world\n", 6));
+  if (calibrated)
+    ASSERT_EQ(sizeof(cal), write(fd, &cal, sizeof(cal)));
+  ASSERT_SYS(0, 0, close(fd));
+}
+
+TEST(trace, decode) {
+  testlib_extract("/zip/ftrace", "ftrace", 0755);
+  WriteSyntheticLog("synth", true);
+  ASSERT_EQ(0, Run("out", 0, (char *[]){"./ftrace", "synth", 0}));
+  EXPECT_STREQ("FUN      1      2                100         64 0x1000\n"
+               "FUN      1      2                200        128   0x2000\n"
+               "FUN      1      2                500         64 0x3000\n",
+               gc(xslurp("out", 0)));
+  ASSERT_EQ(0, Run("out", 0, (char *[]){"./ftrace", "-f", "synth", 0}));
+  EXPECT_STREQ("0x1000 100\n"
+               "0x1000;0x2000 300\n",
+               gc(xslurp("out", 0)));
+}
+
+TEST(trace, decodeUncalibrated) {
+  testlib_extract("/zip/ftrace", "ftrace", 0755);
+  WriteSyntheticLog("synth", false);
+  ASSERT_EQ(1, Run("out", 0, (char *[]){"./ftrace", "synth", 0}));
+  ASSERT_EQ(0, Run("out", 0, (char *[]){"./ftrace", "-c", "2", "synth", 0}));
+  EXPECT_STREQ("FUN      1      2                100         64 0x1000\n"
+               "FUN      1      2                200        128   0x2000\n"
+               "FUN      1      2                500         64 0x3000\n",
+               gc(xslurp("out", 0)));
+}
@@ -0,0 +1,219 @@
+/*-*- mode:c;indent-tabs-mode:nil;c-basic-offset:2;tab-width:8;coding:utf-8 -*-│
+│ vi: set et ft=c ts=2 sts=2 sw=2 fenc=utf-8                               :vi │
+╞══════════════════════════════════════════════════════════════════════════════╡
+│ Copyright 2024 Justine Alexandra Roberts Tunney                              │
+│                                                                              │
+│ Permission to use, copy, modify, and/or distribute this software for         │
+│ any purpose with or without fee is hereby granted, provided that the         │
+│ above copyright notice and this permission notice appear in all copies.      │
+│                                                                              │
+│ THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL                │
+│ WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED                │
+│ WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE             │
+│ AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL         │
+│ DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR        │
+│ PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER               │
+│ TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR             │
+│ PERFORMANCE OF THIS SOFTWARE.                                                │
+╚─────────────────────────────────────────────────────────────────────────────*/
+#include "libc/atomic.h"
+#include "libc/calls/calls.h"
+#include "libc/calls/struct/timespec.h"
+#include "libc/errno.h"
+#include "libc/intrin/kprintf.h"
+#include "libc/runtime/runtime.h"
+#include "libc/testlib/benchmark.h"
+#include "libc/testlib/testlib.h"
+#include "libc/thread/thread.h"
+
+// exercises the futex based process shared rwlock, condition variable
+// and barrier, by having forked processes contend on shared memory
+
+#define PROCESSES  8
+#define WRITERS    2
+#define ITERATIONS 10000
+#define ROUNDS     100
+
+struct SharedMemory {
+  pthread_rwlock_t rwlock;
+  pthread_barrier_t barrier;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  atomic_int writersleft;
+  volatile long x;
+  volatile long y;
+  volatile long turn;
+}* shm;
+
+void SetUp(void) {
+  pthread_condattr_t cattr;
+  pthread_mutexattr_t mattr;
+  pthread_rwlockattr_t rattr;
+  pthread_barrierattr_t battr;
+  shm = _mapshared(getpagesize());
+  ASSERT_EQ(0, pthread_rwlockattr_init(&rattr));
+  ASSERT_EQ(0, pthread_rwlockattr_setpshared(&rattr, PTHREAD_PROCESS_SHARED));
+  ASSERT_EQ(0, pthread_rwlock_init(&shm->rwlock, &rattr));
+  ASSERT_EQ(0, pthread_rwlockattr_destroy(&rattr));
+  ASSERT_EQ(0, pthread_barrierattr_init(&battr));
+  ASSERT_EQ(0, pthread_barrierattr_setpshared(&battr, PTHREAD_PROCESS_SHARED));
+  ASSERT_EQ(0, pthread_barrier_init(&shm->barrier, &battr, PROCESSES));
+  ASSERT_EQ(0, pthread_barrierattr_destroy(&battr));
+  ASSERT_EQ(0, pthread_mutexattr_init(&mattr));
+  ASSERT_EQ(0, pthread_mutexattr_setpshared(&mattr, PTHREAD_PROCESS_SHARED));
+  ASSERT_EQ(0, pthread_mutex_init(&shm->mutex, &mattr));
+  ASSERT_EQ(0, pthread_mutexattr_destroy(&mattr));
+  ASSERT_EQ(0, pthread_condattr_init(&cattr));
+  ASSERT_EQ(0, pthread_condattr_setpshared(&cattr, PTHREAD_PROCESS_SHARED));
+  ASSERT_EQ(0, pthread_cond_init(&shm->cond, &cattr));
+  ASSERT_EQ(0, pthread_condattr_destroy(&cattr));
+}
+
+void TearDown(void) {
+  ASSERT_EQ(0, pthread_cond_destroy(&shm->cond));
+  ASSERT_EQ(0, pthread_mutex_destroy(&shm->mutex));
+  ASSERT_EQ(0, pthread_barrier_destroy(&shm->barrier));
+  ASSERT_EQ(0, pthread_rwlock_destroy(&shm->rwlock));
+  ASSERT_SYS(0, 0, munmap(shm, getpagesize()));
+}
+
+void Spawn(void worker(int)) {
+  int e, ws, pid;
+  for (int i = 0; i < PROCESSES; ++i) {
+    ASSERT_NE(-1, (pid = fork()));
+    if (!pid) {
+      worker(i);
+      _Exit(0);
+    }
+  }
+  for (;;) {
+    e = errno;
+    if ((pid = waitpid(-1, &ws, 0)) != -1) {
+      if (WIFSIGNALED(ws)) {
+        kprintf("process %d terminated with %G\n", pid, WTERMSIG(ws));
+        testlib_incrementfailed();
+      } else if (WEXITSTATUS(ws)) {
+        kprintf("process %d exited with %d\n", pid, WEXITSTATUS(ws));
+        testlib_incrementfailed();
+      }
+    } else {
+      ASSERT_EQ(ECHILD, errno);
+      errno = e;
+      break;
+    }
+  }
+}
+
+void ReadWrite(int i) {
+  long x, y;
+  pthread_barrier_wait(&shm->barrier);
+  if (i < WRITERS) {
+    for (int j = 0; j < ITERATIONS; ++j) {
+      if (pthread_rwlock_wrlock(&shm->rwlock))
+        _Exit(1);
+      ++shm->x;
+      ++shm->y;
+      if (pthread_rwlock_unlock(&shm->rwlock))
+        _Exit(2);
+    }
+    --shm->writersleft;
+  } else {
+    while (shm->writersleft) {
+      if (pthread_rwlock_rdlock(&shm->rwlock))
+        _Exit(3);
+      x = shm->x;
+      y = shm->y;
+      if (pthread_rwlock_unlock(&shm->rwlock))
+        _Exit(4);
+      if (x != y)
+        _Exit(5);
+    }
+  }
+}
+
+TEST(pthread_rwlock_pshared, readersNeverSeeTornWrites) {
+  shm->writersleft = WRITERS;
+  Spawn(ReadWrite);
+  EXPECT_EQ(WRITERS * ITERATIONS, shm->x);
+  EXPECT_EQ(WRITERS * ITERATIONS, shm->y);
+}
+
+TEST(pthread_rwlock_pshared, trylock) {
+  ASSERT_EQ(0, pthread_rwlock_tryrdlock(&shm->rwlock));
+  ASSERT_EQ(0, pthread_rwlock_tryrdlock(&shm->rwlock));
+  ASSERT_EQ(EBUSY, pthread_rwlock_trywrlock(&shm->rwlock));
+  ASSERT_EQ(EBUSY, pthread_rwlock_destroy(&shm->rwlock));
+  ASSERT_EQ(0, pthread_rwlock_unlock(&shm->rwlock));
+  ASSERT_EQ(0, pthread_rwlock_unlock(&shm->rwlock));
+  ASSERT_EQ(0, pthread_rwlock_trywrlock(&shm->rwlock));
+  ASSERT_EQ(EBUSY, pthread_rwlock_tryrdlock(&shm->rwlock));
+  ASSERT_EQ(0, pthread_rwlock_unlock(&shm->rwlock));
+  ASSERT_EQ(EPERM, pthread_rwlock_unlock(&shm->rwlock));
+}
+
+void Rounds(int i) {
+  for (int j = 0; j < ROUNDS; ++j) {
+    if (pthread_barrier_wait(&shm->barrier) == PTHREAD_BARRIER_SERIAL_THREAD)
+      ++shm->x;
+    pthread_barrier_wait(&shm->barrier);
+    // nobody can be in the next round yet
+    if (shm->x != j + 1)
+      _Exit(6);
+  }
+}
+
+TEST(pthread_barrier_pshared, canBeReusedImmediately) {
+  Spawn(Rounds);
+  EXPECT_EQ(ROUNDS, shm->x);
+}
+
+void PingPong(int i) {
+  for (int j = 0; j < ROUNDS; ++j) {
+    pthread_mutex_lock(&shm->mutex);
+    while (shm->turn % PROCESSES != i)
+      pthread_cond_wait(&shm->cond, &shm->mutex);
+    ++shm->turn;
+    pthread_cond_broadcast(&shm->cond);
+    pthread_mutex_unlock(&shm->mutex);
+  }
+}
+
+TEST(pthread_cond_pshared, wakesWaitersInOtherProcesses) {
+  Spawn(PingPong);
+  EXPECT_EQ(PROCESSES * ROUNDS, shm->turn);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// BENCHMARKS
+
+void ReadMostly(int i) {
+  long x;
+  pthread_barrier_wait(&shm->barrier);
+  for (int j = 0; j < ITERATIONS; ++j) {
+    if (!i && !(j % 16)) {
+      pthread_rwlock_wrlock(&shm->rwlock);
+      ++shm->x;
+      pthread_rwlock_unlock(&shm->rwlock);
+    } else {
+      pthread_rwlock_rdlock(&shm->rwlock);
+      x = shm->x;
+      pthread_rwlock_unlock(&shm->rwlock);
+      (void)x;
+    }
+  }
+}
+
+void WriteOnly(int i) {
+  pthread_barrier_wait(&shm->barrier);
+  for (int j = 0; j < ITERATIONS; ++j) {
+    pthread_rwlock_wrlock(&shm->rwlock);
+    ++shm->x;
+    pthread_rwlock_unlock(&shm->rwlock);
+  }
+}
+
+TEST(pthread_rwlock_pshared, bench) {
+  BENCHMARK(1, PROCESSES * ITERATIONS, Spawn(ReadMostly));
+  BENCHMARK(1, PROCESSES * ITERATIONS, Spawn(WriteOnly));
+  BENCHMARK(1, PROCESSES * ROUNDS, Spawn(PingPong));
+}
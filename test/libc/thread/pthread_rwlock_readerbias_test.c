@@ -0,0 +1,216 @@
+/*-*- mode:c;indent-tabs-mode:nil;c-basic-offset:2;tab-width:8;coding:utf-8 -*-│
+│ vi: set et ft=c ts=2 sts=2 sw=2 fenc=utf-8                               :vi │
+╞══════════════════════════════════════════════════════════════════════════════╡
+│ Copyright 2024 Justine Alexandra Roberts Tunney                              │
+│                                                                              │
+│ Permission to use, copy, modify, and/or distribute this software for         │
+│ any purpose with or without fee is hereby granted, provided that the         │
+│ above copyright notice and this permission notice appear in all copies.      │
+│                                                                              │
+│ THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL                │
+│ WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED                │
+│ WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE             │
+│ AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL         │
+│ DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR        │
+│ PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER               │
+│ TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR             │
+│ PERFORMANCE OF THIS SOFTWARE.                                                │
+╚─────────────────────────────────────────────────────────────────────────────*/
+#include "libc/atomic.h"
+#include "libc/errno.h"
+#include "libc/intrin/atomic.h"
+#include "libc/mem/mem.h"
+#include "libc/stdalign.h"
+#include "libc/testlib/benchmark.h"
+#include "libc/testlib/testlib.h"
+#include "libc/thread/posixthread.internal.h"
+#include "libc/thread/thread.h"
+
+#define READERS    8
+#define WRITERS    2
+#define ITERATIONS 10000
+
+atomic_int writersleft;
+alignas(128) long foo;
+alignas(128) long bar;
+pthread_rwlock_t lock;
+pthread_barrier_t barrier;
+
+void SetUp(void) {
+  pthread_rwlockattr_t attr;
+  ASSERT_EQ(0, pthread_rwlockattr_init(&attr));
+  ASSERT_EQ(0, pthread_rwlockattr_setreaderbias_np(&attr, true));
+  ASSERT_EQ(0, pthread_rwlock_init(&lock, &attr));
+  ASSERT_EQ(0, pthread_rwlockattr_destroy(&attr));
+}
+
+void TearDown(void) {
+  ASSERT_EQ(0, pthread_rwlock_destroy(&lock));
+}
+
+TEST(pthread_rwlockattr_setreaderbias_np, keepsPshared) {
+  int x;
+  pthread_rwlockattr_t attr;
+  ASSERT_EQ(0, pthread_rwlockattr_init(&attr));
+  ASSERT_EQ(0, pthread_rwlockattr_setpshared(&attr, PTHREAD_PROCESS_SHARED));
+  ASSERT_EQ(0, pthread_rwlockattr_setreaderbias_np(&attr, true));
+  ASSERT_EQ(0, pthread_rwlockattr_getpshared(&attr, &x));
+  ASSERT_EQ(PTHREAD_PROCESS_SHARED, x);
+  ASSERT_EQ(0, pthread_rwlockattr_getreaderbias_np(&attr, &x));
+  ASSERT_TRUE(x);
+  ASSERT_EQ(0, pthread_rwlockattr_setpshared(&attr, PTHREAD_PROCESS_PRIVATE));
+  ASSERT_EQ(0, pthread_rwlockattr_getreaderbias_np(&attr, &x));
+  ASSERT_TRUE(x);
+  ASSERT_EQ(0, pthread_rwlockattr_destroy(&attr));
+}
+
+TEST(pthread_rwlock_readerbias, trywrlock_failsWhileBiasedReaderHoldsLock) {
+  // an uncontended read turns the bias on for subsequent reads
+  ASSERT_EQ(0, pthread_rwlock_rdlock(&lock));
+  ASSERT_EQ(0, pthread_rwlock_unlock(&lock));
+  ASSERT_EQ(0, pthread_rwlock_rdlock(&lock));
+  ASSERT_EQ(EBUSY, pthread_rwlock_trywrlock(&lock));
+  ASSERT_EQ(0, pthread_rwlock_unlock(&lock));
+  ASSERT_EQ(0, pthread_rwlock_trywrlock(&lock));
+  ASSERT_EQ(EBUSY, pthread_rwlock_tryrdlock(&lock));
+  ASSERT_EQ(0, pthread_rwlock_unlock(&lock));
+}
+
+TEST(pthread_rwlock_readerbias, manyReadLocksHeldAtOnce) {
+  int i;
+  pthread_rwlock_t locks[16];
+  pthread_rwlockattr_t attr;
+  ASSERT_EQ(0, pthread_rwlockattr_init(&attr));
+  ASSERT_EQ(0, pthread_rwlockattr_setreaderbias_np(&attr, true));
+  for (i = 0; i < 16; ++i) {
+    ASSERT_EQ(0, pthread_rwlock_init(locks + i, &attr));
+    ASSERT_EQ(0, pthread_rwlock_rdlock(locks + i));
+    ASSERT_EQ(0, pthread_rwlock_unlock(locks + i));
+  }
+  for (i = 0; i < 16; ++i)
+    ASSERT_EQ(0, pthread_rwlock_rdlock(locks + i));
+  for (i = 0; i < 16; ++i)
+    ASSERT_EQ(EBUSY, pthread_rwlock_trywrlock(locks + i));
+  for (i = 16; i--;)
+    ASSERT_EQ(0, pthread_rwlock_unlock(locks + i));
+  for (i = 0; i < 16; ++i) {
+    ASSERT_EQ(0, pthread_rwlock_wrlock(locks + i));
+    ASSERT_EQ(0, pthread_rwlock_unlock(locks + i));
+    ASSERT_EQ(0, pthread_rwlock_destroy(locks + i));
+  }
+  ASSERT_EQ(0, pthread_rwlockattr_destroy(&attr));
+}
+
+TEST(pthread_rwlock_readerbias, collidingLocksHeldAtOnce) {
+  int i, n = 65536;
+  pthread_rwlock_t *locks, *a, *b;
+  pthread_rwlockattr_t attr;
+  // find two locks whose readers share a slot in this thread
+  ASSERT_NE(NULL, (locks = calloc(n, sizeof(*locks))));
+  a = locks;
+  for (b = 0, i = 1; i < n && !b; ++i)
+    if (_pthread_rwlock_bravo_slot(locks + i) == _pthread_rwlock_bravo_slot(a))
+      b = locks + i;
+  ASSERT_NE(NULL, b);
+  ASSERT_EQ(0, pthread_rwlockattr_init(&attr));
+  ASSERT_EQ(0, pthread_rwlockattr_setreaderbias_np(&attr, true));
+  ASSERT_EQ(0, pthread_rwlock_init(a, &attr));
+  ASSERT_EQ(0, pthread_rwlock_init(b, &attr));
+  ASSERT_EQ(0, pthread_rwlockattr_destroy(&attr));
+  ASSERT_EQ(0, pthread_rwlock_rdlock(a));
+  ASSERT_EQ(0, pthread_rwlock_unlock(a));
+  ASSERT_EQ(0, pthread_rwlock_rdlock(b));
+  ASSERT_EQ(0, pthread_rwlock_unlock(b));
+  // a claims the slot, so b has to take its read lock the slow way
+  ASSERT_EQ(0, pthread_rwlock_rdlock(a));
+  ASSERT_EQ(0, pthread_rwlock_rdlock(b));
+  ASSERT_EQ(0, pthread_rwlock_unlock(b));
+  // releasing b mustn't have released a, or leaked a reader on b
+  ASSERT_EQ(EBUSY, pthread_rwlock_trywrlock(a));
+  ASSERT_EQ(0, pthread_rwlock_trywrlock(b));
+  ASSERT_EQ(0, pthread_rwlock_unlock(b));
+  ASSERT_EQ(0, pthread_rwlock_unlock(a));
+  ASSERT_EQ(0, pthread_rwlock_trywrlock(a));
+  ASSERT_EQ(0, pthread_rwlock_unlock(a));
+  ASSERT_EQ(0, pthread_rwlock_destroy(b));
+  ASSERT_EQ(0, pthread_rwlock_destroy(a));
+  free(locks);
+}
+
+void *Reader(void *arg) {
+  long x, y;
+  pthread_barrier_wait(&barrier);
+  while (atomic_load_explicit(&writersleft, memory_order_relaxed)) {
+    ASSERT_EQ(0, pthread_rwlock_rdlock(&lock));
+    x = foo;
+    y = bar;
+    ASSERT_EQ(0, pthread_rwlock_unlock(&lock));
+    ASSERT_EQ(x, y);
+  }
+  return 0;
+}
+
+void *Writer(void *arg) {
+  pthread_barrier_wait(&barrier);
+  for (int i = 0; i < ITERATIONS; ++i) {
+    ASSERT_EQ(0, pthread_rwlock_wrlock(&lock));
+    ++foo;
+    ++bar;
+    ASSERT_EQ(0, pthread_rwlock_unlock(&lock));
+  }
+  --writersleft;
+  return 0;
+}
+
+TEST(pthread_rwlock_readerbias, readersNeverSeeTornWrites) {
+  int i;
+  pthread_t t[READERS + WRITERS];
+  foo = bar = 0;
+  writersleft = WRITERS;
+  ASSERT_EQ(0, pthread_barrier_init(&barrier, 0, READERS + WRITERS));
+  for (i = 0; i < READERS + WRITERS; ++i)
+    ASSERT_EQ(0, pthread_create(t + i, 0, i < READERS ? Reader : Writer, 0));
+  for (i = 0; i < READERS + WRITERS; ++i)
+    EXPECT_EQ(0, pthread_join(t[i], 0));
+  EXPECT_EQ(WRITERS * ITERATIONS, foo);
+  EXPECT_EQ(WRITERS * ITERATIONS, bar);
+  ASSERT_EQ(0, pthread_barrier_destroy(&barrier));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// BENCHMARKS
+
+pthread_rwlock_t *benchlock;
+
+void *ReadMostly(void *arg) {
+  pthread_barrier_wait(&barrier);
+  for (int i = 0; i < ITERATIONS; ++i) {
+    if (!arg || i % 1024) {
+      pthread_rwlock_rdlock(benchlock);
+      pthread_rwlock_unlock(benchlock);
+    } else {
+      pthread_rwlock_wrlock(benchlock);
+      pthread_rwlock_unlock(benchlock);
+    }
+  }
+  return 0;
+}
+
+void ReadContended(pthread_rwlock_t *rwlock) {
+  int i;
+  pthread_t t[READERS];
+  benchlock = rwlock;
+  ASSERT_EQ(0, pthread_barrier_init(&barrier, 0, READERS));
+  for (i = 0; i < READERS; ++i)
+    ASSERT_EQ(0, pthread_create(t + i, 0, ReadMostly, (void *)(intptr_t)!i));
+  for (i = 0; i < READERS; ++i)
+    ASSERT_EQ(0, pthread_join(t[i], 0));
+  ASSERT_EQ(0, pthread_barrier_destroy(&barrier));
+}
+
+TEST(pthread_rwlock_readerbias, bench) {
+  pthread_rwlock_t plain = PTHREAD_RWLOCK_INITIALIZER;
+  BENCHMARK(10, READERS * ITERATIONS, ReadContended(&plain));
+  BENCHMARK(10, READERS * ITERATIONS, ReadContended(&lock));
+  ASSERT_EQ(0, pthread_rwlock_destroy(&plain));
+}
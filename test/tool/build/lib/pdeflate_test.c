@@ -0,0 +1,94 @@
+/*-*- mode:c;indent-tabs-mode:nil;c-basic-offset:2;tab-width:8;coding:utf-8 -*-│
+│ vi: set et ft=c ts=2 sts=2 sw=2 fenc=utf-8                               :vi │
+╞══════════════════════════════════════════════════════════════════════════════╡
+│ Copyright 2024 Justine Alexandra Roberts Tunney                              │
+│                                                                              │
+│ Permission to use, copy, modify, and/or distribute this software for         │
+│ any purpose with or without fee is hereby granted, provided that the         │
+│ above copyright notice and this permission notice appear in all copies.      │
+│                                                                              │
+│ THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL                │
+│ WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED                │
+│ WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE             │
+│ AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL         │
+│ DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR        │
+│ PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER               │
+│ TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR             │
+│ PERFORMANCE OF THIS SOFTWARE.                                                │
+╚─────────────────────────────────────────────────────────────────────────────*/
+#include "tool/build/lib/pdeflate.h"
+#include "libc/macros.h"
+#include "libc/mem/gc.h"
+#include "libc/mem/mem.h"
+#include "libc/stdio/rand.h"
+#include "libc/str/str.h"
+#include "libc/testlib/hyperion.h"
+#include "libc/testlib/testlib.h"
+#include "third_party/zlib/zlib.h"
+
+// makes input that's half prose, which has matches reaching back across
+// block boundaries, and half noise, which deflate has to store
+static char *MakeInput(size_t size) {
+  size_t i, n;
+  char *p = malloc(size + 1);
+  for (i = 0; i < size; i += n) {
+    n = MIN(size - i, kHyperionSize);
+    if ((i / kHyperionSize) & 1) {
+      memcpy(p + i, kHyperion, n);
+    } else {
+      rngset(p + i, n, lemur64, 0);
+    }
+  }
+  return p;
+}
+
+// inflates raw deflate stream, checking it decodes to exactly `want`
+static void CheckRoundTrip(const char *want, size_t size, int threads) {
+  z_stream zs;
+  size_t zsize;
+  char *z, *got;
+  z = gc(pdeflate(want, size, 6, threads, &zsize));
+  got = gc(malloc(size + 1));
+  bzero(&zs, sizeof(zs));
+  ASSERT_EQ(Z_OK, inflateInit2(&zs, -MAX_WBITS));
+  zs.next_in = (unsigned char *)z;
+  zs.avail_in = zsize;
+  zs.next_out = (unsigned char *)got;
+  zs.avail_out = size + 1;
+  EXPECT_EQ(Z_STREAM_END, inflate(&zs, Z_FINISH));
+  EXPECT_EQ(0, zs.avail_in);
+  EXPECT_EQ(size, zs.total_out);
+  EXPECT_EQ(0, memcmp(want, got, size));
+  inflateEnd(&zs);
+}
+
+TEST(pdeflate, empty) {
+  CheckRoundTrip("", 0, 4);
+}
+
+TEST(pdeflate, belowParallelThreshold) {
+  CheckRoundTrip(kHyperion, kHyperionSize, 4);
+}
+
+TEST(pdeflate, blockAligned) {
+  size_t size = PDEFLATE_BLOCK * 5;
+  char *p = gc(MakeInput(size));
+  CheckRoundTrip(p, size, 4);
+}
+
+TEST(pdeflate, notBlockAligned) {
+  size_t size = PDEFLATE_BLOCK * 4 + 12345;
+  char *p = gc(MakeInput(size));
+  CheckRoundTrip(p, size, 1);
+  CheckRoundTrip(p, size, 3);
+}
+
+TEST(pdeflate, outputDoesntDependOnThreadCount) {
+  char *a, *b;
+  size_t an, bn, size = PDEFLATE_BLOCK * 6 + 1;
+  char *p = gc(MakeInput(size));
+  a = gc(pdeflate(p, size, 6, 1, &an));
+  b = gc(pdeflate(p, size, 6, 8, &bn));
+  ASSERT_EQ(an, bn);
+  EXPECT_EQ(0, memcmp(a, b, an));
+}
@@ -45,9 +45,11 @@ TEST_TOOL_NET_DIRECTDEPS =					\
 	LIBC_THREAD						\
 	LIBC_THREAD						\
 	LIBC_X							\
+	NET_HTTPS						\
 	THIRD_PARTY_MBEDTLS					\
 	THIRD_PARTY_REGEX					\
-	THIRD_PARTY_SQLITE3
+	THIRD_PARTY_SQLITE3					\
+	THIRD_PARTY_ZLIB
 
 TEST_TOOL_NET_DEPS :=						\
 	$(call uniq,$(foreach x,$(TEST_TOOL_NET_DIRECTDEPS),$($(x))))
@@ -21,6 +21,18 @@ assert(0200 == 128)
 assert("\e" == "\x1b")
 assert("hi" * 3 == "hihihi")
 assert("hello %d" % {123} == "hello 123")
+assert("%5d|%-5d|%05d" % {-42, 42, -42} == "  -42|42   |-0042")
+assert("%x %X %08x" % {255, 255, -1} == "ff FF ffffffffffffffff")
+assert("%u" % {-1} == "18446744073709551615")
+assert("<%3s|%-3s|%s>" % {"a", "b", 7} == "<  a|b  |7>")
+assert("%d %s" % {3.0, 1.5} == "3 1.5")
+assert("%.3f%%" % {1/3} == "0.333%")
+assert(not pcall(string.format, "%d", 1.5))
+assert(not pcall(string.format, "%100d", 1))
+assert(not pcall(string.format, "%-5s", "a\0b"))
+debug.setmetatable(0, {__tostring=function(x) return "<"..x..">" end})
+assert(("%s|%s|%d" % {1, 2, 3}):rep(9) == ("<1>|<2>|3"):rep(9))
+debug.setmetatable(0, nil)
 
 -- test ProgramContentType
 assert(ProgramContentType("txt") == "text/plain")
@@ -30,3 +42,21 @@ assert(ProgramContentType("1") == nil)
 ProgramContentType("1", "text/x-foo")
 assert(ProgramContentType("1"), "text/x-foo")
 assert(ProgramContentType("file.1"), "text/x-foo")
+
+--------------------------------------------------------------------------------
+-- benchmarks of templated html output; call bench() to run them
+
+function TemplateRow()
+   return ('<tr><td class="id">%d</td><td>%s</td><td>%s</td>' ..
+           '<td align="right">%8d</td></tr>\n') %
+      {123, "Alice", "alice@example.com", 45678}
+end
+
+function TemplateFloat()
+   return "<td>%.2f</td>" % {3.14159}
+end
+
+function bench()
+   print("TemplateRow", Benchmark(TemplateRow))
+   print("TemplateFloat", Benchmark(TemplateFloat))
+end
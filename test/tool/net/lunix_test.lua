@@ -146,6 +146,66 @@ function UnixTest()
    table.sort(t)
    assert(EncodeLua(t) == '{".", "..", "foo"}');
 
+   -- vectored and positional i/o
+   fd = assert(unix.open("%s/foo" % {tmpdir}, unix.O_RDWR | unix.O_TRUNC))
+   assert(unix.writev(fd, {"hello", " ", "world"}) == 11)
+   assert(unix.writev(fd, {"W", "ORLD"}, 6) == 5)
+   a, b, c = assert(unix.readv(fd, {2, 4, 100}, 1))
+   assert(a == "el" and b == "lo W" and c == "ORLD")
+   a, b = assert(unix.readv(fd, {4, 4}))
+   assert(a == "" and b == "")
+   assert(not pcall(unix.writev, fd, {"x", 1}))
+
+   -- in-kernel copies
+   out = assert(unix.open("%s/bar" % {tmpdir}, unix.O_RDWR | unix.O_CREAT | unix.O_TRUNC, 0600))
+   assert(not pcall(unix.sendfile, out, fd, -1))
+   assert(not pcall(unix.splice, fd, out, -1))
+   assert(not pcall(unix.copy_file_range, fd, out, -1))
+   ok, err = unix.copy_file_range(fd, out, 5, 0, 0)
+   if ok then
+      assert(ok == 5)
+      assert(unix.read(out, 20, 0) == "hello")
+   else
+      assert(err:errno() == unix.ENOSYS)
+   end
+   if GetHostOs() == "LINUX" then
+      -- other systems only sendfile() to sockets
+      assert(unix.ftruncate(out, 0))
+      assert(unix.sendfile(out, fd, 5, 6) == 5)
+      assert(unix.read(out, 10, 0) == "WORLD")
+      reader, writer = assert(unix.pipe())
+      assert(unix.splice(fd, writer, 5, 0, 0) == 5)
+      assert(unix.read(reader, 5) == "hello")
+      assert(unix.close(reader))
+      assert(unix.close(writer))
+   end
+   assert(unix.close(out))
+   assert(unix.close(fd))
+   assert(unix.unlink("%s/bar" % {tmpdir}))
+
+   -- epoll
+   if GetHostOs() == "LINUX" then
+      ep = assert(unix.epoll_create(unix.EPOLL_CLOEXEC))
+      reader, writer = assert(unix.pipe())
+      assert(unix.epoll_ctl(ep, unix.EPOLL_CTL_ADD, reader, unix.EPOLLIN))
+      assert(unix.epoll_ctl(ep, unix.EPOLL_CTL_ADD, writer, unix.EPOLLOUT))
+      evs = assert(unix.epoll_wait(ep, 0))
+      assert(evs[reader] == nil)
+      assert(evs[writer] == unix.EPOLLOUT)
+      assert(unix.write(writer, "x"))
+      assert(unix.epoll_ctl(ep, unix.EPOLL_CTL_DEL, writer))
+      evs = assert(unix.epoll_wait(ep, 1000, 1))
+      assert(evs[reader] == unix.EPOLLIN)
+      ok, err = unix.epoll_ctl(ep, unix.EPOLL_CTL_MOD, writer, unix.EPOLLIN)
+      assert(not ok and err:errno() == unix.ENOENT)
+      assert(unix.close(reader))
+      assert(unix.close(writer))
+      assert(unix.close(ep))
+   else
+      ok, err = unix.epoll_create()
+      assert(not ok and err:errno() == unix.ENOSYS)
+   end
+
 end
 
 function main()
@@ -18,12 +18,14 @@
 ╚─────────────────────────────────────────────────────────────────────────────*/
 #include "libc/calls/calls.h"
 #include "libc/calls/struct/sigset.h"
+#include "libc/calls/struct/stat.h"
 #include "libc/dce.h"
 #include "libc/fmt/conv.h"
 #include "libc/mem/gc.h"
 #include "libc/runtime/runtime.h"
 #include "libc/sock/goodsocket.internal.h"
 #include "libc/sock/sock.h"
+#include "libc/sock/struct/pollfd.h"
 #include "libc/sock/struct/sockaddr.h"
 #include "libc/stdio/stdio.h"
 #include "libc/str/str.h"
@@ -32,12 +34,19 @@
 #include "libc/sysv/consts/inaddr.h"
 #include "libc/sysv/consts/ipproto.h"
 #include "libc/sysv/consts/o.h"
+#include "libc/sysv/consts/poll.h"
 #include "libc/sysv/consts/shut.h"
 #include "libc/sysv/consts/sig.h"
 #include "libc/sysv/consts/sock.h"
 #include "libc/sysv/consts/tcp.h"
+#include "libc/testlib/benchmark.h"
 #include "libc/testlib/testlib.h"
 #include "libc/x/x.h"
+#include "libc/x/xasprintf.h"
+#include "libc/zip.h"
+#include "net/https/https.h"
+#include "third_party/mbedtls/ctr_drbg.h"
+#include "third_party/mbedtls/ssl.h"
 #include "third_party/regex/regex.h"
 
 __static_yoink("zipos");
@@ -45,17 +54,12 @@ __static_yoink("o/" MODE "/test/tool/net/redbean-tester");
 
 int port;
 
-void SetUpOnce(void) {
+void CopyFile(const char *from, const char *to) {
   ssize_t n;
   char buf[1024];
   int fdin, fdout;
-  if (IsWindows())
-    return;
-  testlib_enable_tmp_setup_teardown_once();
-  ASSERT_NE(-1, mkdir("bin", 0755));
-  ASSERT_NE(-1, (fdin = open("/zip/o/" MODE "/test/tool/net/redbean-tester",
-                             O_RDONLY)));
-  ASSERT_NE(-1, (fdout = creat("bin/redbean-tester", 0755)));
+  ASSERT_NE(-1, (fdin = open(from, O_RDONLY)));
+  ASSERT_NE(-1, (fdout = creat(to, 0755)));
   for (;;) {
     ASSERT_NE(-1, (n = read(fdin, buf, sizeof(buf))));
     if (!n)
@@ -66,6 +70,15 @@ void SetUpOnce(void) {
   close(fdin);
 }
 
+void SetUpOnce(void) {
+  if (IsWindows())
+    return;
+  testlib_enable_tmp_setup_teardown_once();
+  ASSERT_NE(-1, mkdir("bin", 0755));
+  CopyFile("/zip/o/" MODE "/test/tool/net/redbean-tester",
+           "bin/redbean-tester");
+}
+
 int Socket(void) {
   return GoodSocket(AF_INET, SOCK_STREAM, IPPROTO_TCP, false, 0);
 }
@@ -103,6 +116,41 @@ bool Matches(const char *regex, const char *str) {
   return r;
 }
 
+sigset_t savemask;
+
+// launches redbean-tester with `args` and sets `port` to where it's at
+int StartRedbean(char *const args[]) {
+  int pid, pipefds[2];
+  char portbuf[16] = {0};
+  sigset_t chldmask;
+  sigemptyset(&chldmask);
+  sigaddset(&chldmask, SIGCHLD);
+  EXPECT_NE(-1, sigprocmask(SIG_BLOCK, &chldmask, &savemask));
+  EXPECT_NE(-1, pipe(pipefds));
+  EXPECT_NE(-1, (pid = fork()));
+  if (!pid) {
+    setpgrp();
+    close(0);
+    open("/dev/null", O_RDWR);
+    close(pipefds[0]);
+    dup2(pipefds[1], 1);
+    sigprocmask(SIG_SETMASK, &savemask, NULL);
+    execv(args[0], args);
+    _exit(127);
+  }
+  EXPECT_NE(-1, close(pipefds[1]));
+  EXPECT_NE(-1, read(pipefds[0], portbuf, sizeof(portbuf) - 1));
+  EXPECT_NE(-1, close(pipefds[0]));
+  port = atoi(portbuf);
+  return pid;
+}
+
+void StopRedbean(int pid) {
+  EXPECT_NE(-1, kill(pid, SIGTERM));
+  EXPECT_NE(-1, wait(0));
+  EXPECT_NE(-1, sigprocmask(SIG_SETMASK, &savemask, 0));
+}
+
 TEST(redbean, testOptions) {
   if (IsWindows())
     return;
@@ -291,3 +339,342 @@ Z\n",
   EXPECT_NE(-1, wait(0));
   EXPECT_NE(-1, sigprocmask(SIG_SETMASK, &savemask, 0));
 }
+
+void RunRedbean(void) {
+  int ws;
+  if (!vfork()) {
+    execv("bin/redbean-tester",
+          (char *const[]){"bin/redbean-tester", "-i", "-e", "", 0});
+    _Exit(127);
+  }
+  ASSERT_NE(-1, wait(&ws));
+  ASSERT_EQ(0, ws);
+}
+
+BENCH(redbean, startup) {
+  if (IsWindows())
+    return;
+  BENCHMARK(32, 1, RunRedbean());
+}
+
+int TlsSend(void *ctx, const unsigned char *p, size_t n) {
+  return write(*(int *)ctx, p, n);
+}
+
+int TlsRecv(void *ctx, unsigned char *p, size_t n) {
+  return read(*(int *)ctx, p, n);
+}
+
+// does https request, resuming `session` if it has an id, and then
+// replaces it with the session the server ended up giving us
+void HttpsRequest(mbedtls_ssl_config *conf, mbedtls_ssl_session *session) {
+  int fd;
+  unsigned char buf[512];
+  mbedtls_ssl_context ssl;
+  const char *req = "GET / HTTP/1.0\r\n\r\n";
+  struct sockaddr_in addr = {AF_INET, htons(port), {htonl(INADDR_LOOPBACK)}};
+  ASSERT_NE(-1, (fd = Socket()));
+  ASSERT_NE(-1, connect(fd, (struct sockaddr *)&addr, sizeof(addr)));
+  mbedtls_ssl_init(&ssl);
+  ASSERT_EQ(0, mbedtls_ssl_setup(&ssl, conf));
+  mbedtls_ssl_set_bio(&ssl, &fd, TlsSend, TlsRecv, 0);
+  if (session->id_len)
+    ASSERT_EQ(0, mbedtls_ssl_set_session(&ssl, session));
+  ASSERT_EQ(0, mbedtls_ssl_handshake(&ssl));
+  // the worker caches the session before it serves our request, so
+  // reading the whole response ensures the next connection can see it
+  ASSERT_EQ(strlen(req), mbedtls_ssl_write(&ssl, (void *)req, strlen(req)));
+  while (mbedtls_ssl_read(&ssl, buf, sizeof(buf)) > 0) {
+  }
+  mbedtls_ssl_session_free(session);
+  mbedtls_ssl_session_init(session);
+  ASSERT_EQ(0, mbedtls_ssl_get_session(&ssl, session));
+  mbedtls_ssl_free(&ssl);
+  close(fd);
+}
+
+TEST(redbean, tlsSessionCache_resumesSessionIdInAnotherWorker) {
+  if (IsWindows())
+    return;
+  int pid;
+  unsigned char id[32];
+  mbedtls_ssl_config conf;
+  mbedtls_ssl_session session;
+  mbedtls_ctr_drbg_context rng;
+  pid = StartRedbean((char *[]){"bin/redbean-tester", "-vvszp0",
+                                "-l127.0.0.1", 0});
+  InitializeRng(&rng);
+  mbedtls_ssl_config_init(&conf);
+  ASSERT_EQ(0, mbedtls_ssl_config_defaults(&conf, MBEDTLS_SSL_IS_CLIENT,
+                                           MBEDTLS_SSL_TRANSPORT_STREAM,
+                                           MBEDTLS_SSL_PRESET_DEFAULT));
+  mbedtls_ssl_conf_rng(&conf, mbedtls_ctr_drbg_random, &rng);
+  mbedtls_ssl_conf_authmode(&conf, MBEDTLS_SSL_VERIFY_NONE);
+  mbedtls_ssl_conf_session_tickets(&conf,
+                                   MBEDTLS_SSL_SESSION_TICKETS_DISABLED);
+  mbedtls_ssl_session_init(&session);
+  HttpsRequest(&conf, &session);
+  ASSERT_EQ(32, session.id_len);
+  memcpy(id, session.id, 32);
+  // each connection is served by a fresh fork, so the server can only
+  // echo the same id back if the session came from the shared cache
+  HttpsRequest(&conf, &session);
+  ASSERT_EQ(32, session.id_len);
+  EXPECT_EQ(0, memcmp(id, session.id, 32));
+  EXPECT_TRUE(Matches("sslcachehits: 1\r\n",
+                      gc(SendHttpRequest("GET /statusz HTTP/1.0\r\n\r\n"))));
+  mbedtls_ssl_session_free(&session);
+  mbedtls_ssl_config_free(&conf);
+  mbedtls_ctr_drbg_free(&rng);
+  StopRedbean(pid);
+}
+
+// runs copy of redbean that may modify itself and returns wait status
+int RunZipper(char *const args[]) {
+  int ws, pid;
+  if (!(pid = fork())) {
+    execv("bin/zipper", args);
+    _Exit(127);
+  }
+  EXPECT_NE(-1, waitpid(pid, &ws, 0));
+  return ws;
+}
+
+bool HasZip64Eocd(const char *path) {
+  bool r;
+  char *p;
+  size_t n;
+  uint8_t *eocd;
+  if (!(p = xslurp(path, &n)))
+    return false;
+  r = (eocd = GetZipEocd(p, n, 0)) && ZIP_READ32(eocd) == kZipCdir64HdrMagic;
+  free(p);
+  return r;
+}
+
+TEST(redbean, storeAssets_compactsZip64AndReopens) {
+  if (IsWindows())
+    return;
+  char big[4096];
+  int64_t size1, size2;
+  struct stat st;
+  CopyFile("bin/redbean-tester", "bin/zipper");
+  ASSERT_NE(-1, mkdir("assets", 0755));
+  memset(big, 'x', sizeof(big));
+  ASSERT_NE(-1, xbarf("assets/hello.txt", "hello", 5));
+  ASSERT_NE(-1, xbarf("assets/big.txt", big, sizeof(big)));
+  // more than 0xffff records means the eocd has to be zip64
+  ASSERT_EQ(0, RunZipper((char *[]){
+                   "bin/zipper", "-ss", "-A", "assets", "-e",
+                   "local t = {}\n"
+                   "for i = 1, 70000 do t[i] = {'/many/' .. i, ''..i} end\n"
+                   "StoreAssets(t)\n",
+                   0}));
+  ASSERT_NE(-1, stat("bin/zipper", &st));
+  size1 = st.st_size;
+  EXPECT_TRUE(HasZip64Eocd("bin/zipper"));
+  // storing the directory again supersedes its files and the big
+  // central directory, which compaction should then get rid of
+  ASSERT_EQ(0, RunZipper((char *[]){"bin/zipper", "-ss", "-A", "assets",
+                                    "-e", "assert(CompactAssets() > 0)", 0}));
+  ASSERT_NE(-1, stat("bin/zipper", &st));
+  size2 = st.st_size;
+  EXPECT_LT(size2, size1);
+  EXPECT_TRUE(HasZip64Eocd("bin/zipper"));
+  // the rewritten executable should still start and index everything
+  EXPECT_EQ(0, RunZipper((char *[]){
+                   "bin/zipper", "-i", "-e",
+                   "assert(LoadAsset('/assets/hello.txt') == 'hello')\n"
+                   "assert(LoadAsset('/assets/big.txt') == ('x'):rep(4096))\n"
+                   "assert(LoadAsset('/many/1') == '1')\n"
+                   "assert(LoadAsset('/many/70000') == '70000')\n"
+                   "assert(#GetZipPaths('/many/') == 70000)\n",
+                   0}));
+  EXPECT_NE(-1, unlink("bin/zipper"));
+}
+
+TEST(redbean, compactAssets_reclaimsFilesBelowLowestLiveOne) {
+  if (IsWindows())
+    return;
+  struct stat st;
+  int64_t size1, size2;
+  CopyFile("bin/redbean-tester", "bin/zipper");
+  ASSERT_NE(-1, mkdir("empty", 0755));
+  // storing every file again leaves nothing but garbage below the
+  // lowest live local file, so no leftover follows a live one
+  ASSERT_EQ(0, RunZipper((char *[]){
+                   "bin/zipper", "-ss", "-A", "empty", "-e",
+                   "local t = {}\n"
+                   "for _, p in ipairs(GetZipPaths()) do\n"
+                   "  if not p:find('/$') then\n"
+                   "    t[#t + 1] = {p, LoadAsset(p), GetAssetMode(p)}\n"
+                   "  end\n"
+                   "end\n"
+                   "StoreAssets(t)\n",
+                   0}));
+  ASSERT_NE(-1, stat("bin/zipper", &st));
+  size1 = st.st_size;
+  ASSERT_EQ(0, RunZipper((char *[]){"bin/zipper", "-ss", "-A", "empty", "-e",
+                                    "assert(CompactAssets() > 0)", 0}));
+  ASSERT_NE(-1, stat("bin/zipper", &st));
+  size2 = st.st_size;
+  EXPECT_LT(size2, size1);
+  EXPECT_EQ(0, RunZipper((char *[]){"bin/zipper", "-i", "-e",
+                                    "assert(LoadAsset('/seekable.txt'))", 0}));
+  EXPECT_NE(-1, unlink("bin/zipper"));
+}
+
+// runs bin/zipper with stderr going to `log` and returns wait status
+int RunZipperLogged(char *const args[], const char *log) {
+  int ws, pid;
+  if (!(pid = fork())) {
+    close(2);
+    open(log, O_CREAT | O_TRUNC | O_WRONLY | O_APPEND, 0644);
+    execv("bin/zipper", args);
+    _Exit(127);
+  }
+  EXPECT_NE(-1, waitpid(pid, &ws, 0));
+  return ws;
+}
+
+TEST(redbean, storeAsset_onlyIndexesAppendedRecords) {
+  if (IsWindows())
+    return;
+  char *log, *p;
+  int reindexes;
+  CopyFile("bin/redbean-tester", "bin/zipper");
+  ASSERT_NE(-1, mkdir("empty", 0755));
+  ASSERT_EQ(0, RunZipperLogged(
+                   (char *[]){"bin/zipper", "-vv", "-A", "empty", "-e",
+                              "StoreAsset('/a.txt', 'a')\n"
+                              "StoreAsset('/b.txt', 'b')\n"
+                              "StoreAsset('/a.txt', 'A')\n"
+                              "assert(LoadAsset('/a.txt') == 'A')\n"
+                              "assert(LoadAsset('/b.txt') == 'b')\n"
+                              "assert(LoadAsset('/seekable.txt'))\n",
+                              0},
+                   "log"));
+  // each store appended one record, which is all that got indexed
+  if (!IsTiny()) {
+    ASSERT_NE(NULL, (log = gc(xslurp("log", 0))));
+    ASSERT_NE(NULL, (p = strstr(log, "(zip) reindexing 1 new assets")));
+    EXPECT_EQ(NULL, strstr(p, "(zip) indexing assets"));
+    for (reindexes = 0; p; p = strstr(p + 1, "(zip) reindexing 1 new assets"))
+      ++reindexes;
+    EXPECT_EQ(3, reindexes);
+  }
+  // and indexing the whole thing from scratch agrees
+  EXPECT_EQ(0, RunZipper((char *[]){
+                   "bin/zipper", "-i", "-e",
+                   "assert(LoadAsset('/a.txt') == 'A')\n"
+                   "assert(LoadAsset('/b.txt') == 'b')\n"
+                   "assert(LoadAsset('/seekable.txt'))\n"
+                   "assert(#GetZipPaths('/a.txt') == 1)\n",
+                   0}));
+  EXPECT_NE(-1, unlink("bin/zipper"));
+}
+
+TEST(redbean, luaChunkName_isZipPath) {
+  if (IsWindows())
+    return;
+  int pid;
+  CopyFile("bin/redbean-tester", "bin/zipper");
+  ASSERT_NE(-1, mkdir("lua", 0755));
+  ASSERT_NE(-1, xbarf("lua/name.lua", "Write(debug.getinfo(1, 'S').source)",
+                      -1));
+  ASSERT_EQ(0, RunZipper((char *[]){"bin/zipper", "-ss", "-A", "lua", 0}));
+  // the server precompiles the page, and the worker loads its bytecode
+  pid = StartRedbean((char *[]){"bin/zipper", "-vvszp0", "-l127.0.0.1", 0});
+  EXPECT_TRUE(Matches("\r\n\r\n@/zip/lua/name\\.lua$",
+                      gc(SendHttpRequest("GET /lua/name.lua HTTP/1.0\r\n"
+                                         "\r\n"))));
+  StopRedbean(pid);
+  EXPECT_NE(-1, unlink("bin/zipper"));
+}
+
+// listens on loopback and sets `port` to where it's at
+int Listen(void) {
+  int fd;
+  uint32_t len;
+  struct sockaddr_in addr = {AF_INET, 0, {htonl(INADDR_LOOPBACK)}};
+  len = sizeof(addr);
+  EXPECT_NE(-1, (fd = Socket()));
+  EXPECT_NE(-1, bind(fd, (struct sockaddr *)&addr, sizeof(addr)));
+  EXPECT_NE(-1, listen(fd, 10));
+  EXPECT_NE(-1, getsockname(fd, (struct sockaddr *)&addr, &len));
+  port = ntohs(addr.sin_port);
+  return fd;
+}
+
+// accepts connection, or returns -1 if none arrives within `ms`
+int AcceptWithin(int server, int ms) {
+  struct pollfd pfd = {server, POLLIN};
+  if (poll(&pfd, 1, ms) != 1)
+    return -1;
+  return accept(server, 0, 0);
+}
+
+// reads an http request, returning false if the client hung up first
+bool ReadRequest(int fd) {
+  ssize_t rc;
+  size_t n = 0;
+  char buf[1024], *p, *q;
+  for (;;) {
+    if ((rc = read(fd, buf + n, sizeof(buf) - 1 - n)) <= 0)
+      return false;
+    buf[n += rc] = 0;
+    if ((p = strstr(buf, "\r\n\r\n")) &&
+        buf + n - (p + 4) >= ((q = strstr(buf, "Content-Length: "))
+                                  ? atoi(q + strlen("Content-Length: "))
+                                  : 0))
+      return true;
+  }
+}
+
+// has redbean fetch from us twice over a pooled connection, hangs up
+// after reading the second request, and returns if it tried it again
+bool FetchFromFlakyServer(const char *method, const char *want) {
+  char *code;
+  bool retried;
+  int ws, pid, server, client;
+  const char *ok = "HTTP/1.1 200 OK\r\nContent-Length: 0\r\n\r\n";
+  server = Listen();
+  code = gc(xasprintf("ProgramFetchPool(1)\n"
+                      "local url = 'http://127.0.0.1:%d/'\n"
+                      "assert(Fetch(url) == 200)\n"
+                      "assert(Fetch(url, {method = '%s'}) == %s)\n",
+                      port, method, want));
+  ASSERT_NE(-1, (pid = fork()));
+  if (!pid) {
+    execv("bin/redbean-tester",
+          (char *const[]){"bin/redbean-tester", "-ss", "-i", "-e", code, 0});
+    _Exit(127);
+  }
+  ASSERT_NE(-1, (client = AcceptWithin(server, 10000)));
+  ASSERT_TRUE(ReadRequest(client));
+  ASSERT_EQ(strlen(ok), write(client, ok, strlen(ok)));
+  ASSERT_TRUE(ReadRequest(client));
+  ASSERT_SYS(0, 0, close(client));
+  if ((retried = (client = AcceptWithin(server, 1000)) != -1)) {
+    ASSERT_TRUE(ReadRequest(client));
+    ASSERT_EQ(strlen(ok), write(client, ok, strlen(ok)));
+    ASSERT_SYS(0, 0, close(client));
+  }
+  ASSERT_NE(-1, waitpid(pid, &ws, 0));
+  ASSERT_EQ(0, ws);
+  ASSERT_SYS(0, 0, close(server));
+  return retried;
+}
+
+TEST(redbean, fetchPool_retriesIdempotentRequestOnStaleConnection) {
+  if (IsWindows())
+    return;
+  EXPECT_TRUE(FetchFromFlakyServer("GET", "200"));
+  EXPECT_TRUE(FetchFromFlakyServer("PUT", "200"));
+}
+
+TEST(redbean, fetchPool_doesntRetryPostOnStaleConnection) {
+  if (IsWindows())
+    return;
+  EXPECT_FALSE(FetchFromFlakyServer("POST", "nil"));
+}
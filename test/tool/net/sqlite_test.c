@@ -22,12 +22,24 @@
 #include "libc/mem/gc.h"
 #include "libc/mem/mem.h"
 #include "libc/runtime/runtime.h"
+#include "libc/serialize.h"
 #include "libc/stdio/rand.h"
+#include "libc/str/str.h"
 #include "libc/testlib/testlib.h"
 #include "libc/thread/thread.h"
+#include "libc/x/x.h"
+#include "libc/zip.h"
 #include "third_party/sqlite3/sqlite3.h"
+#include "third_party/zlib/zlib.h"
 
+int ZiposChild(void);
+
+// when re-run by the zipos test, /zip is the zip file it wrote
 void SetUpOnce(void) {
+  if (__argc == 2 && !strcmp(__argv[1], "zipos")) {
+    sqlite3_initialize();
+    exit(ZiposChild());
+  }
   testlib_enable_tmp_setup_teardown();
   sqlite3_initialize();
 }
@@ -139,3 +151,132 @@ TEST(sqlite, test) {
     ASSERT_EQ(0, pthread_join(t[i], 0));
   }
 }
+
+// opens stored.db through the zipos vfs with memory mapping turned on,
+// so pages come from xFetch(), and checks deflated.db is refused
+int ZiposChild(void) {
+  int rc;
+  sqlite3 *db;
+  sqlite3_stmt *stmt;
+  if (sqlite3_open_v2("file:/zip/stored.db?vfs=zipos", &db,
+                      SQLITE_OPEN_READONLY | SQLITE_OPEN_URI, 0))
+    return 1;
+  if (sqlite3_exec(db, "PRAGMA mmap_size=1048576", 0, 0, 0))
+    return 2;
+  if (sqlite3_prepare_v2(db, "SELECT COUNT(*), SUM(x) FROM t", -1, &stmt, 0))
+    return 3;
+  if (sqlite3_step(stmt) != SQLITE_ROW ||
+      sqlite3_column_int64(stmt, 0) != 1000 ||
+      sqlite3_column_int64(stmt, 1) != 1000 * 1001 / 2)
+    return 4;
+  if (sqlite3_finalize(stmt) || sqlite3_close(db))
+    return 5;
+  rc = sqlite3_open_v2("file:/zip/deflated.db?vfs=zipos", &db,
+                       SQLITE_OPEN_READONLY | SQLITE_OPEN_URI, 0);
+  sqlite3_close(db);
+  if (rc != SQLITE_CANTOPEN)
+    return 6;
+  return 0;
+}
+
+// writes zip holding `data` twice, once stored and once deflated
+void WriteZiposZip(const char *path, const char *data, size_t size) {
+  int i;
+  z_stream zs;
+  uint32_t crc;
+  const char *name;
+  char *zip, *p, *cdir, *z[2];
+  size_t n, namelen, zn[2], lf[2];
+  zn[0] = size;
+  z[0] = (char *)data;
+  bzero(&zs, sizeof(zs));
+  ASSERT_EQ(Z_OK, deflateInit2(&zs, 6, Z_DEFLATED, -MAX_WBITS, 8,
+                               Z_DEFAULT_STRATEGY));
+  z[1] = gc(malloc(deflateBound(&zs, size)));
+  zs.next_in = (const unsigned char *)data;
+  zs.avail_in = size;
+  zs.next_out = (unsigned char *)z[1];
+  zs.avail_out = deflateBound(&zs, size);
+  ASSERT_EQ(Z_STREAM_END, deflate(&zs, Z_FINISH));
+  zn[1] = zs.total_out;
+  deflateEnd(&zs);
+  crc = crc32_z(0, data, size);
+  p = zip = gc(malloc(zn[0] + zn[1] + 1024));
+  for (i = 0; i < 2; ++i) {
+    name = i ? "deflated.db" : "stored.db";
+    namelen = strlen(name);
+    lf[i] = p - zip;
+    p = WRITE32LE(p, kZipLfileHdrMagic);
+    p = WRITE16LE(p, kZipEra1993);
+    p = WRITE16LE(p, 0);
+    p = WRITE16LE(p, i ? kZipCompressionDeflate : kZipCompressionNone);
+    p = WRITE16LE(p, 0);
+    p = WRITE16LE(p, 0);
+    p = WRITE32LE(p, crc);
+    p = WRITE32LE(p, zn[i]);
+    p = WRITE32LE(p, size);
+    p = WRITE16LE(p, namelen);
+    p = WRITE16LE(p, 0);
+    p = mempcpy(p, name, namelen);
+    p = mempcpy(p, z[i], zn[i]);
+  }
+  cdir = p;
+  for (i = 0; i < 2; ++i) {
+    name = i ? "deflated.db" : "stored.db";
+    namelen = strlen(name);
+    p = WRITE32LE(p, kZipCfileHdrMagic);
+    p = WRITE16LE(p, kZipOsUnix << 8 | kZipEra1993);
+    p = WRITE16LE(p, kZipEra1993);
+    p = WRITE16LE(p, 0);
+    p = WRITE16LE(p, i ? kZipCompressionDeflate : kZipCompressionNone);
+    p = WRITE16LE(p, 0);
+    p = WRITE16LE(p, 0);
+    p = WRITE32LE(p, crc);
+    p = WRITE32LE(p, zn[i]);
+    p = WRITE32LE(p, size);
+    p = WRITE16LE(p, namelen);
+    p = WRITE16LE(p, 0);
+    p = WRITE16LE(p, 0);
+    p = WRITE16LE(p, 0);
+    p = WRITE16LE(p, 0);
+    p = WRITE32LE(p, 0100644u << 16);
+    p = WRITE32LE(p, lf[i]);
+    p = mempcpy(p, name, namelen);
+  }
+  n = p - cdir;
+  p = WRITE32LE(p, kZipCdirHdrMagic);
+  p = WRITE16LE(p, 0);
+  p = WRITE16LE(p, 0);
+  p = WRITE16LE(p, 2);
+  p = WRITE16LE(p, 2);
+  p = WRITE32LE(p, n);
+  p = WRITE32LE(p, cdir - zip);
+  p = WRITE16LE(p, 0);
+  ASSERT_NE(-1, xbarf(path, zip, p - zip));
+}
+
+TEST(sqlite, ziposVfs) {
+  int ws;
+  char *data;
+  size_t size;
+  sqlite3 *db;
+  ASSERT_EQ(SQLITE_OK, sqlite3_open("zipos.db", &db));
+  ASSERT_EQ(SQLITE_OK, DbExec(db, "CREATE TABLE t (x INTEGER);\n"
+                                  "WITH RECURSIVE c(x) AS (\n"
+                                  "  SELECT 1 UNION ALL\n"
+                                  "  SELECT x + 1 FROM c WHERE x < 1000\n"
+                                  ")\n"
+                                  "INSERT INTO t SELECT x FROM c"));
+  ASSERT_EQ(SQLITE_OK, sqlite3_close(db));
+  ASSERT_NE(NULL, (data = gc(xslurp("zipos.db", &size))));
+  WriteZiposZip("zipos.zip", data, size);
+  if (!fork()) {
+    setenv("COSMOPOLITAN_INIT_ZIPOS", "zipos.zip", true);
+    execv(GetProgramExecutableName(),
+          (char *const[]){GetProgramExecutableName(), "zipos", 0});
+    _Exit(127);
+  }
+  ASSERT_NE(-1, wait(&ws));
+  ASSERT_TRUE(WIFEXITED(ws));
+  ASSERT_EQ(0, WEXITSTATUS(ws));
+}
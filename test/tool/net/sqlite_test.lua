@@ -29,3 +29,192 @@ local st = assert(db:prepare("select * from foo"))
 assert(st:readonly() == true)
 st = assert(db:prepare("insert into foo (a) values (1)"))
 assert(st:readonly() == false)
+
+-- statements run by exec() and rows() are cached by sql text
+db = sqlite3.open_memory()
+assert(db:stmt_cache_size() == 16)
+assert(db:exec("create table bar(a, b)") == 0)
+for i = 1, 3 do
+  assert(db:exec("insert into bar (a, b) values (1, 'x')") == 0)
+end
+local stats = db:stmt_cache_stats()
+assert(stats.misses == 2)
+assert(stats.hits == 2)
+assert(stats.count == 2)
+local n = 0
+for a, b in db:urows("select a, b from bar") do
+  assert(a == 1 and b == 'x')
+  n = n + 1
+end
+assert(n == 3)
+for row in db:nrows("select a, b from bar") do
+  -- same statement is checked out twice while nested
+  for a in db:urows("select a, b from bar") do end
+end
+stats = db:stmt_cache_stats()
+assert(stats.hits == 5)
+local rows = {}
+assert(db:exec("select b from bar", function(udata, cols, values, names)
+  rows[#rows + 1] = values[1]
+  assert(names[1] == "b")
+  return 0
+end) == 0)
+assert(#rows == 3 and rows[1] == 'x')
+assert(db:exec("select b from bar", function() return 1 end) == sqlite3.ABORT)
+assert(db:exec("select nope from bar") == sqlite3.ERROR)
+
+-- multiple statements aren't cached but still work
+assert(db:exec("insert into bar values (2, 'y'); insert into bar values (3, 'z')") == 0)
+for n in db:urows("select count(*) from bar") do assert(n == 5) end
+local multi = "insert into bar values (4, 'w'); insert into bar values (5, 'v')"
+local before = db:stmt_cache_stats()
+for _ in db:rows(multi) do end  -- only runs the first statement
+assert(db:exec(multi) == 0)  -- must not reuse it from the cache
+assert(db:exec(multi) == 0)
+for n in db:urows("select count(*) from bar where a >= 4") do assert(n == 5) end
+stats = db:stmt_cache_stats()
+assert(stats.hits == before.hits)
+assert(stats.misses == before.misses + 1)
+
+-- lru eviction and disabling
+assert(db:stmt_cache_size(2) == 16)
+assert(db:stmt_cache_stats().count == 0)
+db:exec("select 1")
+db:exec("select 2")
+db:exec("select 3")
+stats = db:stmt_cache_stats()
+assert(stats.count == 2)
+assert(stats.evictions >= 1)
+assert(db:stmt_cache_size(0) == 2)
+db:exec("select 1")
+assert(db:stmt_cache_stats().count == 0)
+assert(db:close() == 0)
+
+-- connections inherited across fork() are abandoned rather than closed
+local tmpdir = "%s/o/tmp/sqlite_test.%d" % {os.getenv('TMPDIR'), unix.getpid()}
+assert(unix.makedirs(tmpdir))
+db = assert(sqlite3.open(tmpdir .. "/fork.db"))
+assert(db:exec([[
+  PRAGMA journal_mode=WAL;
+  CREATE TABLE kv (k TEXT PRIMARY KEY, v TEXT);
+  INSERT INTO kv VALUES ('hello', 'world');
+]]) == 0)
+local pid = assert(unix.fork())
+if pid == 0 then
+  local child = sqlite3.open(tmpdir .. "/fork.db")
+  for v in child:urows("SELECT v FROM kv WHERE k = 'hello'") do
+    if v ~= 'world' then unix.exit(1) end
+  end
+  if child:exec("INSERT INTO kv VALUES ('from', 'child')") ~= 0 then unix.exit(2) end
+  if child:close() ~= 0 then unix.exit(3) end
+  if db:close() ~= 0 then unix.exit(4) end
+  unix.exit(0)
+end
+local _, ws = assert(unix.wait())
+assert(unix.WIFEXITED(ws) and unix.WEXITSTATUS(ws) == 0)
+-- parent's connection survived the child closing it and sees its write
+for v in db:urows("SELECT v FROM kv WHERE k = 'from'") do
+  assert(v == 'child')
+end
+assert(db:close() == 0)
+
+-- lazy connections open once per process with statements ready to go
+local sql = "SELECT v FROM kv WHERE k = ?"
+local lazydb = sqlite3.lazy(tmpdir .. "/fork.db", nil, "PRAGMA busy_timeout=1000", {sql})
+stats = lazydb:stats()
+assert(stats.opens == 0 and not stats.connected)
+db = assert(lazydb:get())
+assert(lazydb:get() == db)
+stats = lazydb:stats()
+assert(stats.opens == 1 and stats.reuses == 1 and stats.connected)
+assert(db:stmt_cache_stats().count == 1)
+for v in db:urows(sql) do end
+assert(db:stmt_cache_stats().hits == 1)
+pid = assert(unix.fork())
+if pid == 0 then
+  local child = lazydb:get()
+  if child == db then unix.exit(1) end
+  if lazydb:stats().opens ~= 2 then unix.exit(2) end
+  for v in child:urows("SELECT v FROM kv WHERE k = 'hello'") do
+    if v ~= 'world' then unix.exit(3) end
+  end
+  unix.exit(0)
+end
+_, ws = assert(unix.wait())
+assert(unix.WIFEXITED(ws) and unix.WEXITSTATUS(ws) == 0)
+assert(lazydb:get() == db)
+assert(not pcall(sqlite3.lazy, "x.db", nil, nil, {1}))
+lazydb:close()
+assert(not pcall(lazydb.get, lazydb))
+assert(unix.rmrf(tmpdir))
+
+--------------------------------------------------------------------------------
+-- benchmark of a read-heavy endpoint served by forked workers, the way
+-- redbean serves clients, comparing requests per second when opening a
+-- connection per request, when opening one by hand the first time each
+-- worker needs it, and when using sqlite3.lazy() to do the same with the
+-- statement prepared up front
+
+function bench()
+  local dir = "%s/o/tmp/sqlite_bench.%d" % {os.getenv('TMPDIR'), unix.getpid()}
+  assert(unix.makedirs(dir))
+  local path = dir .. "/bench.db"
+  local pragmas = "PRAGMA journal_mode=WAL; PRAGMA busy_timeout=1000;"
+  local query = "SELECT name FROM t WHERE id = 500"
+  local d = assert(sqlite3.open(path))
+  d:exec(pragmas)
+  d:exec("CREATE TABLE t (id INTEGER PRIMARY KEY, name TEXT)")
+  d:exec("BEGIN")
+  for i = 1, 1000 do
+    d:exec("INSERT INTO t (name) VALUES ('name%d')" % {i})
+  end
+  d:exec("COMMIT")
+  local function Endpoint(conn)
+    for name in conn:urows(query) do end
+  end
+  local function OpenPerRequest()
+    local conn = sqlite3.open(path)
+    conn:exec(pragmas)
+    Endpoint(conn)
+    conn:close()
+  end
+  local conn, connpid
+  local function OpenPerWorker()
+    if connpid ~= unix.getpid() then
+      conn = sqlite3.open(path)
+      conn:exec(pragmas)
+      connpid = unix.getpid()
+    end
+    Endpoint(conn)
+  end
+  local lazydb = sqlite3.lazy(path, nil, pragmas, {query})
+  local function OpenLazily()
+    Endpoint(lazydb:get())
+  end
+  -- forks workers which each serve some keep-alive requests concurrently
+  -- and returns how many requests per second were served in total
+  local function Serve(handler, workers, requests)
+    local s0, ns0 = unix.clock_gettime(unix.CLOCK_MONOTONIC)
+    for i = 1, workers do
+      if assert(unix.fork()) == 0 then
+        for j = 1, requests do handler() end
+        unix.exit(0)
+      end
+    end
+    for i = 1, workers do
+      local _, ws = assert(unix.wait())
+      assert(unix.WIFEXITED(ws) and unix.WEXITSTATUS(ws) == 0)
+    end
+    local s1, ns1 = unix.clock_gettime(unix.CLOCK_MONOTONIC)
+    local ns = (s1 - s0) * 1000000000 + (ns1 - ns0)
+    return workers * requests * 1000000000 // ns
+  end
+  for _, requests in ipairs{1, 10, 100} do
+    print("OpenPerRequest", requests, Serve(OpenPerRequest, 8, requests))
+    print("OpenPerWorker", requests, Serve(OpenPerWorker, 8, requests))
+    print("OpenLazily", requests, Serve(OpenLazily, 8, requests))
+  end
+  lazydb:close()
+  d:close()
+  assert(unix.rmrf(dir))
+end
@@ -28,6 +28,7 @@
 #define lstrlib_c
 #define LUA_LIB
 
+#include "libc/fmt/itoa.h"
 #include "libc/math.h"
 #include "libc/str/str.h"
 #include "third_party/lua/cosmo.h"
@@ -337,13 +338,12 @@ static int arith_mod (lua_State *L) {
     lua_len(L, 2);
     n = lua_tointeger(L, -1);
     lua_pop(L, 1);
-    lua_pushcfunction(L, str_format);
-    lua_pushvalue(L, 1);
+    luaL_checkstack(L, n, "too many format arguments");
     for (i = 1; i <= n; ++i) {
       lua_geti(L, 2, i);
     }
-    lua_call(L, 1 + n, 1);
-    return 1;
+    lua_remove(L, 2);  /* leaves format string followed by its arguments */
+    return str_format(L);
   } else {
     return arith(L, LUA_OPMOD, "__mod");
   }
@@ -1309,6 +1309,98 @@ static void addlenmod (char *form, const char *lenmod) {
 }
 
 
+/*
+** [jart] Formats the common conversions used for templating (%d, %i,
+** %u, %x, %X and %s, with an optional '-' or '0' flag and width) of
+** integers and strings straight into the buffer, without building a
+** format string for snprintf. Returns the address after the specifier,
+** or NULL if the slow path must handle it.
+*/
+static const char *fastformat (lua_State *L, luaL_Buffer *b,
+                               const char *strfrmt, int arg) {
+  char flag = 0;
+  int width = 0;
+  size_t len;
+  const char *s;
+  char tmp[24];
+  if (*strfrmt == '-' || *strfrmt == '0')
+    flag = *strfrmt++;
+  if (isdigit(uchar(*strfrmt))) {
+    width = *strfrmt++ - '0';
+    if (isdigit(uchar(*strfrmt)))
+      width = width * 10 + (*strfrmt++ - '0');
+  }
+  switch (*strfrmt) {
+    case 'd': case 'i': case 'u': case 'x': case 'X': {
+      lua_Unsigned u;
+      char *p = tmp + sizeof(tmp);
+      if (!lua_isinteger(L, arg)) return NULL;
+      u = (lua_Unsigned)lua_tointeger(L, arg);
+      if (*strfrmt == 'x' || *strfrmt == 'X') {
+        const char *digits = *strfrmt == 'x' ? "0123456789abcdef"
+                                             : "0123456789ABCDEF";
+        do *--p = digits[u & 15]; while ((u >>= 4));
+      }
+      else if (*strfrmt != 'u' && (lua_Integer)u < 0) {
+        u = -u;
+        do *--p = '0' + u % 10; while ((u /= 10));
+        *--p = '-';
+      }
+      else {
+        do *--p = '0' + u % 10; while ((u /= 10));
+      }
+      s = p;
+      len = tmp + sizeof(tmp) - p;
+      break;
+    }
+    case 's': {
+      if (flag == '0') return NULL;
+      if (lua_type(L, arg) == LUA_TSTRING) {
+        s = lua_tolstring(L, arg, &len);
+        if ((flag || width) && memchr(s, 0, len)) return NULL;
+      }
+      else if (lua_isinteger(L, arg)) {
+        if (luaL_getmetafield(L, arg, "__tostring") != LUA_TNIL) {
+          lua_pop(L, 1);  /* slow path calls it via luaL_tolstring */
+          return NULL;
+        }
+        s = tmp;
+        len = FormatInt64(tmp, lua_tointeger(L, arg)) - tmp;
+      }
+      else
+        return NULL;
+      break;
+    }
+    default:
+      return NULL;
+  }
+  if (len < (size_t)width) {
+    char *p = luaL_prepbuffsize(b, width);
+    size_t pad = width - len;
+    if (flag == '-') {
+      memcpy(p, s, len);
+      memset(p + len, ' ', pad);
+    }
+    else if (flag == '0') {
+      if (*s == '-') {
+        *p++ = *s++;
+        --len;
+      }
+      memset(p, '0', pad);
+      memcpy(p + pad, s, len);
+    }
+    else {
+      memset(p, ' ', pad);
+      memcpy(p + pad, s, len);
+    }
+    luaL_addsize(b, width);
+  }
+  else
+    luaL_addlstring(b, s, len);
+  return strfrmt + 1;
+}
+
+
 static int str_format (lua_State *L) {
   int top = lua_gettop(L);
   int arg = 1;
@@ -1316,13 +1408,23 @@ static int str_format (lua_State *L) {
   const char *strfrmt = luaL_checklstring(L, arg, &sfl);
   const char *strfrmt_end = strfrmt+sfl;
   const char *flags;
+  const char *next;
   luaL_Buffer b;
   luaL_buffinit(L, &b);
   while (strfrmt < strfrmt_end) {
-    if (*strfrmt != L_ESC)
-      luaL_addchar(&b, *strfrmt++);
+    if (*strfrmt != L_ESC) {
+      /* copy literal text up to the next conversion in one go */
+      next = memchr(strfrmt, L_ESC, strfrmt_end - strfrmt);
+      if (!next) next = strfrmt_end;
+      luaL_addlstring(&b, strfrmt, next - strfrmt);
+      strfrmt = next;
+    }
     else if (*++strfrmt == L_ESC)
       luaL_addchar(&b, *strfrmt++);  /* %% */
+    else if (arg < top && (next = fastformat(L, &b, strfrmt, arg + 1))) {
+      ++arg;
+      strfrmt = next;
+    }
     else { /* format item */
       char form[MAX_FORMAT];  /* to store the format ('%...') */
       int maxitem = MAX_ITEM;  /* maximum length for the result */
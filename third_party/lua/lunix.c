@@ -26,6 +26,7 @@
 #include "libc/calls/struct/bpf.internal.h"
 #include "libc/calls/struct/dirent.h"
 #include "libc/calls/struct/flock.h"
+#include "libc/calls/struct/iovec.h"
 #include "libc/calls/struct/itimerval.h"
 #include "libc/calls/struct/rlimit.h"
 #include "libc/calls/struct/rusage.h"
@@ -37,6 +38,7 @@
 #include "libc/calls/struct/timespec.h"
 #include "libc/calls/struct/timeval.h"
 #include "libc/calls/struct/winsize.h"
+#include "libc/calls/syscall-sysv.internal.h"
 #include "libc/calls/ucontext.h"
 #include "libc/calls/weirdtypes.h"
 #include "libc/dce.h"
@@ -72,6 +74,7 @@
 #include "libc/sysv/consts/dt.h"
 #include "libc/sysv/consts/f.h"
 #include "libc/sysv/consts/fd.h"
+#include "libc/sysv/consts/iov.h"
 #include "libc/sysv/consts/ip.h"
 #include "libc/sysv/consts/ipproto.h"
 #include "libc/sysv/consts/itimer.h"
@@ -93,6 +96,7 @@
 #include "libc/sysv/consts/sig.h"
 #include "libc/sysv/consts/sio.h"
 #include "libc/sysv/consts/so.h"
+#include "libc/sysv/consts/splice.h"
 #include "libc/sysv/consts/sock.h"
 #include "libc/sysv/consts/sol.h"
 #include "libc/sysv/consts/st.h"
@@ -1109,6 +1113,150 @@ static int LuaUnixWrite(lua_State *L) {
   return SysretInteger(L, "write", olderr, rc);
 }
 
+// unix.readv(fd:int, sizes:{int,...}[, offset:int])
+//     ├─→ data:str, ...
+//     └─→ nil, unix.Errno
+static int LuaUnixReadv(lua_State *L) {
+  char *buf;
+  ssize_t rc;
+  size_t got, take;
+  struct iovec *iov;
+  lua_Integer offset, size, total;
+  int i, n, fd, olderr = errno;
+  fd = luaL_checkinteger(L, 1);
+  luaL_checktype(L, 2, LUA_TTABLE);
+  offset = luaL_optinteger(L, 3, -1);
+  n = luaL_len(L, 2);
+  luaL_argcheck(L, 0 < n && n <= IOV_MAX, 2, "bad iovec count");
+  luaL_checkstack(L, n, "too many iovecs");
+  iov = LuaAllocOrDie(L, n * sizeof(*iov));
+  for (total = i = 0; i < n; ++i) {
+    lua_rawgeti(L, 2, i + 1);
+    size = lua_tointeger(L, -1);
+    lua_pop(L, 1);
+    if (!(0 <= size && size <= 0x7ffff000 - total)) {
+      free(iov);
+      return luaL_argerror(L, 2, "bad iovec size");
+    }
+    iov[i].iov_len = size;
+    total += size;
+  }
+  buf = LuaAllocOrDie(L, total);
+  for (total = i = 0; i < n; ++i) {
+    iov[i].iov_base = buf + total;
+    total += iov[i].iov_len;
+  }
+  if (offset == -1) {
+    rc = readv(fd, iov, n);
+  } else {
+    rc = preadv(fd, iov, n, offset);
+  }
+  if (rc != -1) {
+    for (got = rc, i = 0; i < n; ++i) {
+      take = MIN(got, iov[i].iov_len);
+      lua_pushlstring(L, iov[i].iov_base, take);
+      got -= take;
+    }
+    free(buf);
+    free(iov);
+    return n;
+  } else {
+    free(buf);
+    free(iov);
+    return LuaUnixSysretErrno(L, "readv", olderr);
+  }
+}
+
+// unix.writev(fd:int, iov:{str,...}[, offset:int])
+//     ├─→ wrotebytes:int
+//     └─→ nil, unix.Errno
+static int LuaUnixWritev(lua_State *L) {
+  ssize_t rc;
+  struct iovec *iov;
+  lua_Integer offset;
+  int i, n, fd, olderr = errno;
+  fd = luaL_checkinteger(L, 1);
+  luaL_checktype(L, 2, LUA_TTABLE);
+  offset = luaL_optinteger(L, 3, -1);
+  n = luaL_len(L, 2);
+  luaL_argcheck(L, 0 < n && n <= IOV_MAX, 2, "bad iovec count");
+  iov = LuaAllocOrDie(L, n * sizeof(*iov));
+  for (i = 0; i < n; ++i) {
+    // the table keeps each string alive while we use its pointer
+    if (lua_rawgeti(L, 2, i + 1) != LUA_TSTRING) {
+      free(iov);
+      return luaL_argerror(L, 2, "iovec must be a list of strings");
+    }
+    iov[i].iov_base = (void *)lua_tolstring(L, -1, &iov[i].iov_len);
+    lua_pop(L, 1);
+  }
+  if (offset == -1) {
+    rc = writev(fd, iov, n);
+  } else {
+    rc = pwritev(fd, iov, n, offset);
+  }
+  free(iov);
+  return SysretInteger(L, "writev", olderr, rc);
+}
+
+static size_t CheckCount(lua_State *L, int i) {
+  lua_Integer count = luaL_checkinteger(L, i);
+  luaL_argcheck(L, count >= 0, i, "count must be non-negative");
+  return count;
+}
+
+// unix.sendfile(outfd:int, infd:int, count:int[, offset:int])
+//     ├─→ sentbytes:int
+//     └─→ nil, unix.Errno
+static int LuaUnixSendfile(lua_State *L) {
+  size_t count;
+  int64_t offset;
+  int outfd, infd, olderr = errno;
+  outfd = luaL_checkinteger(L, 1);
+  infd = luaL_checkinteger(L, 2);
+  count = CheckCount(L, 3);
+  offset = luaL_optinteger(L, 4, -1);
+  return SysretInteger(
+      L, "sendfile", olderr,
+      sendfile(outfd, infd, offset == -1 ? 0 : &offset, count));
+}
+
+// unix.splice(infd:int, outfd:int, count:int[, flags:int[, inoffset:int[, outoffset:int]]])
+//     ├─→ movedbytes:int
+//     └─→ nil, unix.Errno
+static int LuaUnixSplice(lua_State *L) {
+  size_t count;
+  unsigned flags;
+  int64_t inoff, outoff;
+  int infd, outfd, olderr = errno;
+  infd = luaL_checkinteger(L, 1);
+  outfd = luaL_checkinteger(L, 2);
+  count = CheckCount(L, 3);
+  flags = luaL_optinteger(L, 4, 0);
+  inoff = luaL_optinteger(L, 5, -1);
+  outoff = luaL_optinteger(L, 6, -1);
+  return SysretInteger(L, "splice", olderr,
+                       splice(infd, inoff == -1 ? 0 : &inoff, outfd,
+                              outoff == -1 ? 0 : &outoff, count, flags));
+}
+
+// unix.copy_file_range(infd:int, outfd:int, count:int[, inoffset:int[, outoffset:int]])
+//     ├─→ copiedbytes:int
+//     └─→ nil, unix.Errno
+static int LuaUnixCopyFileRange(lua_State *L) {
+  size_t count;
+  long inoff, outoff;
+  int infd, outfd, olderr = errno;
+  infd = luaL_checkinteger(L, 1);
+  outfd = luaL_checkinteger(L, 2);
+  count = CheckCount(L, 3);
+  inoff = luaL_optinteger(L, 4, -1);
+  outoff = luaL_optinteger(L, 5, -1);
+  return SysretInteger(L, "copy_file_range", olderr,
+                       copy_file_range(infd, inoff == -1 ? 0 : &inoff, outfd,
+                                       outoff == -1 ? 0 : &outoff, count, 0));
+}
+
 // unix.stat(path:str[, flags:int[, dirfd:int]])
 //     ├─→ unix.Stat
 //     └─→ nil, unix.Errno
@@ -1596,6 +1744,88 @@ static int LuaUnixPoll(lua_State *L) {
   }
 }
 
+// linux abi, since libc no longer wraps epoll
+#define kEpollCtlAdd    1
+#define kEpollCtlDel    2
+#define kEpollCtlMod    3
+#define kEpollIn        0x00000001
+#define kEpollPri       0x00000002
+#define kEpollOut       0x00000004
+#define kEpollErr       0x00000008
+#define kEpollHup       0x00000010
+#define kEpollRdhup     0x00002000
+#define kEpollExclusive 0x10000000
+#define kEpollOneshot   0x40000000
+#define kEpollEt        0x80000000
+#define kEpollMaxEvents 4096
+
+struct LuaEpollEvent {
+  uint32_t events;
+  uint64_t fd;
+}
+#ifdef __x86_64__
+__attribute__((__packed__))
+#endif
+;
+
+// unix.epoll_create([flags:int])
+//     ├─→ epfd:int
+//     └─→ nil, unix.Errno
+static int LuaUnixEpollCreate(lua_State *L) {
+  int rc, olderr = errno;
+  if (IsLinux()) {
+    rc = sys_epoll_create1(luaL_optinteger(L, 1, 0));
+  } else {
+    rc = enosys();
+  }
+  return SysretInteger(L, "epoll_create", olderr, rc);
+}
+
+// unix.epoll_ctl(epfd:int, op:int, fd:int[, events:int])
+//     ├─→ true
+//     └─→ nil, unix.Errno
+static int LuaUnixEpollCtl(lua_State *L) {
+  int rc, olderr = errno;
+  struct LuaEpollEvent ev;
+  ev.fd = luaL_checkinteger(L, 3);
+  ev.events = luaL_optinteger(L, 4, 0);
+  if (IsLinux()) {
+    rc = sys_epoll_ctl(luaL_checkinteger(L, 1), luaL_checkinteger(L, 2), ev.fd,
+                       &ev);
+  } else {
+    rc = enosys();
+  }
+  return SysretBool(L, "epoll_ctl", olderr, rc);
+}
+
+// unix.epoll_wait(epfd:int[, timeoutms:int[, maxevents:int]])
+//     ├─→ {[fd:int]=events:int, ...}
+//     └─→ nil, unix.Errno
+static int LuaUnixEpollWait(lua_State *L) {
+  struct LuaEpollEvent *evs;
+  int i, rc, epfd, timeout, maxevents, olderr = errno;
+  epfd = luaL_checkinteger(L, 1);
+  timeout = luaL_optinteger(L, 2, -1);
+  maxevents = luaL_optinteger(L, 3, 64);
+  luaL_argcheck(L, 0 < maxevents && maxevents <= kEpollMaxEvents, 3,
+                "maxevents out of range");
+  if (!IsLinux())
+    return SysretBool(L, "epoll_wait", olderr, enosys());
+  evs = LuaAllocOrDie(L, maxevents * sizeof(*evs));
+  if ((rc = sys_epoll_pwait(epfd, evs, maxevents, timeout, 0, 8)) != -1) {
+    lua_createtable(L, 0, rc);
+    for (i = 0; i < rc; ++i) {
+      lua_pushinteger(L, evs[i].events);
+      lua_rawseti(L, -2, evs[i].fd);
+    }
+    free(evs);
+    return 1;
+  } else {
+    free(evs);
+    return LuaUnixSysretErrno(L, "epoll_wait", olderr);
+  }
+}
+
 // unix.recvfrom(fd:int[, bufsiz:int[, flags:int]])
 //     ├─→ data:str, ip:uint32, port:uint16
 //     ├─→ data:str, unixpath:str
@@ -3242,8 +3472,12 @@ static const luaL_Reg kLuaUnix[] = {
     {"close", LuaUnixClose},              // close file or socket
     {"commandv", LuaUnixCommandv},        // resolve program on $PATH
     {"connect", LuaUnixConnect},          // connect to remote address
+    {"copy_file_range", LuaUnixCopyFileRange},  // copy between files in kernel
     {"dup", LuaUnixDup},                  // copy fd to lowest empty slot
     {"environ", LuaUnixEnviron},          // get environment variables
+    {"epoll_create", LuaUnixEpollCreate},  // create scalable poller (linux)
+    {"epoll_ctl", LuaUnixEpollCtl},       // watch fd with poller (linux)
+    {"epoll_wait", LuaUnixEpollWait},     // wait for watched fds (linux)
     {"execve", LuaUnixExecve},            // replace process with program
     {"exit", LuaUnixExit},                // exit w/o atexit
     {"fcntl", LuaUnixFcntl},              // manipulate file descriptor
@@ -3292,6 +3526,7 @@ static const luaL_Reg kLuaUnix[] = {
     {"raise", LuaUnixRaise},              // signal this process
     {"read", LuaUnixRead},                // read from file or socket
     {"readlink", LuaUnixReadlink},        // reads symbolic link
+    {"readv", LuaUnixReadv},              // scatter read from file or socket
     {"realpath", LuaUnixRealpath},        // abspath without dots/symlinks
     {"recv", LuaUnixRecv},                // receive tcp from some address
     {"recvfrom", LuaUnixRecvfrom},        // receive udp from some address
@@ -3300,6 +3535,7 @@ static const luaL_Reg kLuaUnix[] = {
     {"rmrf", LuaUnixRmrf},                // remove file recursively
     {"sched_yield", LuaUnixSchedYield},   // relinquish scheduled quantum
     {"send", LuaUnixSend},                // send tcp to some address
+    {"sendfile", LuaUnixSendfile},        // copy file to socket in kernel
     {"sendto", LuaUnixSendto},            // send udp to some address
     {"setfsgid", LuaUnixSetfsgid},        // set/get group id for fs ops
     {"setfsuid", LuaUnixSetfsuid},        // set/get user id for fs ops
@@ -3321,6 +3557,7 @@ static const luaL_Reg kLuaUnix[] = {
     {"siocgifconf", LuaUnixSiocgifconf},  // get list of network interfaces
     {"socket", LuaUnixSocket},            // create network communication fd
     {"socketpair", LuaUnixSocketpair},    // create bidirectional pipe
+    {"splice", LuaUnixSplice},            // move data to or from pipe
     {"stat", LuaUnixStat},                // get file info from path
     {"statfs", LuaUnixStatfs},            // get filesystem info from path
     {"strsignal", LuaUnixStrsignal},      // turn signal into string
@@ -3337,6 +3574,7 @@ static const luaL_Reg kLuaUnix[] = {
     {"verynice", LuaUnixVerynice},        // lowest priority
     {"wait", LuaUnixWait},                // wait for child to change status
     {"write", LuaUnixWrite},              // write to file or socket
+    {"writev", LuaUnixWritev},            // gather write to file or socket
     {0},                                  //
 };
 
@@ -3449,6 +3687,26 @@ int LuaUnix(lua_State *L) {
   LuaSetIntField(L, "MSG_TRUNC", MSG_TRUNC);
   LuaSetIntField(L, "MSG_CTRUNC", MSG_CTRUNC);
 
+  // epoll_ctl() operations and events
+  LuaSetIntField(L, "EPOLL_CLOEXEC", IsLinux() ? O_CLOEXEC : 0);
+  LuaSetIntField(L, "EPOLL_CTL_ADD", kEpollCtlAdd);
+  LuaSetIntField(L, "EPOLL_CTL_DEL", kEpollCtlDel);
+  LuaSetIntField(L, "EPOLL_CTL_MOD", kEpollCtlMod);
+  LuaSetIntField(L, "EPOLLIN", kEpollIn);
+  LuaSetIntField(L, "EPOLLPRI", kEpollPri);
+  LuaSetIntField(L, "EPOLLOUT", kEpollOut);
+  LuaSetIntField(L, "EPOLLERR", kEpollErr);
+  LuaSetIntField(L, "EPOLLHUP", kEpollHup);
+  LuaSetIntField(L, "EPOLLRDHUP", kEpollRdhup);
+  LuaSetIntField(L, "EPOLLEXCLUSIVE", kEpollExclusive);
+  LuaSetIntField(L, "EPOLLONESHOT", kEpollOneshot);
+  LuaSetIntField(L, "EPOLLET", kEpollEt);
+
+  // splice() flags
+  LuaSetIntField(L, "SPLICE_F_MOVE", SPLICE_F_MOVE);
+  LuaSetIntField(L, "SPLICE_F_NONBLOCK", SPLICE_F_NONBLOCK);
+  LuaSetIntField(L, "SPLICE_F_MORE", SPLICE_F_MORE);
+
   // readdir() type
   LuaSetIntField(L, "DT_UNKNOWN", DT_UNKNOWN);
   LuaSetIntField(L, "DT_REG", DT_REG);
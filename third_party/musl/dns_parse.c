@@ -58,3 +58,41 @@ int __dns_parse(const unsigned char *r, int rlen,
 	}
 	return 0;
 }
+
+/* Returns the negative caching ttl of an NXDOMAIN or NODATA response,
+ * which per RFC 2308 is the lesser of the authority SOA record's own
+ * ttl and its MINIMUM field, or -1 if the response carries no SOA. */
+int __dns_negative_ttl(const unsigned char *r, int rlen)
+{
+	int qdcount, ancount, nscount;
+	const unsigned char *p;
+	unsigned ttl, min;
+	int len;
+
+	if (rlen<12) return -1;
+	p = r+12;
+	qdcount = r[4]*256 + r[5];
+	ancount = r[6]*256 + r[7];
+	nscount = r[8]*256 + r[9];
+	while (qdcount--) {
+		while (p-r < rlen && *p-1U < 127) p++;
+		if (p>r+rlen-6)
+			return -1;
+		p += 5 + !!*p;
+	}
+	for (ancount += nscount; ancount--; ) {
+		while (p-r < rlen && *p-1U < 127) p++;
+		if (p>r+rlen-12)
+			return -1;
+		p += 1 + !!*p;
+		len = p[8]*256 + p[9];
+		if (len+10 > r+rlen-p) return -1;
+		if (p[0]==0 && p[1]==6 && len>=22 && ancount<nscount) {
+			ttl = (unsigned)p[4]<<24 | p[5]<<16 | p[6]<<8 | p[7];
+			min = (unsigned)p[6+len]<<24 | p[7+len]<<16 | p[8+len]<<8 | p[9+len];
+			return (ttl < min ? ttl : min) & 0x7fffffff;
+		}
+		p += 10 + len;
+	}
+	return -1;
+}
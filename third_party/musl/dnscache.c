@@ -0,0 +1,401 @@
+/*-*- mode:c;indent-tabs-mode:nil;c-basic-offset:2;tab-width:8;coding:utf-8 -*-│
+│ vi: set et ft=c ts=2 sts=2 sw=2 fenc=utf-8                               :vi │
+╞══════════════════════════════════════════════════════════════════════════════╡
+│ Copyright 2024 Justine Alexandra Roberts Tunney                              │
+│                                                                              │
+│ Permission to use, copy, modify, and/or distribute this software for         │
+│ any purpose with or without fee is hereby granted, provided that the         │
+│ above copyright notice and this permission notice appear in all copies.      │
+│                                                                              │
+│ THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL                │
+│ WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED                │
+│ WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE             │
+│ AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL         │
+│ DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR        │
+│ PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER               │
+│ TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR             │
+│ PERFORMANCE OF THIS SOFTWARE.                                                │
+╚─────────────────────────────────────────────────────────────────────────────*/
+#include "libc/calls/struct/timespec.h"
+#include "libc/intrin/atomic.h"
+#include "libc/limits.h"
+#include "libc/macros.h"
+#include "libc/mem/mem.h"
+#include "libc/str/str.h"
+#include "libc/str/tab.h"
+#include "libc/sysv/errfuns.h"
+#include "libc/thread/thread.h"
+#include "third_party/musl/dnscache.h"
+#include "third_party/musl/lookup.internal.h"
+#include "third_party/musl/netdb.h"
+
+/**
+ * @fileoverview hostname resolution cache for getaddrinfo()
+ *
+ * Every name that __lookup_name() can't answer as a literal is looked
+ * up through here. When the cache is enabled, answers from the hosts
+ * file and the network are remembered for as long as their records'
+ * time-to-live allows, nxdomain and nodata answers are remembered for
+ * their RFC 2308 negative ttl, and a thread asking for a name another
+ * thread is already resolving waits for that answer instead of sending
+ * queries of its own. Transient failures are handed to those waiters
+ * but never cached.
+ *
+ * Misses scan the whole table to choose a slot, which costs nothing
+ * next to the round trip they're about to make; hits are O(1).
+ */
+
+#define DNS_CACHE_MAX_TTL          3600
+#define DNS_CACHE_MAX_NEGATIVE_TTL 300
+
+struct DnsCacheEntry {
+  int next;         // hash chain link, or -1
+  int family;       // AF_UNSPEC, AF_INET, or AF_INET6
+  int cnt;          // what the resolver returned
+  unsigned serial;  // bumped whenever the slot is recycled
+  bool live;
+  bool pending;     // a thread is resolving this name right now
+  bool transient;   // result is only for threads that waited on it
+  struct timespec expires;
+  struct timespec used;
+  struct address *addrs;
+  char canon[256];
+  char name[256];
+};
+
+static struct {
+  atomic_bool enabled;
+  pthread_once_t once;
+  int pending;  // number of entries being resolved
+  int waiting;  // number of threads blocked on cond
+  size_t count;
+  size_t capacity;
+  size_t mask;
+  int *buckets;
+  struct DnsCacheEntry *entries;
+  struct dns_cache_stats stats;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+} g_dnscache = {
+    .once = PTHREAD_ONCE_INIT,
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+};
+
+static unsigned dns_cache_hash(const char *name, int family) {
+  unsigned h = 2166136261u ^ family;
+  while (*name)
+    h = (h ^ kToLower[*name++ & 255]) * 16777619;
+  return h;
+}
+
+static int dns_cache_find(const char *name, int family) {
+  int i;
+  struct DnsCacheEntry *e;
+  i = g_dnscache.buckets[dns_cache_hash(name, family) & g_dnscache.mask];
+  for (; i != -1; i = e->next) {
+    e = g_dnscache.entries + i;
+    if (e->family == family && !strcasecmp(e->name, name))
+      return i;
+  }
+  return -1;
+}
+
+static void dns_cache_remove(int i) {
+  int *p;
+  struct DnsCacheEntry *e = g_dnscache.entries + i;
+  p = g_dnscache.buckets +
+      (dns_cache_hash(e->name, e->family) & g_dnscache.mask);
+  while (*p != i)
+    p = &g_dnscache.entries[*p].next;
+  *p = e->next;
+  free(e->addrs);
+  e->addrs = 0;
+  e->live = false;
+  ++e->serial;
+  --g_dnscache.count;
+}
+
+static void dns_cache_lock(void) {
+  pthread_mutex_lock(&g_dnscache.lock);
+}
+
+static void dns_cache_unlock(void) {
+  pthread_mutex_unlock(&g_dnscache.lock);
+}
+
+// the threads resolving or waiting on names didn't survive the fork,
+// so forget the lookups they were in the middle of
+static void dns_cache_wipe(void) {
+  size_t i;
+  pthread_mutex_wipe_np(&g_dnscache.lock);
+  pthread_cond_init(&g_dnscache.cond, 0);
+  for (i = 0; i < g_dnscache.capacity; ++i) {
+    if (g_dnscache.entries[i].pending) {
+      g_dnscache.entries[i].pending = false;
+      dns_cache_remove(i);
+    }
+  }
+  g_dnscache.pending = 0;
+  g_dnscache.waiting = 0;
+}
+
+static void dns_cache_setup(void) {
+  pthread_atfork(dns_cache_lock, dns_cache_unlock, dns_cache_wipe);
+}
+
+// picks an empty slot, else an expired one, else the least recently
+// used one that nobody is resolving, and links it under name/family
+static int dns_cache_claim(const char *name, int family) {
+  size_t i;
+  int *bucket, victim = -1;
+  struct DnsCacheEntry *e;
+  struct timespec now = timespec_mono();
+  for (i = 0; i < g_dnscache.capacity; ++i) {
+    e = g_dnscache.entries + i;
+    if (!e->live) {
+      victim = i;
+      break;
+    }
+    if (e->pending)
+      continue;
+    if (e->transient || timespec_cmp(now, e->expires) >= 0) {
+      if (!e->transient)
+        ++g_dnscache.stats.expired;
+      dns_cache_remove(i);
+      victim = i;
+      break;
+    }
+    if (victim == -1 ||
+        timespec_cmp(e->used, g_dnscache.entries[victim].used) < 0)
+      victim = i;
+  }
+  if (victim == -1)
+    return -1;
+  e = g_dnscache.entries + victim;
+  if (e->live) {
+    ++g_dnscache.stats.evicted;
+    dns_cache_remove(victim);
+  }
+  e->live = true;
+  e->pending = true;
+  e->transient = false;
+  e->family = family;
+  e->used = now;
+  strlcpy(e->name, name, sizeof(e->name));
+  bucket =
+      g_dnscache.buckets + (dns_cache_hash(name, family) & g_dnscache.mask);
+  e->next = *bucket;
+  *bucket = victim;
+  ++g_dnscache.count;
+  ++g_dnscache.pending;
+  return victim;
+}
+
+static void dns_cache_store(struct DnsCacheEntry *e,
+                            const struct address *buf, const char *canon,
+                            int cnt, unsigned ttl) {
+  e->pending = false;
+  e->expires = timespec_mono();
+  if (cnt > 0) {
+    if ((e->addrs = malloc(cnt * sizeof(*buf)))) {
+      memcpy(e->addrs, buf, cnt * sizeof(*buf));
+      ttl = MIN(ttl, DNS_CACHE_MAX_TTL);
+    } else {
+      cnt = EAI_MEMORY;
+      ttl = 0;
+    }
+  } else if (!cnt || cnt == EAI_NODATA || cnt == EAI_NONAME) {
+    ttl = MIN(ttl, DNS_CACHE_MAX_NEGATIVE_TTL);
+  } else {
+    ttl = 0;
+  }
+  e->cnt = cnt;
+  e->transient = !ttl;
+  e->expires = timespec_add(e->expires, timespec_fromseconds(ttl));
+  strlcpy(e->canon, canon, sizeof(e->canon));
+}
+
+static int dns_cache_copy(struct DnsCacheEntry *e, struct address *buf,
+                          char *canon) {
+  if (e->cnt > 0)
+    memcpy(buf, e->addrs, e->cnt * sizeof(*buf));
+  strcpy(canon, e->canon);
+  return e->cnt;
+}
+
+static void dns_cache_abandon(void *arg) {
+  struct DnsCacheEntry *e = arg;
+  pthread_mutex_lock(&g_dnscache.lock);
+  e->pending = false;
+  --g_dnscache.pending;
+  dns_cache_remove(e - g_dnscache.entries);
+  pthread_cond_broadcast(&g_dnscache.cond);
+  pthread_mutex_unlock(&g_dnscache.lock);
+}
+
+static void dns_cache_unwait(void *arg) {
+  --g_dnscache.waiting;
+  pthread_cond_broadcast(&g_dnscache.cond);
+  pthread_mutex_unlock(&g_dnscache.lock);
+}
+
+// blocks until the query in flight for `e` finishes, returning true if
+// its answer is still sitting in `e` for us to take
+static bool dns_cache_wait(struct DnsCacheEntry *e) {
+  unsigned serial = e->serial;
+  ++g_dnscache.stats.coalesced;
+  ++g_dnscache.waiting;
+  pthread_cleanup_push(dns_cache_unwait, 0);
+  do
+    pthread_cond_wait(&g_dnscache.cond, &g_dnscache.lock);
+  while (e->pending && e->serial == serial);
+  pthread_cleanup_pop(false);
+  if (!--g_dnscache.waiting)
+    pthread_cond_broadcast(&g_dnscache.cond);
+  return e->serial == serial;
+}
+
+int __dns_cache_lookup(struct address buf[static MAXADDRS],
+                       char canon[static 256], const char *name, int family,
+                       dns_resolver_f *resolve) {
+  int i, cnt;
+  unsigned ttl = -1;
+  struct timespec now;
+  struct DnsCacheEntry *e;
+  if (!atomic_load_explicit(&g_dnscache.enabled, memory_order_acquire))
+    return resolve(buf, canon, name, family, &ttl);
+  pthread_mutex_lock(&g_dnscache.lock);
+  for (;;) {
+    if (!g_dnscache.capacity) {
+      pthread_mutex_unlock(&g_dnscache.lock);
+      return resolve(buf, canon, name, family, &ttl);
+    }
+    if ((i = dns_cache_find(name, family)) == -1)
+      break;
+    e = g_dnscache.entries + i;
+    if (e->pending) {
+      if (dns_cache_wait(e)) {
+        cnt = dns_cache_copy(e, buf, canon);
+        pthread_mutex_unlock(&g_dnscache.lock);
+        return cnt;
+      }
+      continue;
+    }
+    now = timespec_mono();
+    if (!e->transient && timespec_cmp(now, e->expires) < 0) {
+      if (e->cnt > 0) {
+        ++g_dnscache.stats.hits;
+      } else {
+        ++g_dnscache.stats.negative_hits;
+      }
+      e->used = now;
+      cnt = dns_cache_copy(e, buf, canon);
+      pthread_mutex_unlock(&g_dnscache.lock);
+      return cnt;
+    }
+    if (!e->transient)
+      ++g_dnscache.stats.expired;
+    dns_cache_remove(i);
+    break;
+  }
+  ++g_dnscache.stats.misses;
+  if ((i = dns_cache_claim(name, family)) == -1) {
+    pthread_mutex_unlock(&g_dnscache.lock);
+    return resolve(buf, canon, name, family, &ttl);
+  }
+  e = g_dnscache.entries + i;
+  pthread_mutex_unlock(&g_dnscache.lock);
+  pthread_cleanup_push(dns_cache_abandon, e);
+  cnt = resolve(buf, canon, name, family, &ttl);
+  pthread_cleanup_pop(false);
+  pthread_mutex_lock(&g_dnscache.lock);
+  dns_cache_store(e, buf, canon, cnt, ttl);
+  --g_dnscache.pending;
+  pthread_cond_broadcast(&g_dnscache.cond);
+  pthread_mutex_unlock(&g_dnscache.lock);
+  return cnt;
+}
+
+/**
+ * Enables caching of getaddrinfo() and gethostbyname() results.
+ *
+ * The cache is process-wide and thread-safe. It honors record ttls,
+ * remembers nonexistent names, and coalesces concurrent lookups of
+ * the same name into a single query. It's off by default.
+ *
+ * @param capacity is maximum number of names to remember, or zero to
+ *     disable the cache and free its memory; calling this again with a
+ *     different capacity discards whatever was cached before
+ * @return 0 on success, or -1 w/ errno
+ * @raise EINVAL if `capacity` is unreasonably large
+ * @raise ENOMEM if the table couldn't be allocated
+ */
+int dns_cache_enable(size_t capacity) {
+  int cs;
+  size_t i, nbuckets;
+  int *buckets = 0;
+  struct DnsCacheEntry *entries = 0;
+  if (capacity > INT_MAX / 2)
+    return einval();
+  nbuckets = 0;
+  if (capacity) {
+    for (nbuckets = 1; nbuckets < capacity * 2; nbuckets <<= 1) {
+    }
+    entries = calloc(capacity, sizeof(*entries));
+    buckets = malloc(nbuckets * sizeof(*buckets));
+    if (!entries || !buckets) {
+      free(buckets);
+      free(entries);
+      return -1;
+    }
+    memset(buckets, -1, nbuckets * sizeof(*buckets));
+  }
+  pthread_once(&g_dnscache.once, dns_cache_setup);
+  pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &cs);
+  pthread_mutex_lock(&g_dnscache.lock);
+  atomic_store_explicit(&g_dnscache.enabled, false, memory_order_release);
+  while (g_dnscache.pending || g_dnscache.waiting)
+    pthread_cond_wait(&g_dnscache.cond, &g_dnscache.lock);
+  for (i = 0; i < g_dnscache.capacity; ++i)
+    free(g_dnscache.entries[i].addrs);
+  free(g_dnscache.entries);
+  free(g_dnscache.buckets);
+  g_dnscache.entries = entries;
+  g_dnscache.buckets = buckets;
+  g_dnscache.capacity = capacity;
+  g_dnscache.mask = nbuckets - 1;
+  g_dnscache.count = 0;
+  atomic_store_explicit(&g_dnscache.enabled, !!capacity,
+                        memory_order_release);
+  pthread_mutex_unlock(&g_dnscache.lock);
+  pthread_setcancelstate(cs, 0);
+  return 0;
+}
+
+/**
+ * Forgets every cached hostname, e.g. after the network changes.
+ *
+ * Queries that are in flight are unaffected.
+ */
+void dns_cache_flush(void) {
+  size_t i;
+  pthread_mutex_lock(&g_dnscache.lock);
+  for (i = 0; i < g_dnscache.capacity; ++i)
+    if (g_dnscache.entries[i].live && !g_dnscache.entries[i].pending)
+      dns_cache_remove(i);
+  pthread_mutex_unlock(&g_dnscache.lock);
+}
+
+/**
+ * Reports hostname cache counters.
+ *
+ * Counters accumulate from process start, across enable and flush.
+ */
+void dns_cache_stats(struct dns_cache_stats *st) {
+  pthread_mutex_lock(&g_dnscache.lock);
+  *st = g_dnscache.stats;
+  st->entries = g_dnscache.count;
+  st->capacity = g_dnscache.capacity;
+  pthread_mutex_unlock(&g_dnscache.lock);
+}
@@ -0,0 +1,21 @@
+#ifndef COSMOPOLITAN_THIRD_PARTY_MUSL_DNSCACHE_H_
+#define COSMOPOLITAN_THIRD_PARTY_MUSL_DNSCACHE_H_
+COSMOPOLITAN_C_START_
+
+struct dns_cache_stats {
+  uint64_t hits;          /* positive answers served from cache */
+  uint64_t negative_hits; /* nxdomain/nodata answers served from cache */
+  uint64_t misses;        /* lookups that went to hosts file and network */
+  uint64_t coalesced;     /* lookups that waited on an in-flight query */
+  uint64_t expired;       /* entries dropped because their ttl lapsed */
+  uint64_t evicted;       /* live entries dropped to make room */
+  size_t entries;
+  size_t capacity;
+};
+
+int dns_cache_enable(size_t) libcesque;
+void dns_cache_flush(void) libcesque;
+void dns_cache_stats(struct dns_cache_stats *) libcesque;
+
+COSMOPOLITAN_C_END_
+#endif /* COSMOPOLITAN_THIRD_PARTY_MUSL_DNSCACHE_H_ */
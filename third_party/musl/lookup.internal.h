@@ -33,6 +33,7 @@ struct resolvconf {
 	struct address ns[MAXNS];
 	unsigned nns, attempts, ndots;
 	unsigned timeout;
+	unsigned short port;
 };
 
 /* The limit of 48 results is a non-sharp bound on the number of addresses
@@ -47,6 +48,10 @@ int __lookup_ipliteral(struct address buf[static 1], const char *name, int famil
 int __get_resolv_conf(struct resolvconf *, char *, size_t);
 int __res_msend_rc(int, const unsigned char *const *, const int *, unsigned char *const *, int *, int, const struct resolvconf *);
 int __dns_parse(const unsigned char *, int, int (*)(void *, int, const void *, int, const void *, int), void *);
+int __dns_negative_ttl(const unsigned char *, int);
+
+typedef int dns_resolver_f(struct address *, char *, const char *, int, unsigned *);
+int __dns_cache_lookup(struct address buf[static MAXADDRS], char canon[static 256], const char *name, int family, dns_resolver_f *);
 
 COSMOPOLITAN_C_END_
 #endif /* COSMOPOLITAN_THIRD_PARTY_MUSL_LOOKUP_INTERNAL_H_ */
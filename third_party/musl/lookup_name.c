@@ -142,6 +142,7 @@ struct dpc_ctx {
 	char *canon;
 	int cnt;
 	int rrtype;
+	unsigned ttl;
 };
 
 #define RR_A 1
@@ -154,7 +155,14 @@ static int dns_parse_callback(void *c, int rr, const void *data, int len, const
 {
 	char tmp[256];
 	int family;
+	unsigned ttl;
 	struct dpc_ctx *ctx = c;
+	/* __dns_parse hands us rdata, which the ttl and rdlength precede */
+	ttl = (unsigned)((unsigned char *)data)[-6]<<24 |
+	      ((unsigned char *)data)[-5]<<16 |
+	      ((unsigned char *)data)[-4]<<8 |
+	      ((unsigned char *)data)[-3];
+	if (ttl < ctx->ttl) ctx->ttl = ttl;
 	if (rr == RR_CNAME) {
 		if (__dn_expand(packet, (const unsigned char *)packet + plen,
 		    data, tmp, sizeof tmp) > 0 && is_valid_hostname(tmp))
@@ -181,7 +189,7 @@ static int dns_parse_callback(void *c, int rr, const void *data, int len, const
 	return 0;
 }
 
-static int name_from_dns(struct address buf[static MAXADDRS], char canon[static 256], const char *name, int family, const struct resolvconf *conf)
+static int name_from_dns(struct address buf[static MAXADDRS], char canon[static 256], const char *name, int family, const struct resolvconf *conf, unsigned *ttl)
 {
 #pragma GCC push_options
 #pragma GCC diagnostic ignored "-Wframe-larger-than="
@@ -192,8 +200,8 @@ static int name_from_dns(struct address buf[static MAXADDRS], char canon[static
 	const unsigned char *qp[2] = { qbuf[0], qbuf[1] };
 	unsigned char *ap[2] = { abuf[0], abuf[1] };
 	int qlens[2], alens[2], qtypes[2];
-	int i, nq = 0;
-	struct dpc_ctx ctx = { .addrs = buf, .canon = canon };
+	int i, nq = 0, nttl;
+	struct dpc_ctx ctx = { .addrs = buf, .canon = canon, .ttl = *ttl };
 	const struct { int af; int rr; } afrr[2] = {
 		{ .af = AF_INET6, .rr = RR_A },
 		{ .af = AF_INET, .rr = RR_AAAA },
@@ -219,7 +227,12 @@ static int name_from_dns(struct address buf[static MAXADDRS], char canon[static
 
 	for (i=0; i<nq; i++) {
 		if (alens[i] < 4 || (abuf[i][3] & 15) == 2) return EAI_AGAIN;
-		if ((abuf[i][3] & 15) == 3) return 0;
+		if ((abuf[i][3] & 15) == 3) {
+			if (alens[i] > sizeof(abuf[i])) alens[i] = sizeof abuf[i];
+			nttl = __dns_negative_ttl(abuf[i], alens[i]);
+			if (nttl >= 0 && (unsigned)nttl < *ttl) *ttl = nttl;
+			return 0;
+		}
 		if ((abuf[i][3] & 15) != 0) return EAI_FAIL;
 	}
 
@@ -229,11 +242,18 @@ static int name_from_dns(struct address buf[static MAXADDRS], char canon[static
 		__dns_parse(abuf[i], alens[i], dns_parse_callback, &ctx);
 	}
 
-	if (ctx.cnt) return ctx.cnt;
+	if (ctx.cnt) {
+		*ttl = ctx.ttl;
+		return ctx.cnt;
+	}
+	for (i=0; i<nq; i++) {
+		nttl = __dns_negative_ttl(abuf[i], alens[i]);
+		if (nttl >= 0 && (unsigned)nttl < *ttl) *ttl = nttl;
+	}
 	return EAI_NODATA;
 }
 
-static int name_from_dns_search(struct address buf[static MAXADDRS], char canon[static 256], const char *name, int family)
+static int name_from_dns_search(struct address buf[static MAXADDRS], char canon[static 256], const char *name, int family, unsigned *ttl)
 {
 	char search[256];
 	struct resolvconf conf;
@@ -268,13 +288,27 @@ static int name_from_dns_search(struct address buf[static MAXADDRS], char canon[
 		if (z-p < 256 - l - 1) {
 			memcpy(canon+l+1, p, z-p);
 			canon[z-p+1+l] = 0;
-			int cnt = name_from_dns(buf, canon, canon, family, &conf);
+			int cnt = name_from_dns(buf, canon, canon, family, &conf, ttl);
 			if (cnt) return cnt;
 		}
 	}
 
 	canon[l] = 0;
-	return name_from_dns(buf, canon, name, family, &conf);
+	return name_from_dns(buf, canon, name, family, &conf, ttl);
+}
+
+/* How long a name answered by /etc/hosts may be served from the cache
+ * before the hosts file is consulted again. */
+#define HOSTS_TTL 10
+
+static int name_from_network(struct address buf[static MAXADDRS], char canon[static 256], const char *name, int family, unsigned *ttl)
+{
+	int cnt = name_from_hosts(buf, canon, name, family);
+	if (cnt) {
+		if (*ttl > HOSTS_TTL) *ttl = HOSTS_TTL;
+		return cnt;
+	}
+	return name_from_dns_search(buf, canon, name, family, ttl);
 }
 
 static const struct policy {
@@ -376,8 +410,7 @@ int __lookup_name(struct address buf[static MAXADDRS], char canon[static 256], c
 	cnt = name_from_null(buf, name, family, flags);
 	if (!cnt) cnt = name_from_numeric(buf, name, family);
 	if (!cnt && !(flags & AI_NUMERICHOST)) {
-		cnt = name_from_hosts(buf, canon, name, family);
-		if (!cnt) cnt = name_from_dns_search(buf, canon, name, family);
+		cnt = __dns_cache_lookup(buf, canon, name, family, name_from_network);
 	}
 	if (cnt<=0) return cnt ? cnt : EAI_NONAME;
 
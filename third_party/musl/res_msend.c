@@ -142,12 +142,12 @@ int __res_msend_rc(int nqueries, const unsigned char *const *queries,
 		const struct address *iplit = &conf->ns[nns];
 		if (iplit->family == AF_INET) {
 			memcpy(&ns[nns].sin.sin_addr, iplit->addr, 4);
-			ns[nns].sin.sin_port = htons(53);
+			ns[nns].sin.sin_port = htons(conf->port);
 			ns[nns].sin.sin_family = AF_INET;
 		} else {
 			sl = sizeof sa.sin6;
 			memcpy(&ns[nns].sin6.sin6_addr, iplit->addr, 16);
-			ns[nns].sin6.sin6_port = htons(53);
+			ns[nns].sin6.sin6_port = htons(conf->port);
 			ns[nns].sin6.sin6_scope_id = iplit->scopeid;
 			ns[nns].sin6.sin6_family = family = AF_INET6;
 		}
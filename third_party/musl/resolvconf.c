@@ -114,6 +114,7 @@ int __get_resolv_conf(struct resolvconf *conf, char *search, size_t search_sz)
 	conf->ndots = 1;
 	conf->timeout = 5;
 	conf->attempts = 2;
+	conf->port = 53;
 	if (search) *search = 0;
 
 	f = fopen("/etc/resolv.conf", "rbe");
@@ -8048,6 +8048,9 @@ int sqlite3_os_init(void){
   }
 #ifdef SQLITE_OS_KV_OPTIONAL
   sqlite3KvvfsInit();
+#endif
+#ifdef __COSMOPOLITAN__
+  sqlite3ZiposInit();
 #endif
   unixBigLock = sqlite3MutexAlloc(SQLITE_MUTEX_STATIC_VFS1);
 
@@ -0,0 +1,254 @@
+/*-*- mode:c;indent-tabs-mode:nil;c-basic-offset:2;tab-width:8;coding:utf-8 -*-│
+│ vi: set et ft=c ts=2 sts=2 sw=2 fenc=utf-8                               :vi │
+╞══════════════════════════════════════════════════════════════════════════════╡
+│ Copyright 2024 Justine Alexandra Roberts Tunney                              │
+│                                                                              │
+│ Permission to use, copy, modify, and/or distribute this software for         │
+│ any purpose with or without fee is hereby granted, provided that the         │
+│ above copyright notice and this permission notice appear in all copies.      │
+│                                                                              │
+│ THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL                │
+│ WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED                │
+│ WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE             │
+│ AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL         │
+│ DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR        │
+│ PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER               │
+│ TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR             │
+│ PERFORMANCE OF THIS SOFTWARE.                                                │
+╚─────────────────────────────────────────────────────────────────────────────*/
+#include "libc/macros.h"
+#include "libc/runtime/zipos.internal.h"
+#include "libc/str/str.h"
+#include "libc/zip.h"
+#include "third_party/sqlite3/sqlite3.h"
+
+/**
+ * @fileoverview read-only sqlite vfs for databases stored in /zip
+ *
+ * The "zipos" vfs opens a main database file that was added to the
+ * executable with `zip -0` (i.e. stored, not deflated) and serves it
+ * straight out of the image zipos already has mapped. Reads are just
+ * memcpy() and xFetch() hands the pager pointers into the mapping, so
+ * nothing is copied at all once memory-mapped i/o is turned on. Since
+ * the mapping is shared and read-only, forked workers share its pages
+ * with the process that opened the database. For example:
+ *
+ *     sqlite3_open_v2("file:/zip/geo.db?vfs=zipos", &db,
+ *                     SQLITE_OPEN_READONLY | SQLITE_OPEN_URI, 0);
+ *     sqlite3_exec(db, "PRAGMA mmap_size=268435456", 0, 0, 0);
+ *
+ * The pager only calls xFetch() when mmap_size is nonzero, which is why
+ * that pragma is recommended. Opening read-write is quietly downgraded
+ * to read-only. Opening a deflated entry fails with SQLITE_CANTOPEN,
+ * since there's nothing to map. Names outside /zip, journals, and
+ * temporary files are passed along to the default vfs.
+ *
+ * WAL mode isn't supported, because there's no xShmMap() for the
+ * wal-index, so databases should be put in rollback journal mode
+ * (e.g. `PRAGMA journal_mode=DELETE`) before they're zipped.
+ */
+
+struct ZiposFile {
+  sqlite3_file base;
+  const unsigned char *data;
+  sqlite3_int64 size;
+};
+
+static sqlite3_vfs *g_zipos_parent;
+
+static int ZiposClose(sqlite3_file *file) {
+  return SQLITE_OK;
+}
+
+static int ZiposRead(sqlite3_file *file, void *buf, int amt,
+                     sqlite3_int64 off) {
+  struct ZiposFile *f = (struct ZiposFile *)file;
+  sqlite3_int64 got;
+  if (off >= f->size) {
+    got = 0;
+  } else if (amt > f->size - off) {
+    got = f->size - off;
+  } else {
+    got = amt;
+  }
+  memcpy(buf, f->data + off, got);
+  if (got == amt)
+    return SQLITE_OK;
+  bzero((char *)buf + got, amt - got);
+  return SQLITE_IOERR_SHORT_READ;
+}
+
+static int ZiposWrite(sqlite3_file *file, const void *buf, int amt,
+                      sqlite3_int64 off) {
+  return SQLITE_READONLY;
+}
+
+static int ZiposTruncate(sqlite3_file *file, sqlite3_int64 size) {
+  return SQLITE_READONLY;
+}
+
+static int ZiposSync(sqlite3_file *file, int flags) {
+  return SQLITE_OK;
+}
+
+static int ZiposFileSize(sqlite3_file *file, sqlite3_int64 *size) {
+  *size = ((struct ZiposFile *)file)->size;
+  return SQLITE_OK;
+}
+
+static int ZiposLock(sqlite3_file *file, int lock) {
+  return SQLITE_OK;
+}
+
+static int ZiposCheckReservedLock(sqlite3_file *file, int *out) {
+  *out = 0;
+  return SQLITE_OK;
+}
+
+static int ZiposFileControl(sqlite3_file *file, int op, void *arg) {
+  return SQLITE_NOTFOUND;
+}
+
+static int ZiposSectorSize(sqlite3_file *file) {
+  return 512;
+}
+
+static int ZiposDeviceCharacteristics(sqlite3_file *file) {
+  return SQLITE_IOCAP_IMMUTABLE;
+}
+
+static int ZiposFetch(sqlite3_file *file, sqlite3_int64 off, int amt,
+                      void **out) {
+  struct ZiposFile *f = (struct ZiposFile *)file;
+  if (off >= 0 && amt <= f->size - off) {
+    *out = (void *)(f->data + off);
+  } else {
+    *out = 0;
+  }
+  return SQLITE_OK;
+}
+
+static int ZiposUnfetch(sqlite3_file *file, sqlite3_int64 off, void *p) {
+  return SQLITE_OK;
+}
+
+static const sqlite3_io_methods kZiposIoMethods = {
+    .iVersion = 3,
+    .xClose = ZiposClose,
+    .xRead = ZiposRead,
+    .xWrite = ZiposWrite,
+    .xTruncate = ZiposTruncate,
+    .xSync = ZiposSync,
+    .xFileSize = ZiposFileSize,
+    .xLock = ZiposLock,
+    .xUnlock = ZiposLock,
+    .xCheckReservedLock = ZiposCheckReservedLock,
+    .xFileControl = ZiposFileControl,
+    .xSectorSize = ZiposSectorSize,
+    .xDeviceCharacteristics = ZiposDeviceCharacteristics,
+    .xFetch = ZiposFetch,
+    .xUnfetch = ZiposUnfetch,
+};
+
+// finds content of stored /zip entry, returning SQLITE_NOTFOUND if
+// `name` isn't in /zip, or SQLITE_CANTOPEN if it's been compressed
+static int ZiposFind(const char *name, const unsigned char **out_data,
+                     sqlite3_int64 *out_size) {
+  ssize_t cf;
+  size_t lf;
+  struct Zipos *z;
+  struct ZiposUri uri;
+  if (!name || __zipos_parseuri(name, &uri) == -1)
+    return SQLITE_NOTFOUND;
+  if (!(z = __zipos_get()))
+    return SQLITE_NOTFOUND;
+  if ((cf = __zipos_find(z, &uri)) == -1 || cf == ZIPOS_SYNTHETIC_DIRECTORY)
+    return SQLITE_NOTFOUND;
+  lf = GetZipCfileOffset(z->map + cf);
+  if (ZIP_LFILE_COMPRESSIONMETHOD(z->map + lf) != kZipCompressionNone) {
+    sqlite3_log(SQLITE_CANTOPEN, "%s isn't stored uncompressed (try zip -0)",
+                name);
+    return SQLITE_CANTOPEN;
+  }
+  *out_size = GetZipLfileUncompressedSize(z->map + lf);
+  *out_data = ZIP_LFILE_CONTENT(z->map + lf);
+  return SQLITE_OK;
+}
+
+static int ZiposOpen(sqlite3_vfs *vfs, const char *name, sqlite3_file *file,
+                     int flags, int *out_flags) {
+  int rc;
+  struct ZiposFile *f = (struct ZiposFile *)file;
+  if (!(flags & SQLITE_OPEN_MAIN_DB) ||
+      (rc = ZiposFind(name, &f->data, &f->size)) == SQLITE_NOTFOUND)
+    return g_zipos_parent->xOpen(g_zipos_parent, name, file, flags, out_flags);
+  if (rc != SQLITE_OK) {
+    f->base.pMethods = 0;
+    return rc;
+  }
+  if (out_flags)
+    *out_flags = (flags & ~(SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE)) |
+                 SQLITE_OPEN_READONLY;
+  f->base.pMethods = &kZiposIoMethods;
+  return SQLITE_OK;
+}
+
+static int ZiposDelete(sqlite3_vfs *vfs, const char *name, int syncdir) {
+  return g_zipos_parent->xDelete(g_zipos_parent, name, syncdir);
+}
+
+static int ZiposAccess(sqlite3_vfs *vfs, const char *name, int flags,
+                       int *out) {
+  return g_zipos_parent->xAccess(g_zipos_parent, name, flags, out);
+}
+
+static int ZiposFullPathname(sqlite3_vfs *vfs, const char *name, int size,
+                             char *out) {
+  return g_zipos_parent->xFullPathname(g_zipos_parent, name, size, out);
+}
+
+static int ZiposRandomness(sqlite3_vfs *vfs, int size, char *out) {
+  return g_zipos_parent->xRandomness(g_zipos_parent, size, out);
+}
+
+static int ZiposSleep(sqlite3_vfs *vfs, int micros) {
+  return g_zipos_parent->xSleep(g_zipos_parent, micros);
+}
+
+static int ZiposCurrentTime(sqlite3_vfs *vfs, double *out) {
+  return g_zipos_parent->xCurrentTime(g_zipos_parent, out);
+}
+
+static int ZiposGetLastError(sqlite3_vfs *vfs, int size, char *out) {
+  return g_zipos_parent->xGetLastError(g_zipos_parent, size, out);
+}
+
+static int ZiposCurrentTimeInt64(sqlite3_vfs *vfs, sqlite3_int64 *out) {
+  return g_zipos_parent->xCurrentTimeInt64(g_zipos_parent, out);
+}
+
+static sqlite3_vfs g_zipos_vfs = {
+    .iVersion = 2,
+    .zName = "zipos",
+    .xOpen = ZiposOpen,
+    .xDelete = ZiposDelete,
+    .xAccess = ZiposAccess,
+    .xFullPathname = ZiposFullPathname,
+    .xRandomness = ZiposRandomness,
+    .xSleep = ZiposSleep,
+    .xCurrentTime = ZiposCurrentTime,
+    .xGetLastError = ZiposGetLastError,
+    .xCurrentTimeInt64 = ZiposCurrentTimeInt64,
+};
+
+/**
+ * Registers "zipos" vfs, which is called by sqlite3_os_init().
+ */
+int sqlite3ZiposInit(void) {
+  if (!(g_zipos_parent = sqlite3_vfs_find(0)))
+    return SQLITE_ERROR;
+  g_zipos_vfs.mxPathname = g_zipos_parent->mxPathname;
+  g_zipos_vfs.szOsFile = MAX(sizeof(struct ZiposFile),
+                             (size_t)g_zipos_parent->szOsFile);
+  return sqlite3_vfs_register(&g_zipos_vfs, 0);
+}
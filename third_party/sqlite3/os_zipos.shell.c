@@ -0,0 +1 @@
+#include "third_party/sqlite3/os_zipos.c"
@@ -5499,5 +5499,8 @@ const char **sqlite3CompileOptions(int *pnOpt);
 #if SQLITE_OS_UNIX && defined(SQLITE_OS_KV_OPTIONAL)
 int sqlite3KvvfsInit(void);
 #endif
+#if SQLITE_OS_UNIX && defined(__COSMOPOLITAN__)
+int sqlite3ZiposInit(void);
+#endif
 
 #endif /* SQLITEINT_H */
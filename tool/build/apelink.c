@@ -32,6 +32,7 @@
 #include "libc/limits.h"
 #include "libc/macho.h"
 #include "libc/macros.h"
+#include "libc/mem/alg.h"
 #include "libc/mem/mem.h"
 #include "libc/nt/pedef.internal.h"
 #include "libc/nt/struct/imageimportbyname.internal.h"
@@ -223,6 +224,7 @@ struct Loaders {
 struct Asset {
   unsigned char *cfile;
   unsigned char *lfile;
+  int align;  // of content, or 0 if it doesn't matter
 };
 
 struct Assets {
@@ -634,12 +636,14 @@ static bool IsSymbolWorthyOfSymtab(Elf64_Sym *sym) {
                               ELF64_ST_TYPE(sym->st_info) == STT_OBJECT);
 }
 
-static void AppendZipAsset(unsigned char *lfile, unsigned char *cfile) {
+static void AppendZipAsset(unsigned char *lfile, unsigned char *cfile,
+                           int align) {
   if (assets.n == 65534)
     Die(outpath, "fat binary has >65534 zip assets");
   assets.p = Realloc(assets.p, (assets.n + 1) * sizeof(*assets.p));
   assets.p[assets.n].cfile = cfile;
   assets.p[assets.n].lfile = lfile;
+  assets.p[assets.n].align = align;
   assets.total_local_file_bytes += ZIP_LFILE_SIZE(lfile);
   assets.total_centraldir_bytes += ZIP_CFILE_HDRSIZE(cfile);
   ++assets.n;
@@ -663,10 +667,6 @@ static void *Compress(const void *data, size_t size, size_t *out_size, int wb) {
   return res;
 }
 
-static void *Deflate(const void *data, size_t size, size_t *out_size) {
-  return Compress(data, size, out_size, -MAX_WBITS);
-}
-
 static void *Gzip(const void *data, size_t size, size_t *out_size) {
   return Compress(data, size, out_size, MAX_WBITS + 16);
 }
@@ -679,8 +679,12 @@ static void LoadSymbols(Elf64_Ehdr *e, Elf64_Off size, const char *path) {
     Die(path, "could not load elf symbol table");
   st->names = 0;      // make this deterministic
   st->name_base = 0;  // ready for serialization
-  size_t data_size;
-  void *data = Deflate(st, st->size, &data_size);
+  st->symbols = 0;
+  st->index = 0;
+  // the symbol table is stored rather than deflated, so the runtime
+  // can use it in place from the executable's memory mapping
+  size_t data_size = st->size;
+  void *data = st;
   uint32_t crc = crc32_z(0, st, st->size);
   size_t cfile_size = kZipCfileHdrMinSize + name_size;
   unsigned char *cfile = Malloc(cfile_size);
@@ -690,7 +694,7 @@ static void LoadSymbols(Elf64_Ehdr *e, Elf64_Off size, const char *path) {
             kZipOsUnix << 8 | kZipCosmopolitanVersion);
   WRITE16LE(cfile + kZipCfileOffsetVersionNeeded, kZipEra2001);
   WRITE16LE(cfile + kZipCfileOffsetGeneralflag, kZipGflagUtf8);
-  WRITE16LE(cfile + kZipCfileOffsetCompressionmethod, kZipCompressionDeflate);
+  WRITE16LE(cfile + kZipCfileOffsetCompressionmethod, kZipCompressionNone);
   WRITE16LE(cfile + kZipCfileOffsetLastmodifieddate, DOS_DATE(2023, 7, 29));
   WRITE16LE(cfile + kZipCfileOffsetLastmodifiedtime, DOS_TIME(0, 0, 0));
   WRITE32LE(cfile + kZipCfileOffsetCompressedsize, data_size);
@@ -705,7 +709,7 @@ static void LoadSymbols(Elf64_Ehdr *e, Elf64_Off size, const char *path) {
   WRITE32LE(lfile, kZipLfileHdrMagic);
   WRITE16LE(lfile + kZipLfileOffsetVersionNeeded, kZipEra2001);
   WRITE16LE(lfile + kZipLfileOffsetGeneralflag, kZipGflagUtf8);
-  WRITE16LE(lfile + kZipLfileOffsetCompressionmethod, kZipCompressionDeflate);
+  WRITE16LE(lfile + kZipLfileOffsetCompressionmethod, kZipCompressionNone);
   WRITE16LE(lfile + kZipLfileOffsetLastmodifieddate, DOS_DATE(2023, 7, 29));
   WRITE16LE(lfile + kZipLfileOffsetLastmodifiedtime, DOS_TIME(0, 0, 0));
   WRITE32LE(lfile + kZipLfileOffsetCompressedsize, data_size);
@@ -715,8 +719,8 @@ static void LoadSymbols(Elf64_Ehdr *e, Elf64_Off size, const char *path) {
   memcpy(lfile + kZipLfileHdrMinSize, name, name_size);
   memcpy(lfile + kZipLfileHdrMinSize + name_size, data, data_size);
   unassert(ZIP_LFILE_SIZE(lfile) == lfile_size);
-  free(data);
-  AppendZipAsset(lfile, cfile);
+  CloseSymbolTable(&st);
+  AppendZipAsset(lfile, cfile, 4096);
 }
 
 // resolves portable executable relative virtual address
@@ -1805,11 +1809,42 @@ static void IndexZipAssetsFromElf(struct Input *in) {
       Die(in->path, "zip local file content overlaps image eof");
     }
     if (!IsZipFileNamed(lfile, ".symtab") && !HasZipAsset(lfile)) {
-      AppendZipAsset(lfile, cfile);
+      AppendZipAsset(lfile, cfile, 0);
     }
   }
 }
 
+// orders assets the same way as __zipos_compare_names()
+static int CompareZipAssetNames(const void *a, const void *b) {
+  const unsigned char *x = ((const struct Asset *)a)->cfile;
+  const unsigned char *y = ((const struct Asset *)b)->cfile;
+  int xn = ZIP_CFILE_NAMESIZE(x);
+  int yn = ZIP_CFILE_NAMESIZE(y);
+  int c = memcmp(ZIP_CFILE_NAME(x), ZIP_CFILE_NAME(y), MIN(xn, yn));
+  return c ? c : xn - yn;
+}
+
+// pads local file extra field so asset content is aligned in output
+static void AlignZipAsset(struct Asset *asset, Elf64_Off offset) {
+  unsigned char *lfile = asset->lfile;
+  size_t hdrsize = ZIP_LFILE_HDRSIZE(lfile);
+  size_t pad = -(offset + hdrsize) & (asset->align - 1);
+  if (!pad)
+    return;
+  if (pad < kZipExtraHdrSize)
+    pad += asset->align;
+  size_t content = ZIP_LFILE_SIZE(lfile) - hdrsize;
+  unsigned char *p = Malloc(ZIP_LFILE_SIZE(lfile) + pad);
+  memcpy(p, lfile, hdrsize);
+  WRITE16LE(p + kZipLfileOffsetExtrasize, ZIP_LFILE_EXTRASIZE(lfile) + pad);
+  bzero(p + hdrsize, pad);
+  WRITE16LE(p + hdrsize, kZipExtraAlignment);
+  WRITE16LE(p + hdrsize + 2, pad - kZipExtraHdrSize);
+  memcpy(p + hdrsize + pad, lfile + hdrsize, content);
+  asset->lfile = p;
+  assets.total_local_file_bytes += pad;
+}
+
 static void CopyZips(Elf64_Off offset) {
   int i;
   for (i = 0; i < inputs.n; ++i) {
@@ -1821,6 +1856,12 @@ static void CopyZips(Elf64_Off offset) {
   if (!assets.n) {
     return;  // nothing to do
   }
+  Elf64_Off ap = offset;
+  for (i = 0; i < assets.n; ++i) {
+    if (assets.p[i].align)
+      AlignZipAsset(assets.p + i, ap);
+    ap += ZIP_LFILE_SIZE(assets.p[i].lfile);
+  }
   if (offset + assets.total_local_file_bytes + assets.total_centraldir_bytes +
           kZipCdirHdrMinSize >
       INT_MAX) {
@@ -1835,10 +1876,15 @@ static void CopyZips(Elf64_Off offset) {
     unsigned char *lfile = assets.p[i].lfile;
     Pwrite(lfile, ZIP_LFILE_SIZE(lfile), lp);
     lp += ZIP_LFILE_SIZE(lfile);
+  }
+  unassert(lp == midpoint);
+  // sort central directory by name so zipos can use it as its index
+  qsort(assets.p, assets.n, sizeof(*assets.p), CompareZipAssetNames);
+  for (i = 0; i < assets.n; ++i) {
+    unsigned char *cfile = assets.p[i].cfile;
     Pwrite(cfile, ZIP_CFILE_HDRSIZE(cfile), cp);
     cp += ZIP_CFILE_HDRSIZE(cfile);
   }
-  unassert(lp == midpoint);
   unsigned char eocd[kZipCdirHdrMinSize] = {0};
   WRITE32LE(eocd, kZipCdirHdrMagic);
   WRITE32LE(eocd + kZipCdirRecordsOnDiskOffset, assets.n);
@@ -50,6 +50,7 @@
 #include "libc/runtime/runtime.h"
 #include "libc/serialize.h"
 #include "libc/stdio/append.h"
+#include "libc/str/blake2.h"
 #include "libc/str/str.h"
 #include "libc/sysv/consts/auxv.h"
 #include "libc/sysv/consts/clock.h"
@@ -133,6 +134,8 @@ ENVIRONMENT\n\
   V=4          print command w/ wall+cpu+mem usage\n\
   V=5          print output when exitcode is zero\n\
   COLUMNS=INT  explicitly set terminal width for output truncation\n\
+  COMPILE_CACHE=DIR\n\
+               reuse objects compiled from same inputs, e.g. o/cache\n\
   TERM=dumb    disable ansi x3.64 sequences and thousands separators\n\
 \n"
 
@@ -151,6 +154,7 @@ bool wantpg;
 bool wantnop;
 bool isclang;
 bool wantnopg;
+bool cachehit;
 bool wantasan;
 bool wantframe;
 bool wantubsan;
@@ -188,6 +192,7 @@ char *output;
 char *outpath;
 char *command;
 char *movepath;
+char *cachedir;
 char *shortened;
 char *colorflag;
 char ccpath[PATH_MAX];
@@ -206,6 +211,7 @@ sigset_t mask;
 char buf[4096];
 sigset_t savemask;
 char tmpout[PATH_MAX];
+char cachepath[PATH_MAX];
 posix_spawnattr_t spawnattr;
 posix_spawn_file_actions_t spawnfila;
 
@@ -846,6 +852,137 @@ char *MakeTmpOut(const char *path) {
   return tmpout;
 }
 
+// returns true if command compiles one file to an object and nothing else
+bool IsCacheable(void) {
+  int i;
+  bool compiling = false;
+  if (!iscc || !movepath)
+    return false;
+  for (i = 1; i < args.n; ++i) {
+    if (!strcmp(args.p[i], "-c")) {
+      compiling = true;
+    } else if (startswith(args.p[i], "-M") ||           // writes deps
+               startswith(args.p[i], "-save-temps") ||  // writes temps
+               startswith(args.p[i], "-Wa,-a") ||       // writes listing
+               !strcmp(args.p[i], "-fsave-optimization-record") ||
+               !strcmp(args.p[i], "-E") ||
+               !strcmp(args.p[i], "assembler") ||  // -x assembler
+               (args.p[i][0] != '-' && endswith(args.p[i], ".s"))) {
+      return false;  // isn't preprocessed, so we can't hash it
+    }
+  }
+  return compiling;
+}
+
+// hashes everything which determines what the compiler will output,
+// i.e. compiler binary, arguments, environment, and the source after
+// it's been preprocessed, so that changes to headers are noticed too
+bool HashCompilation(uint8_t digest[BLAKE2B256_DIGEST_LENGTH]) {
+  int i, ws, pid, fds[2];
+  ssize_t rc;
+  bool incbin;
+  char seam[10];
+  const char *s;
+  struct stat cc;
+  struct Blake2b h;
+  struct Strings pp = {0};
+  posix_spawn_file_actions_t fa;
+  if (stat(cmd, &cc))
+    return false;
+  BLAKE2B256_Init(&h);
+  BLAKE2B256_Update(&h, cmd, strlen(cmd) + 1);
+  BLAKE2B256_Update(&h, &cc.st_size, sizeof(cc.st_size));
+  BLAKE2B256_Update(&h, &cc.st_mtim, sizeof(cc.st_mtim));
+  for (i = 0; i < args.n; ++i) {
+    s = args.p[i] == g_tmpout ? "" : args.p[i];
+    BLAKE2B256_Update(&h, s, strlen(s) + 1);
+  }
+  for (i = 0; i < env.n; ++i)
+    BLAKE2B256_Update(&h, env.p[i], strlen(env.p[i]) + 1);
+  for (i = 0; i < args.n; ++i) {
+    if (!strcmp(args.p[i], "-c")) {
+      AddStr(&pp, "-E");
+    } else if (!strcmp(args.p[i], "-o") && i + 1 < args.n) {
+      AddStr(&pp, "-o");
+      AddStr(&pp, "-");
+      ++i;
+    } else {
+      AddStr(&pp, args.p[i]);
+    }
+  }
+  if (pipe2(fds, O_CLOEXEC) == -1) {
+    free(pp.p);
+    return false;
+  }
+  posix_spawn_file_actions_init(&fa);
+  posix_spawn_file_actions_adddup2(&fa, fds[1], 1);
+  posix_spawn_file_actions_addopen(&fa, 2, "/dev/null", O_WRONLY, 0);
+  rc = posix_spawn(&pid, cmd, &fa, 0, pp.p, env.p);
+  posix_spawn_file_actions_destroy(&fa);
+  close(fds[1]);
+  free(pp.p);
+  if (rc) {
+    close(fds[0]);
+    return false;
+  }
+  // inline assembly may .incbin files whose content we can't see
+  incbin = false;
+  bzero(seam, sizeof(seam));
+  while ((rc = read(fds[0], buf, sizeof(buf))) > 0 ||
+         (rc == -1 && errno == EINTR)) {
+    if (rc <= 0)
+      continue;
+    BLAKE2B256_Update(&h, buf, rc);
+    memcpy(seam + 5, buf, MIN(rc, 5));
+    if (memmem(seam, 5 + MIN(rc, 5), "incbin", 6) ||
+        memmem(buf, rc, "incbin", 6))
+      incbin = true;
+    if (rc >= 5)
+      memcpy(seam, buf + rc - 5, 5);
+  }
+  close(fds[0]);
+  while (waitpid(pid, &ws, 0) == -1)
+    if (errno != EINTR)
+      return false;
+  if (rc || incbin || !WIFEXITED(ws) || WEXITSTATUS(ws))
+    return false;
+  BLAKE2B256_Final(&h, digest);
+  return true;
+}
+
+// copies object from cache, if it was built before with the same inputs
+void ConsultCache(void) {
+  int i;
+  char *p;
+  uint8_t digest[BLAKE2B256_DIGEST_LENGTH];
+  if (!IsCacheable() || !HashCompilation(digest))
+    return;
+  p = cachepath;
+  p = stpcpy(p, cachedir);
+  *p++ = '/';
+  for (i = 0; i < BLAKE2B256_DIGEST_LENGTH; ++i) {
+    if (i == 1)
+      *p++ = '/';
+    *p++ = "0123456789abcdef"[digest[i] >> 4];
+    *p++ = "0123456789abcdef"[digest[i] & 15];
+  }
+  stpcpy(p, ".o");
+  cachehit = MovePreservingDestinationInode(cachepath, tmpout);
+}
+
+// adds object we just built to cache, atomically
+void UpdateCache(void) {
+  char tmp[PATH_MAX + 16];
+  if (!*cachepath || cachehit)
+    return;
+  MakeDirs(xdirname(cachepath), 0755);
+  snprintf(tmp, sizeof(tmp), "%s.%d", cachepath, getpid());
+  if (MovePreservingDestinationInode(tmpout, tmp) &&
+      !rename(tmp, cachepath))
+    return;
+  unlink(tmp);
+}
+
 int main(int argc, char *argv[]) {
   uint64_t us;
   bool isineditor;
@@ -1224,6 +1361,10 @@ int main(int argc, char *argv[]) {
     open("/dev/null", O_RDONLY);
   }
 
+  // don't run the compiler if we've already seen what it will output
+  if ((cachedir = getenv("COMPILE_CACHE")) && *cachedir)
+    ConsultCache();
+
   // SIGINT (CTRL-C) and SIGQUIT (CTRL-\) are delivered to the child
   // process, so we should ignore it and wait for the child to die.
   // SIGPIPE shouldn't happen until the very end since we buffer so it
@@ -1247,7 +1388,11 @@ int main(int argc, char *argv[]) {
   }
 
   // run command
-  ws = Launch();
+  if (cachehit) {
+    ws = 0;
+  } else {
+    ws = Launch();
+  }
 
   // propagate exit
   if (ws != -1) {
@@ -1261,6 +1406,8 @@ int main(int argc, char *argv[]) {
           }
         }
         if (movepath) {
+          if (!exitcode)
+            UpdateCache();
           if (!MovePreservingDestinationInode(tmpout, movepath)) {
             unlink(tmpout);
             exitcode = 90;
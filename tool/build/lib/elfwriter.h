@@ -74,6 +74,12 @@ void elfwriter_setsection(struct ElfWriter *, struct ElfWriterSymRef, uint16_t);
 void elfwriter_zip(struct ElfWriter *, const char *, const char *, size_t,
                    const void *, size_t, uint32_t, struct timespec,
                    struct timespec, struct timespec, bool);
+void *elfwriter_zip_compress(const char *, size_t, const void *, size_t, bool,
+                             int, size_t *);
+void elfwriter_zip_deflated(struct ElfWriter *, const char *, const char *,
+                            size_t, const void *, size_t, const void *, size_t,
+                            uint32_t, struct timespec, struct timespec,
+                            struct timespec);
 
 COSMOPOLITAN_C_END_
 #endif /* COSMOPOLITAN_TOOL_BUILD_LIB_ELFWRITER_H_ */
@@ -25,6 +25,7 @@
 #include "libc/mem/mem.h"
 #include "libc/nexgen32e/crc32.h"
 #include "libc/nt/enum/fileflagandattributes.h"
+#include "libc/runtime/runtime.h"
 #include "libc/runtime/zipos.internal.h"
 #include "libc/serialize.h"
 #include "libc/stdio/rand.h"
@@ -37,6 +38,7 @@
 #include "net/http/http.h"
 #include "third_party/zlib/zlib.h"
 #include "tool/build/lib/elfwriter.h"
+#include "tool/build/lib/pdeflate.h"
 
 #define ZIP_CFILE_HDR_SIZE (kZipCfileHdrMinSize + 36)
 
@@ -137,6 +139,39 @@ static void EmitZipCdirHdr(unsigned char *p, const void *name, size_t namesize,
   p = WRITE64LE(p, ct);
 }
 
+/**
+ * Deflates zip file content, if it's worth compressing.
+ *
+ * This function doesn't touch the elf writer, so it may be called for
+ * many files at once from separate threads.
+ *
+ * @param threads is how many threads may deflate a large file
+ * @param out_compsize receives size of deflated data
+ * @return raw deflate stream to be freed by caller, or null if the
+ *     content should be stored uncompressed
+ */
+void *elfwriter_zip_compress(const char *cname, size_t namesize,
+                             const void *data, size_t size, bool nocompress,
+                             int threads, size_t *out_compsize) {
+  bool ok;
+  void *res;
+  char *name;
+  size_t compsize;
+  CHECK_NOTNULL((name = strndup(cname, namesize)));
+  namesize = __zipos_normpath(name, name, strlen(name) + 1);
+  ok = ShouldCompress(name, namesize, data, size, nocompress);
+  free(name);
+  if (!ok)
+    return 0;
+  res = pdeflate(data, size, Z_DEFAULT_COMPRESSION, threads, &compsize);
+  if (compsize >= size) {
+    free(res);
+    return 0;
+  }
+  *out_compsize = compsize;
+  return res;
+}
+
 /**
  * Embeds zip file in elf object.
  */
@@ -144,7 +179,26 @@ void elfwriter_zip(struct ElfWriter *elf, const char *symbol, const char *cname,
                    size_t namesize, const void *data, size_t size,
                    uint32_t mode, struct timespec mtim, struct timespec atim,
                    struct timespec ctim, bool nocompress) {
-  z_stream zs;
+  void *deflated;
+  size_t deflatedsize = 0;
+  deflated = elfwriter_zip_compress(cname, namesize, data, size, nocompress,
+                                    __get_cpu_count(), &deflatedsize);
+  elfwriter_zip_deflated(elf, symbol, cname, namesize, data, size, deflated,
+                         deflatedsize, mode, mtim, atim, ctim);
+  free(deflated);
+}
+
+/**
+ * Embeds zip file in elf object, that was compressed ahead of time.
+ *
+ * @param deflated is from elfwriter_zip_compress(), or null to store
+ */
+void elfwriter_zip_deflated(struct ElfWriter *elf, const char *symbol,
+                            const char *cname, size_t namesize,
+                            const void *data, size_t size,
+                            const void *deflated, size_t deflatedsize,
+                            uint32_t mode, struct timespec mtim,
+                            struct timespec atim, struct timespec ctim) {
   uint8_t era;
   uint32_t crc;
   unsigned char *lfile, *cfile;
@@ -175,36 +229,18 @@ void elfwriter_zip(struct ElfWriter *elf, const char *symbol, const char *cname,
   if (S_ISREG(mode) && istext(data, size)) {
     iattrs |= kZipIattrText;
   }
-  method = ShouldCompress(name, namesize, data, size, nocompress)
-               ? kZipCompressionDeflate
-               : kZipCompressionNone;
+  if (deflated) {
+    method = kZipCompressionDeflate;
+    compsize = deflatedsize;
+  } else {
+    method = kZipCompressionNone;
+  }
 
   /* emit embedded file content w/ pkzip local file header */
   elfwriter_align(elf, 1, 0);
   elfwriter_startsection(elf, ".zip.file", SHT_PROGBITS, 0);
-  if (method == kZipCompressionDeflate) {
-    CHECK_EQ(Z_OK, deflateInit2(memset(&zs, 0, sizeof(zs)),
-                                Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS,
-                                MAX_MEM_LEVEL, Z_DEFAULT_STRATEGY));
-    zs.next_in = data;
-    zs.avail_in = uncompsize;
-    zs.next_out = ((lfile = elfwriter_reserve(
-                        elf, (lfilehdrsize +
-                              (zs.avail_out = compressBound(uncompsize))))) +
-                   lfilehdrsize);
-    CHECK_EQ(Z_STREAM_END, deflate(&zs, Z_FINISH));
-    CHECK_EQ(Z_OK, deflateEnd(&zs));
-    if (zs.total_out < uncompsize) {
-      compsize = zs.total_out;
-    } else {
-      method = kZipCompressionNone;
-    }
-  } else {
-    lfile = elfwriter_reserve(elf, lfilehdrsize + uncompsize);
-  }
-  if (method == kZipCompressionNone) {
-    memcpy(lfile + lfilehdrsize, data, uncompsize);
-  }
+  lfile = elfwriter_reserve(elf, lfilehdrsize + compsize);
+  memcpy(lfile + lfilehdrsize, deflated ? deflated : data, compsize);
   era = method ? kZipEra1993 : kZipEra1989;
   EmitZipLfileHdr(lfile, name, namesize, crc, era, gflags, method, mtime, mdate,
                   compsize, uncompsize);
@@ -216,9 +252,10 @@ void elfwriter_zip(struct ElfWriter *elf, const char *symbol, const char *cname,
                       STV_DEFAULT, lfilehdrsize, compsize);
   elfwriter_finishsection(elf);
 
-  /* emit central directory record */
+  /* emit central directory record, named so the linker can sort it */
   elfwriter_align(elf, 1, 0);
-  elfwriter_startsection(elf, ".zip.cdir", SHT_PROGBITS, 0);
+  elfwriter_startsection(elf, gc(xasprintf("%s%s", ".zip.cdir.", name)),
+                         SHT_PROGBITS, 0);
   EmitZipCdirHdr(
       (cfile = elfwriter_reserve(elf, ZIP_CFILE_HDR_SIZE + namesize)), name,
       namesize, crc, era, gflags, method, mtime, mdate, iattrs, mode, compsize,
@@ -0,0 +1,139 @@
+/*-*- mode:c;indent-tabs-mode:nil;c-basic-offset:2;tab-width:8;coding:utf-8 -*-│
+│ vi: set et ft=c ts=2 sts=2 sw=2 fenc=utf-8                               :vi │
+╞══════════════════════════════════════════════════════════════════════════════╡
+│ Copyright 2024 Justine Alexandra Roberts Tunney                              │
+│                                                                              │
+│ Permission to use, copy, modify, and/or distribute this software for         │
+│ any purpose with or without fee is hereby granted, provided that the         │
+│ above copyright notice and this permission notice appear in all copies.      │
+│                                                                              │
+│ THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL                │
+│ WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED                │
+│ WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE             │
+│ AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL         │
+│ DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR        │
+│ PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER               │
+│ TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR             │
+│ PERFORMANCE OF THIS SOFTWARE.                                                │
+╚─────────────────────────────────────────────────────────────────────────────*/
+#include "tool/build/lib/pdeflate.h"
+#include "libc/atomic.h"
+#include "libc/intrin/atomic.h"
+#include "libc/log/check.h"
+#include "libc/macros.h"
+#include "libc/mem/mem.h"
+#include "libc/runtime/runtime.h"
+#include "libc/str/str.h"
+#include "libc/thread/thread.h"
+#include "third_party/zlib/zlib.h"
+
+/**
+ * @fileoverview block parallel deflate
+ *
+ * Large inputs are cut into fixed size blocks which are compressed on
+ * separate threads, each primed with the 32kb of input preceding it as
+ * its dictionary, so matches can still reach backwards across block
+ * boundaries. Every block but the last ends with a sync flush, which
+ * leaves it byte aligned, so the blocks concatenate into a single raw
+ * deflate stream. Block boundaries don't depend on the thread count,
+ * so the output is the same on every machine.
+ */
+
+struct Block {
+  unsigned char *p;
+  size_t n;
+};
+
+struct Pdeflate {
+  int level;
+  size_t size;
+  size_t count;
+  const unsigned char *data;
+  struct Block *blocks;
+  atomic_size_t next;
+};
+
+static void *Deflate(const unsigned char *data, size_t size, size_t dictsize,
+                     bool last, int level, size_t *out_size) {
+  z_stream zs;
+  unsigned char *res;
+  bzero(&zs, sizeof(zs));
+  CHECK_EQ(Z_OK, deflateInit2(&zs, level, Z_DEFLATED, -MAX_WBITS,
+                              MAX_MEM_LEVEL, Z_DEFAULT_STRATEGY));
+  if (dictsize)
+    CHECK_EQ(Z_OK, deflateSetDictionary(&zs, data - dictsize, dictsize));
+  zs.next_in = data;
+  zs.avail_in = size;
+  zs.avail_out = compressBound(size) + 16;
+  CHECK_NOTNULL((zs.next_out = res = malloc(zs.avail_out)));
+  if (last) {
+    CHECK_EQ(Z_STREAM_END, deflate(&zs, Z_FINISH));
+  } else {
+    CHECK_EQ(Z_OK, deflate(&zs, Z_SYNC_FLUSH));
+    CHECK_NE(0, zs.avail_out);
+  }
+  deflateEnd(&zs);
+  *out_size = zs.total_out;
+  return res;
+}
+
+static void *Worker(void *arg) {
+  size_t i, off;
+  struct Pdeflate *pd = arg;
+  while ((i = atomic_fetch_add(&pd->next, 1)) < pd->count) {
+    off = i * PDEFLATE_BLOCK;
+    pd->blocks[i].p =
+        Deflate(pd->data + off, MIN(PDEFLATE_BLOCK, pd->size - off),
+                MIN(off, 32768), i + 1 == pd->count, pd->level,
+                &pd->blocks[i].n);
+  }
+  return 0;
+}
+
+/**
+ * Compresses data as raw deflate stream, using multiple threads.
+ *
+ * Inputs smaller than four blocks are compressed as one stream on the
+ * calling thread, which produces the same bytes as a single deflate()
+ * call would have.
+ *
+ * @param level is zlib compression level
+ * @param threads is maximum number of threads to use, including caller
+ * @param out_size receives number of bytes in result
+ * @return raw deflate stream, which caller must free()
+ */
+void *pdeflate(const void *data, size_t size, int level, int threads,
+               size_t *out_size) {
+  int i, n;
+  size_t j, z;
+  pthread_t *th;
+  unsigned char *res;
+  struct Pdeflate pd;
+  if (size < PDEFLATE_BLOCK * 4)
+    return Deflate(data, size, 0, true, level, out_size);
+  pd.data = data;
+  pd.size = size;
+  pd.level = level;
+  pd.count = (size + PDEFLATE_BLOCK - 1) / PDEFLATE_BLOCK;
+  CHECK_NOTNULL((pd.blocks = calloc(pd.count, sizeof(*pd.blocks))));
+  atomic_init(&pd.next, 0);
+  n = MIN(MAX(threads, 1), pd.count);
+  CHECK_NOTNULL((th = calloc(n, sizeof(*th))));
+  for (i = 1; i < n; ++i)
+    CHECK_EQ(0, pthread_create(th + i, 0, Worker, &pd));
+  Worker(&pd);
+  for (i = 1; i < n; ++i)
+    CHECK_EQ(0, pthread_join(th[i], 0));
+  for (z = j = 0; j < pd.count; ++j)
+    z += pd.blocks[j].n;
+  CHECK_NOTNULL((res = malloc(z)));
+  for (z = j = 0; j < pd.count; ++j) {
+    memcpy(res + z, pd.blocks[j].p, pd.blocks[j].n);
+    z += pd.blocks[j].n;
+    free(pd.blocks[j].p);
+  }
+  free(pd.blocks);
+  free(th);
+  *out_size = z;
+  return res;
+}
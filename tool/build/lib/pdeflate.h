@@ -0,0 +1,10 @@
+#ifndef COSMOPOLITAN_TOOL_BUILD_LIB_PDEFLATE_H_
+#define COSMOPOLITAN_TOOL_BUILD_LIB_PDEFLATE_H_
+COSMOPOLITAN_C_START_
+
+#define PDEFLATE_BLOCK 1048576
+
+void *pdeflate(const void *, size_t, int, int, size_t *);
+
+COSMOPOLITAN_C_END_
+#endif /* COSMOPOLITAN_TOOL_BUILD_LIB_PDEFLATE_H_ */
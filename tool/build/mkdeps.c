@@ -16,12 +16,16 @@
 │ TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR             │
 │ PERFORMANCE OF THIS SOFTWARE.                                                │
 ╚─────────────────────────────────────────────────────────────────────────────*/
+#include "libc/atomic.h"
 #include "libc/calls/calls.h"
 #include "libc/calls/struct/stat.h"
+#include "libc/calls/struct/timespec.h"
 #include "libc/errno.h"
+#include "libc/fmt/conv.h"
 #include "libc/fmt/itoa.h"
 #include "libc/fmt/libgen.h"
 #include "libc/fmt/magnumstrs.internal.h"
+#include "libc/intrin/atomic.h"
 #include "libc/limits.h"
 #include "libc/macros.h"
 #include "libc/mem/alg.h"
@@ -38,11 +42,12 @@
 #include "libc/sysv/consts/o.h"
 #include "libc/sysv/consts/prot.h"
 #include "libc/sysv/consts/s.h"
+#include "libc/thread/thread.h"
 #include "third_party/getopt/getopt.internal.h"
 #include "tool/build/lib/getargs.h"
 
 #define VERSION                     \
-  "cosmopolitan mkdeps v3.0\n"      \
+  "cosmopolitan mkdeps v3.1\n"      \
   "copyright 2023 justine tunney\n" \
   "https://github.com/jart/cosmopolitan\n"
 
@@ -83,6 +88,8 @@
   "  -r ROOT    set build output path, e.g. o/$(MODE)/\n"                    \
   "  -S PATH    isystem include path [repeatable; default: libc/isystem/]\n" \
   "  -s         hermetically sealed mode [repeatable]\n"                     \
+  "  -c CACHE   set include scan cache [default: OUTPUT.cache]\n"            \
+  "  -j N       set number of scanning threads [default: ncpu]\n"            \
   "\n"                                                                       \
   "ARGUMENTS\n"                                                              \
   "\n"                                                                       \
@@ -90,6 +97,8 @@
   "  INPUT      should be source or @args.txt\n"                             \
   "\n"
 
+#define CACHE_MAGIC "MKDEPS1\n"
+
 #define Read32(s) (s[3] << 24 | s[2] << 16 | s[1] << 8 | s[0])
 #define EXT(s)    Read32(s "\0\0")
 
@@ -124,6 +133,20 @@ struct Paths {
   const char *p[64];
 };
 
+struct Scan {
+  int err;
+  bool owned;
+  const char *path;
+  const char *incs;
+  size_t incslen;
+  int64_t size;
+  struct timespec mtim;
+  int64_t cachesize;
+  struct timespec cachemtim;
+  const char *cacheincs;
+  size_t cacheincslen;
+};
+
 static const uint32_t kSourceExts[] = {
     EXT("s"),    // assembly
     EXT("S"),    // assembly with c preprocessor
@@ -135,8 +158,14 @@ static const uint32_t kSourceExts[] = {
 };
 
 static char *names;
+static int threads;
 static int hermetic;
+static char *cachemap;
+static size_t cachesize;
 static unsigned counter;
+static atomic_bool dirty;
+static struct Scan *scans;
+static atomic_size_t nextscan;
 static const char *prog;
 static struct Edges edges;
 static struct Sauce *sauces;
@@ -145,6 +174,7 @@ static struct Paths systempaths;
 static const char *buildroot;
 static const char *genroot;
 static const char *outpath;
+static const char *cachepath;
 
 static inline bool IsBlank(int c) {
   return c == ' ' || c == '\t';
@@ -400,29 +430,209 @@ static const char *FindIncludePath(const char *map, size_t mapsize,
   return q;
 }
 
-static void LoadRelationships(int argc, char *argv[]) {
+// scans source for include directives without resolving them
+//
+// the result is a sequence of nul terminated strings, each of which
+// begins with the bracket character that opened the path, e.g.
+// `<stdio.h` or `"libc/calls/calls.h`. since this only depends on the
+// content of the file, it can be computed on any thread and cached.
+static void ScanSource(struct Scan *scan) {
   int fd;
   char *map;
-  ssize_t rc;
-  size_t size;
+  char *incs;
+  struct stat st;
   bool is_assembly;
+  const char *p, *pe, *path, *pathend;
+  if (scan->cacheincs) {
+    if (stat(scan->path, &st)) {
+      scan->err = errno;
+      return;
+    }
+    if (scan->cachesize == st.st_size &&
+        !timespec_cmp(scan->cachemtim, st.st_mtim)) {
+      scan->size = st.st_size;
+      scan->mtim = st.st_mtim;
+      scan->incs = scan->cacheincs;
+      scan->incslen = scan->cacheincslen;
+      return;
+    }
+  }
+  if ((fd = open(scan->path, O_RDONLY)) == -1 || fstat(fd, &st)) {
+    scan->err = errno;
+    if (fd != -1)
+      close(fd);
+    return;
+  }
+  scan->size = st.st_size;
+  scan->mtim = st.st_mtim;
+  incs = 0;
+  if (st.st_size) {
+    is_assembly = endswith(scan->path, ".s");
+    map = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED)
+      DieSys(scan->path);
+    for (p = map, pe = map + st.st_size; p < pe; ++p) {
+      if (!(p = memmem(p, pe - p, "include ", 8)))
+        break;
+      if (!(path = FindIncludePath(map, st.st_size, p, is_assembly)))
+        continue;
+      if (!(pathend = memchr(path, path[-1] == '<' ? '>' : '"', pe - path)))
+        continue;
+      if (pathend - path >= PATH_MAX) {
+        tinyprint(2, scan->path, ": uses really long include path\n", NULL);
+        exit(1);
+      }
+      Appendd(&incs, path - 1, pathend - path + 1);
+      Appendw(&incs, 0);
+      p = pathend;
+    }
+    if (munmap(map, st.st_size))
+      DieSys(scan->path);
+  }
+  if (close(fd))
+    DieSys(scan->path);
+  scan->incs = incs;
+  scan->incslen = appendz(incs).i;
+  scan->owned = true;
+  atomic_store_explicit(&dirty, true, memory_order_relaxed);
+}
+
+static void *ScanWorker(void *arg) {
+  size_t i;
+  while ((i = atomic_fetch_add_explicit(&nextscan, 1, memory_order_relaxed)) <
+         counter)
+    ScanSource(scans + i);
+  return 0;
+}
+
+static void ScanSources(void) {
+  int i, n, rc;
+  pthread_t *th;
+  n = MIN(threads, counter);
+  th = Malloc(MAX(n, 1) * sizeof(*th));
+  for (i = 1; i < n; ++i)
+    if ((rc = pthread_create(th + i, 0, ScanWorker, 0))) {
+      errno = rc;
+      DieSys("pthread_create");
+    }
+  ScanWorker(0);
+  for (i = 1; i < n; ++i)
+    if ((rc = pthread_join(th[i], 0))) {
+      errno = rc;
+      DieSys("pthread_join");
+    }
+  free(th);
+}
+
+// cache is a sequence of records, each of which looks like:
+//
+//     uint32_t namelen, incslen;
+//     int64_t size, mtim.tv_sec, mtim.tv_nsec;
+//     char name[namelen], incs[incslen];
+//
+// it's only trusted to describe files whose mtime and size still match
+static void LoadCache(void) {
+  int fd, id;
+  ssize_t rc;
+  size_t i, n, size;
+  struct Scan *scan;
+  unsigned namelen, incslen;
+  if (!cachepath || (fd = open(cachepath, O_RDONLY)) == -1)
+    return;
+  if ((rc = lseek(fd, 0, SEEK_END)) == -1)
+    DieSys(cachepath);
+  if ((size = rc) > 8) {
+    cachemap = mmap(0, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (cachemap == MAP_FAILED)
+      DieSys(cachepath);
+    cachesize = size;
+  }
+  if (close(fd))
+    DieSys(cachepath);
+  if (!cachemap || memcmp(cachemap, CACHE_MAGIC, 8))
+    return;
+  for (i = 8; i + 32 <= size; i += n) {
+    namelen = READ32LE(cachemap + i);
+    incslen = READ32LE(cachemap + i + 4);
+    n = 32 + (size_t)namelen + incslen;
+    if (n > size - i || (incslen && cachemap[i + n - 1]))
+      break;
+    if ((id = HashSource(cachemap + i + 32, namelen, false)) == -1)
+      continue;
+    if (scans[id].path[namelen])
+      continue;
+    scan = scans + id;
+    scan->cachesize = READ64LE(cachemap + i + 8);
+    scan->cachemtim.tv_sec = READ64LE(cachemap + i + 16);
+    scan->cachemtim.tv_nsec = READ64LE(cachemap + i + 24);
+    scan->cacheincs = cachemap + i + 32 + namelen;
+    scan->cacheincslen = incslen;
+  }
+}
+
+static void SaveCache(void) {
+  int fd;
+  ssize_t rc;
+  size_t i, n;
+  char *b = 0;
+  char hdr[32];
+  struct Scan *scan;
+  char tmp[PATH_MAX];
+  if (!cachepath || !atomic_load_explicit(&dirty, memory_order_relaxed))
+    return;
+  Appendd(&b, CACHE_MAGIC, 8);
+  for (i = 0; i < counter; ++i) {
+    scan = scans + i;
+    if (scan->err)
+      continue;
+    WRITE32LE(hdr, strlen(scan->path));
+    WRITE32LE(hdr + 4, scan->incslen);
+    WRITE64LE(hdr + 8, scan->size);
+    WRITE64LE(hdr + 16, scan->mtim.tv_sec);
+    WRITE64LE(hdr + 24, scan->mtim.tv_nsec);
+    Appendd(&b, hdr, 32);
+    Appends(&b, scan->path);
+    Appendd(&b, scan->incs, scan->incslen);
+  }
+  // write to temporary file and rename, so concurrent or interrupted
+  // runs never observe a partially written cache
+  if (snprintf(tmp, sizeof(tmp), "%s.%d", cachepath, getpid()) >= PATH_MAX)
+    DiePathTooLong(cachepath);
+  if ((fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644)) == -1)
+    DieSys(tmp);
+  n = appendz(b).i;
+  for (i = 0; i < n; i += (size_t)rc)
+    if ((rc = write(fd, b + i, n - i)) == -1)
+      DieSys(tmp);
+  if (close(fd) || rename(tmp, cachepath))
+    DieSys(tmp);
+  free(b);
+}
+
+static void LoadRelationships(int argc, char *argv[]) {
+  size_t j;
+  char right;
+  struct Scan *scan;
   struct GetArgs ga;
   int srcid, dependency;
   static char srcdirbuf[PATH_MAX];
-  const char *p, *pe, *src, *path, *pathend, *srcdir, *final;
+  const char *q, *qe, *src, *srcdir, *final;
   getargs_init(&ga, argv + optind);
   while ((src = getargs_next(&ga)))
     CreateSourceId(src);
   getargs_destroy(&ga);
+  scans = Calloc(counter, sizeof(*scans));
+  for (j = 0; j < sources.n; ++j)
+    if (sources.p[j].hash)
+      scans[sources.p[j].id].path = names + sources.p[j].name;
+  LoadCache();
+  ScanSources();
   getargs_init(&ga, argv + optind);
   while ((src = getargs_next(&ga))) {
-    is_assembly = endswith(src, ".s");
     srcid = GetSourceId(src);
-    if (strlcpy(srcdirbuf, src, PATH_MAX) >= PATH_MAX)
-      DiePathTooLong(src);
-    srcdir = dirname(srcdirbuf);
-    if ((fd = open(src, O_RDONLY)) == -1) {
-      if (errno == ENOENT && ga.path) {
+    scan = scans + srcid;
+    if (scan->err) {
+      if (scan->err == ENOENT && ga.path) {
         // This code helps GNU Make automatically fix itself when we
         // delete a source file. It removes o/.../srcs.txt or
         // o/.../hdrs.txt and exits nonzero. Since we use hyphen
@@ -431,97 +641,70 @@ static void LoadRelationships(int argc, char *argv[]) {
         tinyprint(2, prog, ": deleting ", ga.path, " to refresh build...\n",
                   NULL);
       }
+      errno = scan->err;
       DieSys(src);
     }
-    if ((rc = lseek(fd, 0, SEEK_END)) == -1)
-      DieSys(src);
-    if ((size = rc)) {
-      // repeatedly map to same fixed address so in order to weasel out
-      // of incurring the additional overhead of all these munmap calls
-      map = mmap(0, size, PROT_READ, MAP_SHARED, fd, 0);
-      if (map == MAP_FAILED)
-        DieSys(src);
-      for (p = map, pe = map + size; p < pe; ++p) {
-        if (!(p = memmem(p, pe - p, "include ", 8)))
-          break;
-        if (!(path = FindIncludePath(map, size, p, is_assembly)))
+    if (strlcpy(srcdirbuf, src, PATH_MAX) >= PATH_MAX)
+      DiePathTooLong(src);
+    srcdir = dirname(srcdirbuf);
+    for (q = scan->incs, qe = q + scan->incslen; q < qe; q += strlen(q) + 1) {
+      right = *q == '<' ? '>' : '"';
+      char juf[PATH_MAX];
+      const char *incpath = q + 1;
+      if (right == '>') {
+        // handle angle bracket includes
+        if (!systempaths.n)
           continue;
-        // copy the specified include path
-        char right;
-        if (path[-1] == '<') {
-          if (!systempaths.n)
-            continue;
-          right = '>';
-        } else {
-          right = '"';
+        dependency = -1;
+        for (long i = 0; i < systempaths.n; ++i) {
+          if (!(final =
+                    __join_paths(juf, PATH_MAX, systempaths.p[i], incpath)))
+            DiePathTooLong(incpath);
+          if ((dependency = GetSourceId(final)) != -1)
+            break;
         }
-        if (!(pathend = memchr(path, right, pe - path)))
-          continue;
-        if (pathend - path >= PATH_MAX) {
-          tinyprint(2, src, ": uses really long include path\n", NULL);
+        if (dependency != -1) {
+          AppendEdge(&edges, dependency, srcid);
+        } else {
+          if (hermetic == 1) {
+            // chances are the `#include <foo>` is in some #ifdef
+            // that'll never actually be executed; thus we ignore
+            // since landlock make unveil() shall catch it anyway
+            continue;
+          }
+          tinyprint(2, incpath,
+                    ": system header not specified by the HDRS/SRCS/INCS "
+                    "make variables defined by the hermetic mono repo\n",
+                    NULL);
           exit(1);
         }
-        char juf[PATH_MAX];
-        char incpath[PATH_MAX];
-        *(char *)mempcpy(incpath, path, pathend - path) = 0;
-        if (right == '>') {
-          // handle angle bracket includes
-          dependency = -1;
-          for (long i = 0; i < systempaths.n; ++i) {
-            if (!(final =
-                      __join_paths(juf, PATH_MAX, systempaths.p[i], incpath)))
-              DiePathTooLong(incpath);
-            if ((dependency = GetSourceId(final)) != -1)
-              break;
-          }
-          if (dependency != -1) {
-            AppendEdge(&edges, dependency, srcid);
-            p = pathend + 1;
+      } else {
+        // handle double quote includes
+        // let foo/bar.c say `#include "foo/hdr.h"`
+        dependency = GetSourceId((final = incpath));
+        // let foo/bar.c say `#include "hdr.h"`
+        if (dependency == -1 && !strchr(final, '/')) {
+          if (!(final = __join_paths(juf, PATH_MAX, srcdir, final)))
+            DiePathTooLong(incpath);
+          dependency = GetSourceId(final);
+        }
+        if (dependency == -1) {
+          if (startswith(final, genroot)) {
+            dependency = CreateSourceId(src);
           } else {
-            if (hermetic == 1) {
-              // chances are the `#include <foo>` is in some #ifdef
-              // that'll never actually be executed; thus we ignore
-              // since landlock make unveil() shall catch it anyway
-              continue;
-            }
             tinyprint(2, incpath,
-                      ": system header not specified by the HDRS/SRCS/INCS "
-                      "make variables defined by the hermetic mono repo\n",
-                      NULL);
+                      ": path not specified by HDRS/SRCS/INCS make variables "
+                      "(it was included by ",
+                      src, ")\n", NULL);
             exit(1);
           }
-        } else {
-          // handle double quote includes
-          // let foo/bar.c say `#include "foo/hdr.h"`
-          dependency = GetSourceId((final = incpath));
-          // let foo/bar.c say `#include "hdr.h"`
-          if (dependency == -1 && !strchr(final, '/')) {
-            if (!(final = __join_paths(juf, PATH_MAX, srcdir, final)))
-              DiePathTooLong(incpath);
-            dependency = GetSourceId(final);
-          }
-          if (dependency == -1) {
-            if (startswith(final, genroot)) {
-              dependency = CreateSourceId(src);
-            } else {
-              tinyprint(2, incpath,
-                        ": path not specified by HDRS/SRCS/INCS make variables "
-                        "(it was included by ",
-                        src, ")\n", NULL);
-              exit(1);
-            }
-          }
-          AppendEdge(&edges, dependency, srcid);
-          p = pathend + 1;
         }
+        AppendEdge(&edges, dependency, srcid);
       }
-      if (munmap(map, size))
-        DieSys(src);
     }
-    if (close(fd))
-      DieSys(src);
   }
   getargs_destroy(&ga);
+  SaveCache();
 }
 
 static wontreturn void ShowUsage(int rc, int fd) {
@@ -537,7 +720,7 @@ static void AddPath(struct Paths *paths, const char *path) {
 
 static void GetOpts(int argc, char *argv[]) {
   int opt;
-  while ((opt = getopt(argc, argv, "hnsgS:o:r:")) != -1) {
+  while ((opt = getopt(argc, argv, "hnsgS:o:r:c:j:")) != -1) {
     switch (opt) {
       case 's':
         ++hermetic;
@@ -555,6 +738,12 @@ static void GetOpts(int argc, char *argv[]) {
           Die("multiple build roots specified");
         buildroot = optarg;
         break;
+      case 'c':
+        cachepath = optarg;
+        break;
+      case 'j':
+        threads = atoi(optarg);
+        break;
       case 'g':
         if (genroot)
           Die("multiple generated roots specified");
@@ -570,6 +759,16 @@ static void GetOpts(int argc, char *argv[]) {
   }
   if (optind == argc)
     Die("missing input argument");
+  if (threads <= 0)
+    threads = __get_cpu_count();
+  if (threads <= 0)
+    threads = 1;
+  if (!cachepath && outpath) {
+    static char cachepathbuf[PATH_MAX];
+    if (snprintf(cachepathbuf, PATH_MAX, "%s.cache", outpath) >= PATH_MAX)
+      DiePathTooLong(outpath);
+    cachepath = cachepathbuf;
+  }
   if (!genroot)
     genroot = "o/";
   if (!endswith(genroot, "/"))
@@ -718,6 +917,12 @@ int main(int argc, char *argv[]) {
   if (outpath && close(fd))
     DieSys(outpath);
   free(makefile);
+  for (i = 0; i < counter; ++i)
+    if (scans[i].owned)
+      free((char *)scans[i].incs);
+  if (cachemap && munmap(cachemap, cachesize))
+    DieSys(cachepath);
+  free(scans);
   free(edges.p);
   free(sauces);
   free(names);
@@ -19,11 +19,14 @@
 #include "tool/build/runit.h"
 #include "libc/assert.h"
 #include "libc/calls/calls.h"
+#include "libc/calls/struct/flock.h"
 #include "libc/calls/struct/itimerval.h"
 #include "libc/calls/struct/sigaction.h"
 #include "libc/calls/struct/stat.h"
 #include "libc/calls/struct/timespec.h"
 #include "libc/errno.h"
+#include "libc/fmt/conv.h"
+#include "libc/fmt/itoa.h"
 #include "libc/fmt/libgen.h"
 #include "libc/intrin/kprintf.h"
 #include "libc/intrin/safemacros.h"
@@ -36,9 +39,11 @@
 #include "libc/serialize.h"
 #include "libc/sock/ipclassify.internal.h"
 #include "libc/stdio/stdio.h"
+#include "libc/str/blake2.h"
 #include "libc/str/str.h"
 #include "libc/sysv/consts/af.h"
 #include "libc/sysv/consts/ex.h"
+#include "libc/sysv/consts/f.h"
 #include "libc/sysv/consts/ipproto.h"
 #include "libc/sysv/consts/itimer.h"
 #include "libc/sysv/consts/limits.h"
@@ -47,13 +52,12 @@
 #include "libc/sysv/consts/prot.h"
 #include "libc/sysv/consts/sig.h"
 #include "libc/sysv/consts/sock.h"
-#include "libc/temp.h"
 #include "libc/x/xasprintf.h"
 #include "net/https/https.h"
 #include "third_party/mbedtls/net_sockets.h"
 #include "third_party/mbedtls/ssl.h"
 #include "third_party/musl/netdb.h"
-#include "third_party/zlib/zlib.h"
+#include "third_party/zstd/zstd.h"
 #include "tool/build/lib/eztls.h"
 #include "tool/build/lib/psk.h"
 
@@ -122,6 +126,8 @@ int handshake_latency;
 char g_hostname[128];
 uint16_t g_runitdport;
 volatile bool alarmed;
+int g_sharedfd = -1;
+unsigned char g_digest[BLAKE2B256_DIGEST_LENGTH];
 
 int __sys_execve(const char *, char *const[], char *const[]);
 
@@ -196,46 +202,129 @@ TryAgain:
   connect_latency = timespec_tomicros(timespec_sub(timespec_mono(), start));
 }
 
-bool Send(int tmpfd, const void *output, size_t outputsize) {
-  bool ok;
-  char *zbuf;
-  size_t zsize;
-  int rc, have;
-  static bool once;
-  static z_stream zs;
-  zsize = 32768;
-  if (!(zbuf = malloc(zsize)))
-    __builtin_trap();
-  if (!once) {
-    CHECK_EQ(Z_OK, deflateInit2(&zs, 4, Z_DEFLATED, MAX_WBITS, DEF_MEM_LEVEL,
-                                Z_DEFAULT_STRATEGY));
-    once = true;
+bool Recv(char *p, int n) {
+  int i, rc;
+  for (i = 0; i < n; i += rc) {
+    do
+      rc = mbedtls_ssl_read(&ezssl, p + i, n - i);
+    while (rc == MBEDTLS_ERR_SSL_WANT_READ);
+    if (!rc)
+      return false;
+    if (rc < 0) {
+      if (rc == MBEDTLS_ERR_NET_CONN_RESET) {
+        EzTlsDie("connection reset", rc);
+      } else {
+        EzTlsDie("read response failed", rc);
+      }
+    }
   }
-  zs.next_in = output;
-  zs.avail_in = outputsize;
-  ok = true;
+  return true;
+}
+
+void Send(const void *data, size_t size) {
+  int rc;
+  size_t i;
+  for (i = 0; i < size; i += rc)
+    if ((rc = mbedtls_ssl_write(&ezssl, (const char *)data + i, size - i)) <= 0)
+      EzTlsDie("send request failed", rc);
+}
+
+void Flush(void) {
+  int rc;
+  if ((rc = EzTlsFlush(&ezbio, 0, 0)) < 0)
+    EzTlsDie("send request failed to flush", rc);
+}
+
+ZSTD_CCtx *NewCompressor(void) {
+  ZSTD_CCtx *zc;
+  CHECK_NOTNULL((zc = ZSTD_createCCtx()));
+  ZSTD_CCtx_setParameter(zc, ZSTD_c_compressionLevel, 9);
+  ZSTD_CCtx_setParameter(zc, ZSTD_c_nbWorkers, __get_cpu_count());
+  return zc;
+}
+
+// compresses program on all cores while it's being uploaded
+void SendProgram(const void *prog, size_t progsize) {
+  size_t rc;
+  ZSTD_CCtx *zc;
+  ZSTD_inBuffer in = {prog, progsize, 0};
+  ZSTD_outBuffer out = {gc(malloc(ZSTD_CStreamOutSize())), 0, 0};
+  CHECK_NOTNULL(out.dst);
+  zc = NewCompressor();
   do {
-    zs.avail_out = zsize;
-    zs.next_out = (unsigned char *)zbuf;
-    rc = deflate(&zs, Z_SYNC_FLUSH);
-    CHECK_NE(Z_STREAM_ERROR, rc);
-    have = zsize - zs.avail_out;
-    rc = write(tmpfd, zbuf, have);
-    if (rc != have) {
-      DEBUGF("write(%d, %d) → %d", tmpfd, have, rc);
-      ok = false;
-      break;
-    }
-  } while (!zs.avail_out);
-  free(zbuf);
-  return ok;
+    out.pos = 0;
+    out.size = ZSTD_CStreamOutSize();
+    rc = ZSTD_compressStream2(zc, &out, &in, ZSTD_e_end);
+    if (ZSTD_isError(rc))
+      FATALF("zstd: %s", ZSTD_getErrorName(rc));
+    Send(out.dst, out.pos);
+  } while (rc);
+  ZSTD_freeCCtx(zc);
+  Flush();
+}
+
+// hashes program once, before forking a runit for each host, and hands
+// the digest down to them through an anonymous file, which the first
+// of them to miss the daemon's cache will append the compressed program
+void ShareProgram(void) {
+  char *p;
+  int fd, zfd;
+  struct stat st;
+  char ibuf[12];
+  CHECK_NE(-1, (fd = open(g_prog, O_RDONLY)));
+  CHECK_NE(-1, fstat(fd, &st));
+  CHECK_NE(MAP_FAILED, (p = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0)));
+  BLAKE2B256(p, st.st_size, g_digest);
+  CHECK_NE(-1, (zfd = tmpfd()));
+  CHECK_EQ(sizeof(g_digest), write(zfd, g_digest, sizeof(g_digest)));
+  FormatInt32(ibuf, zfd);
+  CHECK_NE(-1, setenv("RUNIT_SHARED_FD", ibuf, true));
+  CHECK_NE(-1, munmap(p, st.st_size));
+  CHECK_NE(-1, close(fd));
+}
+
+// reads the digest ShareProgram() made, if any
+void LoadSharedProgram(void) {
+  const char *s;
+  if (!(s = getenv("RUNIT_SHARED_FD")))
+    return;
+  g_sharedfd = atoi(s);
+  CHECK_EQ(sizeof(g_digest), pread(g_sharedfd, g_digest, sizeof(g_digest), 0));
 }
 
-bool SendRequest(int tmpfd) {
+// sends the compressed program from the shared file, compressing it
+// first if no sibling runit has needed to upload it yet
+void SendSharedProgram(const void *prog, size_t progsize) {
+  char *p, *z;
+  size_t zsize;
+  ZSTD_CCtx *zc;
+  struct stat st;
+  CHECK_NE(-1, fcntl(g_sharedfd, F_SETLKW, &(struct flock){F_WRLCK}));
+  CHECK_NE(-1, fstat(g_sharedfd, &st));
+  if (st.st_size == sizeof(g_digest)) {
+    CHECK_NOTNULL((z = malloc((zsize = ZSTD_compressBound(progsize)))));
+    zc = NewCompressor();
+    zsize = ZSTD_compress2(zc, z, zsize, prog, progsize);
+    if (ZSTD_isError(zsize))
+      FATALF("zstd: %s", ZSTD_getErrorName(zsize));
+    ZSTD_freeCCtx(zc);
+    CHECK_EQ(zsize, pwrite(g_sharedfd, z, zsize, sizeof(g_digest)));
+    st.st_size += zsize;
+    free(z);
+  }
+  CHECK_NE(-1, fcntl(g_sharedfd, F_SETLK, &(struct flock){F_UNLCK}));
+  CHECK_NE(MAP_FAILED, (p = mmap(0, st.st_size, PROT_READ, MAP_SHARED,
+                                 g_sharedfd, 0)));
+  Send(p + sizeof(g_digest), st.st_size - sizeof(g_digest));
+  Flush();
+  CHECK_NE(-1, munmap(p, st.st_size));
+}
+
+// sends request header, and then the program itself, unless the
+// daemon already has a copy of the file with the same content hash
+bool SendRequest(void) {
   int fd;
   char *p;
-  bool okall;
-  uint32_t crc;
   struct stat st;
   const char *name;
   unsigned char *hdr, *q;
@@ -245,65 +334,34 @@ bool SendRequest(int tmpfd) {
   CHECK_NE(MAP_FAILED, (p = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0)));
   CHECK_LE((namesize = strlen((name = basename(g_prog)))), PATH_MAX);
   CHECK_LE((progsize = st.st_size), INT_MAX);
-  CHECK_NOTNULL((hdr = gc(calloc(1, (hdrsize = 17 + namesize)))));
-  crc = crc32_z(0, (unsigned char *)p, st.st_size);
+  CHECK_NOTNULL((hdr = gc(calloc(1, (hdrsize = 13 + 32 + namesize)))));
+  if (g_sharedfd == -1)
+    BLAKE2B256(p, progsize, g_digest);
   q = hdr;
   q = WRITE32BE(q, RUNITD_MAGIC);
   *q++ = kRunitExecute;
   q = WRITE32BE(q, namesize);
   q = WRITE32BE(q, progsize);
-  q = WRITE32BE(q, crc);
+  q = mempcpy(q, g_digest, sizeof(g_digest));
   q = mempcpy(q, name, namesize);
   assert(hdrsize == q - hdr);
-  okall = true;
-  okall &= Send(tmpfd, hdr, hdrsize);
-  okall &= Send(tmpfd, p, progsize);
-  CHECK_NE(-1, munmap(p, st.st_size));
-  CHECK_NE(-1, close(fd));
-  return okall;
-}
-
-void RelayRequest(void) {
-  int i, rc, have, transferred;
-  char *buf = gc(malloc(PIPE_BUF));
-  for (transferred = 0;;) {
-    rc = read(13, buf, PIPE_BUF);
-    CHECK_NE(-1, rc);
-    have = rc;
-    if (!rc)
-      break;
-    transferred += have;
-    for (i = 0; i < have; i += rc) {
-      rc = mbedtls_ssl_write(&ezssl, buf + i, have - i);
-      if (rc <= 0) {
-        EzTlsDie("relay request failed", rc);
-      }
-    }
-  }
-  CHECK_NE(0, transferred);
-  rc = EzTlsFlush(&ezbio, 0, 0);
-  if (rc < 0) {
-    EzTlsDie("relay request failed to flush", rc);
+  Send(hdr, hdrsize);
+  Flush();
+  char msg[5];
+  if (!Recv(msg, 5) || READ32BE(msg) != RUNITD_MAGIC ||
+      (msg[4] != kRunitCached && msg[4] != kRunitUpload)) {
+    WARNF("%s didn't acknowledge request to run %s", g_hostname, g_prog);
+    return false;
   }
-  close(13);
-}
-
-bool Recv(char *p, int n) {
-  int i, rc;
-  for (i = 0; i < n; i += rc) {
-    do
-      rc = mbedtls_ssl_read(&ezssl, p + i, n - i);
-    while (rc == MBEDTLS_ERR_SSL_WANT_READ);
-    if (!rc)
-      return false;
-    if (rc < 0) {
-      if (rc == MBEDTLS_ERR_NET_CONN_RESET) {
-        EzTlsDie("connection reset", rc);
-      } else {
-        EzTlsDie("read response failed", rc);
-      }
-    }
+  if (msg[4] == kRunitUpload && g_sharedfd != -1) {
+    SendSharedProgram(p, progsize);
+  } else if (msg[4] == kRunitUpload) {
+    SendProgram(p, progsize);
+  } else {
+    VERBOSEF("%s already has %s", g_hostname, g_prog);
   }
+  CHECK_NE(-1, munmap(p, st.st_size));
+  CHECK_NE(-1, close(fd));
   return true;
 }
 
@@ -393,7 +451,10 @@ int RunOnHost(char *spec) {
     close(g_sock);
     return 1;
   }
-  RelayRequest();
+  if (!SendRequest()) {
+    close(g_sock);
+    return 200;
+  }
   int rc = ReadResponse();
   kprintf("%s on %-16s %'8ld µs %'8ld µs %'11d µs\n", basename(g_prog),
           g_hostname, connect_latency, handshake_latency, execute_latency);
@@ -415,14 +476,6 @@ int SpawnSubprocesses(int argc, char *argv[]) {
   struct sigaction ignore, saveint, savequit;
   char *args[5] = {argv[0], argv[1], argv[2]};
 
-  // create compressed network request ahead of time
-  const char *tmpdir = firstnonnull(getenv("TMPDIR"), "/tmp");
-  char *tpath = gc(xasprintf("%s/runit.XXXXXX", tmpdir));
-  int tmpfd = mkstemp(tpath);
-  CHECK_NE(-1, tmpfd);
-  CHECK(SendRequest(tmpfd));
-  CHECK_NE(-1, close(tmpfd));
-
   // fork off 𝑛 subprocesses for each host on which we run binary.
   // what's important here is htop in tree mode will report like:
   //
@@ -435,6 +488,7 @@ int SpawnSubprocesses(int argc, char *argv[]) {
   argc -= 3;
   argv += 3;
   exitcode = 0;
+  ShareProgram();
   pids = calloc(argc, sizeof(int));
   ignore.sa_flags = 0;
   ignore.sa_handler = SIG_IGN;
@@ -448,7 +502,6 @@ int SpawnSubprocesses(int argc, char *argv[]) {
     args[3] = argv[i];
     CHECK_NE(-1, (pids[i] = vfork()));
     if (!pids[i]) {
-      dup2(open(tpath, O_RDONLY | O_CLOEXEC), 13);
       sigaction(SIGINT, &(struct sigaction){0}, 0);
       sigaction(SIGQUIT, &(struct sigaction){0}, 0);
       sigprocmask(SIG_SETMASK, &savemask, 0);
@@ -485,7 +538,6 @@ int SpawnSubprocesses(int argc, char *argv[]) {
       break;
     }
   }
-  unlink(tpath);
   sigprocmask(SIG_SETMASK, &savemask, 0);
   sigaction(SIGQUIT, &savequit, 0);
   sigaction(SIGINT, &saveint, 0);
@@ -515,11 +567,11 @@ int main(int argc, char *argv[]) {
     /* hosts list empty */
     return 0;
   } else if (argc == 4) {
-    /* TODO(jart): this is broken */
     /* single host */
     SetupPresharedKeySsl(MBEDTLS_SSL_IS_CLIENT, GetRunitPsk());
     g_sshport = 22;
     g_runitdport = RUNITD_PORT;
+    LoadSharedProgram();
     return RunOnHost(argv[3]);
   } else {
     /* multiple hosts */
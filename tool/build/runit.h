@@ -10,6 +10,8 @@ enum RunitCommand {
   kRunitStdout,
   kRunitStderr,
   kRunitExit,
+  kRunitCached,
+  kRunitUpload,
 };
 
 #endif /* COSMOPOLITAN_TOOL_BUILD_RUNIT_H_ */
@@ -19,6 +19,7 @@
 #include "libc/assert.h"
 #include "libc/atomic.h"
 #include "libc/calls/calls.h"
+#include "libc/calls/struct/dirent.h"
 #include "libc/calls/struct/rusage.h"
 #include "libc/calls/struct/sigaction.h"
 #include "libc/calls/struct/sigset.h"
@@ -37,7 +38,6 @@
 #include "libc/mem/gc.h"
 #include "libc/mem/leaks.h"
 #include "libc/mem/mem.h"
-#include "libc/nexgen32e/crc32.h"
 #include "libc/proc/posix_spawn.h"
 #include "libc/runtime/internal.h"
 #include "libc/runtime/runtime.h"
@@ -50,6 +50,7 @@
 #include "libc/stdio/rand.h"
 #include "libc/stdio/stdio.h"
 #include "libc/stdio/sysparam.h"
+#include "libc/str/blake2.h"
 #include "libc/str/str.h"
 #include "libc/sysv/consts/af.h"
 #include "libc/sysv/consts/at.h"
@@ -81,7 +82,7 @@
 #include "third_party/getopt/getopt.internal.h"
 #include "third_party/mbedtls/debug.h"
 #include "third_party/mbedtls/ssl.h"
-#include "third_party/zlib/zlib.h"
+#include "third_party/zstd/zstd.h"
 #include "tool/build/lib/eztls.h"
 #include "tool/build/lib/psk.h"
 #include "tool/build/runit.h"
@@ -98,22 +99,31 @@
  *   - 1 byte command = kRunitExecute
  *   - 4 byte nbo name length in bytes, e.g. "test1"
  *   - 4 byte nbo executable file length in bytes
+ *   - 32 byte blake2b256 digest of executable
  *   - <name bytes> (no NUL terminator)
- *   - <file bytes> (it's binary data)
  *
- * 2. Runs program, after verifying it came from the IP that spawned
+ * 2. Looks up the digest in o/runitd.cache/ and answers with:
+ *
+ *   - 4 byte nbo magic = 0xFEEDABEEu
+ *   - 1 byte command = kRunitCached or kRunitUpload
+ *
+ *    In the latter case, the client then sends the executable as a
+ *    single zstd frame, which is decompressed into the cache as it's
+ *    received, and it's only used if its digest turns out to match.
+ *
+ * 3. Runs program, after verifying it came from the IP that spawned
  *    this program via SSH. Be sure to only run this over a trusted
  *    physically-wired network. To use this software on untrustworthy
  *    networks, wrap it with stunnel and use your own CA.
  *
- * 3. Sends stdout/stderr fragments, potentially multiple times:
+ * 4. Sends stdout/stderr fragments, potentially multiple times:
  *
  *   - 4 byte nbo magic = 0xFEEDABEEu
  *   - 1 byte command = kRunitStdout/Stderr
  *   - 4 byte nbo byte length
  *   - <chunk bytes>
  *
- * 4. Sends process exit code:
+ * 5. Sends process exit code:
  *
  *   - 4 byte nbo magic = 0xFEEDABEEu
  *   - 1 byte command = kRunitExit
@@ -125,6 +135,9 @@
 #define kLogFile     "o/runitd.log"
 #define kLogMaxBytes (2 * 1000 * 1000)
 
+#define kCacheDir    "o/runitd.cache"
+#define kCacheMaxAge (7 * 24 * 60 * 60)
+
 #define LOG_LEVEL_WARN 0
 #define LOG_LEVEL_INFO 1
 #define LOG_LEVEL_VERB 2
@@ -150,17 +163,10 @@ struct Client {
   pthread_t th;
   uint32_t addrsize;
   struct sockaddr_in addr;
-  bool once;
-  int zstatus;
-  z_stream zs;
-  struct {
-    size_t off;
-    size_t len;
-    size_t cap;
-    char *data;
-  } rbuf;
+  ZSTD_DCtx *zs;
   char *output;
   char tmpexepath[128];
+  char tmpcachepath[128];
   char buf[32768];
 };
 
@@ -324,34 +330,75 @@ void SendOutputFragmentMessage(enum RunitCommand kind, char *buf, size_t size) {
   }
 }
 
-void Recv(struct Client *client, void *output, size_t outputsize) {
+void SendCommand(enum RunitCommand kind) {
   EzSanity();
-  ssize_t chunk, received, totalgot;
-  if (!client->once) {
-    unassert(Z_OK == inflateInit(&client->zs));
-    client->once = true;
+  int rc;
+  unsigned char msg[4 + 1];
+  WRITE32BE(msg, RUNITD_MAGIC);
+  msg[4] = kind;
+  if (sizeof(msg) != (rc = mbedtls_ssl_write(&ezssl, msg, sizeof(msg)))) {
+    EzTlsDie("SendCommand mbedtls_ssl_write failed", rc);
   }
-  totalgot = 0;
-  for (;;) {
-    if (client->rbuf.len >= outputsize) {
-      memcpy(output, client->rbuf.data + client->rbuf.off, outputsize);
-      client->rbuf.len -= outputsize;
-      client->rbuf.off += outputsize;
-      // trim dymanic buffer once it empties
-      if (!client->rbuf.len) {
-        client->rbuf.off = 0;
-        client->rbuf.cap = 4096;
-        client->rbuf.data = realloc(client->rbuf.data, client->rbuf.cap);
-      }
-      return;
+  if ((rc = EzTlsFlush(&ezbio, 0, 0))) {
+    EzTlsDie("SendCommand EzTlsFlush failed", rc);
+  }
+}
+
+void Recv(struct Client *client, void *output, size_t outputsize) {
+  EzSanity();
+  size_t i;
+  ssize_t received;
+  for (i = 0; i < outputsize; i += received) {
+    received = mbedtls_ssl_read(&ezssl, (char *)output + i, outputsize - i);
+    if (!received) {
+      EzTlsDie("got unexpected eof", received);
     }
-    if (client->zstatus == Z_STREAM_END) {
-      WARNF("recv zlib unexpected eof");
-      pthread_exit(0);
+    if (received < 0) {
+      EzTlsDie("read failed", received);
     }
-    // get another fixed-size data packet from network
-    // pass along error conditions to caller
-    // pass along eof condition to zlib
+  }
+}
+
+void GetCachePath(char path[hasatleast 128],
+                  const unsigned char digest[BLAKE2B256_DIGEST_LENGTH]) {
+  *hexpcpy(stpcpy(path, kCacheDir "/"), digest, BLAKE2B256_DIGEST_LENGTH) = 0;
+}
+
+bool IsCached(const char *path, size_t filesize) {
+  struct stat st;
+  if (stat(path, &st) || st.st_size != filesize)
+    return false;
+  utimensat(AT_FDCWD, path, 0, 0);  // keep PruneCache() away
+  return true;
+}
+
+// receives executable, decompressing it into the cache as it arrives
+bool ReceiveProgram(struct Client *client, const char *cachepath,
+                    const unsigned char digest[BLAKE2B256_DIGEST_LENGTH],
+                    size_t filesize) {
+  int fd;
+  size_t rc;
+  ssize_t received;
+  size_t total = 0;
+  struct Blake2b b2;
+  unsigned char got[BLAKE2B256_DIGEST_LENGTH];
+  ZSTD_inBuffer in;
+  ZSTD_outBuffer out = {gc(malloc(ZSTD_DStreamOutSize())),
+                        ZSTD_DStreamOutSize(), 0};
+  if (!out.dst || !(client->zs = ZSTD_createDCtx())) {
+    WARNF("out of memory");
+    return false;
+  }
+  snprintf(client->tmpcachepath, sizeof(client->tmpcachepath), "%s.XXXXXX",
+           cachepath);
+  if ((fd = openatemp(AT_FDCWD, client->tmpcachepath, 0, O_CLOEXEC, 0600)) ==
+      -1) {
+    WARNF("failed to open temporary file %#s due to %m", client->tmpcachepath);
+    *client->tmpcachepath = 0;
+    return false;
+  }
+  BLAKE2B256_Init(&b2);
+  for (rc = 1; rc;) {
     received = mbedtls_ssl_read(&ezssl, client->buf, sizeof(client->buf));
     if (!received) {
       EzTlsDie("got unexpected eof", received);
@@ -359,46 +406,82 @@ void Recv(struct Client *client, void *output, size_t outputsize) {
     if (received < 0) {
       EzTlsDie("read failed", received);
     }
-    totalgot += received;
-    // decompress packet completely
-    // into a dynamical size buffer
-    client->zs.avail_in = received;
-    client->zs.next_in = (unsigned char *)client->buf;
-    unassert(Z_OK == client->zstatus);
+    in.src = client->buf;
+    in.size = received;
+    in.pos = 0;
     do {
-      // make sure we have a reasonable capacity for zlib output
-      if (client->rbuf.cap - (client->rbuf.off + client->rbuf.len) <
-          sizeof(client->buf)) {
-        client->rbuf.cap += sizeof(client->buf);
-        client->rbuf.data = realloc(client->rbuf.data, client->rbuf.cap);
+      out.pos = 0;
+      rc = ZSTD_decompressStream(client->zs, &out, &in);
+      if (ZSTD_isError(rc)) {
+        WARNF("zstd: %s", ZSTD_getErrorName(rc));
+        close(fd);
+        return false;
       }
-      // inflate packet, which naturally can be much larger
-      // permit zlib no delay flushes that come from sender
-      client->zs.next_out = (unsigned char *)client->rbuf.data +
-                            (client->rbuf.off + client->rbuf.len);
-      client->zs.avail_out = chunk =
-          client->rbuf.cap - (client->rbuf.off + client->rbuf.len);
-      client->zstatus = inflate(&client->zs, Z_SYNC_FLUSH);
-      unassert(Z_STREAM_ERROR != client->zstatus);
-      switch (client->zstatus) {
-        case Z_NEED_DICT:
-          WARNF("tls recv Z_NEED_DICT %ld total %ld", received, totalgot);
-          pthread_exit(0);
-        case Z_DATA_ERROR:
-          WARNF("tls recv Z_DATA_ERROR %ld total %ld", received, totalgot);
-          pthread_exit(0);
-        case Z_MEM_ERROR:
-          WARNF("tls recv Z_MEM_ERROR %ld total %ld", received, totalgot);
-          pthread_exit(0);
-        case Z_BUF_ERROR:
-          client->zstatus = Z_OK;  // harmless? nothing for inflate to do
-          break;                   // it probably just our wraparound eof
-        default:
-          client->rbuf.len += chunk - client->zs.avail_out;
-          break;
+      if (out.pos > filesize - total) {
+        WARNF("client sent more than %'zu bytes", filesize);
+        close(fd);
+        return false;
+      }
+      if (write(fd, out.dst, out.pos) != out.pos) {
+        WARNF("failed to write %#s due to %m", client->tmpcachepath);
+        close(fd);
+        return false;
       }
-    } while (!client->zs.avail_out);
+      BLAKE2B256_Update(&b2, out.dst, out.pos);
+      total += out.pos;
+    } while (rc && (in.pos < in.size || out.pos == out.size));
+  }
+  BLAKE2B256_Final(&b2, got);
+  if (close(fd)) {
+    WARNF("failed to close %#s due to %m", client->tmpcachepath);
+    return false;
+  }
+  if (total != filesize || memcmp(got, digest, sizeof(got))) {
+    WARNF("digest mismatch!");
+    return false;
+  }
+  if (rename(client->tmpcachepath, cachepath)) {
+    WARNF("failed to rename %#s due to %m", client->tmpcachepath);
+    return false;
+  }
+  *client->tmpcachepath = 0;
+  return true;
+}
+
+// copies program out of cache, since it's possible for an ape binary
+// to modify itself once it's run and we don't want that to be shared
+bool CopyProgram(const char *cachepath, int exefd) {
+  int fd;
+  ssize_t rc;
+  char *buf = gc(malloc(65536));
+  if (!buf || (fd = open(cachepath, O_RDONLY | O_CLOEXEC)) == -1)
+    return false;
+  while ((rc = read(fd, buf, 65536)) > 0)
+    if (write(exefd, buf, rc) != rc)
+      break;
+  close(fd);
+  return !rc;
+}
+
+// deletes cached programs that haven't been run for a week
+void PruneCache(void) {
+  DIR *dir;
+  struct stat st;
+  struct dirent *e;
+  int64_t now = time(0);
+  if (!(dir = opendir(kCacheDir)))
+    return;
+  while ((e = readdir(dir))) {
+    if (e->d_name[0] == '.')
+      continue;
+    if (fstatat(dirfd(dir), e->d_name, &st, AT_SYMLINK_NOFOLLOW))
+      continue;
+    if (now - st.st_mtim.tv_sec > kCacheMaxAge || strchr(e->d_name, '.')) {
+      VERBF("pruning %s/%s", kCacheDir, e->d_name);
+      unlinkat(dirfd(dir), e->d_name, 0);
+    }
   }
+  closedir(dir);
 }
 
 void SendProgramOutput(struct Client *client) {
@@ -431,18 +514,17 @@ void FreeClient(struct Client *client) {
   if (*client->tmpexepath) {
     unlink(client->tmpexepath);
   }
-  if (client->once) {
-    inflateEnd(&client->zs);
+  if (*client->tmpcachepath) {
+    unlink(client->tmpcachepath);
   }
+  ZSTD_freeDCtx(client->zs);
   EzDestroy();
-  free(client->rbuf.data);
   free(client->output);
   free(client);
   VERBF("---------------");
 }
 
 void *ClientWorker(void *arg) {
-  uint32_t crc;
   sigset_t sigmask;
   struct timespec ts0;
   struct timespec ts1;
@@ -451,7 +533,8 @@ void *ClientWorker(void *arg) {
   struct Client *client = arg;
   uint32_t namesize, filesize;
   char *addrstr, *origname;
-  unsigned char msg[4 + 1 + 4 + 4 + 4];
+  char cachepath[128];
+  unsigned char msg[4 + 1 + 4 + 4 + BLAKE2B256_DIGEST_LENGTH];
 
   ts0 = timespec_mono();
   ts1 = timespec_mono();
@@ -484,25 +567,32 @@ void *ClientWorker(void *arg) {
   }
   namesize = READ32BE(msg + 5);
   filesize = READ32BE(msg + 9);
-  crc = READ32BE(msg + 13);
+  if (namesize > PATH_MAX) {
+    WARNF("%s name too long!", addrstr);
+    pthread_exit(0);
+  }
   origname = gc(calloc(1, namesize + 1));
   ts2 = timespec_mono();
   Recv(client, origname, namesize);
   DEBUF("it took %'zu us to receive #2",
         timespec_tomicros(timespec_sub(timespec_mono(), ts2)));
-  VERBF("%s sent %#s (%'u bytes @ %#s)", addrstr, origname, filesize,
-        client->tmpexepath);
-  char *exedata = gc(malloc(filesize));
-  ts2 = timespec_mono();
-  Recv(client, exedata, filesize);
-  DEBUF("it took %'zu us to receive #3",
-        timespec_tomicros(timespec_sub(timespec_mono(), ts2)));
+  VERBF("%s sent %#s (%'u bytes)", addrstr, origname, filesize);
+  GetCachePath(cachepath, msg + 13);
+  if (IsCached(cachepath, filesize)) {
+    VERBF("%s found in %#s", origname, cachepath);
+    SendCommand(kRunitCached);
+  } else {
+    SendCommand(kRunitUpload);
+    ts2 = timespec_mono();
+    if (!ReceiveProgram(client, cachepath, msg + 13, filesize)) {
+      WARNF("%s failed to upload %#s", addrstr, origname);
+      pthread_exit(0);
+    }
+    DEBUF("it took %'zu us to receive #3",
+          timespec_tomicros(timespec_sub(timespec_mono(), ts2)));
+  }
   DEBUF("it took %'zu us to receive executable from network",
         timespec_tomicros(timespec_sub(timespec_mono(), ts1)));
-  if (crc32_z(0, exedata, filesize) != crc) {
-    WARNF("%s crc mismatch! %#s", addrstr, origname);
-    pthread_exit(0);
-  }
 
   // create the executable file
   // if another thread vforks while we're writing it then a race
@@ -523,7 +613,7 @@ void *ClientWorker(void *arg) {
     close(exefd);
     pthread_exit(0);
   }
-  if (write(exefd, exedata, filesize) != filesize) {
+  if (!CopyProgram(cachepath, exefd)) {
     WARNF("%s failed to write %#s due to %m", addrstr, origname);
     close(exefd);
     pthread_exit(0);
@@ -855,6 +945,8 @@ int main(int argc, char *argv[]) {
     g_bogusfd = open("/dev/zero", O_RDONLY | O_CLOEXEC);
   }
   mkdir("o", 0700);
+  mkdir(kCacheDir, 0700);
+  PruneCache();
   if (g_daemonize)
     Daemonize();
   Serve();
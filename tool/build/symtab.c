@@ -77,6 +77,8 @@ int main(int argc, char *argv[]) {
 
   tab->names = 0;
   tab->name_base = 0;
+  tab->symbols = 0;
+  tab->index = 0;
 
   if ((fd = open(outpath, O_WRONLY | O_CREAT | O_TRUNC, 0644)) == -1) {
     fprintf(stderr, "error: %s(%`'s) failed %m\n", "open", outpath);
@@ -17,16 +17,19 @@
 │ PERFORMANCE OF THIS SOFTWARE.                                                │
 ╚─────────────────────────────────────────────────────────────────────────────*/
 #include "libc/assert.h"
+#include "libc/atomic.h"
 #include "libc/calls/calls.h"
 #include "libc/calls/struct/stat.h"
 #include "libc/elf/def.h"
 #include "libc/errno.h"
 #include "libc/fmt/conv.h"
 #include "libc/fmt/libgen.h"
+#include "libc/intrin/atomic.h"
 #include "libc/limits.h"
 #include "libc/log/check.h"
 #include "libc/log/log.h"
-#include "libc/mem/gc.h"
+#include "libc/macros.h"
+#include "libc/mem/mem.h"
 #include "libc/runtime/runtime.h"
 #include "libc/stdio/stdio.h"
 #include "libc/str/str.h"
@@ -37,6 +40,7 @@
 #include "libc/sysv/consts/o.h"
 #include "libc/sysv/consts/prot.h"
 #include "libc/sysv/consts/s.h"
+#include "libc/thread/thread.h"
 #include "libc/time.h"
 #include "libc/x/x.h"
 #include "libc/zip.h"
@@ -44,6 +48,16 @@
 #include "tool/build/lib/elfwriter.h"
 #include "tool/build/lib/stripcomponents.h"
 
+struct Input {
+  void *map;
+  size_t size;
+  uint32_t mode;
+  char *name;
+  const char *path;
+  void *deflated;
+  size_t deflatedsize;
+};
+
 int arch_;
 char *name_;
 char *yoink_;
@@ -54,6 +68,10 @@ bool basenamify_;
 int strip_components_;
 const char *path_prefix_;
 struct timespec timestamp;
+struct Input *inputs_;
+size_t inputs_n_;
+atomic_size_t next_;
+int deflaters_;
 
 wontreturn void PrintUsage(int fd, int rc) {
   tinyprint(fd, "\n\
@@ -158,55 +176,95 @@ void GetOpts(int *argc, char ***argv) {
   }
 }
 
-void ProcessFile(struct ElfWriter *elf, const char *path) {
+void LoadFile(struct Input *in) {
   int fd;
-  void *map;
+  char *name;
   struct stat st;
-  const char *name;
-  if (stat(path, &st)) {
-    perror(path);
+  if (stat(in->path, &st)) {
+    perror(in->path);
     exit(1);
   }
+  // descriptors are closed right away, since the mapping outlives them
+  // and there may be more inputs than the open file limit allows
   if (S_ISDIR(st.st_mode)) {
-    if ((fd = open(path, O_RDONLY | O_DIRECTORY)) == -1) {
-      perror(path);
+    if ((fd = open(in->path, O_RDONLY | O_DIRECTORY)) == -1) {
+      perror(in->path);
       exit(1);
     }
-    map = "";
+    close(fd);
+    in->map = "";
     st.st_size = 0;
   } else if (st.st_size) {
-    if ((fd = open(path, O_RDONLY)) == -1 ||
-        (map = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0)) ==
+    if ((fd = open(in->path, O_RDONLY)) == -1 ||
+        (in->map = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0)) ==
             MAP_FAILED) {
-      perror(path);
+      perror(in->path);
       exit(1);
     }
+    close(fd);
   } else {
-    fd = -1;
-    map = 0;
+    in->map = 0;
   }
   if (name_) {
-    name = name_;
+    name = xstrdup(name_);
   } else {
-    name = path;
+    name = xstrdup(in->path);
     if (basenamify_)
-      name = basename(gc(xstrdup(name)));
-    name = StripComponents(name, strip_components_);
+      name = basename(name);
+    name = xstrdup(StripComponents(name, strip_components_));
     if (path_prefix_)
-      name = gc(xjoinpaths(path_prefix_, name));
+      name = xjoinpaths(path_prefix_, name);
   }
   if (S_ISDIR(st.st_mode)) {
     st.st_size = 0;
     if (!endswith(name, "/")) {
-      name = gc(xstrcat(name, '/'));
+      name = xstrcat(name, '/');
     }
   }
-  elfwriter_zip(elf, name, name, strlen(name), map, st.st_size, st.st_mode,
-                timestamp, timestamp, timestamp, nocompress_);
-  if (st.st_size) {
-    unassert(!munmap(map, st.st_size));
+  in->name = name;
+  in->size = st.st_size;
+  in->mode = st.st_mode;
+}
+
+void *CompressWorker(void *arg) {
+  size_t i;
+  struct Input *in;
+  while ((i = atomic_fetch_add(&next_, 1)) < inputs_n_) {
+    in = inputs_ + i;
+    in->deflated =
+        elfwriter_zip_compress(in->name, strlen(in->name), in->map, in->size,
+                               nocompress_, deflaters_, &in->deflatedsize);
+  }
+  return 0;
+}
+
+// deflates every input at once, since it dominates the runtime. cores
+// are divided between files and the blocks of large files, so at most
+// one thread per cpu is ever running
+void CompressFiles(void) {
+  int i, n, c;
+  pthread_t *th;
+  c = MAX(__get_cpu_count(), 1);
+  n = MIN(c, inputs_n_);
+  deflaters_ = c / MAX(n, 1);
+  th = xcalloc(MAX(n, 1), sizeof(*th));
+  for (i = 1; i < n; ++i)
+    unassert(!pthread_create(th + i, 0, CompressWorker, 0));
+  CompressWorker(0);
+  for (i = 1; i < n; ++i)
+    unassert(!pthread_join(th[i], 0));
+  free(th);
+}
+
+// emits inputs in command line order so output is deterministic
+void EmitFile(struct ElfWriter *elf, struct Input *in) {
+  elfwriter_zip_deflated(elf, in->name, in->name, strlen(in->name), in->map,
+                         in->size, in->deflated, in->deflatedsize, in->mode,
+                         timestamp, timestamp, timestamp);
+  free(in->deflated);
+  if (in->size) {
+    unassert(!munmap(in->map, in->size));
   }
-  close(fd);
 }
 
 void PullEndOfCentralDirectoryIntoLinkage(struct ElfWriter *elf) {
@@ -229,10 +287,17 @@ void zipobj(int argc, char **argv) {
   GetOpts(&argc, &argv);
   for (i = 0; i < argc; ++i)
     CheckFilenameKosher(argv[i]);
+  inputs_n_ = argc;
+  inputs_ = xcalloc(MAX(argc, 1), sizeof(*inputs_));
+  for (i = 0; i < argc; ++i) {
+    inputs_[i].path = argv[i];
+    LoadFile(inputs_ + i);
+  }
+  CompressFiles();
   elf = elfwriter_open(outpath_, 0644, arch_);
   elfwriter_cargoculting(elf);
   for (i = 0; i < argc; ++i)
-    ProcessFile(elf, argv[i]);
+    EmitFile(elf, inputs_ + i);
   PullEndOfCentralDirectoryIntoLinkage(elf);
   elfwriter_close(elf);
 }
@@ -0,0 +1,288 @@
+/*-*- mode:c;indent-tabs-mode:nil;c-basic-offset:2;tab-width:8;coding:utf-8 -*-│
+│ vi: set et ft=c ts=2 sts=2 sw=2 fenc=utf-8                               :vi │
+╞══════════════════════════════════════════════════════════════════════════════╡
+│ Copyright 2024 Justine Alexandra Roberts Tunney                              │
+│                                                                              │
+│ Permission to use, copy, modify, and/or distribute this software for         │
+│ any purpose with or without fee is hereby granted, provided that the         │
+│ above copyright notice and this permission notice appear in all copies.      │
+│                                                                              │
+│ THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL                │
+│ WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED                │
+│ WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE             │
+│ AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL         │
+│ DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR        │
+│ PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER               │
+│ TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR             │
+│ PERFORMANCE OF THIS SOFTWARE.                                                │
+╚─────────────────────────────────────────────────────────────────────────────*/
+#include "libc/calls/calls.h"
+#include "libc/calls/struct/stat.h"
+#include "libc/errno.h"
+#include "libc/fmt/conv.h"
+#include "libc/log/check.h"
+#include "libc/log/log.h"
+#include "libc/macros.h"
+#include "libc/mem/mem.h"
+#include "libc/runtime/ftrace.internal.h"
+#include "libc/runtime/runtime.h"
+#include "libc/runtime/symbols.internal.h"
+#include "libc/stdio/stdio.h"
+#include "libc/str/str.h"
+#include "libc/sysv/consts/ex.h"
+#include "libc/sysv/consts/exit.h"
+#include "libc/sysv/consts/map.h"
+#include "libc/sysv/consts/o.h"
+#include "libc/sysv/consts/prot.h"
+#include "third_party/getopt/getopt.internal.h"
+
+/**
+ * @fileoverview Binary function trace decoder.
+ *
+ * Reads the log written by a program that was run with the
+ * `--ftrace-binary` flag, and prints it as text like `--ftrace` would,
+ * as Chrome Trace Event JSON for chrome://tracing and Perfetto, or as
+ * folded stacks for flamegraph.pl weighted by nanoseconds of self time.
+ * Anything in the log that isn't a record chunk (e.g. kprintf() lines)
+ * is skipped. Records only describe function entry, so a frame is
+ * considered finished once its thread calls something at the same or
+ * a shallower nesting level. Timestamps are converted to nanoseconds
+ * using the calibration the traced program logs when it exits, unless
+ * `-c` is passed.
+ */
+
+#define USAGE \
+  " [-jf] [-c CYCLES_PER_NS] TRACE [PROG.dbg]\n\
+\n\
+Flags:\n\
+  -j    print chrome trace event json\n\
+  -f    print folded stacks\n\
+  -c    rdtsc ticks per nanosecond [default is measured at exit]\n\
+  -h    show this help\n\
+\n"
+
+#define MAX_NESTING 512
+
+struct Frame {
+  uint32_t depth;
+  uint64_t addr;
+};
+
+struct Thread {
+  int pid, tid, n;
+  uint64_t last;
+  struct Frame stack[MAX_NESTING + 1];
+};
+
+static int g_mode;
+static double g_cpns;
+static struct FtraceChunk g_calib;
+static const char *g_comma = "";
+static struct SymbolTable *g_symtab;
+static struct {
+  int n;
+  struct Thread **p;
+} g_threads;
+
+static wontreturn void PrintUsage(int rc, FILE *f) {
+  fputs("Usage: ", f);
+  fputs(program_invocation_name, f);
+  fputs(USAGE, f);
+  exit(rc);
+}
+
+static void GetOpts(int argc, char *argv[]) {
+  int opt;
+  while ((opt = getopt(argc, argv, "?hjfc:")) != -1) {
+    switch (opt) {
+      case 'j':
+      case 'f':
+        g_mode = opt;
+        break;
+      case 'c':
+        if ((g_cpns = strtod(optarg, 0)) <= 0)
+          PrintUsage(EX_USAGE, stderr);
+        break;
+      case '?':
+      case 'h':
+        PrintUsage(EXIT_SUCCESS, stdout);
+      default:
+        PrintUsage(EX_USAGE, stderr);
+    }
+  }
+  if (optind == argc || argc - optind > 2)
+    PrintUsage(EX_USAGE, stderr);
+}
+
+// returns symbol name for addr, or formats it as hex into buf
+static const char *GetName(uint64_t addr, char buf[static 19]) {
+  char *s;
+  if (g_symtab &&
+      (s = __get_symbol_name(g_symtab, __get_symbol(g_symtab, addr))))
+    return s;
+  snprintf(buf, 19, "%#lx", addr);
+  return buf;
+}
+
+static double GetNanos(uint64_t tsc) {
+  return tsc / g_cpns;
+}
+
+static struct Thread *GetThread(int pid, int tid) {
+  int i;
+  struct Thread *t;
+  for (i = 0; i < g_threads.n; ++i)
+    if (g_threads.p[i]->tid == tid && g_threads.p[i]->pid == pid)
+      return g_threads.p[i];
+  CHECK_NOTNULL((t = calloc(1, sizeof(*t))));
+  CHECK_NOTNULL((g_threads.p = realloc(
+                     g_threads.p, (g_threads.n + 1) * sizeof(*g_threads.p))));
+  g_threads.p[g_threads.n++] = t;
+  t->pid = pid;
+  t->tid = tid;
+  return t;
+}
+
+static void PrintJsonString(const char *s) {
+  putchar('"');
+  for (; *s; ++s) {
+    if (*s == '"' || *s == '\\')
+      putchar('\\');
+    putchar(*s);
+  }
+  putchar('"');
+}
+
+static void PrintEvent(struct Thread *t, uint64_t addr, char ph,
+                       uint64_t tsc) {
+  char buf[19];
+  printf("%s\n{\"name\":", g_comma);
+  PrintJsonString(GetName(addr, buf));
+  printf(",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":%d,\"tid\":%d}", ph,
+         GetNanos(tsc) / 1000, t->pid, t->tid);
+  g_comma = ",";
+}
+
+static void PrintFolded(struct Thread *t, uint64_t tsc) {
+  int i;
+  char buf[19];
+  if (!t->n || tsc <= t->last)
+    return;
+  for (i = 0; i < t->n; ++i) {
+    if (i)
+      putchar(';');
+    fputs(GetName(t->stack[i].addr, buf), stdout);
+  }
+  printf(" %lu\n", (uint64_t)(GetNanos(tsc) - GetNanos(t->last)));
+}
+
+static void OnRecord(const struct FtraceRecord *r) {
+  char buf[19];
+  struct Thread *t;
+  if (!g_mode) {
+    printf("FUN %6d %6d %18lu %10u %*s%s\n", r->pid, r->tid,
+           (uint64_t)GetNanos(r->tsc), r->stackuse,
+           (int)MIN(r->depth, MAX_NESTING) * 2, "", GetName(r->addr, buf));
+    return;
+  }
+  t = GetThread(r->pid, r->tid);
+  if (g_mode == 'f')
+    PrintFolded(t, r->tsc);
+  while (t->n && t->stack[t->n - 1].depth >= r->depth) {
+    --t->n;
+    if (g_mode == 'j')
+      PrintEvent(t, t->stack[t->n].addr, 'E', r->tsc);
+  }
+  if (t->n == ARRAYLEN(t->stack))
+    --t->n;
+  t->stack[t->n].depth = r->depth;
+  t->stack[t->n].addr = r->addr;
+  ++t->n;
+  t->last = r->tsc;
+  if (g_mode == 'j')
+    PrintEvent(t, r->addr, 'B', r->tsc);
+}
+
+// visits records, or when calibrating, finds the longest measurement
+// of timestamp counter frequency, which a log may have several of if
+// the traced program forked
+static void Decode(const char *p, size_t n, bool calibrating) {
+  const char *e, *q;
+  struct FtraceChunk hdr;
+  struct FtraceRecord rec;
+  for (e = p + n; (q = memmem(p, e - p, FTRACE_MAGIC, 8)); p = q + 8) {
+    if (e - q < sizeof(hdr))
+      break;
+    memcpy(&hdr, q, sizeof(hdr));
+    if (hdr.size != sizeof(rec) ||
+        (e - q - sizeof(hdr)) / sizeof(rec) < hdr.count)
+      continue;
+    if (calibrating) {
+      if (hdr.ticks && hdr.nanos > g_calib.nanos)
+        g_calib = hdr;
+      continue;
+    }
+    q += sizeof(hdr);
+    for (; hdr.count--; q += sizeof(rec)) {
+      memcpy(&rec, q, sizeof(rec));
+      OnRecord(&rec);
+    }
+    q -= 8;
+  }
+}
+
+static void Finish(void) {
+  int i;
+  struct Thread *t;
+  if (g_mode != 'j')
+    return;
+  for (i = 0; i < g_threads.n; ++i) {
+    t = g_threads.p[i];
+    while (t->n) {
+      --t->n;
+      PrintEvent(t, t->stack[t->n].addr, 'E', t->last);
+    }
+  }
+  printf("\n]}\n");
+}
+
+int main(int argc, char *argv[]) {
+  int fd;
+  char *map;
+  struct stat st;
+  ShowCrashReports();
+  GetOpts(argc, argv);
+  if (optind + 1 < argc && !(g_symtab = OpenSymbolTable(argv[optind + 1]))) {
+    fprintf(stderr, "%s: failed to open symbol table\n", argv[optind + 1]);
+    return 1;
+  }
+  if ((fd = open(argv[optind], O_RDONLY)) == -1 || fstat(fd, &st) == -1) {
+    perror(argv[optind]);
+    return 1;
+  }
+  map = 0;
+  if (st.st_size) {
+    CHECK_NE(MAP_FAILED, (map = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE,
+                                     fd, 0)));
+    if (!g_cpns)
+      Decode(map, st.st_size, true);
+  }
+  if (!g_cpns && g_calib.nanos)
+    g_cpns = (double)g_calib.ticks / g_calib.nanos;
+  if (!g_cpns && st.st_size) {
+    fprintf(stderr,
+            "%s: no calibration found, since the program didn't exit "
+            "normally; pass -c\n",
+            argv[optind]);
+    return 1;
+  }
+  if (g_mode == 'j')
+    printf("{\"traceEvents\":[");
+  if (st.st_size) {
+    Decode(map, st.st_size, false);
+    CHECK_NE(-1, munmap(map, st.st_size));
+  }
+  Finish();
+  CHECK_NE(-1, close(fd));
+  return 0;
+}
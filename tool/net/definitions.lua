@@ -1423,6 +1423,33 @@ function LoadAsset(path) end
 ---@param mode? integer
 function StoreAsset(path, data, mode) end
 
+--- Stores many assets at once, where `assets` is a list of tables that each
+--- hold the arguments you'd pass to `StoreAsset`, e.g.
+---
+---     StoreAssets{{'/a.txt', 'hi'}, {'/b.sh', '#!/bin/sh', 0755}}
+---
+--- Every local file gets appended and then a single central directory is
+--- written for the whole batch, under one lock, so it's much faster than
+--- calling `StoreAsset` in a loop, and the executable won't grow by a copy of
+--- the central directory for each asset. If a path appears twice, the last one
+--- wins. The `-A` flag uses this too, storing each directory it's given as one
+--- transaction.
+---@param assets { [1]: string, [2]: string, [3]: integer? }[]
+function StoreAssets(assets) end
+
+--- Rewrites the executable without the superseded files and stale central
+--- directories that `StoreAsset` leaves behind. The result is written to a
+--- temporary file alongside the executable and then renamed into place, so it
+--- needs write access to that directory. Workers still serving from the old
+--- file continue to do so, and pick up the new one the next time they
+--- reindex. Returns the number of bytes reclaimed, zero if there was nothing
+--- to do, or -1 if compaction failed. Everything before the first leftover is
+--- kept byte for byte. Past that point, every file the central directory lists
+--- is moved down along with its data descriptor, whoever put it there, and any
+--- other bytes in between are dropped.
+---@return integer reclaimed
+function CompactAssets() end
+
 --- Emits message string to log, if level is less than or equal to `GetLogLevel`.
 --- If redbean is running in interactive mode, then this will log to the console.
 --- If redbean is running as a daemon or the `-L LOGFILE` flag is passed, then this
@@ -1705,7 +1732,11 @@ function ProgramRedirect(code, src, location) end
 
 --- Defaults to `86400` (24 hours). This may be set to `≤0` to disable SSL tickets.
 --- It's a good idea to use these since it increases handshake performance 10x and
---- eliminates a network round trip. This function is not available in unsecure mode.
+--- eliminates a network round trip. The same lifetime applies to the server-side
+--- session cache, which lets clients that don't support tickets resume sessions
+--- by id in any worker process. It's shared across workers, holds 1024 sessions,
+--- and reports its effectiveness in the `sslcache*` counters of `/statusz`. This
+--- function is not available in unsecure mode.
 ---@param seconds integer
 function ProgramSslTicketLifetime(seconds) end
 
@@ -1725,6 +1756,20 @@ function ProgramSslTicketLifetime(seconds) end
 ---@param identity string
 function ProgramSslPresharedKey(key, identity) end
 
+--- Enables transparent connection reuse for `Fetch()`. Requests that don't
+--- supply their own `keepalive` table leave their connection open afterwards,
+--- and the next request to the same scheme, host, and port picks it up again.
+--- HTTPS pooled connections skip the handshake entirely, and new connections to
+--- a host resume its last TLS session. At most `maxperhost` idle connections
+--- are kept per host, and they're closed after `idletimeoutms` milliseconds of
+--- idleness (default 30000). Each process has its own pool. If the server
+--- hangs up a pooled connection before responding, idempotent requests such as
+--- GET and PUT are sent once more on a new connection, but POST and the other
+--- methods fail, since the server may have acted on them. Passing 0 disables.
+---@param maxperhost integer
+---@param idletimeoutms integer?
+function ProgramFetchPool(maxperhost, idletimeoutms) end
+
 --- May be used to disable the verification of certificates
 --- for remote hosts when using the Fetch() API. This function is
 --- not available in unsecure mode.
@@ -2743,6 +2788,34 @@ function lsqlite3.open(filename, flags) end
 ---@overload fun(): nil, errorcode: integer, errormsg: string
 function lsqlite3.open_memory() end
 
+--- Creates a lazy connection that gives each process its own warm
+--- connection to a database. Nothing is opened until `lazydb:get()` is first
+--- called in a process, which is normally a forked redbean worker, since
+--- SQLite connections can't be used across `fork()`. The worker then keeps
+--- reusing that connection for the rest of its requests.
+---
+--- `setup` is SQL that's run on every new connection, e.g. pragmas. Each
+--- connection also loads the schema and prepares `statements` into its
+--- statement cache before it's returned, so the first `db:urows()` or
+--- `db:exec()` of that SQL doesn't have to prepare it.
+---
+---     lazydb = lsqlite3.lazy('db.sqlite3', nil, [[
+---         PRAGMA journal_mode=WAL;
+---         PRAGMA busy_timeout=1000;
+---     ]], {'SELECT name FROM users WHERE id = ?'})
+---     function OnHttpRequest()
+---         local db = lazydb:get()
+---         ...
+---     end
+---
+---@param filename string
+---@param flags? integer defaults to `lsqlite3.OPEN_READWRITE + lsqlite3.OPEN_CREATE`
+---@param setup? string
+---@param statements? string[]
+---@return lsqlite3.Lazy lazydb
+---@nodiscard
+function lsqlite3.lazy(filename, flags, setup, statements) end
+
 ---@return string version lsqlite3 library version information, in the form 'x.y[.z]'.
 ---@nodiscard
 function lsqlite3.lversion() end
@@ -2751,6 +2824,27 @@ function lsqlite3.lversion() end
 ---@nodiscard
 function lsqlite3.version() end
 
+---@class lsqlite3.Lazy: userdata
+--- Returned by `lsqlite3.lazy`.
+local Lazy = nil
+
+--- Returns connection for the current process, opening it if needed.
+---@return lsqlite3.Database db
+---@nodiscard
+---@overload fun(self: lsqlite3.Lazy): nil, errorcode: integer, errormsg: string
+function Lazy:get() end
+
+--- Returns the number of connections opened (`opens`) and of `lazydb:get()`
+--- calls that reused one (`reuses`), counting those made by a parent before
+--- it forked, and whether the current process has one (`connected`).
+---@return { opens: integer, reuses: integer, connected: boolean }
+---@nodiscard
+function Lazy:stats() end
+
+--- Closes the current process's connection, if it has one. The lazy
+--- connection can't be used afterwards.
+function Lazy:close() end
+
 ---@class lsqlite3.Context: userdata
 --- A callback context is available as a parameter inside the callback functions
 --- `db:create_aggregate()` and `db:create_function()`. It can be used to get
@@ -2999,8 +3093,10 @@ function Database:error_message() end
 Database.errmsg = Database.error_message
 
 --- Compiles and executes the SQL statement(s) given in string sql. The statements
---- are simply executed one after the other and not stored. The function returns
---- `lsqlite3.OK` on success or else a numerical error code.
+--- are simply executed one after the other and not stored, unless sql holds just
+--- one statement, in which case it's kept in the statement cache (see
+--- `db:stmt_cache_size()`). The function returns `lsqlite3.OK` on success or else
+--- a numerical error code.
 ---
 --- If one or more of the SQL statements are queries, then the callback function
 --- specified in func is invoked once for each row of the query result (if func is
@@ -3148,6 +3244,22 @@ function Database:rows(sql) end
 ---@nodiscard
 function Database:serialize() end
 
+--- Sets how many statements prepared by `db:exec()`, `db:rows()`, `db:nrows()`
+--- and `db:urows()` are kept around, keyed by their SQL text, so running the same
+--- query again skips parsing and planning it. When the cache is full, the least
+--- recently used statement is finalized. Cached statements are reset and have
+--- their bindings cleared before reuse. Defaults to 16. Passing `0` disables the
+--- cache. Changing the size empties the cache.
+---@param size? integer
+---@return integer previous size
+function Database:stmt_cache_size(size) end
+
+--- Returns statement cache statistics, i.e. `hits`, `misses`, `evictions`, how
+--- many statements are cached (`count`) and the cache `size`.
+---@return { hits: integer, misses: integer, evictions: integer, count: integer, size: integer }
+---@nodiscard
+function Database:stmt_cache_stats() end
+
 ---@return integer # the number of database rows that have been modified by INSERT, UPDATE or DELETE statements since the database was opened.
 --- This includes UPDATE, INSERT and DELETE statements executed as part of trigger
 --- programs. All changes are counted as soon as the statement that produces them
@@ -4444,6 +4556,33 @@ unix = {
     --- default, so this error code is a distinct possibility when pipes or
     --- sockets are being used.
     EPIPE = nil,
+
+    --- @type integer
+    EPOLL_CLOEXEC = nil,
+    --- @type integer
+    EPOLL_CTL_ADD = nil,
+    --- @type integer
+    EPOLL_CTL_DEL = nil,
+    --- @type integer
+    EPOLL_CTL_MOD = nil,
+    --- @type integer
+    EPOLLERR = nil,
+    --- @type integer
+    EPOLLET = nil,
+    --- @type integer
+    EPOLLEXCLUSIVE = nil,
+    --- @type integer
+    EPOLLHUP = nil,
+    --- @type integer
+    EPOLLIN = nil,
+    --- @type integer
+    EPOLLONESHOT = nil,
+    --- @type integer
+    EPOLLOUT = nil,
+    --- @type integer
+    EPOLLPRI = nil,
+    --- @type integer
+    EPOLLRDHUP = nil,
     --- @type integer Raised by `accept`, `connect`, `socket`, `socketpair`.
     EPROTO = nil,
     --- @type integer Protocol not supported. Raised by `socket`, `socketpair`.
@@ -4878,6 +5017,13 @@ unix = {
     --- @type integer
     SOCK_STREAM = nil,
 
+    --- @type integer
+    SPLICE_F_MORE = nil,
+    --- @type integer
+    SPLICE_F_MOVE = nil,
+    --- @type integer
+    SPLICE_F_NONBLOCK = nil,
+
     --- @type integer
     SOL_IP = nil,
     --- @type integer
@@ -5082,6 +5228,77 @@ function unix.read(fd, bufsiz, offset) end
 ---@overload fun(fd: integer, data: string, offset?: integer): nil, error: unix.Errno
 function unix.write(fd, data, offset) end
 
+--- Reads from file descriptor into several buffers at once.
+---
+--- `sizes` is a list of buffer sizes. One string is returned for each,
+--- holding however much of the data landed in that buffer. If `offset`
+--- is specified, then the file position isn't used or changed.
+---@param fd integer
+---@param sizes integer[]
+---@param offset integer?
+---@return string data, string ...
+---@overload fun(fd: integer, sizes: integer[], offset?: integer): nil, error: unix.Errno
+function unix.readv(fd, sizes, offset) end
+
+--- Writes list of strings to file descriptor with a single system call.
+---
+--- If `offset` is specified, then the file position isn't used or changed.
+---@param fd integer
+---@param iov string[]
+---@param offset integer?
+---@return integer wrotebytes
+---@overload fun(fd: integer, iov: string[], offset?: integer): nil, error: unix.Errno
+function unix.writev(fd, iov, offset) end
+
+--- Sends up to `count` bytes of file `infd` to `outfd` without copying them
+--- through Lua, e.g. to serve a file on a socket.
+---
+--- If `offset` is specified, reading starts there and the file position of
+--- `infd` isn't changed. Otherwise it's read from, and advances, the file
+--- position.
+---@param outfd integer
+---@param infd integer
+---@param count integer
+---@param offset integer?
+---@return integer sentbytes
+---@overload fun(outfd: integer, infd: integer, count: integer, offset?: integer): nil, error: unix.Errno
+function unix.sendfile(outfd, infd, count, offset) end
+
+--- Moves up to `count` bytes between two file descriptors inside the kernel,
+--- where one of them must be a pipe. This is only supported on Linux.
+---
+--- `flags` may have any of:
+---
+--- - `unix.SPLICE_F_MOVE`
+--- - `unix.SPLICE_F_NONBLOCK`
+--- - `unix.SPLICE_F_MORE`
+---
+--- `inoffset` and `outoffset` may be specified for the side that isn't a
+--- pipe, in which case its file position isn't used or changed.
+---@param infd integer
+---@param outfd integer
+---@param count integer
+---@param flags integer?
+---@param inoffset integer?
+---@param outoffset integer?
+---@return integer movedbytes
+---@overload fun(infd: integer, outfd: integer, count: integer, flags?: integer, inoffset?: integer, outoffset?: integer): nil, error: unix.Errno
+function unix.splice(infd, outfd, count, flags, inoffset, outoffset) end
+
+--- Copies up to `count` bytes from one file to another inside the kernel,
+--- which lets filesystems that support it share the blocks instead.
+---
+--- If `inoffset` or `outoffset` is specified, then the corresponding file
+--- position isn't used or changed. This is supported on Linux and FreeBSD.
+---@param infd integer
+---@param outfd integer
+---@param count integer
+---@param inoffset integer?
+---@param outoffset integer?
+---@return integer copiedbytes
+---@overload fun(infd: integer, outfd: integer, count: integer, inoffset?: integer, outoffset?: integer): nil, error: unix.Errno
+function unix.copy_file_range(infd, outfd, count, inoffset, outoffset) end
+
 --- Invokes `_Exit(exitcode)` on the process. This will immediately
 --- halt the current process. Memory will be freed. File descriptors
 --- will be closed. Any open connections it owns will be reset. This
@@ -6578,6 +6795,44 @@ function unix.setsockopt(fd, level, optname, value) end
 ---@overload fun(fds: table<integer,integer>, timeoutms:integer): nil, unix.Errno
 function unix.poll(fds, timeoutms) end
 
+--- Creates epoll file descriptor. Linux only.
+---
+--- Unlike `unix.poll()`, the set of watched file descriptors lives in the
+--- kernel, so each wakeup only costs as much as the number of fds that are
+--- ready. `flags` may be `unix.EPOLL_CLOEXEC`. Close it with `unix.close()`.
+---@param flags integer?
+---@return integer epfd
+---@nodiscard
+---@overload fun(flags?: integer): nil, unix.Errno
+function unix.epoll_create(flags) end
+
+--- Adds, changes, or removes file descriptor watched by epoll. Linux only.
+---
+--- `op` is `unix.EPOLL_CTL_ADD`, `unix.EPOLL_CTL_MOD` or
+--- `unix.EPOLL_CTL_DEL`. `events` may be any combination of `EPOLLIN`,
+--- `EPOLLOUT`, `EPOLLPRI`, `EPOLLRDHUP`, `EPOLLET`, `EPOLLONESHOT` and
+--- `EPOLLEXCLUSIVE`.
+---@param epfd integer
+---@param op integer
+---@param fd integer
+---@param events integer?
+---@return true
+---@overload fun(epfd: integer, op: integer, fd: integer, events?: integer): nil, unix.Errno
+function unix.epoll_ctl(epfd, op, fd, events) end
+
+--- Waits for events on file descriptors watched by epoll. Linux only.
+---
+--- Returns table of at most `maxevents` (default 64) ready file
+--- descriptors mapped to their events, which may also include `EPOLLERR`
+--- and `EPOLLHUP`. `timeoutms` defaults to -1 which blocks indefinitely.
+---@param epfd integer
+---@param timeoutms integer?
+---@param maxevents integer?
+---@return table<integer,integer> `{[fd:int]=events:int, ...}`
+---@nodiscard
+---@overload fun(epfd: integer, timeoutms?: integer, maxevents?: integer): nil, unix.Errno
+function unix.epoll_wait(epfd, timeoutms, maxevents) end
+
 --- Returns hostname of system.
 ---@return string host
 ---@nodiscard
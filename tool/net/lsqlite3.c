@@ -27,6 +27,7 @@
 │ TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE            │
 │ SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.                       │
 ╚─────────────────────────────────────────────────────────────────────────────*/
+#include "libc/calls/calls.h"
 #include "libc/calls/weirdtypes.h"
 #include "libc/mem/gc.h"
 #include "libc/mem/mem.h"
@@ -44,6 +45,7 @@ Copyright 2002-2016 Tiago Dionizio, Doug Currie");
 
 // LOCAL CHANGES
 //
+//   - Cache statements prepared by db:exec() and db:rows()
 //   - Remove online backup code
 //   - Remove trace callback code
 //   - Remove progress callback code
@@ -77,6 +79,8 @@ typedef struct sdb sdb;
 typedef struct sdb_vm sdb_vm;
 typedef struct sdb_bu sdb_bu;
 typedef struct sdb_func sdb_func;
+typedef struct sdb_stmt sdb_stmt;
+typedef struct sdb_lazy sdb_lazy;
 
 /* to use as C user data so i know what function sqlite is calling */
 struct sdb_func {
@@ -97,6 +101,8 @@ struct sdb {
     lua_State *L;
     /* sqlite database handle */
     sqlite3 *db;
+    /* process that opened it; children must not touch it after fork() */
+    int pid;
 
     /* sql functions stack usage */
     sdb_func *func;         /* top SQL function being called */
@@ -116,11 +122,32 @@ struct sdb {
 
     int rollback_hook_cb; /* rollback_hook callback */
     int rollback_hook_udata;
+
+    /* statements prepared by db:exec() and db:rows(), keyed by sql text */
+    sdb_stmt *stmts;
+    int stmt_count;
+    int stmt_size;          /* max cached statements; 0 disables cache */
+    unsigned long stmt_clock;
+    lua_Integer stmt_hits;
+    lua_Integer stmt_misses;
+    lua_Integer stmt_evictions;
 };
 
+/* idle prepared statement in the cache */
+struct sdb_stmt {
+    char *sql;
+    int sql_len;
+    unsigned hash;
+    unsigned long used;     /* stmt_clock when it was last returned */
+    sqlite3_stmt *vm;
+};
+
+#define DEFAULT_STMT_CACHE_SIZE 16
+
 static const char *const sqlite_meta      = ":sqlite3";
 static const char *const sqlite_vm_meta   = ":sqlite3:vm";
 static const char *const sqlite_ctx_meta  = ":sqlite3:ctx";
+static const char *const sqlite_lazy_meta = ":sqlite3:lazy";
 static int sqlite_ctx_meta_ref;
 #ifdef SQLITE_ENABLE_SESSION
 static const char *const sqlite_ses_meta  = ":sqlite3:ses";
@@ -175,8 +202,118 @@ struct sdb_vm {
     char has_values;        /* true when step succeeds */
 
     char temp;              /* temporary vm used in db:rows */
+
+    char *sql;              /* cache key when vm goes back to cache */
+    int sql_len;
 };
 
+/*
+** =======================================================
+** Statement Cache
+** =======================================================
+*/
+
+static unsigned stmt_hash(const char *sql, int len) {
+    unsigned h = 2166136261u;
+    while (len--) h = (h ^ (unsigned char)*sql++) * 16777619u;
+    return h;
+}
+
+static void stmt_drop(sdb *db, int i) {
+    sqlite3_finalize(db->stmts[i].vm);
+    free(db->stmts[i].sql);
+    db->stmts[i] = db->stmts[--db->stmt_count];
+}
+
+/* evicts least recently used statements until at most n remain */
+static void stmt_trim(sdb *db, int n) {
+    int i, lru;
+    while (db->stmt_count > n) {
+        for (lru = i = 0; i < db->stmt_count; ++i)
+            if (db->stmts[i].used < db->stmts[lru].used) lru = i;
+        stmt_drop(db, lru);
+        ++db->stmt_evictions;
+    }
+}
+
+static void stmt_clear(sdb *db) {
+    while (db->stmt_count) stmt_drop(db, db->stmt_count - 1);
+    free(db->stmts);
+    db->stmts = NULL;
+}
+
+/* skips whitespace and semicolons that may follow the last statement */
+static const char *stmt_skip(const char *tail) {
+    while (*tail == ' ' || *tail == '\t' || *tail == '\n' || *tail == '\r' ||
+           *tail == ';')
+        ++tail;
+    return tail;
+}
+
+/*
+** Takes statement for sql out of the cache, or else prepares it. If
+** the statement should be returned to the cache when its user is done
+** with it then *key is set to an allocated copy of the sql text. Only
+** sql holding a single statement is cached, since a cache hit can't
+** tell the caller where the next statement would have started.
+*/
+static int stmt_checkout(sdb *db, const char *sql, int sql_len,
+                         sqlite3_stmt **vm, const char **tail, char **key) {
+    int i, rc;
+    const char *t;
+    unsigned hash = stmt_hash(sql, sql_len);
+    *key = NULL;
+    for (i = 0; i < db->stmt_count; ++i) {
+        if (db->stmts[i].hash == hash && db->stmts[i].sql_len == sql_len &&
+            !memcmp(db->stmts[i].sql, sql, sql_len)) {
+            *vm = db->stmts[i].vm;
+            *key = db->stmts[i].sql;
+            if (tail) *tail = sql + sql_len;
+            db->stmts[i] = db->stmts[--db->stmt_count];
+            ++db->stmt_hits;
+            return SQLITE_OK;
+        }
+    }
+    rc = sqlite3_prepare_v2(db->db, sql, sql_len, vm, &t);
+    if (tail) *tail = t;
+    if (rc == SQLITE_OK && *vm && db->stmt_size > 0 && !*stmt_skip(t)) {
+        ++db->stmt_misses;
+        if ((*key = malloc(sql_len + 1))) {
+            memcpy(*key, sql, sql_len);
+            (*key)[sql_len] = 0;
+        }
+    }
+    return rc;
+}
+
+/* returns statement to the cache, taking ownership of key */
+static void stmt_checkin(sdb *db, sqlite3_stmt *vm, char *key, int key_len) {
+    int i;
+    unsigned hash;
+    sqlite3_reset(vm);
+    sqlite3_clear_bindings(vm);
+    if (!key || !db->db || db->stmt_size <= 0) goto drop;
+    hash = stmt_hash(key, key_len);
+    for (i = 0; i < db->stmt_count; ++i) {
+        /* same sql was checked out twice at once; keep one */
+        if (db->stmts[i].hash == hash && db->stmts[i].sql_len == key_len &&
+            !memcmp(db->stmts[i].sql, key, key_len)) goto drop;
+    }
+    if (!db->stmts &&
+        !(db->stmts = malloc(db->stmt_size * sizeof(*db->stmts)))) goto drop;
+    stmt_trim(db, db->stmt_size - 1);
+    db->stmts[db->stmt_count].sql = key;
+    db->stmts[db->stmt_count].sql_len = key_len;
+    db->stmts[db->stmt_count].hash = hash;
+    db->stmts[db->stmt_count].used = ++db->stmt_clock;
+    db->stmts[db->stmt_count].vm = vm;
+    ++db->stmt_count;
+    return;
+drop:
+    sqlite3_finalize(vm);
+    free(key);
+}
+
 /* called with db,sql text on the lua stack */
 static sdb_vm *newvm(lua_State *L, sdb *db) {
     sdb_vm *svm = (sdb_vm*)lua_newuserdata(L, sizeof(sdb_vm)); /* db sql svm_ud -- */
@@ -189,6 +326,8 @@ static sdb_vm *newvm(lua_State *L, sdb *db) {
     svm->has_values = 0;
     svm->vm = NULL;
     svm->temp = 0;
+    svm->sql = NULL;
+    svm->sql_len = 0;
 
     /* add an entry on the database table: svm -> db to keep db live while svm is live */
     lua_pushlightuserdata(L, db);     /* db sql svm_ud db_lud -- */
@@ -206,7 +345,19 @@ static int cleanupvm(lua_State *L, sdb_vm *svm) {
     svm->has_values = 0;
 
     if (!svm->vm) return 0;
-    lua_pushinteger(L, sqlite3_finalize(svm->vm));
+    if (svm->db->pid != getpid()) {
+        /* statement of a connection inherited across fork(); abandon it */
+        svm->vm = NULL;
+        svm->sql = NULL;
+        return 0;
+    }
+    if (svm->sql) {
+        lua_pushinteger(L, sqlite3_reset(svm->vm));
+        stmt_checkin(svm->db, svm->vm, svm->sql, svm->sql_len);
+        svm->sql = NULL;
+    }
+    else
+        lua_pushinteger(L, sqlite3_finalize(svm->vm));
     svm->vm = NULL;
     return 1;
 }
@@ -597,6 +748,7 @@ static sdb *newdb (lua_State *L) {
     sdb *db = (sdb*)lua_newuserdata(L, sizeof(sdb));
     db->L = L;
     db->db = NULL;  /* database handle is currently `closed' */
+    db->pid = getpid();
     db->func = NULL;
 
     db->busy_cb =
@@ -611,6 +763,14 @@ static sdb *newdb (lua_State *L) {
     db->rollback_hook_udata =
         LUA_NOREF;
 
+    db->stmts = NULL;
+    db->stmt_count = 0;
+    db->stmt_size = DEFAULT_STMT_CACHE_SIZE;
+    db->stmt_clock = 0;
+    db->stmt_hits = 0;
+    db->stmt_misses = 0;
+    db->stmt_evictions = 0;
+
     luaL_getmetatable(L, sqlite_meta);
     lua_setmetatable(L, -2);        /* set metatable */
 
@@ -649,7 +809,10 @@ static int cleanupdb(lua_State *L, sdb *db) {
 
     if (!db->db) return SQLITE_MISUSE;
 
-    closevms(L, db, 0);
+    if (db->pid == getpid()) {
+        closevms(L, db, 0);
+        stmt_clear(db);
+    }
 
     /* remove entry in lua registry table */
     lua_pushlightuserdata(L, db);
@@ -669,8 +832,13 @@ static int cleanupdb(lua_State *L, sdb *db) {
     luaL_unref(L, LUA_REGISTRYINDEX, db->rollback_hook_udata);
 
     /* close database; _v2 is intended for use with garbage collected languages
-       and where the order in which destructors are called is arbitrary. */
-    result = sqlite3_close_v2(db->db);
+       and where the order in which destructors are called is arbitrary. A
+       connection inherited across fork() still belongs to the parent, whose
+       locks and wal file closing it here could disturb, so it's abandoned. */
+    if (db->pid == getpid())
+        result = sqlite3_close_v2(db->db);
+    else
+        result = SQLITE_OK;
     db->db = NULL;
 
     /* free associated memory with created functions */
@@ -1562,9 +1730,65 @@ static int db_exec_callback(void* user, int columns, char **data, char **names)
     return result;
 }
 
+/*
+** Runs each statement in sql in turn, invoking the callback the same
+** way sqlite3_exec() would. sql holding a single statement is served
+** from the statement cache; otherwise each statement is prepared once,
+** stepped, and finalized without being cached, so nothing is ever
+** prepared twice.
+*/
+static int db_exec_cached(lua_State *L, sdb *db, const char *sql, int sql_len,
+                          int callback) {
+    int i, rc, columns, first = 1;
+    char *key, **cols;
+    const char *tail;
+    sqlite3_stmt *vm;
+
+    for (;;) {
+        if (first) {
+            rc = stmt_checkout(db, sql, sql_len, &vm, &tail, &key);
+            first = 0;
+        } else {
+            key = NULL;
+            rc = sqlite3_prepare_v2(db->db, sql, sql_len, &vm, &tail);
+        }
+        if (rc != SQLITE_OK) return rc;
+        if (vm) {
+            cols = NULL;
+            columns = sqlite3_column_count(vm);
+            while ((rc = sqlite3_step(vm)) == SQLITE_ROW) {
+                if (!callback) continue;
+                if (!cols &&
+                    !(cols = malloc(2 * columns * sizeof(*cols) + 1))) {
+                    rc = SQLITE_NOMEM;
+                    break;
+                }
+                for (i = 0; i < columns; ++i) {
+                    cols[i] = (char *)sqlite3_column_name(vm, i);
+                    cols[columns + i] = (char *)sqlite3_column_text(vm, i);
+                }
+                if (db_exec_callback(L, columns, cols + columns, cols)) {
+                    rc = SQLITE_ABORT;
+                    break;
+                }
+            }
+            free(cols);
+            if (rc == SQLITE_DONE) rc = SQLITE_OK;
+            if (rc != SQLITE_ABORT && rc != SQLITE_NOMEM)
+                rc = sqlite3_reset(vm);
+            stmt_checkin(db, vm, key, sql_len);
+            if (rc != SQLITE_OK) return rc;
+        }
+        sql_len -= tail - sql;
+        sql = tail;
+        if (!*stmt_skip(sql)) return SQLITE_OK;
+    }
+}
+
 static int db_exec(lua_State *L) {
     sdb *db = lsqlite_checkdb(L, 1);
     const char *sql = luaL_checkstring(L, 2);
+    int sql_len = lua_rawlen(L, 2);
     int result;
 
     if (!lua_isnoneornil(L, 3)) {
@@ -1579,11 +1803,11 @@ static int db_exec(lua_State *L) {
         lua_pushnil(L);     /* column names not known at this point */
         lua_newtable(L);    /* column values table */
 
-        result = sqlite3_exec(db->db, sql, db_exec_callback, L, NULL);
+        result = db_exec_cached(L, db, sql, sql_len, 1);
     }
     else {
         /* no callbacks */
-        result = sqlite3_exec(db->db, sql, NULL, NULL, NULL);
+        result = db_exec_cached(L, db, sql, sql_len, 0);
     }
 
     lua_pushinteger(L, result);
@@ -1655,18 +1879,18 @@ static int db_do_next_row(lua_State *L, int packed) {
         }
     }
 
-    if (svm->temp) {
-        /* finalize and check for errors */
-        result = sqlite3_finalize(vm);
-        svm->vm = NULL;
-        cleanupvm(L, svm);
-    }
-    else if (result == SQLITE_DONE) {
+    if (result == SQLITE_DONE || svm->temp) {
         result = sqlite3_reset(vm);
     }
 
     if (result != SQLITE_OK) {
         lua_pushstring(L, sqlite3_errmsg(svm->db->db));
+    }
+    if (svm->temp) {
+        /* finalize, or return statement to cache */
+        lua_pop(L, cleanupvm(L, svm));
+    }
+    if (result != SQLITE_OK) {
         lua_error(L);
     }
     return 0;
@@ -1708,12 +1932,14 @@ static int dbvm_urows(lua_State *L) {
 static int db_do_rows(lua_State *L, int(*f)(lua_State *)) {
     sdb *db = lsqlite_checkdb(L, 1);
     const char *sql = luaL_checkstring(L, 2);
+    int sql_len = lua_rawlen(L, 2);
     sdb_vm *svm;
     lua_settop(L,2); /* db,sql is on top of stack for call to newvm */
     svm = newvm(L, db);
     svm->temp = 1;
+    svm->sql_len = sql_len;
 
-    if (sqlite3_prepare_v2(db->db, sql, -1, &svm->vm, NULL) != SQLITE_OK) {
+    if (stmt_checkout(db, sql, sql_len, &svm->vm, NULL, &svm->sql) != SQLITE_OK) {
         lua_pushstring(L, sqlite3_errmsg(svm->db->db));
         if (cleanupvm(L, svm) == 1)
             lua_pop(L, 1); /* this should not happen since sqlite3_prepare_v2 will not set ->vm on error */
@@ -1738,6 +1964,42 @@ static int db_urows(lua_State *L) {
     return db_do_rows(L, db_next_row);
 }
 
+/*
+** Params: db [, size]
+** returns: previous size
+*/
+static int db_stmt_cache_size(lua_State *L) {
+    sdb *db = lsqlite_checkdb(L, 1);
+    int size = luaL_optinteger(L, 2, db->stmt_size);
+    luaL_argcheck(L, size >= 0, 2, "negative cache size");
+    lua_pushinteger(L, db->stmt_size);
+    if (size != db->stmt_size) {
+        stmt_clear(db);
+        db->stmt_size = size;
+    }
+    return 1;
+}
+
+/*
+** Params: db
+** returns: table with hits, misses, evictions, count and size
+*/
+static int db_stmt_cache_stats(lua_State *L) {
+    sdb *db = lsqlite_checkdb(L, 1);
+    lua_createtable(L, 0, 5);
+    lua_pushinteger(L, db->stmt_hits);
+    lua_setfield(L, -2, "hits");
+    lua_pushinteger(L, db->stmt_misses);
+    lua_setfield(L, -2, "misses");
+    lua_pushinteger(L, db->stmt_evictions);
+    lua_setfield(L, -2, "evictions");
+    lua_pushinteger(L, db->stmt_count);
+    lua_setfield(L, -2, "count");
+    lua_pushinteger(L, db->stmt_size);
+    lua_setfield(L, -2, "size");
+    return 1;
+}
+
 static int db_tostring(lua_State *L) {
     char buff[33];
     sdb *db = lsqlite_getdb(L, 1);
@@ -2436,6 +2698,167 @@ static int lsqlite_open_memory(lua_State *L) {
     return lsqlite_do_open(L, ":memory:", SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE);
 }
 
+/*
+** =======================================================
+** Lazy Per-Process Connection
+** =======================================================
+** Connections must not be used across fork(), and redbean forks a
+** worker for each client, so each worker needs a connection of its
+** own. A lazy connection remembers how to open the database and does
+** so the first time get() is called in a process: the setup sql is
+** run, the schema is loaded, and the given statements are prepared
+** into the connection's statement cache, so the worker's first request
+** costs no more than the rest. Nothing is opened in the process that
+** creates it, so there's no connection for workers to inherit.
+*/
+struct sdb_lazy {
+    char *filename;
+    char *setup;        /* sql run on each new connection, or NULL */
+    int flags;
+    int stmts;          /* registry reference to table of sql strings */
+    int ref;            /* registry reference to connection */
+    sdb *db;            /* connection of process that opened it, or NULL */
+    lua_Integer opens;
+    lua_Integer reuses;
+};
+
+static sdb_lazy *lsqlite_checklazy(lua_State *L, int index) {
+    sdb_lazy *lazy = (sdb_lazy*)luaL_checkudata(L, index, sqlite_lazy_meta);
+    if (lazy->filename == NULL) luaL_argerror(L, index, "attempt to use closed lazy sqlite database");
+    return lazy;
+}
+
+static void lazy_release(lua_State *L, sdb_lazy *lazy) {
+    /* an inherited connection gets abandoned by cleanupdb() once unrefed */
+    if (lazy->db && lazy->db->pid == getpid() && lazy->db->db)
+        cleanupdb(L, lazy->db);
+    luaL_unref(L, LUA_REGISTRYINDEX, lazy->ref);
+    lazy->ref = LUA_NOREF;
+    lazy->db = NULL;
+}
+
+/* prepares sql and leaves it idle in the statement cache */
+static int lazy_prepare(sdb *db, const char *sql, int sql_len) {
+    int rc;
+    char *key;
+    sqlite3_stmt *vm;
+    if ((rc = stmt_checkout(db, sql, sql_len, &vm, NULL, &key)) != SQLITE_OK)
+        return rc;
+    if (vm) stmt_checkin(db, vm, key, sql_len);
+    return SQLITE_OK;
+}
+
+/* leaves connection on stack, or else nil, errcode, errmsg */
+static int lazy_connect(lua_State *L, sdb_lazy *lazy) {
+    sdb *db;
+    size_t len;
+    const char *sql;
+    int i, n, rc = SQLITE_OK;
+    if (lsqlite_do_open(L, lazy->filename, lazy->flags) != 1) return 3;
+    db = (sdb*)lua_touserdata(L, -1);
+    if (lazy->setup) rc = sqlite3_exec(db->db, lazy->setup, 0, 0, 0);
+    /* preparing anything reads the schema, so do it before the first request */
+    if (rc == SQLITE_OK)
+        rc = sqlite3_exec(db->db, "SELECT 1 FROM sqlite_schema LIMIT 0", 0, 0, 0);
+    lua_rawgeti(L, LUA_REGISTRYINDEX, lazy->stmts);
+    n = luaL_len(L, -1);
+    for (i = 1; rc == SQLITE_OK && i <= n; ++i) {
+        lua_rawgeti(L, -1, i);
+        sql = lua_tolstring(L, -1, &len);
+        rc = lazy_prepare(db, sql, len);
+        lua_pop(L, 1);
+    }
+    lua_pop(L, 1);
+    if (rc != SQLITE_OK) {
+        lua_pushnil(L);
+        lua_pushinteger(L, rc);
+        lua_pushstring(L, sqlite3_errmsg(db->db));
+        cleanupdb(L, db);
+        return 3;
+    }
+    lazy_release(L, lazy);
+    lazy->db = db;
+    lua_pushvalue(L, -1);
+    lazy->ref = luaL_ref(L, LUA_REGISTRYINDEX);
+    ++lazy->opens;
+    return 1;
+}
+
+static int lsqlite_lazy(lua_State *L) {
+    int i, n;
+    sdb_lazy *lazy;
+    const char *filename = luaL_checkstring(L, 1);
+    int flags = luaL_optinteger(L, 2, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE);
+    const char *setup = luaL_optstring(L, 3, NULL);
+    if (!lua_isnoneornil(L, 4)) luaL_checktype(L, 4, LUA_TTABLE);
+    /* copy statements, so they can't change out from under us */
+    n = lua_isnoneornil(L, 4) ? 0 : luaL_len(L, 4);
+    lua_createtable(L, n, 0);
+    for (i = 1; i <= n; ++i) {
+        if (lua_geti(L, 4, i) != LUA_TSTRING)
+            return luaL_argerror(L, 4, "statements must be a list of strings");
+        lua_rawseti(L, -2, i);
+    }
+    lazy = (sdb_lazy*)lua_newuserdata(L, sizeof(sdb_lazy));
+    memset(lazy, 0, sizeof(*lazy));
+    lazy->ref = LUA_NOREF;
+    lazy->stmts = LUA_NOREF;
+    luaL_getmetatable(L, sqlite_lazy_meta);
+    lua_setmetatable(L, -2);
+    lua_insert(L, -2);
+    lazy->stmts = luaL_ref(L, LUA_REGISTRYINDEX);
+    lazy->flags = flags;
+    if (!(lazy->filename = strdup(filename)) ||
+        (setup && !(lazy->setup = strdup(setup))))
+        return luaL_error(L, "out of memory");
+    return 1;
+}
+
+static int lazy_get(lua_State *L) {
+    sdb_lazy *lazy = lsqlite_checklazy(L, 1);
+    if (lazy->db && lazy->db->db && lazy->db->pid == getpid()) {
+        ++lazy->reuses;
+        lua_rawgeti(L, LUA_REGISTRYINDEX, lazy->ref);
+        return 1;
+    }
+    return lazy_connect(L, lazy);
+}
+
+static int lazy_stats(lua_State *L) {
+    sdb_lazy *lazy = lsqlite_checklazy(L, 1);
+    lua_createtable(L, 0, 3);
+    lua_pushinteger(L, lazy->opens);
+    lua_setfield(L, -2, "opens");
+    lua_pushinteger(L, lazy->reuses);
+    lua_setfield(L, -2, "reuses");
+    lua_pushboolean(L, lazy->db && lazy->db->db && lazy->db->pid == getpid());
+    lua_setfield(L, -2, "connected");
+    return 1;
+}
+
+static int lazy_close(lua_State *L) {
+    sdb_lazy *lazy = (sdb_lazy*)luaL_checkudata(L, 1, sqlite_lazy_meta);
+    if (lazy->filename) {
+        lazy_release(L, lazy);
+        luaL_unref(L, LUA_REGISTRYINDEX, lazy->stmts);
+        lazy->stmts = LUA_NOREF;
+        free(lazy->filename);
+        free(lazy->setup);
+        lazy->filename = NULL;
+        lazy->setup = NULL;
+    }
+    return 0;
+}
+
+static int lazy_tostring(lua_State *L) {
+    sdb_lazy *lazy = (sdb_lazy*)luaL_checkudata(L, 1, sqlite_lazy_meta);
+    if (lazy->filename)
+        lua_pushfstring(L, "lazy sqlite database (%s)", lazy->filename);
+    else
+        lua_pushliteral(L, "lazy sqlite database (closed)");
+    return 1;
+}
+
 /*
 ** Log callback:
 ** Params: user, result code, log message
@@ -2650,6 +3073,8 @@ static const luaL_Reg dblib[] = {
 
     {"exec",                db_exec                 },
     {"execute",             db_exec                 },
+    {"stmt_cache_size",     db_stmt_cache_size      },
+    {"stmt_cache_stats",    db_stmt_cache_stats     },
     {"close",               db_close                },
     {"close_vm",            db_close_vm             },
 
@@ -2722,6 +3147,16 @@ static const luaL_Reg vmlib[] = {
     { NULL, NULL }
 };
 
+static const luaL_Reg lazylib[] = {
+    {"get",             lazy_get                },
+    {"stats",           lazy_stats              },
+    {"close",           lazy_close              },
+
+    {"__tostring",      lazy_tostring           },
+    {"__gc",            lazy_close              },
+    {NULL, NULL}
+};
+
 static const luaL_Reg ctxlib[] = {
     {"user_data",               lcontext_user_data              },
 
@@ -2788,6 +3223,7 @@ static const luaL_Reg sqlitelib[] = {
     {"version",         lsqlite_version         },
     {"open",            lsqlite_open            },
     {"open_memory",     lsqlite_open_memory     },
+    {"lazy",            lsqlite_lazy            },
     {"config",          lsqlite_config          },
 
     {"__newindex",      lsqlite_newindex        },
@@ -2814,6 +3250,7 @@ LUALIB_API int luaopen_lsqlite3(lua_State *L) {
     create_meta(L, sqlite_meta, dblib);
     create_meta(L, sqlite_vm_meta, vmlib);
     create_meta(L, sqlite_ctx_meta, ctxlib);
+    create_meta(L, sqlite_lazy_meta, lazylib);
 
     luaL_getmetatable(L, sqlite_ctx_meta);
     sqlite_ctx_meta_ref = luaL_ref(L, LUA_REGISTRYINDEX);
@@ -49,6 +49,7 @@
 #include "libc/log/log.h"
 #include "libc/macros.h"
 #include "libc/math.h"
+#include "libc/mem/alg.h"
 #include "libc/mem/alloca.h"
 #include "libc/mem/gc.h"
 #include "libc/mem/leaks.h"
@@ -333,13 +334,18 @@ static struct Redirects {
 
 static struct Assets {
   uint32_t n;
+  uint32_t records;  // central directory records indexed
+  uint64_t cdir;     // offset of central directory indexed
+  uint32_t *order;   // slot of each record, or -1 if unsupported
   struct Asset {
     bool istext;
     uint32_t hash;
     uint64_t cf;
     uint64_t lf;
     int64_t lastmodified;
-    char *lastmodifiedstr;
+    char lastmodifiedstr[30];
+    uint64_t compiledlf;  // local file offset bytecode was compiled from
+    char *bytecode;       // lua_dump() of zip asset, in append() buffer
     struct File {
       struct String path;
       struct stat st;
@@ -372,6 +378,19 @@ struct Blackhole {
   int fd;
 } blackhole;
 
+// tls sessions get cached in a set associative table in shared memory
+// so clients that don't do tickets can resume in any forked worker
+#define SSL_CACHE_SETS 512
+#define SSL_CACHE_WAYS 2
+
+struct SslCacheEntry {
+  _Atomic(uint32_t) seq;  // odd while entry is being written
+  uint32_t len;
+  int64_t expires;
+  unsigned char id[32];
+  unsigned char data[464];  // serialized mbedtls_ssl_session
+};
+
 static struct Shared {
   _Atomic(int) workers;
   struct timespec lastmeltdown;
@@ -388,6 +407,7 @@ static struct Shared {
   pthread_mutex_t server_mu;
   pthread_mutex_t children_mu;
   pthread_mutex_t lastmeltdown_mu;
+  struct SslCacheEntry sslcache[SSL_CACHE_SETS][SSL_CACHE_WAYS];
 } *shared;
 
 static const char kCounterNames[] =
@@ -1809,6 +1829,111 @@ static int TlsRoutePsk(void *ctx, mbedtls_ssl_context *ssl,
   return -1;
 }
 
+static struct SslCacheEntry *TlsCacheSet(const unsigned char id[32]) {
+  return shared->sslcache[READ32LE(id) & (SSL_CACHE_SETS - 1)];  // random
+}
+
+// entries are guarded by a sequence lock, so readers never block and
+// merely retry when they race a writer, and writers that race another
+// writer give up, since caching a session is only ever an optimization
+static int TlsGetCache(void *ctx, mbedtls_ssl_session *session) {
+  int i;
+  size_t len;
+  uint32_t seq;
+  int64_t expires;
+  struct SslCacheEntry *e;
+  mbedtls_ssl_session loaded;
+  unsigned char id[32], data[sizeof(e->data)];
+  if (session->id_len != 32)
+    return 1;
+  e = TlsCacheSet(session->id);
+  for (i = 0; i < SSL_CACHE_WAYS; ++i) {
+    for (;;) {
+      seq = atomic_load_explicit(&e[i].seq, memory_order_acquire);
+      if (seq & 1)
+        break;
+      memcpy(id, e[i].id, 32);
+      len = MIN(e[i].len, sizeof(data));
+      expires = e[i].expires;
+      memcpy(data, e[i].data, len);
+      // payload loads mustn't be reordered after the sequence re-check
+      atomic_thread_fence(memory_order_acquire);
+      if (atomic_load_explicit(&e[i].seq, memory_order_relaxed) == seq)
+        break;
+    }
+    if ((seq & 1) || !len || timingsafe_bcmp(id, session->id, 32))
+      continue;
+    if (expires <= timespec_real().tv_sec)
+      break;
+    mbedtls_ssl_session_init(&loaded);
+    if (mbedtls_ssl_session_load(&loaded, data, len) ||
+        loaded.ciphersuite != session->ciphersuite ||
+        loaded.compression != session->compression ||
+        loaded.id_len != session->id_len ||
+        timingsafe_bcmp(loaded.id, session->id, session->id_len)) {
+      // e.g. client offered an id for a suite we didn't negotiate
+      mbedtls_ssl_session_free(&loaded);
+      break;
+    }
+    mbedtls_ssl_session_free(session);
+    memcpy(session, &loaded, sizeof(loaded));
+    mbedtls_platform_zeroize(data, len);
+    LockInc(&shared->c.sslcachehits);
+    return 0;
+  }
+  mbedtls_platform_zeroize(data, sizeof(data));
+  LockInc(&shared->c.sslcachemisses);
+  return 1;
+}
+
+static int TlsSetCache(void *ctx, const mbedtls_ssl_session *session) {
+  int i, j;
+  size_t len;
+  uint32_t seq;
+  int64_t now, expires;
+  struct SslCacheEntry *e;
+  unsigned char data[sizeof(e->data)];
+  if (session->id_len != 32)
+    return 1;
+  if (mbedtls_ssl_session_save(session, data, sizeof(data), &len)) {
+    // e.g. the session holds a client certificate
+    LockInc(&shared->c.sslcacheskips);
+    return 1;
+  }
+  // replace same session, else a dead one, else whichever expires first
+  e = TlsCacheSet(session->id);
+  now = timespec_real().tv_sec;
+  for (j = i = 0; i < SSL_CACHE_WAYS; ++i) {
+    expires = e[i].expires;
+    if (!memcmp(e[i].id, session->id, 32) || expires <= now) {
+      j = i;
+      break;
+    }
+    if (expires < e[j].expires) {
+      j = i;
+    }
+  }
+  if (i == SSL_CACHE_WAYS)
+    LockInc(&shared->c.sslcacheevictions);
+  seq = atomic_load_explicit(&e[j].seq, memory_order_relaxed);
+  if ((seq & 1) || !atomic_compare_exchange_strong_explicit(
+                       &e[j].seq, &seq, seq + 1, memory_order_relaxed,
+                       memory_order_relaxed)) {
+    mbedtls_platform_zeroize(data, len);
+    return 1;
+  }
+  // odd sequence must be visible to readers before any payload store
+  atomic_thread_fence(memory_order_release);
+  memcpy(e[j].id, session->id, 32);
+  memcpy(e[j].data, data, len);
+  e[j].len = len;
+  e[j].expires = now + sslticketlifetime;
+  atomic_store_explicit(&e[j].seq, seq + 2, memory_order_release);
+  mbedtls_platform_zeroize(data, len);
+  LockInc(&shared->c.sslcachestores);
+  return 0;
+}
+
 static bool TlsSetup(void) {
   int r;
   oldin.p = inbuf.p;
@@ -2164,13 +2289,20 @@ static inline unsigned Hash(const void *p, unsigned long n) {
   return MAX(1, h);
 }
 
+// the index gets its own mapping so forked workers, which only ever
+// read it, share its pages rather than copying them when they write
+// to malloc() memory that happens to live nearby
 static void FreeAssets(void) {
-  size_t i;
-  for (i = 0; i < assets.n; ++i) {
-    Free(&assets.p[i].lastmodifiedstr);
+  uint32_t i;
+  if (assets.p) {
+    for (i = 0; i < assets.n; ++i)
+      free(assets.p[i].bytecode);
+    LOGIFNEG1(munmap(assets.p, assets.n * sizeof(struct Asset)));
   }
-  Free(&assets.p);
+  assets.p = 0;
   assets.n = 0;
+  assets.records = 0;
+  Free(&assets.order);
 }
 
 static void FreeStrings(struct Strings *l) {
@@ -2186,11 +2318,41 @@ static unsigned long roundup2pow(unsigned long x) {
   return x > 1 ? 2ul << bsrl(x - 1) : x ? 1 : 0;
 }
 
+static uint32_t PutAsset(struct Asset *p, uint32_t m, uint64_t cf,
+                         bool replace) {
+  struct timespec lm;
+  uint32_t i, step, hash;
+  if (!IsCompressionMethodSupported(ZIP_CFILE_COMPRESSIONMETHOD(zmap + cf))) {
+    WARNF("(zip) don't understand zip compression method %d used by %`'.*s",
+          ZIP_CFILE_COMPRESSIONMETHOD(zmap + cf), ZIP_CFILE_NAMESIZE(zmap + cf),
+          ZIP_CFILE_NAME(zmap + cf));
+    return -1;
+  }
+  hash = Hash(ZIP_CFILE_NAME(zmap + cf), ZIP_CFILE_NAMESIZE(zmap + cf));
+  step = 0;
+  do {
+    i = (hash + ((step * (step + 1)) >> 1)) & (m - 1);
+    ++step;
+  } while (p[i].hash &&
+           !(replace && hash == p[i].hash &&
+             ZIP_CFILE_NAMESIZE(zmap + cf) ==
+                 ZIP_CFILE_NAMESIZE(zmap + p[i].cf) &&
+             !memcmp(ZIP_CFILE_NAME(zmap + cf), ZIP_CFILE_NAME(zmap + p[i].cf),
+                     ZIP_CFILE_NAMESIZE(zmap + cf))));
+  GetZipCfileTimestamps(zmap + cf, &lm, 0, 0, gmtoff);
+  p[i].hash = hash;
+  p[i].cf = cf;
+  p[i].lf = GetZipCfileOffset(zmap + cf);
+  p[i].istext = !!(ZIP_CFILE_INTERNALATTRIBUTES(zmap + cf) & kZipIattrText);
+  p[i].lastmodified = lm.tv_sec;
+  FormatUnixHttpDateTime(p[i].lastmodifiedstr, lm.tv_sec);
+  return i;
+}
+
 static void IndexAssets(void) {
   uint64_t cf;
   struct Asset *p;
-  struct timespec lm;
-  uint32_t i, n, m, step, hash;
+  uint32_t k, n, m;
   DEBUGF("(zip) indexing assets (inode %#lx)", zst.st_ino);
   FreeAssets();
   CHECK_GE(HASH_LOAD_FACTOR, 2);
@@ -2198,35 +2360,79 @@ static void IndexAssets(void) {
         READ32LE(zcdir) == kZipCdirHdrMagic);
   n = GetZipCdirRecords(zcdir);
   m = roundup2pow(MAX(1, n) * HASH_LOAD_FACTOR);
-  p = xcalloc(m, sizeof(struct Asset));
-  for (cf = GetZipCdirOffset(zcdir); n--; cf += ZIP_CFILE_HDRSIZE(zmap + cf)) {
+  p = mmap(0, m * sizeof(struct Asset), PROT_READ | PROT_WRITE,
+           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  CHECK_NE(MAP_FAILED, p);
+  assets.order = xmalloc(MAX(1, n) * sizeof(*assets.order));
+  cf = GetZipCdirOffset(zcdir);
+  for (k = 0; k < n; ++k, cf += ZIP_CFILE_HDRSIZE(zmap + cf)) {
     CHECK_EQ(kZipCfileHdrMagic, ZIP_CFILE_MAGIC(zmap + cf));
-    if (!IsCompressionMethodSupported(ZIP_CFILE_COMPRESSIONMETHOD(zmap + cf))) {
-      WARNF("(zip) don't understand zip compression method %d used by %`'.*s",
-            ZIP_CFILE_COMPRESSIONMETHOD(zmap + cf),
-            ZIP_CFILE_NAMESIZE(zmap + cf), ZIP_CFILE_NAME(zmap + cf));
-      continue;
-    }
-    hash = Hash(ZIP_CFILE_NAME(zmap + cf), ZIP_CFILE_NAMESIZE(zmap + cf));
-    step = 0;
-    do {
-      i = (hash + ((step * (step + 1)) >> 1)) & (m - 1);
-      ++step;
-    } while (p[i].hash);
-    GetZipCfileTimestamps(zmap + cf, &lm, 0, 0, gmtoff);
-    p[i].hash = hash;
-    p[i].cf = cf;
-    p[i].lf = GetZipCfileOffset(zmap + cf);
-    p[i].istext = !!(ZIP_CFILE_INTERNALATTRIBUTES(zmap + cf) & kZipIattrText);
-    p[i].lastmodified = lm.tv_sec;
-    p[i].lastmodifiedstr = FormatUnixHttpDateTime(xmalloc(30), lm.tv_sec);
+    assets.order[k] = PutAsset(p, m, cf, false);
   }
   assets.p = p;
   assets.n = m;
+  assets.records = n;
+  assets.cdir = GetZipCdirOffset(zcdir);
+}
+
+// central directories written by StoreAsset() begin with the records
+// of the one before, minus any it replaced, and the old bytes are left
+// where they were. so when the zip only grew, we walk the old and new
+// directories side by side, moving matching entries without redoing
+// their work, and only index the records that were appended. returns
+// false if the zip changed in some other way, so it must be rebuilt.
+static bool IndexNewAssets(void) {
+  uint64_t cf, of;
+  uint32_t i, j, k, n, dropped, *order, *drop;
+  n = GetZipCdirRecords(zcdir);
+  cf = GetZipCdirOffset(zcdir);
+  of = assets.cdir;
+  if (!assets.p || cf <= of ||
+      roundup2pow(MAX(1, n) * HASH_LOAD_FACTOR) > assets.n) {
+    return false;
+  }
+  order = xmalloc(MAX(1, n) * sizeof(*order));
+  drop = xmalloc(MAX(1, assets.records) * sizeof(*drop));
+  for (dropped = j = k = 0; k < assets.records; ++k) {
+    if (j < n && ZIP_CFILE_HDRSIZE(zmap + of) == ZIP_CFILE_HDRSIZE(zmap + cf) &&
+        !memcmp(zmap + of, zmap + cf, ZIP_CFILE_HDRSIZE(zmap + cf))) {
+      if ((i = assets.order[k]) != -1)
+        assets.p[i].cf = cf;
+      order[j++] = i;
+      cf += ZIP_CFILE_HDRSIZE(zmap + cf);
+    } else if (assets.order[k] != -1) {
+      drop[dropped++] = assets.order[k];
+    }
+    of += ZIP_CFILE_HDRSIZE(zmap + of);
+  }
+  DEBUGF("(zip) reindexing %u new assets (inode %#lx)", n - j, zst.st_ino);
+  for (; j < n; ++j, cf += ZIP_CFILE_HDRSIZE(zmap + cf)) {
+    if (ZIP_CFILE_MAGIC(zmap + cf) != kZipCfileHdrMagic)
+      break;
+    order[j] = PutAsset(assets.p, assets.n, cf, true);
+  }
+  // every record that went away must have been replaced by a new one,
+  // which would have moved its slot into the new central directory
+  for (k = 0; j == n && k < dropped; ++k) {
+    if (assets.p[drop[k]].cf < GetZipCdirOffset(zcdir)) {
+      break;
+    }
+  }
+  free(drop);
+  if (j < n || k < dropped) {
+    free(order);
+    return false;
+  }
+  free(assets.order);
+  assets.order = order;
+  assets.records = n;
+  assets.cdir = GetZipCdirOffset(zcdir);
+  return true;
 }
 
 static bool OpenZip(bool force) {
   int fd;
+  bool grew;
   size_t n;
   uint8_t *m, *d;
   struct stat st;
@@ -2238,6 +2444,8 @@ static bool OpenZip(bool force) {
         WARNF("(zip) open() error: %m");
         return false;
       }
+      grew = !force && zmap && st.st_ino == zst.st_ino &&
+             st.st_size > zst.st_size;
       if ((m = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) !=
           MAP_FAILED) {
         n = st.st_size;
@@ -2250,8 +2458,14 @@ static bool OpenZip(bool force) {
           zcdir = d;
           DCHECK(IsZipEocd32(zmap, zsize, zcdir - zmap) == kZipOk ||
                  IsZipEocd64(zmap, zsize, zcdir - zmap) == kZipOk);
+          if (fd != zfd) {
+            // executable was replaced, e.g. by CompactAssets()
+            close(zfd);
+            zfd = fd;
+          }
           memcpy(&zst, &st, sizeof(st));
-          IndexAssets();
+          if (!grew || !IndexNewAssets())
+            IndexAssets();
           return true;
         } else {
           WARNF("(zip) couldn't locate central directory");
@@ -2259,6 +2473,8 @@ static bool OpenZip(bool force) {
       } else {
         WARNF("(zip) mmap() error: %m");
       }
+      if (fd != zfd)
+        close(fd);
     }
   } else {
     // avoid noise if we setuid to user who can't see executable
@@ -2299,9 +2515,8 @@ static struct Asset *GetAssetFile(const char *path, size_t pathlen) {
       a->file->path.s = FreeLater(MergePaths(stagedirs.p[i].s, stagedirs.p[i].n,
                                              path, pathlen, &a->file->path.n));
       if (stat(a->file->path.s, &a->file->st) != -1) {
-        a->lastmodifiedstr = FormatUnixHttpDateTime(
-            FreeLater(xmalloc(30)),
-            (a->lastmodified = a->file->st.st_mtim.tv_sec));
+        a->lastmodified = a->file->st.st_mtim.tv_sec;
+        FormatUnixHttpDateTime(a->lastmodifiedstr, a->lastmodified);
         return a;
       } else {
         LockInc(&shared->c.statfails);
@@ -3305,17 +3520,90 @@ static char *LuaOnHttpRequest(void) {
   }
 }
 
-static char *ServeLua(struct Asset *a, const char *s, size_t n) {
-  char *code;
+static int LuaDumpWriter(lua_State *L, const void *p, size_t n, void *b) {
+  return appendd(b, p, n) == -1;
+}
+
+// pushes chunk of lua asset, or returns -1 if it couldn't be read. the
+// main process keeps the bytecode of zip assets it compiles, so forked
+// workers inherit it and don't have to lex and parse the source again.
+// workers don't keep what they compile, since they'd have to write to
+// the asset index, whose pages they'd rather share with their parent.
+// returns chunk name for lua asset, e.g. "@/zip/foo.lua", so it's the
+// same no matter who compiled the bytecode that's cached for the asset
+static char *GetLuaChunkName(struct Asset *a, const char *path, size_t n) {
+  if (a->file)
+    return xasprintf("@%.*s", n, path);
+  return xasprintf("@/zip/%.*s", ZIP_CFILE_NAMESIZE(zmap + a->cf),
+                   ZIP_CFILE_NAME(zmap + a->cf));
+}
+
+static int LoadLuaAsset(lua_State *L, struct Asset *a, const char *name) {
+  int status;
+  char *code, *bc;
   size_t codelen;
+  if (!a->file && a->bytecode && a->compiledlf == a->lf) {
+    LockInc(&shared->c.luacachehits);
+    return luaL_loadbufferx(L, a->bytecode, appendz(a->bytecode).i, name, "b");
+  }
+  if (!(code = LoadAsset(a, &codelen)))
+    return -1;
+  LockInc(&shared->c.luacachemisses);
+  status = luaL_loadbuffer(L, code, codelen, name);
+  free(code);
+  if (status == LUA_OK && !a->file && !__isworker) {
+    bc = 0;
+    if (!lua_dump(L, LuaDumpWriter, &bc, false) && bc) {
+      free(a->bytecode);
+      a->bytecode = bc;
+      a->compiledlf = a->lf;
+    } else {
+      free(bc);
+    }
+  }
+  return status;
+}
+
+// compiles the lua assets that could be served, ahead of the workers
+static void PrecompileLuaAssets(void) {
+#ifndef STATIC
+  size_t n;
+  uint32_t k;
+  struct Asset *a;
+  char *name;
+  const char *p;
+  lua_State *L = GL;
+  if (__isworker)
+    return;
+  for (k = 0; k < assets.records; ++k) {
+    if (assets.order[k] == -1)
+      continue;
+    a = assets.p + assets.order[k];
+    if (a->bytecode && a->compiledlf == a->lf)
+      continue;
+    p = ZIP_CFILE_NAME(zmap + a->cf);
+    n = ZIP_CFILE_NAMESIZE(zmap + a->cf);
+    if (n <= 4 || *p == '.' ||
+        READ32LE(p + n - 4) != ('.' | 'l' << 8 | 'u' << 16 | 'a' << 24)) {
+      continue;
+    }
+    // syntax errors are left to be reported when the asset's requested
+    name = GetLuaChunkName(a, p, n);
+    if (LoadLuaAsset(L, a, name) != -1)
+      lua_pop(L, 1);  // pop chunk or error
+    free(name);
+  }
+#endif
+}
+
+static char *ServeLua(struct Asset *a, const char *s, size_t n) {
+  int status;
   lua_State *L = GL;
   LockInc(&shared->c.dynamicrequests);
   effectivepath.p = (void *)s;
   effectivepath.n = n;
-  if ((code = FreeLater(LoadAsset(a, &codelen)))) {
-    int status =
-        luaL_loadbuffer(L, code, codelen,
-                        FreeLater(xasprintf("@%s", FreeLater(strndup(s, n)))));
+  if ((status = LoadLuaAsset(L, a, FreeLater(GetLuaChunkName(a, s, n)))) !=
+      -1) {
     if (status == LUA_OK && LuaCallWithYield(L) == LUA_OK) {
       return CommitOutput(GetLuaResponse());
     } else {
@@ -3679,211 +3967,392 @@ static void GetDosLocalTime(int64_t utcunixts, uint16_t *out_time,
   *out_date = DOS_DATE(tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday + 1);
 }
 
-static void StoreAsset(const char *path, size_t pathlen, const char *data,
-                       size_t datalen, int mode) {
-  int64_t ft;
-  uint32_t crc;
-  char *comp, *p;
-  struct timespec now;
-  struct Asset *a;
-  struct iovec v[13];
-  uint8_t era;
+struct StagedAsset {
+  char *path;
+  char *file;  // local file to read when committing, if any
+  char *buf;   // owned copy of the bytes in use, if any
   const char *use;
-  uint16_t gflags, iattrs, mtime, mdate, dosmode, method, disk;
-  size_t oldcdirsize, oldcdiroffset, records, cdiroffset, cdirsize, complen,
-      uselen;
-  if (IsOpenbsd() || IsNetbsd() || IsWindows()) {
-    FATALF("(cfg) StoreAsset() not available on Windows/NetBSD/OpenBSD yet");
+  size_t pathlen, uselen, datalen;
+  uint64_t lf;
+  uint32_t crc, hash;
+  uint16_t gflags, iattrs, method;
+  uint8_t era;
+  bool superseded;
+  int mode;
+};
+
+// assets staged for one zip transaction, which appends all their local
+// files and then writes a single central directory for the whole batch
+struct AssetBatch {
+  size_t n, c;
+  struct StagedAsset *p;
+  uint32_t m, *tab;
+};
+
+static void FreeAssetBatch(struct AssetBatch *b) {
+  size_t i;
+  for (i = 0; i < b->n; ++i) {
+    free(b->p[i].path);
+    free(b->p[i].file);
+    free(b->p[i].buf);
   }
-  INFOF("(srvr) storing asset %`'s", path);
-  disk = gflags = iattrs = 0;
+  free(b->p);
+  free(b->tab);
+  bzero(b, sizeof(*b));
+}
+
+static struct StagedAsset *AddStagedAsset(struct AssetBatch *b,
+                                          const char *path, size_t pathlen,
+                                          int mode) {
+  struct StagedAsset *s;
+  if (pathlen > 1 && path[0] == '/')
+    ++path, --pathlen;
+  INFOF("(srvr) storing asset %`'.*s", pathlen, path);
+  if (b->n == b->c) {
+    b->c = b->c ? b->c * 2 : 8;
+    b->p = xrealloc(b->p, b->c * sizeof(*b->p));
+  }
+  s = b->p + b->n++;
+  bzero(s, sizeof(*s));
+  s->path = xstrndup(path, pathlen);
+  s->pathlen = pathlen;
+  s->hash = Hash(path, pathlen);
+  s->mode = mode;
   if (isutf8(path, pathlen))
-    gflags |= kZipGflagUtf8;
+    s->gflags |= kZipGflagUtf8;
+  return s;
+}
+
+// checksums and compresses data for asset, which must stay valid until
+// its local file has been written unless s->buf gets set
+static void PrepareStagedAsset(struct StagedAsset *s, const char *data,
+                               size_t datalen) {
+  char *comp;
+  size_t complen;
+  s->datalen = datalen;
   if (istext(data, datalen))
-    iattrs |= kZipIattrText;
-  crc = crc32_z(0, data, datalen);
-  if (datalen < 100) {
-    method = kZipCompressionNone;
-    comp = 0;
-    use = data;
-    uselen = datalen;
-    era = kZipEra1989;
-  } else {
+    s->iattrs |= kZipIattrText;
+  s->crc = crc32_z(0, data, datalen);
+  s->method = kZipCompressionNone;
+  s->era = kZipEra1989;
+  s->use = data;
+  s->uselen = datalen;
+  if (datalen >= 100) {
     comp = Deflate(data, datalen, &complen);
     if (complen < datalen) {
-      method = kZipCompressionDeflate;
-      use = comp;
-      uselen = complen;
-      era = kZipEra1993;
+      s->method = kZipCompressionDeflate;
+      s->era = kZipEra1993;
+      s->use = s->buf = comp;
+      s->uselen = complen;
     } else {
-      method = kZipCompressionNone;
-      use = data;
-      uselen = datalen;
-      era = kZipEra1989;
+      free(comp);
     }
   }
-  //////////////////////////////////////////////////////////////////////////////
-  if (-1 == fcntl(zfd, F_SETLKW, &(struct flock){F_WRLCK})) {
-    WARNF("(srvr) can't place write lock on file descriptor %d: %s", zfd,
-          strerror(errno));
-    return;
+  if (s->uselen >= 0xffffffff || s->datalen >= 0xffffffff)
+    s->era = kZipEra2001;
+}
+
+static struct StagedAsset *StageAsset(struct AssetBatch *b, const char *path,
+                                      size_t pathlen, const char *data,
+                                      size_t datalen, int mode) {
+  struct StagedAsset *s;
+  s = AddStagedAsset(b, path, pathlen, mode);
+  PrepareStagedAsset(s, data, datalen);
+  return s;
+}
+
+// reads asset staged by StageFile(), so that only the file currently
+// being written needs to be held in memory
+static bool LoadStagedAsset(struct StagedAsset *s) {
+  char *p;
+  size_t n;
+  if (!(p = xslurp(s->file, &n))) {
+    WARNF("(srvr) can't read %`'s: %m", s->file);
+    return false;
   }
-  OpenZip(false);
-  now = timespec_real();
-  a = GetAssetZip(path, pathlen);
-  if (!mode)
-    mode = a ? GetMode(a) : 0644;
-  if (!(mode & S_IFMT))
-    mode |= S_IFREG;
-  if (pathlen > 1 && path[0] == '/')
-    ++path, --pathlen;
-  dosmode = !(mode & 0200) ? kNtFileAttributeReadonly : 0;
-  ft = (now.tv_sec + MODERNITYSECONDS) * HECTONANOSECONDS;
-  GetDosLocalTime(now.tv_sec, &mtime, &mdate);
-  // local file header
-  if (uselen >= 0xffffffff || datalen >= 0xffffffff) {
-    era = kZipEra2001;
-    v[2].iov_base = p = alloca((v[2].iov_len = 2 + 2 + 8 + 8));
-    p = WRITE16LE(p, kZipExtraZip64);
-    p = WRITE16LE(p, 8 + 8);
-    p = WRITE64LE(p, uselen);
-    p = WRITE64LE(p, datalen);
-  } else {
-    v[2].iov_len = 0;
-    v[2].iov_base = 0;
-  }
-  v[0].iov_base = p = alloca((v[0].iov_len = kZipLfileHdrMinSize));
-  p = WRITE32LE(p, kZipLfileHdrMagic);
-  *p++ = era;
-  *p++ = kZipOsDos;
-  p = WRITE16LE(p, gflags);
-  p = WRITE16LE(p, method);
-  p = WRITE16LE(p, mtime);
-  p = WRITE16LE(p, mdate);
-  p = WRITE32LE(p, crc);
-  p = WRITE32LE(p, 0xffffffffu);
-  p = WRITE32LE(p, 0xffffffffu);
-  p = WRITE16LE(p, pathlen);
-  p = WRITE16LE(p, v[2].iov_len);
-  v[1].iov_len = pathlen;
-  v[1].iov_base = (void *)path;
-  // file data
-  v[3].iov_len = uselen;
-  v[3].iov_base = (void *)use;
-  // old central directory entries
-  oldcdirsize = GetZipCdirSize(zcdir);
-  oldcdiroffset = GetZipCdirOffset(zcdir);
-  if (a) {
-    // to remove an existing asset,
-    // first copy the central directory part before its record
-    v[4].iov_base = zmap + oldcdiroffset;
-    v[4].iov_len = a->cf - oldcdiroffset;
-    // and then the rest of the central directory
-    v[5].iov_base =
-        zmap + oldcdiroffset + (v[4].iov_len + ZIP_CFILE_HDRSIZE(zmap + a->cf));
-    v[5].iov_len =
-        oldcdirsize - (v[4].iov_len + ZIP_CFILE_HDRSIZE(zmap + a->cf));
+  PrepareStagedAsset(s, p, n);
+  if (!s->buf) {
+    s->buf = p;
   } else {
-    v[4].iov_base = zmap + oldcdiroffset;
-    v[4].iov_len = oldcdirsize;
-    v[5].iov_base = 0;
-    v[5].iov_len = 0;
-  }
-  // new central directory entry
-  if (uselen >= 0xffffffff || datalen >= 0xffffffff || zsize >= 0xffffffff) {
-    v[8].iov_base = p = alloca((v[8].iov_len = 2 + 2 + 8 + 8 + 8));
-    p = WRITE16LE(p, kZipExtraZip64);
-    p = WRITE16LE(p, 8 + 8 + 8);
-    p = WRITE64LE(p, uselen);
-    p = WRITE64LE(p, datalen);
-    p = WRITE64LE(p, zsize);
-  } else {
-    v[8].iov_len = 0;
-    v[8].iov_base = 0;
-  }
-  v[9].iov_base = p = alloca((v[9].iov_len = 2 + 2 + 4 + 2 + 2 + 8 + 8 + 8));
-  p = WRITE16LE(p, kZipExtraNtfs);
-  p = WRITE16LE(p, 4 + 2 + 2 + 8 + 8 + 8);
-  p = WRITE32LE(p, 0);
-  p = WRITE16LE(p, 1);
-  p = WRITE16LE(p, 8 + 8 + 8);
-  p = WRITE64LE(p, ft);
-  p = WRITE64LE(p, ft);
-  p = WRITE64LE(p, ft);
-  v[6].iov_base = p = alloca((v[6].iov_len = kZipCfileHdrMinSize));
-  p = WRITE32LE(p, kZipCfileHdrMagic);
-  *p++ = kZipCosmopolitanVersion;
-  *p++ = kZipOsUnix;
-  *p++ = era;
-  *p++ = kZipOsDos;
-  p = WRITE16LE(p, gflags);
-  p = WRITE16LE(p, method);
-  p = WRITE16LE(p, mtime);
-  p = WRITE16LE(p, mdate);
-  p = WRITE32LE(p, crc);
-  p = WRITE32LE(p, 0xffffffffu);
-  p = WRITE32LE(p, 0xffffffffu);
-  p = WRITE16LE(p, pathlen);
-  p = WRITE16LE(p, v[8].iov_len + v[9].iov_len);
-  p = WRITE16LE(p, 0);
-  p = WRITE16LE(p, disk);
-  p = WRITE16LE(p, iattrs);
-  p = WRITE16LE(p, dosmode);
-  p = WRITE16LE(p, mode);
-  p = WRITE32LE(p, 0xffffffffu);
-  v[7].iov_len = pathlen;
-  v[7].iov_base = (void *)path;
-  // zip64 end of central directory
-  cdiroffset =
-      zsize + v[0].iov_len + v[1].iov_len + v[2].iov_len + v[3].iov_len;
-  cdirsize = v[4].iov_len + v[5].iov_len + v[6].iov_len + v[7].iov_len +
-             v[8].iov_len + v[9].iov_len;
-  records = GetZipCdirRecords(zcdir) + !a;
+    free(p);
+  }
+  return true;
+}
+
+static struct StagedAsset *FindStagedAsset(struct AssetBatch *b,
+                                           const char *path, size_t pathlen) {
+  struct StagedAsset *s;
+  uint32_t i, step, hash;
+  hash = Hash(path, pathlen);
+  for (step = 0;; ++step) {
+    i = (hash + ((step * (step + 1)) >> 1)) & (b->m - 1);
+    if (!b->tab[i])
+      return NULL;
+    s = b->p + b->tab[i] - 1;
+    if (hash == s->hash && pathlen == s->pathlen &&
+        memcmp(path, s->path, pathlen) == 0) {
+      return s;
+    }
+  }
+}
+
+// indexes batch by name, so later stores of the same path win
+static void IndexAssetBatch(struct AssetBatch *b) {
+  size_t j;
+  struct StagedAsset *s;
+  uint32_t i, step;
+  b->m = roundup2pow(MAX(1, b->n) * HASH_LOAD_FACTOR);
+  b->tab = xcalloc(b->m, sizeof(*b->tab));
+  for (j = 0; j < b->n; ++j) {
+    if ((s = FindStagedAsset(b, b->p[j].path, b->p[j].pathlen)))
+      s->superseded = true;
+    for (step = 0;; ++step) {
+      i = (b->p[j].hash + ((step * (step + 1)) >> 1)) & (b->m - 1);
+      if (!b->tab[i] || b->p + b->tab[i] - 1 == s) {
+        b->tab[i] = j + 1;
+        break;
+      }
+    }
+  }
+}
+
+// formats the zip64 end of central directory record and its locator if
+// they're needed, followed by the classic eocd record minus comment
+static size_t FormatZipEocd(char *b, uint64_t records, uint64_t cdirsize,
+                            uint64_t cdiroffset, size_t commentsize) {
+  char *p = b;
   if (records >= 0xffff || cdiroffset >= 0xffffffff || cdirsize >= 0xffffffff) {
-    v[10].iov_base = p =
-        alloca((v[10].iov_len = kZipCdir64HdrMinSize + kZipCdir64LocatorSize));
     p = WRITE32LE(p, kZipCdir64HdrMagic);
     p = WRITE64LE(p, 2 + 2 + 4 + 4 + 8 + 8 + 8 + 8);
     p = WRITE16LE(p, kZipCosmopolitanVersion);
     p = WRITE16LE(p, kZipEra2001);
-    p = WRITE32LE(p, disk);
-    p = WRITE32LE(p, disk);
+    p = WRITE32LE(p, 0);
+    p = WRITE32LE(p, 0);
     p = WRITE64LE(p, records);
     p = WRITE64LE(p, records);
     p = WRITE64LE(p, cdirsize);
     p = WRITE64LE(p, cdiroffset);
     p = WRITE32LE(p, kZipCdir64LocatorMagic);
-    p = WRITE32LE(p, disk);
+    p = WRITE32LE(p, 0);
     p = WRITE64LE(p, cdiroffset + cdirsize);
-    p = WRITE32LE(p, disk);
-  } else {
-    v[10].iov_len = 0;
-    v[10].iov_base = 0;
+    p = WRITE32LE(p, 1);
   }
-  // end of central directory
-  v[12].iov_base = (void *)GetZipCdirComment(zcdir);
-  v[12].iov_len = GetZipCdirCommentSize(zcdir);
-  v[11].iov_base = p = alloca((v[11].iov_len = kZipCdirHdrMinSize));
   p = WRITE32LE(p, kZipCdirHdrMagic);
-  p = WRITE16LE(p, disk);
-  p = WRITE16LE(p, disk);
+  p = WRITE16LE(p, 0);
+  p = WRITE16LE(p, 0);
   p = WRITE16LE(p, MIN(records, 0xffff));
   p = WRITE16LE(p, MIN(records, 0xffff));
   p = WRITE32LE(p, MIN(cdirsize, 0xffffffff));
   p = WRITE32LE(p, MIN(cdiroffset, 0xffffffff));
-  p = WRITE16LE(p, v[12].iov_len);
-  CHECK_NE(-1, lseek(zfd, zmap + zsize - zmap, SEEK_SET));
-  CHECK_NE(-1, WritevAll(zfd, v, 13));
-  CHECK_NE(-1, fcntl(zfd, F_SETLK, &(struct flock){F_UNLCK}));
+  p = WRITE16LE(p, commentsize);
+  return p - b;
+}
+
+static void UnlockZip(void) {
+  LOGIFNEG1(fcntl(zfd, F_SETLK, &(struct flock){F_UNLCK}));
+}
+
+// places write lock on the executable and maps its latest contents,
+// following the path if CompactAssets() renamed a new file into place
+// while we were waiting
+static bool LockZip(void) {
+  struct stat st;
+  for (;;) {
+    if (-1 == fcntl(zfd, F_SETLKW, &(struct flock){F_WRLCK})) {
+      WARNF("(srvr) can't place write lock on file descriptor %d: %s", zfd,
+            strerror(errno));
+      return false;
+    }
+    if (stat(zpath, &st) != -1 && st.st_ino != zst.st_ino) {
+      UnlockZip();
+      if (!OpenZip(false))
+        return false;
+      continue;
+    }
+    OpenZip(false);
+    return true;
+  }
+}
+
+static bool CommitAssets(struct AssetBatch *b) {
+  int64_t ft;
+  size_t i, n;
+  struct Asset *a;
+  struct timespec now;
+  struct StagedAsset *s;
+  struct iovec v[4];
+  char *cdir, *p, lfile[kZipLfileHdrMinSize], lextra[2 + 2 + 8 + 8],
+      eocd[kZipCdir64HdrMinSize + kZipCdir64LocatorSize + kZipCdirHdrMinSize];
+  uint16_t mtime, mdate, dosmode, z64;
+  uint64_t cf, off, records, oldrecords, cdirsize, cdiroffset;
+  if (!b->n)
+    return true;
+  if (IsOpenbsd() || IsNetbsd() || IsWindows()) {
+    FATALF("(cfg) StoreAsset() not available on Windows/NetBSD/OpenBSD yet");
+  }
+  IndexAssetBatch(b);
+  //////////////////////////////////////////////////////////////////////////////
+  if (!LockZip())
+    return false;
+  now = timespec_real();
+  ft = (now.tv_sec + MODERNITYSECONDS) * HECTONANOSECONDS;
+  GetDosLocalTime(now.tv_sec, &mtime, &mdate);
+  // append local file headers and contents
+  off = zsize;
+  CHECK_NE(-1, lseek(zfd, off, SEEK_SET));
+  for (i = 0; i < b->n; ++i) {
+    s = b->p + i;
+    if (s->superseded)
+      continue;
+    if (s->file && !LoadStagedAsset(s))
+      goto CommitFailed;
+    if (!s->mode)
+      s->mode = (a = GetAssetZip(s->path, s->pathlen)) ? GetMode(a) : 0644;
+    if (!(s->mode & S_IFMT))
+      s->mode |= S_IFREG;
+    // zip64 local headers must carry both sizes when they carry any
+    v[2].iov_len = 0;
+    if (s->era == kZipEra2001) {
+      v[2].iov_len = sizeof(lextra);
+      p = WRITE16LE(lextra, kZipExtraZip64);
+      p = WRITE16LE(p, 8 + 8);
+      p = WRITE64LE(p, s->datalen);
+      p = WRITE64LE(p, s->uselen);
+    }
+    p = WRITE32LE(lfile, kZipLfileHdrMagic);
+    *p++ = s->era;
+    *p++ = kZipOsDos;
+    p = WRITE16LE(p, s->gflags);
+    p = WRITE16LE(p, s->method);
+    p = WRITE16LE(p, mtime);
+    p = WRITE16LE(p, mdate);
+    p = WRITE32LE(p, s->crc);
+    p = WRITE32LE(p, v[2].iov_len ? 0xffffffff : s->uselen);
+    p = WRITE32LE(p, v[2].iov_len ? 0xffffffff : s->datalen);
+    p = WRITE16LE(p, s->pathlen);
+    p = WRITE16LE(p, v[2].iov_len);
+    v[0].iov_base = lfile;
+    v[0].iov_len = sizeof(lfile);
+    v[1].iov_base = s->path;
+    v[1].iov_len = s->pathlen;
+    v[2].iov_base = lextra;
+    v[3].iov_base = (void *)s->use;
+    v[3].iov_len = s->uselen;
+    s->lf = off;
+    off += sizeof(lfile) + s->pathlen + v[2].iov_len + s->uselen;
+    if (WritevAll(zfd, v, 4) == -1)
+      goto WriteFailed;
+    if (s->file)
+      Free(&s->buf);
+  }
+  // old central directory records minus the ones being replaced
+  cdiroffset = off;
+  cdirsize = GetZipCdirSize(zcdir);
+  for (i = 0; i < b->n; ++i)
+    cdirsize += kZipCfileHdrMinSize + b->p[i].pathlen + 2 + 2 + 8 + 8 + 8 +
+                2 + 2 + 4 + 2 + 2 + 8 + 8 + 8;
+  p = cdir = xmalloc(cdirsize);
+  records = 0;
+  oldrecords = GetZipCdirRecords(zcdir);
+  for (cf = GetZipCdirOffset(zcdir); oldrecords--;
+       cf += ZIP_CFILE_HDRSIZE(zmap + cf)) {
+    if (FindStagedAsset(b, ZIP_CFILE_NAME(zmap + cf),
+                        ZIP_CFILE_NAMESIZE(zmap + cf))) {
+      continue;
+    }
+    p = mempcpy(p, zmap + cf, ZIP_CFILE_HDRSIZE(zmap + cf));
+    ++records;
+  }
+  // new central directory records
+  for (i = 0; i < b->n; ++i) {
+    s = b->p + i;
+    if (s->superseded)
+      continue;
+    dosmode = !(s->mode & 0200) ? kNtFileAttributeReadonly : 0;
+    // central zip64 extra only holds the fields that overflowed
+    z64 = (s->datalen >= 0xffffffff ? 8 : 0) +
+          (s->uselen >= 0xffffffff ? 8 : 0) + (s->lf >= 0xffffffff ? 8 : 0);
+    n = 2 + 2 + 4 + 2 + 2 + 8 + 8 + 8;
+    if (z64)
+      n += 2 + 2 + z64;
+    p = WRITE32LE(p, kZipCfileHdrMagic);
+    *p++ = kZipCosmopolitanVersion;
+    *p++ = kZipOsUnix;
+    *p++ = z64 ? kZipEra2001 : s->era;
+    *p++ = kZipOsDos;
+    p = WRITE16LE(p, s->gflags);
+    p = WRITE16LE(p, s->method);
+    p = WRITE16LE(p, mtime);
+    p = WRITE16LE(p, mdate);
+    p = WRITE32LE(p, s->crc);
+    p = WRITE32LE(p, MIN(s->uselen, 0xffffffff));
+    p = WRITE32LE(p, MIN(s->datalen, 0xffffffff));
+    p = WRITE16LE(p, s->pathlen);
+    p = WRITE16LE(p, n);
+    p = WRITE16LE(p, 0);
+    p = WRITE16LE(p, 0);
+    p = WRITE16LE(p, s->iattrs);
+    p = WRITE16LE(p, dosmode);
+    p = WRITE16LE(p, s->mode);
+    p = WRITE32LE(p, MIN(s->lf, 0xffffffff));
+    p = mempcpy(p, s->path, s->pathlen);
+    if (z64) {
+      p = WRITE16LE(p, kZipExtraZip64);
+      p = WRITE16LE(p, z64);
+      if (s->datalen >= 0xffffffff)
+        p = WRITE64LE(p, s->datalen);
+      if (s->uselen >= 0xffffffff)
+        p = WRITE64LE(p, s->uselen);
+      if (s->lf >= 0xffffffff)
+        p = WRITE64LE(p, s->lf);
+    }
+    p = WRITE16LE(p, kZipExtraNtfs);
+    p = WRITE16LE(p, 4 + 2 + 2 + 8 + 8 + 8);
+    p = WRITE32LE(p, 0);
+    p = WRITE16LE(p, 1);
+    p = WRITE16LE(p, 8 + 8 + 8);
+    p = WRITE64LE(p, ft);
+    p = WRITE64LE(p, ft);
+    p = WRITE64LE(p, ft);
+    ++records;
+  }
+  // end of central directory
+  v[0].iov_base = cdir;
+  v[0].iov_len = cdirsize = p - cdir;
+  v[1].iov_base = eocd;
+  v[1].iov_len = FormatZipEocd(eocd, records, cdirsize, cdiroffset,
+                               GetZipCdirCommentSize(zcdir));
+  v[2].iov_base = (void *)GetZipCdirComment(zcdir);
+  v[2].iov_len = GetZipCdirCommentSize(zcdir);
+  if (WritevAll(zfd, v, 3) == -1) {
+    free(cdir);
+  WriteFailed:
+    WARNF("(srvr) failed to store assets: %m");
+  CommitFailed:
+    LOGIFNEG1(ftruncate(zfd, zsize));
+    UnlockZip();
+    return false;
+  }
+  free(cdir);
+  UnlockZip();
   //////////////////////////////////////////////////////////////////////////////
   OpenZip(false);
-  free(comp);
+  return true;
 }
 
-static void StoreFile(const char *path) {
-  char *p;
+static void StoreAsset(const char *path, size_t pathlen, const char *data,
+                       size_t datalen, int mode) {
+  struct AssetBatch b = {0};
+  StageAsset(&b, path, pathlen, data, datalen, mode);
+  CommitAssets(&b);
+  FreeAssetBatch(&b);
+}
+
+// contents are read one file at a time by CommitAssets()
+static void StageFile(struct AssetBatch *b, const char *path) {
   struct stat st;
-  size_t plen, tlen;
+  size_t tlen;
+  struct StagedAsset *s;
   const char *target = path;
   if (startswith(target, "./"))
     target += 2;
@@ -3893,18 +4362,16 @@ static void StoreFile(const char *path) {
            target);
   if (lstat(path, &st) == -1)
     FATALF("(cfg) error: can't stat %`'s: %m", path);
-  if (!(p = xslurp(path, &plen)))
-    FATALF("(cfg) error: can't read %`'s: %m", path);
-  StoreAsset(target, tlen, p, plen, st.st_mode & 0777);
-  free(p);
+  s = AddStagedAsset(b, target, tlen, st.st_mode & 0777);
+  s->file = xstrdup(path);
 }
 
-static void StorePath(const char *dirpath) {
+static void StagePath(struct AssetBatch *b, const char *dirpath) {
   DIR *d;
   char *path;
   struct dirent *e;
   if (!isdirectory(dirpath) && !endswith(dirpath, "/")) {
-    return StoreFile(dirpath);
+    return StageFile(b, dirpath);
   }
   if (!(d = opendir(dirpath)))
     FATALF("(cfg) error: can't open %`'s", dirpath);
@@ -3915,14 +4382,253 @@ static void StorePath(const char *dirpath) {
       continue;
     path = gc(xjoinpaths(dirpath, e->d_name));
     if (e->d_type == DT_DIR) {
-      StorePath(path);
+      StagePath(b, path);
     } else {
-      StoreFile(path);
+      StageFile(b, path);
     }
   }
   closedir(d);
 }
 
+static void StorePath(const char *dirpath) {
+  struct AssetBatch b = {0};
+  StagePath(&b, dirpath);
+  if (!CommitAssets(&b))
+    FATALF("(cfg) error: can't store %`'s", dirpath);
+  FreeAssetBatch(&b);
+}
+
+struct ZipSpan {
+  uint64_t cf, lf, end, to;
+};
+
+static int CompareZipSpansByLfile(const void *a, const void *b) {
+  const struct ZipSpan *x = a, *y = b;
+  return (x->lf > y->lf) - (x->lf < y->lf);
+}
+
+static int CompareZipSpansByCfile(const void *a, const void *b) {
+  const struct ZipSpan *x = a, *y = b;
+  return (x->cf > y->cf) - (x->cf < y->cf);
+}
+
+// StoreAsset() leaves behind superseded local files and the central
+// directories it replaced, so only gaps starting with those count
+static bool IsZipLeftover(uint64_t off) {
+  uint32_t magic;
+  if (off + 4 > zsize)
+    return false;
+  magic = READ32LE(zmap + off);
+  return magic == kZipLfileHdrMagic || magic == kZipCfileHdrMagic ||
+         magic == kZipCdirHdrMagic || magic == kZipCdir64HdrMagic;
+}
+
+static void SetZipCfileOffset(uint8_t *z, uint64_t off) {
+  int i;
+  uint8_t *p, *pe;
+  if (ZIP_CFILE_OFFSET(z) != 0xffffffffu) {
+    WRITE32LE(z + kZipCfileOffsetOffset, off);
+    return;
+  }
+  p = ZIP_CFILE_EXTRA(z);
+  pe = p + ZIP_CFILE_EXTRASIZE(z);
+  for (; p + ZIP_EXTRA_SIZE(p) <= pe; p += ZIP_EXTRA_SIZE(p)) {
+    if (ZIP_EXTRA_HEADERID(p) == kZipExtraZip64) {
+      i = 0;
+      if (ZIP_CFILE_COMPRESSEDSIZE(z) == 0xffffffffu)
+        i += 8;
+      if (ZIP_CFILE_UNCOMPRESSEDSIZE(z) == 0xffffffffu)
+        i += 8;
+      WRITE64LE(ZIP_EXTRA_CONTENT(p) + i, off);
+      return;
+    }
+  }
+}
+
+// returns size of data descriptor following local file content at end
+// if general purpose flag bit 3 says its crc and sizes were put there
+static uint64_t GetZipDataDescriptorSize(uint64_t lf, uint64_t end) {
+  uint64_t n;
+  uint8_t *p, *pe;
+  if (!(ZIP_LFILE_GENERALFLAG(zmap + lf) & kZipGflagDataDescriptor))
+    return 0;
+  n = 4 + 4 + 4;
+  p = ZIP_LFILE_EXTRA(zmap + lf);
+  pe = p + ZIP_LFILE_EXTRASIZE(zmap + lf);
+  for (; p + ZIP_EXTRA_SIZE(p) <= pe; p += ZIP_EXTRA_SIZE(p)) {
+    if (ZIP_EXTRA_HEADERID(p) == kZipExtraZip64) {
+      n = 4 + 8 + 8;
+      break;
+    }
+  }
+  if (end + 4 <= zsize && READ32LE(zmap + end) == kZipDataDescriptorMagic)
+    n += 4;
+  return n;
+}
+
+// returns offset of the lowest local file that some stale central
+// directory record refers to but the live one doesn't, or -1 if none
+// are found. `z` must be sorted by local file offset
+static uint64_t FindLowestSupersededLfile(const struct ZipSpan *z, uint64_t n,
+                                          uint64_t cdiroffset) {
+  const uint8_t *p, *pe, *lf;
+  uint64_t off, low, lo, hi, mid;
+  low = -1;
+  for (p = zmap, pe = zmap + cdiroffset;
+       (p = memmem(p, pe - p, "PK\1\2", 4)); p += 4) {
+    if (pe - p < kZipCfileHdrMinSize || ZIP_CFILE_HDRSIZE(p) > pe - p)
+      continue;
+    off = GetZipCfileOffset(p);
+    if (off >= low || off >= p - zmap ||
+        p - zmap - off < kZipLfileHdrMinSize)
+      continue;
+    lf = zmap + off;
+    if (ZIP_LFILE_MAGIC(lf) != kZipLfileHdrMagic ||
+        ZIP_LFILE_HDRSIZE(lf) > p - lf ||
+        ZIP_LFILE_NAMESIZE(lf) != ZIP_CFILE_NAMESIZE(p) ||
+        memcmp(ZIP_LFILE_NAME(lf), ZIP_CFILE_NAME(p), ZIP_CFILE_NAMESIZE(p)))
+      continue;
+    // ignore records pointing into local files that are still live
+    for (lo = 0, hi = n; lo < hi;) {
+      mid = lo + (hi - lo) / 2;
+      if (z[mid].lf <= off) {
+        lo = mid + 1;
+      } else {
+        hi = mid;
+      }
+    }
+    if (lo && z[lo - 1].end > off)
+      continue;
+    low = off;
+  }
+  return low;
+}
+
+// rewrites executable without the garbage StoreAsset() accumulated,
+// by copying everything before the lowest superseded local file, or
+// the first leftover following a live one if that comes sooner, then
+// every live local file after it along with its data descriptor,
+// followed by a single central directory. the new file is renamed into
+// place, so workers still serving from the old mapping aren't
+// disturbed. bytes after that point which no central directory record
+// refers to are dropped. returns number of bytes reclaimed.
+static int64_t CompactAssets(void) {
+  int fd;
+  char *tmp;
+  uint8_t *cdir;
+  int64_t reclaimed;
+  struct ZipSpan *z;
+  struct iovec v[3];
+  char eocd[kZipCdir64HdrMinSize + kZipCdir64LocatorSize + kZipCdirHdrMinSize];
+  uint64_t i, n, cf, base, off, cdirsize, cdiroffset, newsize;
+  if (IsOpenbsd() || IsNetbsd() || IsWindows()) {
+    FATALF("(cfg) CompactAssets() not available on Windows/NetBSD/OpenBSD yet");
+  }
+  if (!LockZip())
+    return -1;
+  fd = -1;
+  tmp = 0;
+  cdir = 0;
+  reclaimed = -1;
+  n = GetZipCdirRecords(zcdir);
+  cdiroffset = GetZipCdirOffset(zcdir);
+  cdirsize = GetZipCdirSize(zcdir);
+  z = xcalloc(MAX(1, n), sizeof(*z));
+  for (cf = cdiroffset, i = 0; i < n; ++i, cf += ZIP_CFILE_HDRSIZE(zmap + cf)) {
+    z[i].cf = cf;
+    z[i].lf = GetZipCfileOffset(zmap + cf);
+    if (z[i].lf >= cdiroffset ||
+        cdiroffset - z[i].lf < kZipLfileHdrMinSize ||
+        ZIP_LFILE_MAGIC(zmap + z[i].lf) != kZipLfileHdrMagic) {
+      WARNF("(zip) can't compact: bad local file offset in %`'.*s",
+            ZIP_CFILE_NAMESIZE(zmap + cf), ZIP_CFILE_NAME(zmap + cf));
+      goto Finished;
+    }
+    z[i].end = z[i].lf + ZIP_LFILE_HDRSIZE(zmap + z[i].lf) +
+               GetZipCfileCompressedSize(zmap + cf);
+    z[i].end += GetZipDataDescriptorSize(z[i].lf, z[i].end);
+  }
+  qsort(z, n, sizeof(*z), CompareZipSpansByLfile);
+  for (base = i = 0; i < n; ++i) {
+    off = i + 1 < n ? z[i + 1].lf : cdiroffset;
+    if (z[i].end > off) {
+      WARNF("(zip) can't compact: local files overlap");
+      goto Finished;
+    }
+    if (!base && z[i].end < off && IsZipLeftover(z[i].end)) {
+      base = z[i].end;
+    }
+  }
+  if ((off = FindLowestSupersededLfile(z, n, cdiroffset)) < cdiroffset &&
+      (!base || off < base)) {
+    base = off;
+  }
+  if (!base) {
+    reclaimed = 0;
+    goto Finished;
+  }
+  tmp = xasprintf("%s.%d.compact", zpath, getpid());
+  if ((fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600)) == -1) {
+    WARNF("(zip) can't compact: open(%`'s) failed: %m", tmp);
+    Free(&tmp);
+    goto Finished;
+  }
+  v[0].iov_base = zmap;
+  v[0].iov_len = base;
+  if (WritevAll(fd, v, 1) == -1)
+    goto WriteFailed;
+  for (off = base, i = 0; i < n; ++i) {
+    if (z[i].lf < base) {
+      z[i].to = z[i].lf;
+      continue;
+    }
+    z[i].to = off;
+    v[0].iov_base = zmap + z[i].lf;
+    v[0].iov_len = z[i].end - z[i].lf;
+    off += v[0].iov_len;
+    if (WritevAll(fd, v, 1) == -1)
+      goto WriteFailed;
+  }
+  qsort(z, n, sizeof(*z), CompareZipSpansByCfile);
+  cdir = xmalloc(MAX(1, cdirsize));
+  memcpy(cdir, zmap + cdiroffset, cdirsize);
+  for (i = 0; i < n; ++i)
+    SetZipCfileOffset(cdir + (z[i].cf - cdiroffset), z[i].to);
+  v[0].iov_base = cdir;
+  v[0].iov_len = cdirsize;
+  v[1].iov_base = eocd;
+  v[1].iov_len = FormatZipEocd(eocd, n, cdirsize, off,
+                               GetZipCdirCommentSize(zcdir));
+  v[2].iov_base = (void *)GetZipCdirComment(zcdir);
+  v[2].iov_len = GetZipCdirCommentSize(zcdir);
+  newsize = off + v[0].iov_len + v[1].iov_len + v[2].iov_len;
+  if (WritevAll(fd, v, 3) == -1 ||       //
+      fchmod(fd, zst.st_mode & 07777) ||  //
+      fsync(fd) || close(fd)) {
+  WriteFailed:
+    WARNF("(zip) can't compact: write to %`'s failed: %m", tmp);
+    if (fd != -1)
+      close(fd);
+    unlink(tmp);
+    goto Finished;
+  }
+  fd = -1;
+  if (rename(tmp, zpath) == -1) {
+    WARNF("(zip) can't compact: rename(%`'s, %`'s) failed: %m", tmp, zpath);
+    unlink(tmp);
+    goto Finished;
+  }
+  reclaimed = zsize - newsize;
+  INFOF("(zip) compacted assets reclaiming %'ld bytes", reclaimed);
+Finished:
+  UnlockZip();
+  OpenZip(false);
+  free(cdir);
+  free(tmp);
+  free(z);
+  return reclaimed;
+}
+
 static int LuaStoreAsset(lua_State *L) {
   const char *path, *data;
   size_t pathlen, datalen;
@@ -3937,6 +4643,52 @@ static int LuaStoreAsset(lua_State *L) {
   return 0;
 }
 
+static int LuaStoreAssets(lua_State *L) {
+  lua_Integer i, n;
+  const char *path, *data;
+  size_t pathlen, datalen;
+  struct AssetBatch b = {0};
+  luaL_checktype(L, 1, LUA_TTABLE);
+  n = luaL_len(L, 1);
+  // validate everything first, since raising would leak the batch
+  for (i = 1; i <= n; ++i) {
+    if (lua_geti(L, 1, i) != LUA_TTABLE)
+      return luaL_error(L, "StoreAssets() item %d isn't {path, data[, mode]}",
+                        (int)i);
+    lua_geti(L, -1, 1);
+    lua_geti(L, -2, 2);
+    lua_geti(L, -3, 3);
+    if (lua_type(L, -3) != LUA_TSTRING ||
+        !(path = lua_tolstring(L, -3, &pathlen)) ||
+        !IsReasonablePath(path, pathlen) || pathlen > 0xffff)
+      return luaL_error(L, "StoreAssets() item %d has bad path", (int)i);
+    if (lua_type(L, -2) != LUA_TSTRING)
+      return luaL_error(L, "StoreAssets() item %d data isn't string", (int)i);
+    if (!lua_isnoneornil(L, -1) && !lua_isinteger(L, -1))
+      return luaL_error(L, "StoreAssets() item %d mode isn't integer", (int)i);
+    lua_pop(L, 4);
+  }
+  // strings stay alive since the table that owns them is on the stack
+  for (i = 1; i <= n; ++i) {
+    lua_geti(L, 1, i);
+    lua_geti(L, -1, 1);
+    lua_geti(L, -2, 2);
+    lua_geti(L, -3, 3);
+    path = lua_tolstring(L, -3, &pathlen);
+    data = lua_tolstring(L, -2, &datalen);
+    StageAsset(&b, path, pathlen, data, datalen, lua_tointeger(L, -1));
+    lua_pop(L, 4);
+  }
+  CommitAssets(&b);
+  FreeAssetBatch(&b);
+  return 0;
+}
+
+static int LuaCompactAssets(lua_State *L) {
+  lua_pushinteger(L, CompactAssets());
+  return 1;
+}
+
 static void ReseedRng(mbedtls_ctr_drbg_context *r, const char *s) {
 #ifndef UNSECURE
   if (unsecure)
@@ -4775,6 +5527,18 @@ static int LuaProgramSslFetchVerify(lua_State *L) {
   return LuaProgramBool(L, &sslfetchverify);
 }
 
+static int LuaProgramFetchPool(lua_State *L) {
+  lua_Integer max, ms;
+  max = luaL_checkinteger(L, 1);
+  ms = luaL_optinteger(L, 2, timespec_tomillis(fetchpool.timeout));
+  luaL_argcheck(L, 0 <= max && max <= 1024, 1, "out of range");
+  luaL_argcheck(L, ms >= 0, 2, "out of range");
+  fetchpool.maxperhost = max;
+  fetchpool.timeout = timespec_frommillis(ms);
+  FetchPoolExpire();
+  return 0;
+}
+
 static int LuaProgramSslInit(lua_State *L) {
   OnlyCallFromInitLua(L, "SslInit");
   TlsInit();
@@ -5136,18 +5900,15 @@ static int LuaLaunchBrowser(lua_State *L) {
 static bool LuaRunAsset(const char *path, bool mandatory) {
   int status;
   struct Asset *a;
-  const char *code;
-  size_t pathlen, codelen;
+  size_t pathlen;
   pathlen = strlen(path);
   if ((a = GetAsset(path, pathlen))) {
-    if ((code = FreeLater(LoadAsset(a, &codelen)))) {
-      lua_State *L = GL;
-      effectivepath.p = (void *)path;
-      effectivepath.n = pathlen;
-      DEBUGF("(lua) LuaRunAsset(%`'s)", path);
-      status = luaL_loadbuffer(
-          L, code, codelen,
-          FreeLater(xasprintf("@%s%s", a->file ? "" : "/zip", path)));
+    lua_State *L = GL;
+    effectivepath.p = (void *)path;
+    effectivepath.n = pathlen;
+    DEBUGF("(lua) LuaRunAsset(%`'s)", path);
+    if ((status = LoadLuaAsset(
+             L, a, FreeLater(GetLuaChunkName(a, path, pathlen)))) != -1) {
       if (status != LUA_OK || LuaCallWithTrace(L, 0, 0, NULL) != LUA_OK) {
         LogLuaError("lua code", lua_tostring(L, -1));
         lua_pop(L, 1);  // pop error
@@ -5234,6 +5995,7 @@ static const luaL_Reg kLuaFuncs[] = {
     {"Bsf", LuaBsf},                                            //
     {"Bsr", LuaBsr},                                            //
     {"CategorizeIp", LuaCategorizeIp},                          //
+    {"CompactAssets", LuaCompactAssets},                        //
     {"Compress", LuaCompress},                                  //
     {"Crc32", LuaCrc32},                                        //
     {"Crc32c", LuaCrc32c},                                      //
@@ -5343,6 +6105,7 @@ static const luaL_Reg kLuaFuncs[] = {
     {"ProgramCache", LuaProgramCache},                          //
     {"ProgramContentType", LuaProgramContentType},              //
     {"ProgramDirectory", LuaProgramDirectory},                  //
+    {"ProgramFetchPool", LuaProgramFetchPool},                  //
     {"ProgramGid", LuaProgramGid},                              //
     {"ProgramHeader", LuaProgramHeader},                        //
     {"ProgramHeartbeatInterval", LuaProgramHeartbeatInterval},  //
@@ -5384,6 +6147,7 @@ static const luaL_Reg kLuaFuncs[] = {
     {"Sleep", LuaSleep},                                        //
     {"Slurp", LuaSlurp},                                        //
     {"StoreAsset", LuaStoreAsset},                              //
+    {"StoreAssets", LuaStoreAssets},                            //
     {"Uncompress", LuaUncompress},                              //
     {"Underlong", LuaUnderlong},                                //
     {"UuidV4", LuaUuidV4},                                      //
@@ -5878,13 +6642,15 @@ static void HandleFrag(size_t got) {
 static void HandleReload(void) {
   LockInc(&shared->c.reloads);
   LuaOnServerReload(Reindex());
+  PrecompileLuaAssets();
   invalidated = false;
 }
 
 static void HandleHeartbeat(void) {
   size_t i;
   UpdateCurrentDate(timespec_real());
-  Reindex();
+  if (Reindex())
+    PrecompileLuaAssets();
   unassert(!pthread_mutex_lock(&shared->server_mu));
   getrusage(RUSAGE_SELF, &shared->server);
   unassert(!pthread_mutex_unlock(&shared->server_mu));
@@ -5892,6 +6658,7 @@ static void HandleHeartbeat(void) {
   CallSimpleHookIfDefined("OnServerHeartbeat");
   CollectGarbage();
 #endif
+  FetchPoolExpire();
   for (i = 1; i < servers.n; ++i) {
     if (polls[i].fd < 0) {
       polls[i].fd = -polls[i].fd;
@@ -6804,6 +7571,7 @@ static int HandleConnection(size_t i) {
           meltdown = false;
           __isworker = true;
           connectionclose = false;
+          FetchPoolAbandon();
           if (!IsTiny() && systrace) {
             kStartTsc = rdtsc();
           }
@@ -7214,6 +7982,7 @@ static void TlsInit(void) {
                              MBEDTLS_CIPHER_AES_256_GCM, sslticketlifetime);
     mbedtls_ssl_conf_session_tickets_cb(&conf, mbedtls_ssl_ticket_write,
                                         mbedtls_ssl_ticket_parse, &ssltick);
+    mbedtls_ssl_conf_session_cache(&conf, 0, TlsGetCache, TlsSetCache);
   }
 
   if (sslinitialized)
@@ -7411,6 +8180,7 @@ void RedBean(int argc, char *argv[]) {
   }
 #endif
   LuaInit();
+  PrecompileLuaAssets();
   oldloglevel = __log_level;
   if (uniprocess) {
     shared->workers = 1;
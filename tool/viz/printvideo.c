@@ -25,6 +25,7 @@
 #include "dsp/tty/quant.h"
 #include "dsp/tty/tty.h"
 #include "libc/assert.h"
+#include "libc/atomic.h"
 #include "libc/calls/calls.h"
 #include "libc/calls/internal.h"
 #include "libc/calls/struct/framebufferfixedscreeninfo.h"
@@ -44,6 +45,7 @@
 #include "libc/errno.h"
 #include "libc/fmt/conv.h"
 #include "libc/fmt/itoa.h"
+#include "libc/intrin/atomic.h"
 #include "libc/intrin/kprintf.h"
 #include "libc/intrin/safemacros.h"
 #include "libc/intrin/xchg.h"
@@ -93,6 +95,7 @@
 #include "libc/sysv/consts/termios.h"
 #include "libc/sysv/consts/w.h"
 #include "libc/sysv/errfuns.h"
+#include "libc/thread/semaphore.h"
 #include "libc/thread/thread.h"
 #include "libc/time.h"
 #include "libc/x/xsigaction.h"
@@ -109,6 +112,8 @@
 #define GAMMADELTA    0.1
 #define NETBUFSIZ     (2 * 1024 * 1024)
 #define MAX_FRAMERATE (1 / 60.)
+#define MAXBANDS      8
+#define MINBANDROWS   16
 
 #define USAGE \
   " [FLAGS] MPG\n\
@@ -209,6 +214,27 @@ struct VtFrame {
   };
 };
 
+enum RenderState {
+  kRenderIdle,
+  kRenderBusy,
+  kRenderDone,
+};
+
+struct RenderJob {
+  plm_frame_t frame;
+  double aspect;
+  size_t size;
+  uint8_t *planes;
+  struct timespec start;
+};
+
+struct RasterBand {
+  bool last;
+  unsigned y, yn, xn;
+  struct TtyRgb bg, fg;
+  char *b, *e;
+};
+
 struct FrameCountRing {
   size_t i, n;
   float p[64]; /* seconds relative to starttime_ */
@@ -253,9 +279,14 @@ static struct YCbCr *ycbcr_;
 static bool emboss_, sobel_;
 static const char *patharg_;
 static struct winsize wsize_;
+static struct RenderJob job_;
+static sem_t rendersem_;
+static int renderfds_[2];
+static atomic_int renderstate_;
 static float hue_, sat_, lit_;
 static volatile bool resized_;
 static void *xtcodes_, *audio_;
+static char *bandbuf_;
 static struct FrameBuffer fb0_;
 static unsigned chans_, srate_;
 static volatile bool ignoresigs_;
@@ -403,6 +434,8 @@ static void DimensionDisplay(void) {
           ratio, yn, xn);
     BALLOC(&xtcodes_, 64, ((g2_->yn) * g2_->xn + 8) * sizeof(struct TtyRgb),
            "xtcodes_");
+    BALLOC(&bandbuf_, 64, MAXBANDS * 128 + g2_->yn * (g2_->xn * 32 + 8),
+           "bandbuf_");
     ResizeVtFrame(&vtframe_[0], (g2_->yn), g2_->xn);
     ResizeVtFrame(&vtframe_[1], (g2_->yn), g2_->xn);
     f1_ = &vtframe_[0];
@@ -571,6 +604,68 @@ static const char *DescribeSwing(int swing) {
   }
 }
 
+static void *RasterBand(void *arg) {
+  char *p;
+  unsigned y, x;
+  struct TtyRgb *c;
+  struct RasterBand *rb = arg;
+  unsigned char(*img)[3][g2_->yn][g2_->xn] = g2_->b;
+  c = (struct TtyRgb *)xtcodes_ + rb->y * rb->xn;
+  for (y = rb->y; y < rb->y + rb->yn; ++y)
+    for (x = 0; x < rb->xn; ++x)
+      *c++ = rgb2tty((*img)[0][y][x], (*img)[1][y][x], (*img)[2][y][x]);
+  p = rb->b;
+  if (rb->y) {
+    p = stpcpy(p, "\e[0m\r\n");
+    p = setbgfg(p, rb->bg, rb->fg);
+  }
+  p = ttyraster(p, (struct TtyRgb *)xtcodes_ + rb->y * rb->xn, rb->yn, rb->xn,
+                rb->bg, rb->fg);
+  if (!rb->last)
+    p -= 4; /* next band starts with its own "\e[0m" */
+  rb->e = p;
+  return 0;
+}
+
+/**
+ * Quantizes and rasterizes g2_ in horizontal bands, one per core.
+ *
+ * Every band after the first begins on a fresh line and restates the
+ * initial colors, so bands don't depend on the sgr state left behind
+ * by the band above them. The first band is written straight into p
+ * by the calling thread, and the rest are copied after it in order.
+ */
+static char *RasterBands(char *p, unsigned yn, unsigned xn, struct TtyRgb bg,
+                         struct TtyRgb fg) {
+  int i, n;
+  unsigned y, step;
+  pthread_t th[MAXBANDS];
+  struct RasterBand rb[MAXBANDS];
+  n = MAX(1, MIN(MIN(__get_cpu_count(), MAXBANDS), yn / MINBANDROWS));
+  step = MAX(2, ROUNDUP((yn + n - 1) / n, 2));
+  i = 0, y = 0;
+  do {
+    rb[i].y = y;
+    rb[i].yn = MIN(step, yn - y);
+    rb[i].xn = xn;
+    rb[i].bg = bg;
+    rb[i].fg = fg;
+    rb[i].b = i ? bandbuf_ + i * 128 + (size_t)y * (xn * 32 + 8) : p;
+    rb[i].last = y + step >= yn;
+    ++i, y += step;
+  } while (y < yn);
+  n = i;
+  for (i = 1; i < n; ++i)
+    CHECK_EQ(0, pthread_create(th + i, 0, RasterBand, rb + i));
+  RasterBand(rb);
+  p = rb[0].e;
+  for (i = 1; i < n; ++i) {
+    CHECK_EQ(0, pthread_join(th[i], 0));
+    p = mempcpy(p, rb[i].b, rb[i].e - rb[i].b);
+  }
+  return p;
+}
+
 static void RenderIt(void) {
   long bpf;
   double bpc;
@@ -595,14 +690,14 @@ static void RenderIt(void) {
     fg = (struct TtyRgb){0xff, 0xff, 0xff, 231};
     p = stpcpy(p, "\e[48;5;16;38;5;231m");
   }
-  p = ttyraster(p, xtcodes_, yn, xn, bg, fg);
+  p = RasterBands(p, yn, xn, bg, fg);
   if (ttymode_ && stats_) {
     bpc = bpf = p - vt;
     bpc /= wsize_.ws_row * wsize_.ws_col;
     sprintf(status_[4], " %s/%s/%s %d×%d → %u×%u pixels ",
             kPrimaries[primaries_].name, DescribeSwing(swing_),
-            kLightings[lighting_].name, plm_get_width(plm_),
-            plm_get_height(plm_), g2_->xn, g2_->yn);
+            kLightings[lighting_].name, job_.frame.width, job_.frame.height,
+            g2_->xn, g2_->yn);
     sprintf(status_[5], " decode:%,8luµs | magikarp:%,8luµs ",
             plmpegdecode_latency_, magikarp_latency_);
     sprintf(status_[1], " ycbcr2rgb:%,8luµs | gyarados:%,8luµs ",
@@ -651,7 +746,8 @@ static void RasterIt(void) {
   memcpy(fb0_.map, buf, fb0_.size);
 }
 
-static void TranscodeVideo(plm_frame_t *pf) {
+static void TranscodeVideo(struct RenderJob *job) {
+  plm_frame_t *pf = &job->frame;
   CHECK_EQ(pf->cb.width, pf->cr.width);
   CHECK_EQ(pf->cb.height, pf->cr.height);
   DEBUGF("TranscodeVideo() [grace=%,ldns]", timespec_tonanos(GetGraceTime()));
@@ -664,7 +760,7 @@ static void TranscodeVideo(plm_frame_t *pf) {
       pary_ = 1.;
     if (pf2_)
       pary_ = (266 / 64.) * (900 / 1600.);
-    pary_ *= plm_get_pixel_aspect_ratio(plm_);
+    pary_ *= job->aspect;
     YCbCr2RgbScale(g2_->yn, g2_->xn, g2_->b, pf->y.height, pf->y.width,
                    (void *)pf->y.data, pf->cr.height, pf->cr.width,
                    (void *)pf->cb.data, (void *)pf->cr.data, pf->y.height,
@@ -707,7 +803,7 @@ static void TranscodeVideo(plm_frame_t *pf) {
     t3 = 0;
     TIMEIT(t4, RasterIt());
   } else {
-    TIMEIT(t3, getxtermcodes(xtcodes_, g2_));
+    t3 = 0; /* quantization happens inside the raster bands */
     TIMEIT(t4, RenderIt());
   }
 
@@ -719,22 +815,92 @@ static void TranscodeVideo(plm_frame_t *pf) {
         "quantize=%,zuns "
         "render=%,zuns",
         framecount_++, g2_->yn, g2_->xn, f2_->n,
-        (f1_->n / (double)(g2_->yn * g2_->xn)), t1, t2, t8, t6, t3, t4);
+        (f2_->n / (double)(g2_->yn * g2_->xn)), t1, t2, t8, t6, t3, t4);
+}
+
+/**
+ * Runs the scale, convert, and raster stages of the pipeline.
+ *
+ * The main thread decodes and writes to the terminal, handing frames
+ * to us through job_, which is a queue of depth one. While we're busy
+ * the main thread won't touch f2_, job_, or the graphics; it'll learn
+ * that we're done by reading a byte from renderfds_[0].
+ */
+static void *RenderWorker(void *arg) {
+  for (;;) {
+    while (sem_wait(&rendersem_) == -1)
+      CHECK_EQ(EINTR, errno);
+    TranscodeVideo(&job_);
+    atomic_store_explicit(&renderstate_, kRenderDone, memory_order_release);
+    CHECK_EQ(1, write(renderfds_[1], "", 1));
+  }
+  return 0;
+}
+
+static void StartRenderWorker(void) {
+  pthread_t th;
+  sigset_t mask, old;
+  CHECK_NE(-1, pipe2(renderfds_, O_CLOEXEC));
+  CHECK_NE(-1, sem_init(&rendersem_, 0, 0));
+  sigfillset(&mask);
+  pthread_sigmask(SIG_SETMASK, &mask, &old);
+  CHECK_EQ(0, pthread_create(&th, 0, RenderWorker, 0));
+  pthread_sigmask(SIG_SETMASK, &old, 0);
+  pthread_detach(th);
+}
+
+static bool IsRenderIdle(void) {
+  return atomic_load_explicit(&renderstate_, memory_order_acquire) ==
+         kRenderIdle;
+}
+
+static void CollectFrame(void) {
+  char b;
+  if (atomic_load_explicit(&renderstate_, memory_order_acquire) != kRenderDone)
+    return;
+  while (read(renderfds_[0], &b, 1) == -1)
+    CHECK_EQ(EINTR, errno);
+  atomic_store_explicit(&renderstate_, kRenderIdle, memory_order_relaxed);
+  if (!f1_->n) {
+    struct VtFrame *t = f1_;
+    f1_ = f2_, f2_ = t;
+    f1_start_ = job_.start;
+  } else {
+    f2_start_ = job_.start;
+  }
+}
+
+static void WaitForRender(void) {
+  while (atomic_load_explicit(&renderstate_, memory_order_acquire) ==
+         kRenderBusy)
+    poll((struct pollfd[]){{renderfds_[0], POLLIN}}, 1, -1);
+  CollectFrame();
+}
+
+static void CopyFrame(struct RenderJob *job, const plm_frame_t *pf) {
+  size_t yz, cz;
+  yz = pf->y.width * pf->y.height;
+  cz = pf->cr.width * pf->cr.height;
+  if (yz + cz * 2 > job->size)
+    CHECK_NOTNULL(
+        (job->planes = realloc(job->planes, (job->size = yz + cz * 2))));
+  job->frame = *pf;
+  job->frame.y.data = memcpy(job->planes, pf->y.data, yz);
+  job->frame.cr.data = memcpy(job->planes + yz, pf->cr.data, cz);
+  job->frame.cb.data = memcpy(job->planes + yz + cz, pf->cb.data, cz);
 }
 
 static void OnVideo(plm_t *mpeg, plm_frame_t *pf, void *user) {
   gotvideo_ = true;
-  if (f2_->n) {
+  CollectFrame();
+  if (!IsRenderIdle() || f2_->n) {
     WARNF("video frame dropped");
   } else {
-    TranscodeVideo(pf);
-    if (!f1_->n) {
-      struct VtFrame *t = f1_;
-      f1_ = f2_, f2_ = t;
-      f1_start_ = decode_start_;
-    } else {
-      f2_start_ = decode_start_;
-    }
+    CopyFrame(&job_, pf);
+    job_.start = decode_start_;
+    job_.aspect = plm_get_pixel_aspect_ratio(plm_);
+    atomic_store_explicit(&renderstate_, kRenderBusy, memory_order_relaxed);
+    sem_post(&rendersem_);
   }
 }
 
@@ -773,10 +939,12 @@ static ssize_t WriteVideoCall(void) {
             max(0,
                 min(timespec_tofloat(timespec_sub(timespec_mono(), f1_start_)),
                     plm_get_samplerate(plm_) / PLM_AUDIO_SAMPLES_PER_FRAME)));
-      f1_start_ = f2_start_;
       f1_->i = f1_->n = 0;
-      struct VtFrame *t = f1_;
-      f1_ = f2_, f2_ = t;
+      if (IsRenderIdle() && f2_->n) {
+        struct VtFrame *t = f1_;
+        f1_ = f2_, f2_ = t;
+        f1_start_ = f2_start_;
+      }
       RecordFactThatFrameWasFullyRendered();
     }
   }
@@ -810,6 +978,7 @@ static void WriteVideo(void) {
 }
 
 static void RefreshDisplay(void) {
+  WaitForRender();
   if (f1_ && f1_->n)
     f1_->i = 0;
   DimensionDisplay();
@@ -877,6 +1046,7 @@ static optimizesize void ReadKeyboard(void) {
   memset(b, -1, sizeof(b));
   b[0] = CTRL('B'); /* for eof case */
   if ((n = read(infd_, &b, sizeof(b))) != -1) {
+    WaitForRender();
     for (;;) {
       i = 0;
       c = b[i++];
@@ -1159,6 +1329,7 @@ static void PerformBestEffortIo(void) {
   struct pollfd fds[] = {
       {infd_, POLLIN},
       {outfd_, f1_ && f1_->n ? POLLOUT : 0},
+      {renderfds_[0], POLLIN},
   };
   pollms = MAX(0, timespec_tomillis(GetGraceTime()));
   DEBUGF("poll() ms=%,d", pollms);
@@ -1168,6 +1339,8 @@ static void PerformBestEffortIo(void) {
     if (toto) {
       if (fds[0].revents & (POLLIN | POLLHUP | POLLERR))
         ReadKeyboard();
+      if (fds[2].revents & POLLIN)
+        CollectFrame();
       if (fds[1].revents & (POLLOUT | POLLHUP | POLLERR))
         WriteVideo();
     }
@@ -1275,6 +1448,7 @@ static void GetOpts(int argc, char *argv[]) {
 }
 
 static void OnExit(void) {
+  WaitForRender();
   if (plm_)
     plm_destroy(plm_), plm_ = NULL;
   YCbCrFree(&ycbcr_);
@@ -1287,6 +1461,8 @@ static void OnExit(void) {
   free(vtframe_[0].b);
   free(vtframe_[1].b);
   free(xtcodes_);
+  free(bandbuf_);
+  free(job_.planes);
   free(audio_);
   CloseSpeaker();
 }
@@ -1442,6 +1618,7 @@ int main(int argc, char *argv[]) {
       longjmp(jb_, 1);
     OpenVideo();
     DimensionDisplay();
+    StartRenderWorker();
     starttime_ = timespec_mono();
     PrintVideo();
   }